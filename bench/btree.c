@@ -0,0 +1,281 @@
+// Compares generic and specialized (BTREE_DEFINE) fixed-leaf btree operations
+// on pkg records. Usage: btree_bench [records] [page size]
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/db/defines.h"
+#include "../src/db/table.h"
+#include "../src/db/btree.h"
+#include "../src/db/btree_typed.h"
+#include "../src/tables/pkg.h"
+
+#define BENCH_FILE "/tmp/pmm-bench.pmm"
+#define BENCH_IDENTITY 0xbe
+#define DEFAULT_RECORDS 50000
+#define LOAD_FILL 90
+// Best of this many runs is reported
+#define ROUNDS 5
+
+BTREE_DEFINE(bench, pkg)
+
+#define best(a, b) (((a) < (b)) ? (a) : (b))
+
+// Operation under test, generic or specialized
+typedef int (*insert_fn)(db_table *table, md5_t *key, pkg *record);
+typedef pkg *(*find_fn)(db_table *table, md5_t *key);
+typedef int (*load_fn)(btree_loader *loader, md5_t *key, pkg *record);
+
+double now(void);
+void make_keys(md5_t *keys, uint32_t count);
+int compare_keys(const void *a, const void *b);
+db_table *fresh_table(uint32_t page_size);
+double run_insert(insert_fn insert, md5_t *keys, uint32_t count, uint32_t page_size);
+double run_find(find_fn find, md5_t *keys, uint32_t count, uint32_t page_size);
+double run_load(load_fn load, md5_t *keys, uint32_t count, uint32_t page_size);
+void report(const char *op, uint32_t count, double generic, double specialized);
+int generic_insert(db_table *table, md5_t *key, pkg *record);
+int typed_insert(db_table *table, md5_t *key, pkg *record);
+pkg *generic_find(db_table *table, md5_t *key);
+pkg *typed_find(db_table *table, md5_t *key);
+int generic_load(btree_loader *loader, md5_t *key, pkg *record);
+int typed_load(btree_loader *loader, md5_t *key, pkg *record);
+
+int main(int argc, char **argv) {
+	uint32_t count = (argc > 1) ? strtoul(argv[1], NULL, 10) : DEFAULT_RECORDS;
+	uint32_t page_size = (argc > 2) ? strtoul(argv[2], NULL, 10) : DEFAULT_PAGE_SIZE;
+	if (count == 0 || !valid_page_size(page_size)) {
+		fprintf(stderr, "usage: %s [records] [page size]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	md5_t *keys = malloc(count * sizeof(md5_t));
+	make_keys(keys, count);
+
+	printf("%u records, %u byte pages, %zu byte cells\n", count, page_size, btree_cell_length(pkg));
+	printf("%-8s %12s %12s %8s\n", "op", "generic ns", "typed ns", "speedup");
+	double generic = 1e9;
+	double typed = 1e9;
+	for (int round = 0; round < ROUNDS; round++) {
+		generic = best(generic, run_insert(&generic_insert, keys, count, page_size));
+		typed = best(typed, run_insert(&typed_insert, keys, count, page_size));
+	}
+	report("insert", count, generic, typed);
+
+	generic = typed = 1e9;
+	for (int round = 0; round < ROUNDS; round++) {
+		generic = best(generic, run_find(&generic_find, keys, count, page_size));
+		typed = best(typed, run_find(&typed_find, keys, count, page_size));
+	}
+	report("find", count, generic, typed);
+
+	qsort(keys, count, sizeof(md5_t), &compare_keys);
+	generic = typed = 1e9;
+	for (int round = 0; round < ROUNDS; round++) {
+		generic = best(generic, run_load(&generic_load, keys, count, page_size));
+		typed = best(typed, run_load(&typed_load, keys, count, page_size));
+	}
+	report("load", count, generic, typed);
+
+	free(keys);
+	unlink(BENCH_FILE);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Get monotonic time.
+ *
+ * @return Seconds.
+ */
+double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Generate distinct pseudo-random keys (splitmix64).
+ *
+ * @param[out] keys - Key array.
+ * @param[in] count - Number of keys.
+ */
+void make_keys(md5_t *keys, uint32_t count) {
+	uint64_t state = 0x9e3779b97f4a7c15;
+	for (uint32_t i = 0; i < count; i++) {
+		uint64_t halves[2];
+		for (int h = 0; h < 2; h++) {
+			uint64_t z = (state += 0x9e3779b97f4a7c15);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+			halves[h] = z ^ (z >> 31);
+		}
+		// Index in low bits keeps keys distinct
+		halves[0] = (halves[0] & ~(uint64_t)UINT32_MAX) | i;
+		memcpy(&keys[i], halves, sizeof(md5_t));
+	}
+}
+
+/**
+ * @brief Order keys like the btree (qsort).
+ *
+ * @param[in] a - First key.
+ * @param[in] b - Second key.
+ * @return Comparison result.
+ */
+int compare_keys(const void *a, const void *b) {
+	const md5_t *key_a = a;
+	const md5_t *key_b = b;
+	if (md5_eq(*key_a, *key_b)) {
+		return 0;
+	}
+
+	return md5_ls(*key_a, *key_b) ? -1 : 1;
+}
+
+/**
+ * @brief Create empty table file.
+ *
+ * @param[in] page_size - Page size.
+ * @return Table object.
+ */
+db_table *fresh_table(uint32_t page_size) {
+	unlink(BENCH_FILE);
+	db_table *table = table_open(BENCH_FILE, BENCH_IDENTITY, page_size);
+	if (table == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	return table;
+}
+
+/**
+ * @brief Time inserting keys in random order into an empty btree.
+ *
+ * @param[in] insert - Insert operation.
+ * @param[in] keys - Keys.
+ * @param[in] count - Number of keys.
+ * @param[in] page_size - Page size.
+ * @return Seconds.
+ */
+double run_insert(insert_fn insert, md5_t *keys, uint32_t count, uint32_t page_size) {
+	db_table *table = fresh_table(page_size);
+	btree_init(table, sizeof(pkg));
+
+	pkg record = { .status = PKG_OK, .hosts = 1 };
+	double start = now();
+	for (uint32_t i = 0; i < count; i++) {
+		record.hosts = i;
+		if (insert(table, &keys[i], &record) < 0) {
+			fprintf(stderr, "insert failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	double elapsed = now() - start;
+
+	table_close(table);
+	return elapsed;
+}
+
+/**
+ * @brief Time looking up every key of a btree built by inserts.
+ *
+ * @param[in] find - Find operation.
+ * @param[in] keys - Keys.
+ * @param[in] count - Number of keys.
+ * @param[in] page_size - Page size.
+ * @return Seconds.
+ */
+double run_find(find_fn find, md5_t *keys, uint32_t count, uint32_t page_size) {
+	db_table *table = fresh_table(page_size);
+	btree_init(table, sizeof(pkg));
+	pkg record = { .status = PKG_OK, .hosts = 1 };
+	for (uint32_t i = 0; i < count; i++) {
+		record.hosts = i;
+		btree_insert(table, &keys[i], &record, INSERT_ALWAYS);
+	}
+
+	double start = now();
+	for (uint32_t i = 0; i < count; i++) {
+		pkg *found = find(table, &keys[i]);
+		if (found == NULL || found->hosts != i) {
+			fprintf(stderr, "find failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	double elapsed = now() - start;
+
+	table_close(table);
+	return elapsed;
+}
+
+/**
+ * @brief Time bulk loading sorted keys.
+ *
+ * @param[in] load - Bulk load operation.
+ * @param[in] keys - Sorted keys.
+ * @param[in] count - Number of keys.
+ * @param[in] page_size - Page size.
+ * @return Seconds.
+ */
+double run_load(load_fn load, md5_t *keys, uint32_t count, uint32_t page_size) {
+	db_table *table = fresh_table(page_size);
+	btree_loader *loader = btree_load_begin(table, sizeof(pkg), LOAD_FILL);
+
+	pkg record = { .status = PKG_OK, .hosts = 1 };
+	double start = now();
+	for (uint32_t i = 0; i < count; i++) {
+		record.hosts = i;
+		if (load(loader, &keys[i], &record) < 0) {
+			fprintf(stderr, "load failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	double elapsed = now() - start;
+
+	btree_load_end(loader);
+	table_close(table);
+	return elapsed;
+}
+
+/**
+ * @brief Print timings per operation.
+ *
+ * @param[in] op - Operation name.
+ * @param[in] count - Operations done.
+ * @param[in] generic - Generic time (seconds).
+ * @param[in] specialized - Specialized time (seconds).
+ */
+void report(const char *op, uint32_t count, double generic, double specialized) {
+	printf("%-8s %12.1f %12.1f %7.2fx\n", op, generic * 1e9 / count, specialized * 1e9 / count,
+		generic / specialized);
+}
+
+/** Operations under test */
+
+int generic_insert(db_table *table, md5_t *key, pkg *record) {
+	return btree_insert(table, key, record, INSERT_ALWAYS);
+}
+
+int typed_insert(db_table *table, md5_t *key, pkg *record) {
+	return bench_btree_insert(table, key, record, INSERT_ALWAYS);
+}
+
+pkg *generic_find(db_table *table, md5_t *key) {
+	return btree_find(table, key, NULL);
+}
+
+pkg *typed_find(db_table *table, md5_t *key) {
+	return bench_btree_find(table, key, NULL);
+}
+
+int generic_load(btree_loader *loader, md5_t *key, pkg *record) {
+	return btree_load_add(loader, key, record);
+}
+
+int typed_load(btree_loader *loader, md5_t *key, pkg *record) {
+	return bench_btree_load_add(loader, key, record);
+}
@@ -0,0 +1,254 @@
+// Compares btree and extendible hash tables on pkg records: inserts in
+// random order, lookups of present and absent keys and full scans.
+// Usage: hash_bench [records] [page size]
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "../src/db/defines.h"
+#include "../src/db/table.h"
+#include "../src/db/btree.h"
+#include "../src/db/hash.h"
+#include "../src/tables/pkg.h"
+
+#define BENCH_FILE "/tmp/pmm-hash.pmm"
+#define BENCH_IDENTITY 0xc0
+#define DEFAULT_RECORDS 50000
+// Best of this many runs is reported
+#define ROUNDS 5
+
+#define best(a, b) (((a) < (b)) ? (a) : (b))
+
+// Table layout under test
+typedef struct {
+	void (*init)(db_table *table, uint32_t record_length);
+	int (*insert)(db_table *table, md5_t *key, pkg *record);
+	pkg *(*find)(db_table *table, md5_t *key);
+	uint64_t (*scan)(db_table *table);
+} layout;
+
+// Best times of each operation (seconds)
+typedef struct {
+	double insert;
+	double find;
+	double miss;
+	double scan;
+	uint64_t pages;
+} timings;
+
+double now(void);
+void make_keys(md5_t *keys, uint32_t count, uint64_t seed);
+db_table *filled_table(const layout *ops, md5_t *keys, uint32_t count, uint32_t page_size, double *elapsed);
+void run(const layout *ops, md5_t *keys, md5_t *absent, uint32_t count, uint32_t page_size, timings *best_times);
+void report(const char *op, uint32_t count, double btree, double hash);
+int btree_add(db_table *table, md5_t *key, pkg *record);
+pkg *btree_get(db_table *table, md5_t *key);
+uint64_t btree_walk(db_table *table);
+int hash_add(db_table *table, md5_t *key, pkg *record);
+pkg *hash_get(db_table *table, md5_t *key);
+uint64_t hash_walk(db_table *table);
+
+static const layout btree_layout = { &btree_init, &btree_add, &btree_get, &btree_walk };
+static const layout hash_layout = { &hash_init, &hash_add, &hash_get, &hash_walk };
+
+int main(int argc, char **argv) {
+	uint32_t count = (argc > 1) ? strtoul(argv[1], NULL, 10) : DEFAULT_RECORDS;
+	uint32_t page_size = (argc > 2) ? strtoul(argv[2], NULL, 10) : DEFAULT_PAGE_SIZE;
+	if (count == 0 || !valid_page_size(page_size)) {
+		fprintf(stderr, "usage: %s [records] [page size]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	md5_t *keys = malloc(count * sizeof(md5_t));
+	md5_t *absent = malloc(count * sizeof(md5_t));
+	make_keys(keys, count, 0x9e3779b97f4a7c15);
+	make_keys(absent, count, 0x2545f4914f6cdd1d);
+
+	timings btree = { 1e9, 1e9, 1e9, 1e9, 0 };
+	timings hash = { 1e9, 1e9, 1e9, 1e9, 0 };
+	for (int round = 0; round < ROUNDS; round++) {
+		run(&btree_layout, keys, absent, count, page_size, &btree);
+		run(&hash_layout, keys, absent, count, page_size, &hash);
+	}
+
+	printf("%u records, %u byte pages, %" PRIu64 " btree pages, %" PRIu64 " hash pages\n", count, page_size,
+		btree.pages, hash.pages);
+	printf("%-8s %12s %12s %8s\n", "op", "btree ns", "hash ns", "speedup");
+	report("insert", count, btree.insert, hash.insert);
+	report("find", count, btree.find, hash.find);
+	report("miss", count, btree.miss, hash.miss);
+	report("scan", count, btree.scan, hash.scan);
+
+	free(absent);
+	free(keys);
+	unlink(BENCH_FILE);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Get monotonic time.
+ *
+ * @return Seconds.
+ */
+double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Generate distinct pseudo-random keys (splitmix64).
+ *
+ * @param[out] keys - Key array.
+ * @param[in] count - Number of keys.
+ * @param[in] seed - Generator seed.
+ */
+void make_keys(md5_t *keys, uint32_t count, uint64_t seed) {
+	uint64_t state = seed;
+	for (uint32_t i = 0; i < count; i++) {
+		uint64_t halves[2];
+		for (int h = 0; h < 2; h++) {
+			uint64_t z = (state += 0x9e3779b97f4a7c15);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+			halves[h] = z ^ (z >> 31);
+		}
+		// Index keeps keys distinct, first half (bucket bits) stays random
+		halves[1] = (halves[1] & ~(uint64_t)UINT32_MAX) | i;
+		memcpy(&keys[i], halves, sizeof(md5_t));
+	}
+}
+
+/**
+ * @brief Create table and insert keys in random order.
+ *
+ * @param[in] ops - Table layout.
+ * @param[in] keys - Keys.
+ * @param[in] count - Number of keys.
+ * @param[in] page_size - Page size.
+ * @param[out] elapsed - Insert seconds.
+ * @return Table object.
+ */
+db_table *filled_table(const layout *ops, md5_t *keys, uint32_t count, uint32_t page_size, double *elapsed) {
+	unlink(BENCH_FILE);
+	db_table *table = table_open(BENCH_FILE, BENCH_IDENTITY, page_size);
+	if (table == NULL) {
+		exit(EXIT_FAILURE);
+	}
+	ops->init(table, sizeof(pkg));
+
+	pkg record = { .status = PKG_OK, .hosts = 1 };
+	double start = now();
+	for (uint32_t i = 0; i < count; i++) {
+		record.hosts = i;
+		if (ops->insert(table, &keys[i], &record) < 0) {
+			fprintf(stderr, "insert failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	*elapsed = now() - start;
+
+	return table;
+}
+
+/**
+ * @brief Time all operations on one layout, keeping the best times.
+ *
+ * @param[in] ops - Table layout.
+ * @param[in] keys - Keys inserted.
+ * @param[in] absent - Keys never inserted.
+ * @param[in] count - Number of keys of each kind.
+ * @param[in] page_size - Page size.
+ * @param[in/out] best_times - Best times so far.
+ */
+void run(const layout *ops, md5_t *keys, md5_t *absent, uint32_t count, uint32_t page_size, timings *best_times) {
+	double elapsed;
+	db_table *table = filled_table(ops, keys, count, page_size, &elapsed);
+	best_times->insert = best(best_times->insert, elapsed);
+	best_times->pages = table->cmeta.ext_start;
+
+	double start = now();
+	for (uint32_t i = 0; i < count; i++) {
+		pkg *found = ops->find(table, &keys[i]);
+		if (found == NULL || found->hosts != i) {
+			fprintf(stderr, "find failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	best_times->find = best(best_times->find, now() - start);
+
+	start = now();
+	for (uint32_t i = 0; i < count; i++) {
+		if (ops->find(table, &absent[i]) != NULL) {
+			fprintf(stderr, "absent key found\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	best_times->miss = best(best_times->miss, now() - start);
+
+	start = now();
+	if (ops->scan(table) != count) {
+		fprintf(stderr, "scan failed\n");
+		exit(EXIT_FAILURE);
+	}
+	best_times->scan = best(best_times->scan, now() - start);
+
+	table_close(table);
+}
+
+/**
+ * @brief Print timings per operation.
+ *
+ * @param[in] op - Operation name.
+ * @param[in] count - Operations done (records for scans).
+ * @param[in] btree - Btree time (seconds).
+ * @param[in] hash - Hash time (seconds).
+ */
+void report(const char *op, uint32_t count, double btree, double hash) {
+	printf("%-8s %12.1f %12.1f %7.2fx\n", op, btree * 1e9 / count, hash * 1e9 / count, btree / hash);
+}
+
+/** Operations under test */
+
+int btree_add(db_table *table, md5_t *key, pkg *record) {
+	return btree_insert(table, key, record, INSERT_ALWAYS);
+}
+
+pkg *btree_get(db_table *table, md5_t *key) {
+	return btree_find(table, key, NULL);
+}
+
+uint64_t btree_walk(db_table *table) {
+	btree_cursor *iter = btree_iter(table);
+	uint64_t count = 0;
+	while (btree_next(iter) != NULL) {
+		count++;
+	}
+
+	free(iter);
+	return count;
+}
+
+int hash_add(db_table *table, md5_t *key, pkg *record) {
+	return hash_insert(table, key, record, INSERT_ALWAYS);
+}
+
+pkg *hash_get(db_table *table, md5_t *key) {
+	return hash_find(table, key);
+}
+
+uint64_t hash_walk(db_table *table) {
+	hash_cursor *iter = hash_iter(table);
+	uint64_t count = 0;
+	while (hash_next(iter) != NULL) {
+		count++;
+	}
+
+	free(iter);
+	return count;
+}
@@ -0,0 +1,256 @@
+// Measures shared btree inserts and lookups as threads are added.
+// Usage: btree_parallel [records] [max threads] [page size]
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../src/db/defines.h"
+#include "../src/db/table.h"
+#include "../src/db/btree.h"
+#include "../src/tables/pkg.h"
+
+#define BENCH_FILE "/tmp/pmm-parallel.pmm"
+#define BENCH_IDENTITY 0xbf
+#define DEFAULT_RECORDS 200000
+#define DEFAULT_THREADS 8
+// Best of this many runs is reported
+#define ROUNDS 3
+
+#define best(a, b) (((a) < (b)) ? (a) : (b))
+
+// Keys handled by one thread
+typedef struct {
+	db_table *table;
+	md5_t *keys;
+	uint32_t first;
+	uint32_t end;
+	uint32_t failed;
+} worker;
+
+// Scan check state
+typedef struct {
+	uint32_t count;
+	md5_t last;
+	uint32_t unordered;
+} scan_state;
+
+double now(void);
+void make_keys(md5_t *keys, uint32_t count);
+void run_workers(db_table *table, md5_t *keys, uint32_t count, uint32_t threads, void *(*work)(void *));
+void *insert_work(void *arg);
+void *find_work(void *arg);
+int count_record(md5_t *key, const void *record, uint32_t length, void *data);
+void run(md5_t *keys, uint32_t count, uint32_t threads, uint32_t page_size, double *insert, double *find);
+
+int main(int argc, char **argv) {
+	uint32_t count = (argc > 1) ? strtoul(argv[1], NULL, 10) : DEFAULT_RECORDS;
+	uint32_t max_threads = (argc > 2) ? strtoul(argv[2], NULL, 10) : DEFAULT_THREADS;
+	uint32_t page_size = (argc > 3) ? strtoul(argv[3], NULL, 10) : DEFAULT_PAGE_SIZE;
+	if (count == 0 || max_threads == 0 || !valid_page_size(page_size)) {
+		fprintf(stderr, "usage: %s [records] [max threads] [page size]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	md5_t *keys = malloc(count * sizeof(md5_t));
+	make_keys(keys, count);
+
+	printf("%u records, %u byte pages, %ld cores\n", count, page_size, sysconf(_SC_NPROCESSORS_ONLN));
+	printf("%-8s %12s %8s %12s %8s\n", "threads", "insert ns", "speedup", "find ns", "speedup");
+	double base_insert = 0;
+	double base_find = 0;
+	for (uint32_t threads = 1; threads <= max_threads; threads *= 2) {
+		double insert = 1e9;
+		double find = 1e9;
+		for (int round = 0; round < ROUNDS; round++) {
+			double round_insert, round_find;
+			run(keys, count, threads, page_size, &round_insert, &round_find);
+			insert = best(insert, round_insert);
+			find = best(find, round_find);
+		}
+		if (threads == 1) {
+			base_insert = insert;
+			base_find = find;
+		}
+
+		printf("%-8u %12.1f %7.2fx %12.1f %7.2fx\n", threads, insert * 1e9 / count, base_insert / insert,
+			find * 1e9 / count, base_find / find);
+	}
+
+	free(keys);
+	unlink(BENCH_FILE);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Get monotonic time.
+ *
+ * @return Seconds.
+ */
+double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Generate distinct pseudo-random keys (splitmix64).
+ *
+ * @param[out] keys - Key array.
+ * @param[in] count - Number of keys.
+ */
+void make_keys(md5_t *keys, uint32_t count) {
+	uint64_t state = 0x9e3779b97f4a7c15;
+	for (uint32_t i = 0; i < count; i++) {
+		uint64_t halves[2];
+		for (int h = 0; h < 2; h++) {
+			uint64_t z = (state += 0x9e3779b97f4a7c15);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+			halves[h] = z ^ (z >> 31);
+		}
+		// Index in low bits keeps keys distinct
+		halves[0] = (halves[0] & ~(uint64_t)UINT32_MAX) | i;
+		memcpy(&keys[i], halves, sizeof(md5_t));
+	}
+}
+
+/**
+ * @brief Split keys into contiguous slices and run a worker on each.
+ *
+ * @param[in] table - Shared table object.
+ * @param[in] keys - Keys.
+ * @param[in] count - Number of keys.
+ * @param[in] threads - Number of threads.
+ * @param[in] work - Thread function, given a worker.
+ */
+void run_workers(db_table *table, md5_t *keys, uint32_t count, uint32_t threads, void *(*work)(void *)) {
+	pthread_t *ids = malloc(threads * sizeof(pthread_t));
+	worker *workers = malloc(threads * sizeof(worker));
+	for (uint32_t t = 0; t < threads; t++) {
+		workers[t] = (worker) {
+			.table = table,
+			.keys = keys,
+			.first = (uint64_t)count * t / threads,
+			.end = (uint64_t)count * (t + 1) / threads,
+			.failed = 0
+		};
+		pthread_create(&ids[t], NULL, work, &workers[t]);
+	}
+
+	uint32_t failed = 0;
+	for (uint32_t t = 0; t < threads; t++) {
+		pthread_join(ids[t], NULL);
+		failed += workers[t].failed;
+	}
+	free(workers);
+	free(ids);
+
+	if (failed > 0) {
+		fprintf(stderr, "%u operations failed\n", failed);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief Insert a slice of keys, record holds the key index.
+ *
+ * @param[in] arg - Worker.
+ * @return NULL.
+ */
+void *insert_work(void *arg) {
+	worker *self = arg;
+	pkg record = { .status = PKG_OK, .hosts = 1 };
+	for (uint32_t i = self->first; i < self->end; i++) {
+		record.hosts = i;
+		if (btree_shared_insert(self->table, &self->keys[i], &record, sizeof(pkg), INSERT_ALWAYS) < 0) {
+			self->failed++;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Look up a slice of keys, checking their records.
+ *
+ * @param[in] arg - Worker.
+ * @return NULL.
+ */
+void *find_work(void *arg) {
+	worker *self = arg;
+	pkg record;
+	for (uint32_t i = self->first; i < self->end; i++) {
+		if (btree_shared_find(self->table, &self->keys[i], &record, sizeof(pkg), NULL) != 1 || record.hosts != i) {
+			self->failed++;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Count scanned records, checking key order (btree_visit).
+ *
+ * @param[in] key - Record key.
+ * @param[in] record - Record.
+ * @param[in] length - Record length.
+ * @param[in] data - Scan state.
+ * @return 0 to continue.
+ */
+int count_record(md5_t *key, const void *record, uint32_t length, void *data) {
+	(void)record;
+	(void)length;
+	scan_state *state = data;
+	if (state->count > 0 && !md5_gr(*key, state->last)) {
+		state->unordered++;
+	}
+	md5_cp(&state->last, key);
+	state->count++;
+
+	return 0;
+}
+
+/**
+ * @brief Time inserting keys into an empty shared btree, then looking each
+ * one up, and check the result with a scan.
+ *
+ * @param[in] keys - Keys.
+ * @param[in] count - Number of keys.
+ * @param[in] threads - Number of threads.
+ * @param[in] page_size - Page size.
+ * @param[out] insert - Insert seconds.
+ * @param[out] find - Find seconds.
+ */
+void run(md5_t *keys, uint32_t count, uint32_t threads, uint32_t page_size, double *insert, double *find) {
+	unlink(BENCH_FILE);
+	db_table *table = table_open(BENCH_FILE, BENCH_IDENTITY, page_size);
+	if (table == NULL) {
+		exit(EXIT_FAILURE);
+	}
+	btree_init(table, sizeof(pkg));
+	btree_share(table);
+
+	double start = now();
+	run_workers(table, keys, count, threads, &insert_work);
+	*insert = now() - start;
+
+	start = now();
+	run_workers(table, keys, count, threads, &find_work);
+	*find = now() - start;
+
+	scan_state state = { .count = 0, .unordered = 0 };
+	btree_shared_scan(table, &count_record, &state);
+	if (state.count != count || state.unordered > 0) {
+		fprintf(stderr, "scan found %u records (%u out of order), expected %u\n", state.count,
+			state.unordered, count);
+		exit(EXIT_FAILURE);
+	}
+
+	btree_unshare(table);
+	table_close(table);
+}
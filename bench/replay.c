@@ -0,0 +1,812 @@
+// Replays storage calls captured with PMM_CAPTURE against fresh tables and
+// reports per-call latency of the capture and the replay.
+// Usage: pmm_replay capture [seed table...]
+//
+// Records and ext data are replayed zero-filled. Tables that already held
+// pages when opened start from the seed table of the same identity if one is
+// given. Calls on them are skipped without a seed. Ext reads outside the
+// replayed data are skipped.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "../src/db/defines.h"
+#include "../src/db/table.h"
+#include "../src/db/btree.h"
+#include "../src/db/hash.h"
+#include "../src/db/ext.h"
+#include "../src/db/capture.h"
+#include "../src/util/vector.h"
+
+#define REPLAY_FILE "/tmp/pmm-replay-%016" PRIx64 ".pmm"
+// Power of two latency buckets
+#define BUCKETS 64
+#define BAR_WIDTH 30
+
+// Table file, shared by all opens of a path
+typedef struct {
+	// Captured path hash
+	uint64_t hash;
+	char path[64];
+	// Held pages when captured, but no seed was given
+	uint8_t missing;
+	// Captured ext locators and their replayed counterparts (ext_entry)
+	vector *ext_map;
+} replay_file;
+
+typedef struct {
+	uint64_t captured;
+	ext_t replayed;
+} ext_entry;
+
+// Open table and the call state tied to it, by capture table number
+typedef struct {
+	db_table *table;
+	replay_file *file;
+	btree_cursor *iter;
+	btree_stream *stream;
+	btree_loader *loader;
+	hash_cursor *hash_iter;
+} replay_table;
+
+// Latencies of one call (ns)
+typedef struct {
+	vector *captured;
+	vector *replayed;
+} op_stats;
+
+typedef struct {
+	FILE *capture;
+	char **seeds;
+	int seed_count;
+	// Table files (replay_file *)
+	vector *files;
+	replay_table *tables;
+	op_stats stats[CAPTURE_OP_COUNT];
+	// Data written by replayed calls (zero-filled) and read back
+	uint8_t *zero;
+	uint8_t *sink;
+	uint64_t buf_len;
+	uint64_t replayed;
+	uint64_t skipped;
+	uint64_t failed;
+} replay_state;
+
+uint64_t clock_ns(void);
+int replay_record(replay_state *state, capture_record *record);
+int replay_open(replay_state *state, capture_record *record);
+int replay_call(replay_state *state, replay_table *t, capture_record *record, uint64_t *elapsed);
+int replay_many(replay_state *state, db_table *table, capture_record *record, uint64_t *elapsed);
+int replay_replace(replay_state *state, capture_record *record);
+replay_file *find_file(replay_state *state, uint64_t hash);
+replay_file *add_file(replay_state *state, uint64_t hash);
+int seed_file(replay_state *state, replay_file *file, uint32_t identity);
+int copy_seed(const char *src, const char *dest);
+void map_ext(replay_file *file, ext_t *captured, ext_t *replayed);
+int resolve_ext(replay_file *file, db_table *table, ext_t *captured, ext_t *locator);
+void reserve_buffers(replay_state *state, uint64_t len);
+void report(replay_state *state);
+void print_op(const char *name, op_stats *stats);
+uint64_t percentile(vector *samples, uint32_t pct);
+int compare_ns(const void *a, const void *b);
+uint32_t bucket(uint64_t ns);
+void close_tables(replay_state *state);
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s capture [seed table...]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	replay_state state = {
+		.capture = fopen(argv[1], "rb"),
+		.seeds = argv + 2,
+		.seed_count = argc - 2,
+		.files = vec_new(sizeof(replay_file *)),
+		.tables = calloc(UINT16_MAX + 1, sizeof(replay_table))
+	};
+	if (state.capture == NULL) {
+		fprintf(stderr, "failed to open %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	capture_header header;
+	if (fread(&header, sizeof(capture_header), 1, state.capture) != 1
+			|| header.magic != CAPTURE_MAGIC || header.version != CAPTURE_VERSION) {
+		fprintf(stderr, "%s is not a capture of this version\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	for (int i = 0; i < CAPTURE_OP_COUNT; i++) {
+		state.stats[i].captured = vec_new(sizeof(uint64_t));
+		state.stats[i].replayed = vec_new(sizeof(uint64_t));
+	}
+
+	capture_record record;
+	while (fread(&record, sizeof(capture_record), 1, state.capture) == 1) {
+		if (replay_record(&state, &record) < 0) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	report(&state);
+	close_tables(&state);
+	fclose(state.capture);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Get monotonic time.
+ *
+ * @return Nanoseconds.
+ */
+uint64_t clock_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief Replay a captured call and record both latencies.
+ *
+ * @param[in] state - Replay state.
+ * @param[in] record - Captured call.
+ * @return Status code (-1 on a corrupt capture).
+ */
+int replay_record(replay_state *state, capture_record *record) {
+	if (record->op >= CAPTURE_OP_COUNT) {
+		fprintf(stderr, "unknown call %u in capture\n", record->op);
+		return -1;
+	}
+
+	// Keys of a replayed batch insert
+	if (record->op == CAPTURE_BATCH_KEY) {
+		return 0;
+	}
+
+	uint64_t elapsed = 0;
+	int result;
+	if (record->op == CAPTURE_OPEN) {
+		uint64_t start = clock_ns();
+		result = replay_open(state, record);
+		elapsed = clock_ns() - start;
+	} else if (record->op == CAPTURE_REPLACE) {
+		uint64_t start = clock_ns();
+		result = replay_replace(state, record);
+		elapsed = clock_ns() - start;
+	} else {
+		replay_table *t = &state->tables[record->table];
+		// Table opened before the capture started
+		if (t->table == NULL) {
+			state->skipped++;
+			return (record->op == CAPTURE_INSERT_MANY || record->op == CAPTURE_FIND_MANY) ?
+				replay_many(state, NULL, record, NULL) : 0;
+		}
+		result = replay_call(state, t, record, &elapsed);
+	}
+
+	if (result > 0) {
+		state->skipped++;
+		return 0;
+	}
+	if (result < 0) {
+		state->failed++;
+	}
+
+	state->replayed++;
+	vec_push(state->stats[record->op].captured, &record->nsec);
+	vec_push(state->stats[record->op].replayed, &elapsed);
+	return 0;
+}
+
+/**
+ * @brief Replay table open.
+ *
+ * @param[in] state - Replay state.
+ * @param[in] record - Captured open.
+ * @return Status code.
+ */
+int replay_open(replay_state *state, capture_record *record) {
+	uint32_t identity = (uint32_t)record->arg;
+	uint64_t hash;
+	memcpy(&hash, record->key, sizeof(uint64_t));
+	replay_file *file = find_file(state, hash);
+	if (file == NULL) {
+		file = add_file(state, hash);
+		if ((record->mode & CAPTURE_EXISTING) && seed_file(state, file, identity) < 0) {
+			return -1;
+		}
+	}
+	if (file->missing) {
+		return 1;
+	}
+
+	replay_table *t = &state->tables[record->table];
+	t->file = file;
+	if (record->mode & CAPTURE_LOCKED) {
+		t->table = table_open_locked(file->path, identity, record->length);
+	} else if (record->mode & CAPTURE_READ_ONLY) {
+		t->table = table_open_read(file->path, identity);
+	} else {
+		t->table = table_open(file->path, identity, record->length);
+	}
+
+	return (t->table != NULL) ? 0 : -1;
+}
+
+/**
+ * @brief Replay call on an open table.
+ *
+ * @param[in] state - Replay state.
+ * @param[in] t - Table the call worked on.
+ * @param[in] record - Captured call.
+ * @param[out] elapsed - Call duration (ns).
+ * @return Status code (1 if skipped).
+ */
+int replay_call(replay_state *state, replay_table *t, capture_record *record, uint64_t *elapsed) {
+	db_table *table = t->table;
+	md5_t *key = (md5_t *)record->key;
+	ext_t captured;
+	ext_t locator;
+	memcpy(&captured, record->key, sizeof(ext_t));
+
+	// Prepare outside of the timed call
+	switch (record->op) {
+	case CAPTURE_INSERT_MANY:
+	case CAPTURE_FIND_MANY:
+		return replay_many(state, table, record, elapsed);
+	case CAPTURE_CLOSE:
+		free(t->iter);
+		t->iter = NULL;
+		btree_stream_close(t->stream);
+		t->stream = NULL;
+		free(t->hash_iter);
+		t->hash_iter = NULL;
+		break;
+	case CAPTURE_INSERT:
+	case CAPTURE_HASH_INSERT:
+		// Record length is not captured, records fit a page
+		reserve_buffers(state, table_page_size(table));
+		break;
+	case CAPTURE_NEXT:
+	case CAPTURE_PEEK:
+		if (t->iter == NULL) {
+			return 1;
+		}
+		break;
+	case CAPTURE_STREAM_NEXT:
+	case CAPTURE_STREAM_CLOSE:
+		if (t->stream == NULL) {
+			return 1;
+		}
+		break;
+	case CAPTURE_LOAD_ADD:
+	case CAPTURE_LOAD_ADD_VAR:
+	case CAPTURE_LOAD_RESIZE:
+	case CAPTURE_LOAD_END:
+		if (t->loader == NULL) {
+			return 1;
+		}
+		break;
+	case CAPTURE_HASH_NEXT:
+		if (t->hash_iter == NULL) {
+			return 1;
+		}
+		break;
+	case CAPTURE_EXT_VIEW:
+	case CAPTURE_EXT_READ:
+	case CAPTURE_EXT_READ_DIRECT:
+	case CAPTURE_EXT_ACCESS:
+	case CAPTURE_EXT_PREFETCH:
+		if (resolve_ext(t->file, table, &captured, &locator) < 0) {
+			return 1;
+		}
+		reserve_buffers(state, locator.len);
+		break;
+	default:
+		break;
+	}
+	reserve_buffers(state, record->length);
+
+	int result = 0;
+	uint64_t start = clock_ns();
+	switch (record->op) {
+	case CAPTURE_FLUSH:
+		result = (table_flush(table) < 0) ? -1 : 0;
+		break;
+	case CAPTURE_CLOSE:
+		table_close(table);
+		t->table = NULL;
+		break;
+	case CAPTURE_COMPRESS:
+		result = table_set_ext_compressed(table, record->mode);
+		break;
+	case CAPTURE_INIT:
+		btree_init(table, record->length);
+		break;
+	case CAPTURE_INIT_SLOTTED:
+		btree_init_slotted(table);
+		break;
+	case CAPTURE_INSERT:
+		result = btree_insert(table, key, state->zero, record->mode);
+		break;
+	case CAPTURE_INSERT_VAR:
+		result = btree_insert_var(table, key, state->zero, record->length, record->mode);
+		break;
+	case CAPTURE_FIND:
+		btree_find(table, key, NULL);
+		break;
+	case CAPTURE_ITER:
+		free(t->iter);
+		t->iter = btree_iter(table);
+		break;
+	case CAPTURE_NEXT:
+		btree_next(t->iter);
+		break;
+	case CAPTURE_PEEK:
+		btree_peek(t->iter, record->arg, NULL);
+		break;
+	case CAPTURE_STREAM_OPEN:
+		t->stream = btree_stream_open(table);
+		break;
+	case CAPTURE_STREAM_NEXT:
+		btree_stream_next(t->stream);
+		break;
+	case CAPTURE_STREAM_CLOSE:
+		btree_stream_close(t->stream);
+		t->stream = NULL;
+		break;
+	case CAPTURE_LOAD_BEGIN:
+		t->loader = btree_load_begin(table, record->length, record->arg);
+		result = (t->loader != NULL) ? 0 : -1;
+		break;
+	case CAPTURE_LOAD_BEGIN_SLOTTED:
+		t->loader = btree_load_begin_slotted(table, record->arg);
+		result = (t->loader != NULL) ? 0 : -1;
+		break;
+	case CAPTURE_LOAD_ADD:
+		result = btree_load_add(t->loader, key, state->zero);
+		break;
+	case CAPTURE_LOAD_ADD_VAR:
+		result = btree_load_add_var(t->loader, key, state->zero, record->length);
+		break;
+	case CAPTURE_LOAD_RESIZE:
+		result = btree_load_resize(t->loader, record->length);
+		break;
+	case CAPTURE_LOAD_END:
+		result = btree_load_end(t->loader);
+		t->loader = NULL;
+		break;
+	case CAPTURE_EXT_INSERT:
+		locator = ext_insert(table, state->zero, record->length);
+		break;
+	case CAPTURE_EXT_VIEW:
+		ext_view(table, &locator);
+		break;
+	case CAPTURE_EXT_READ:
+		ext_read(table, &locator, record->arg, state->sink, record->length);
+		break;
+	case CAPTURE_EXT_READ_DIRECT:
+		result = ext_read_direct(table, &locator, state->sink);
+		break;
+	case CAPTURE_EXT_ACCESS:
+		ext_access(table, &locator, state->sink);
+		break;
+	case CAPTURE_EXT_PREFETCH:
+		ext_prefetch(table, &locator);
+		break;
+	case CAPTURE_HASH_INIT:
+		hash_init(table, record->length);
+		break;
+	case CAPTURE_HASH_INSERT:
+		result = hash_insert(table, key, state->zero, record->mode);
+		break;
+	case CAPTURE_HASH_FIND:
+		hash_find(table, key);
+		break;
+	case CAPTURE_HASH_ITER:
+		free(t->hash_iter);
+		t->hash_iter = hash_iter(table);
+		break;
+	case CAPTURE_HASH_NEXT:
+		hash_next(t->hash_iter);
+		break;
+	default:
+		return 1;
+	}
+	*elapsed = clock_ns() - start;
+
+	if (record->op == CAPTURE_EXT_INSERT) {
+		map_ext(t->file, &captured, &locator);
+	}
+
+	return (result < 0) ? -1 : 0;
+}
+
+/**
+ * @brief Replay batch insert or find, reading its keys from the capture.
+ *
+ * @param[in] state - Replay state.
+ * @param[in] table - Table object or NULL to only skip the keys.
+ * @param[in] record - Captured batch call.
+ * @param[out] elapsed - Call duration (ns).
+ * @return Status code.
+ */
+int replay_many(replay_state *state, db_table *table, capture_record *record, uint64_t *elapsed) {
+	uint32_t count = (uint32_t)record->arg;
+	md5_t *keys = malloc((count > 0 ? count : 1) * sizeof(md5_t));
+	capture_record key;
+	for (uint32_t i = 0; i < count; i++) {
+		if (fread(&key, sizeof(capture_record), 1, state->capture) != 1 || key.op != CAPTURE_BATCH_KEY) {
+			fprintf(stderr, "batch call is missing keys\n");
+			free(keys);
+			return -1;
+		}
+		memcpy(&keys[i], key.key, sizeof(md5_t));
+	}
+
+	int result = 0;
+	if (table != NULL && record->op == CAPTURE_FIND_MANY) {
+		void **records = malloc((count > 0 ? count : 1) * sizeof(void *));
+		uint32_t *lengths = malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+		uint64_t start = clock_ns();
+		btree_find_many(table, keys, records, lengths, count);
+		*elapsed = clock_ns() - start;
+		free(records);
+		free(lengths);
+	} else if (table != NULL) {
+		reserve_buffers(state, (uint64_t)record->length * count);
+		uint64_t start = clock_ns();
+		result = btree_insert_many(table, keys, state->zero, record->length, count, record->mode);
+		*elapsed = clock_ns() - start;
+	}
+
+	free(keys);
+	return (result < 0) ? -1 : 0;
+}
+
+/**
+ * @brief Replay file replace.
+ *
+ * @param[in] state - Replay state.
+ * @param[in] record - Captured replace.
+ * @return Status code (1 if skipped).
+ */
+int replay_replace(replay_state *state, capture_record *record) {
+	uint64_t hash;
+	memcpy(&hash, record->key, sizeof(uint64_t));
+	replay_file *src = find_file(state, hash);
+	if (src == NULL || src->missing || !record->mode) {
+		return 1;
+	}
+
+	replay_file *dest = find_file(state, record->arg);
+	if (dest == NULL) {
+		dest = add_file(state, record->arg);
+	}
+
+	if (table_replace(src->path, dest->path) < 0) {
+		return -1;
+	}
+
+	// Data moves to the destination path
+	vector *map = dest->ext_map;
+	dest->ext_map = src->ext_map;
+	dest->missing = 0;
+	src->ext_map = map;
+	return 0;
+}
+
+/**
+ * @brief Find table file of a path.
+ *
+ * @param[in] state - Replay state.
+ * @param[in] hash - Captured path hash.
+ * @return Table file or NULL if not opened yet.
+ */
+replay_file *find_file(replay_state *state, uint64_t hash) {
+	for (uint32_t i = 0; i < state->files->count; i++) {
+		replay_file *file = *(replay_file **)vec_at(state->files, i);
+		if (file->hash == hash) {
+			return file;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Add empty table file.
+ *
+ * @param[in] state - Replay state.
+ * @param[in] hash - Captured path hash.
+ * @return Table file.
+ */
+replay_file *add_file(replay_state *state, uint64_t hash) {
+	replay_file *file = malloc(sizeof(replay_file));
+	file->hash = hash;
+	file->missing = 0;
+	file->ext_map = vec_new(sizeof(ext_entry));
+	snprintf(file->path, sizeof(file->path), REPLAY_FILE, hash);
+	unlink(file->path);
+	vec_push(state->files, &file);
+
+	return file;
+}
+
+/**
+ * @brief Start table file from the seed table of the same identity.
+ *
+ * @param[in] state - Replay state.
+ * @param[in] file - Table file.
+ * @param[in] identity - Table identity.
+ * @return Status code.
+ */
+int seed_file(replay_state *state, replay_file *file, uint32_t identity) {
+	for (int i = 0; i < state->seed_count; i++) {
+		FILE *seed = fopen(state->seeds[i], "rb");
+		if (seed == NULL) {
+			fprintf(stderr, "failed to open seed %s\n", state->seeds[i]);
+			return -1;
+		}
+
+		// Identity leads the metadata of every format
+		uint32_t seed_identity;
+		int match = fread(&seed_identity, sizeof(uint32_t), 1, seed) == 1 && seed_identity == identity;
+		fclose(seed);
+		if (match) {
+			return copy_seed(state->seeds[i], file->path);
+		}
+	}
+
+	fprintf(stderr, "no seed for table %08x, skipping its calls\n", identity);
+	file->missing = 1;
+	return 0;
+}
+
+/**
+ * @brief Copy file contents.
+ *
+ * @param[in] src - Source path.
+ * @param[in] dest - Destination path.
+ * @return Status code.
+ */
+int copy_seed(const char *src, const char *dest) {
+	int in = open(src, O_RDONLY);
+	int out = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (in < 0 || out < 0) {
+		fprintf(stderr, "failed to copy %s\n", src);
+		close(in);
+		close(out);
+		return -1;
+	}
+
+	char buf[65536];
+	ssize_t n;
+	int result = 0;
+	while ((n = read(in, buf, sizeof(buf))) > 0) {
+		if (write(out, buf, n) != n) {
+			result = -1;
+			break;
+		}
+	}
+	if (n < 0) {
+		result = -1;
+	}
+
+	close(in);
+	close(out);
+	return result;
+}
+
+/**
+ * @brief Remember where captured ext data was replayed to.
+ * Data is appended, so captured locators grow until a save is dropped.
+ *
+ * @param[in] file - Table file.
+ * @param[in] captured - Captured locator.
+ * @param[in] replayed - Replayed locator.
+ */
+void map_ext(replay_file *file, ext_t *captured, ext_t *replayed) {
+	vector *map = file->ext_map;
+	if (map->count > 0 && ((ext_entry *)vec_at(map, map->count - 1))->captured >= captured->ptr) {
+		vec_free(map);
+		map = file->ext_map = vec_new(sizeof(ext_entry));
+	}
+
+	ext_entry entry = { .captured = captured->ptr, .replayed = *replayed };
+	vec_push(map, &entry);
+}
+
+/**
+ * @brief Translate captured locator to replayed data.
+ *
+ * @param[in] file - Table file.
+ * @param[in] table - Table object.
+ * @param[in] captured - Captured locator.
+ * @param[out] locator - Locator into the replayed table.
+ * @return Status code (-1 if the data was not replayed).
+ */
+int resolve_ext(replay_file *file, db_table *table, ext_t *captured, ext_t *locator) {
+	uint32_t min = 0;
+	uint32_t max = file->ext_map->count;
+	while (min != max) {
+		uint32_t mid = (min + max) / 2;
+		ext_entry *entry = vec_at(file->ext_map, mid);
+		if (entry->captured == captured->ptr) {
+			*locator = entry->replayed;
+			return 0;
+		}
+		if (entry->captured < captured->ptr) {
+			min = mid + 1;
+		} else {
+			max = mid;
+		}
+	}
+
+	// Data from the seed table
+	uint64_t end = table->cmeta.ext_end_ptr;
+	if (captured->ptr > end || captured->len > end - captured->ptr) {
+		return -1;
+	}
+
+	*locator = *captured;
+	return 0;
+}
+
+/**
+ * @brief Grow data buffers.
+ *
+ * @param[in] state - Replay state.
+ * @param[in] len - Bytes needed.
+ */
+void reserve_buffers(replay_state *state, uint64_t len) {
+	if (len <= state->buf_len) {
+		return;
+	}
+
+	free(state->zero);
+	free(state->sink);
+	state->zero = calloc(len, 1);
+	state->sink = malloc(len);
+	state->buf_len = len;
+}
+
+/**
+ * @brief Print latencies of all replayed calls.
+ *
+ * @param[in] state - Replay state.
+ */
+void report(replay_state *state) {
+	printf("%" PRIu64 " calls replayed, %" PRIu64 " skipped, %" PRIu64 " failed\n",
+		state->replayed, state->skipped, state->failed);
+	printf("%-18s %10s %12s %12s %12s %12s\n", "call", "count",
+		"capture p50", "capture p99", "replay p50", "replay p99");
+
+	for (int i = 0; i < CAPTURE_OP_COUNT; i++) {
+		if (state->stats[i].captured->count > 0) {
+			print_op(capture_op_name(i), &state->stats[i]);
+		}
+	}
+}
+
+/**
+ * @brief Print latency percentiles and histogram of a call.
+ *
+ * @param[in] name - Call name.
+ * @param[in] stats - Call latencies.
+ */
+void print_op(const char *name, op_stats *stats) {
+	printf("%-18s %10u %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 "\n", name,
+		stats->captured->count, percentile(stats->captured, 50), percentile(stats->captured, 99),
+		percentile(stats->replayed, 50), percentile(stats->replayed, 99));
+
+	uint32_t captured[BUCKETS] = { 0 };
+	uint32_t replayed[BUCKETS] = { 0 };
+	uint32_t first = BUCKETS;
+	uint32_t last = 0;
+	uint32_t peak = 0;
+	for (uint32_t i = 0; i < stats->captured->count; i++) {
+		uint32_t c = bucket(*(uint64_t *)vec_at(stats->captured, i));
+		uint32_t r = bucket(*(uint64_t *)vec_at(stats->replayed, i));
+		captured[c]++;
+		replayed[r]++;
+		first = (c < first) ? c : first;
+		first = (r < first) ? r : first;
+		last = (c > last) ? c : last;
+		last = (r > last) ? r : last;
+	}
+	for (uint32_t b = first; b <= last; b++) {
+		peak = (captured[b] > peak) ? captured[b] : peak;
+		peak = (replayed[b] > peak) ? replayed[b] : peak;
+	}
+
+	// Bucket b holds latencies below 2^b ns
+	for (uint32_t b = first; b <= last; b++) {
+		printf("  < %-12" PRIu64 " %8u %-*.*s| %8u %.*s\n", (uint64_t)1 << b,
+			captured[b], BAR_WIDTH, (int)((uint64_t)captured[b] * BAR_WIDTH / peak), "##############################",
+			replayed[b], (int)((uint64_t)replayed[b] * BAR_WIDTH / peak), "##############################");
+	}
+}
+
+/**
+ * @brief Get latency percentile (sorts samples).
+ *
+ * @param[in] samples - Latencies (ns).
+ * @param[in] pct - Percentile.
+ * @return Latency (ns).
+ */
+uint64_t percentile(vector *samples, uint32_t pct) {
+	qsort(samples->raw_array, samples->count, sizeof(uint64_t), &compare_ns);
+	uint32_t index = (uint64_t)(samples->count - 1) * pct / 100;
+	return *(uint64_t *)vec_at(samples, index);
+}
+
+/**
+ * @brief Order latencies (qsort).
+ *
+ * @param[in] a - First latency.
+ * @param[in] b - Second latency.
+ * @return Comparison result.
+ */
+int compare_ns(const void *a, const void *b) {
+	uint64_t ns_a = *(const uint64_t *)a;
+	uint64_t ns_b = *(const uint64_t *)b;
+	return (ns_a > ns_b) - (ns_a < ns_b);
+}
+
+/**
+ * @brief Get histogram bucket of a latency.
+ *
+ * @param[in] ns - Latency.
+ * @return Bucket (bit length of the latency).
+ */
+uint32_t bucket(uint64_t ns) {
+	uint32_t b = 0;
+	while (ns > 0 && b < BUCKETS - 1) {
+		ns >>= 1;
+		b++;
+	}
+
+	return b;
+}
+
+/**
+ * @brief Close tables left open by the capture and free replay state.
+ *
+ * @param[in] state - Replay state.
+ */
+void close_tables(replay_state *state) {
+	for (uint32_t i = 0; i <= UINT16_MAX; i++) {
+		replay_table *t = &state->tables[i];
+		free(t->iter);
+		free(t->hash_iter);
+		btree_stream_close(t->stream);
+		if (t->loader != NULL) {
+			btree_load_end(t->loader);
+		}
+		table_close(t->table);
+	}
+
+	for (uint32_t i = 0; i < state->files->count; i++) {
+		replay_file *file = *(replay_file **)vec_at(state->files, i);
+		vec_free(file->ext_map);
+		unlink(file->path);
+		free(file);
+	}
+	vec_free(state->files);
+
+	for (int i = 0; i < CAPTURE_OP_COUNT; i++) {
+		vec_free(state->stats[i].captured);
+		vec_free(state->stats[i].replayed);
+	}
+	free(state->tables);
+	free(state->zero);
+	free(state->sink);
+}
@@ -1,85 +1,311 @@
 #include "alpm.h"
 
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
 
 #include <alpm.h>
 #include <alpm_list.h>
 
-// TODO: implement properly
-#define make_handle() alpm_initialize("/", "/var/lib/pacman", NULL)
-#define delete_handle(handle) alpm_release(handle)
+#include "client.h"
+#include "../util/trace.h"
+#include "../util/vector.h"
 
+#define ROOT_DIR "/"
+#define DB_PATH "/var/lib/pacman/"
+#define LOCAL_DB_DIR "local"
+#define SYNC_DB_DIR "sync"
+#define CACHE_DIR "/var/cache/pacman/pkg/"
+#define GPG_DIR "/etc/pacman.d/gnupg/"
+#define LOG_FILE "/var/log/pacman.log"
+#define MIRRORLIST "/etc/pacman.d/mirrorlist"
+#define SERVER_PREFIX "Server"
+
+static alpm_handle_t *shared_handle = NULL;
+static int release_registered = 0;
+// Transaction options (cachedir, mirrors) are registered on shared_handle
+static int trans_ready = 0;
+static struct timespec loaded_local;
+static struct timespec loaded_sync;
+static const char *const sync_repos[] = {
+	"core",
+	"extra",
+	"multilib"
+};
+
+alpm_handle_t *get_handle(void);
+void release_handle(void);
 alpm_pkg_t *find_local(alpm_handle_t *handle, const char *name);
 alpm_pkg_t *find_repos(alpm_handle_t *handle, const char *name);
+const char *best_version(alpm_handle_t *handle, const char *name);
 void setup_alpm(alpm_handle_t *handle);
+void db_mtimes(struct timespec *local, struct timespec *sync);
+int setup_trans(alpm_handle_t *handle);
+int add_servers(alpm_db_t *db, const char *arch);
+void free_problems(alpm_errno_t err, alpm_list_t *data);
+
+const char *pmm_alpm_db_path(void) {
+	const char *path = getenv(DB_PATH_ENV);
+	return (path != NULL && *path != '\0') ? path : DB_PATH;
+}
 
 int pmm_alpm_exists(const char *name) {
-	alpm_handle_t *handle = make_handle();
-	setup_alpm(handle);
-
-	/* int found = 0; */
-	/* for (alpm_list_t *i = alpm_get_syncdbs(handle); i; i = alpm_list_next(i)) { */
-	/* 	alpm_pkg_t *pkg = alpm_db_get_pkg(i->data, name); */
-	/* 	if (pkg != NULL) { */
-	/* 		found = 1; */
-	/* 		break; */
-	/* 	} */
-
-	/* 	for (alpm_list_t *j = alpm_db_get_pkgcache(i->data); j; j = alpm_list_next(j)) { */
-	/* 		if (strcmp(alpm_pkg_get_name(j->data), name) == 0) { */
-	/* 			found = 1; */
-	/* 			break; */
-	/* 		} */
-	/* 	} */
-	/* } */
-
-	alpm_pkg_t *pkg = find_repos(handle, name);
-	int result = (pkg != NULL);
-
-	delete_handle(handle);
-	return result;
+	trace_begin("alpm_exists", name);
+	alpm_pkg_t *pkg = find_repos(get_handle(), name);
+	trace_end("alpm_exists");
+
+	return (pkg != NULL);
 }
 
 int pmm_alpm_installed(const char *name) {
-	alpm_handle_t *handle = make_handle();
-	setup_alpm(handle);
+	trace_begin("alpm_installed", name);
+	alpm_pkg_t *pkg = find_local(get_handle(), name);
+	trace_end("alpm_installed");
 
-	/* int found = 0; */
-	/* for (alpm_list_t *i = alpm_db_get_pkgcache(alpm_get_localdb(handle)); i; i = alpm_list_next(i)) { */
-	/* 	if (strcmp(alpm_pkg_get_name(i->data), name) == 0) { */
-	/* 		found = 1; */
-	/* 		break; */
-	/* 	} */
-	/* } */
+	return (pkg != NULL);
+}
 
-	alpm_pkg_t *pkg = find_local(handle, name);
-	int result = (pkg != NULL);
+void pmm_alpm_versions(const char *name, const char **installed, const char **available) {
+	trace_begin("alpm_versions", name);
+	alpm_handle_t *handle = get_handle();
 
-	delete_handle(handle);
-	return result;
+	alpm_pkg_t *local = find_local(handle, name);
+	*installed = (local != NULL) ? alpm_pkg_get_version(local) : NULL;
+
+	*available = best_version(handle, name);
+
+	trace_end("alpm_versions");
 }
 
-int pmm_alpm_outdated(const char *name) {
-	alpm_handle_t *handle = make_handle();
-	setup_alpm(handle);
+int pmm_alpm_explicit(vector *packages) {
+	trace_begin("alpm_explicit", NULL);
+	alpm_handle_t *handle = get_handle();
+	alpm_list_t *pkgs = alpm_db_get_pkgcache(alpm_get_localdb(handle));
 
-	alpm_pkg_t *pkg = find_local(handle, name);
-	if (pkg == NULL) {
-		return 0;
+	for (alpm_list_t *i = pkgs; i != NULL; i = alpm_list_next(i)) {
+		if (alpm_pkg_get_reason(i->data) != ALPM_PKG_REASON_EXPLICIT) {
+			continue;
+		}
+
+		const char *name = alpm_pkg_get_name(i->data);
+		client_pkg package = {
+			.name = name,
+			.installed = alpm_pkg_get_version(i->data),
+			.available = best_version(handle, name)
+		};
+		vec_push(packages, &package);
+	}
+
+	trace_end("alpm_explicit");
+	return 0;
+}
+
+int pmm_alpm_known(vector *packages) {
+	trace_begin("alpm_known", NULL);
+	alpm_handle_t *handle = get_handle();
+	for (alpm_list_t *i = alpm_db_get_pkgcache(alpm_get_localdb(handle)); i != NULL; i = alpm_list_next(i)) {
+		const char *name = alpm_pkg_get_name(i->data);
+		client_pkg package = {
+			.name = name,
+			.installed = alpm_pkg_get_version(i->data),
+			.available = best_version(handle, name)
+		};
+		vec_push(packages, &package);
+	}
+
+	// Packages not installed, taken from the first repository that has them
+	for (alpm_list_t *i = alpm_get_syncdbs(handle); i != NULL; i = alpm_list_next(i)) {
+		for (alpm_list_t *j = alpm_db_get_pkgcache(i->data); j != NULL; j = alpm_list_next(j)) {
+			const char *name = alpm_pkg_get_name(j->data);
+			if (find_local(handle, name) != NULL || find_repos(handle, name) != j->data) {
+				continue;
+			}
+
+			client_pkg package = {
+				.name = name,
+				.installed = NULL,
+				.available = best_version(handle, name)
+			};
+			vec_push(packages, &package);
+		}
+	}
+
+	trace_end("alpm_known");
+	return 0;
+}
+
+int pmm_alpm_local_graph(graph_builder *builder) {
+	trace_begin("alpm_local_graph", NULL);
+	alpm_list_t *pkgs = alpm_db_get_pkgcache(alpm_get_localdb(get_handle()));
+
+	for (alpm_list_t *i = pkgs; i != NULL; i = alpm_list_next(i)) {
+		uint32_t node = graph_add_node(builder, alpm_pkg_get_name(i->data));
+
+		// Version constraints are ignored, any installed provider satisfies
+		for (alpm_list_t *j = alpm_pkg_get_provides(i->data); j != NULL; j = alpm_list_next(j)) {
+			graph_add_alias(builder, node, ((alpm_depend_t *)j->data)->name);
+		}
+		for (alpm_list_t *j = alpm_pkg_get_depends(i->data); j != NULL; j = alpm_list_next(j)) {
+			graph_add_edge(builder, node, ((alpm_depend_t *)j->data)->name);
+		}
+	}
+
+	trace_end("alpm_local_graph");
+	return 0;
+}
+
+uint64_t pmm_alpm_local_stamp(void) {
+	struct timespec local, sync;
+	db_mtimes(&local, &sync);
+
+	return (uint64_t)local.tv_sec * 1000000000 + local.tv_nsec;
+}
+
+void pmm_alpm_refresh(void) {
+	if (shared_handle == NULL) {
+		return;
+	}
+
+	struct timespec local, sync;
+	db_mtimes(&local, &sync);
+	if (local.tv_sec != loaded_local.tv_sec || local.tv_nsec != loaded_local.tv_nsec
+		|| sync.tv_sec != loaded_sync.tv_sec || sync.tv_nsec != loaded_sync.tv_nsec) {
+		release_handle();
+	}
+}
+
+int pmm_alpm_install(const char **packages, uint32_t count) {
+	alpm_handle_t *handle = get_handle();
+	if (setup_trans(handle) < 0) {
+		return -1;
+	}
+
+	// Same semantics as 'pacman -S --asexplicit'
+	trace_begin("alpm_trans.init", NULL);
+	if (alpm_trans_init(handle, ALPM_TRANS_FLAG_ALLEXPLICIT) < 0) {
+		fprintf(stderr, "failed to start transaction: %s\n", alpm_strerror(alpm_errno(handle)));
+		trace_end("alpm_trans.init");
+		return -1;
+	}
+	trace_end("alpm_trans.init");
+
+	int result = 0;
+	alpm_list_t *data = NULL;
+
+	// Queue targets (installs and upgrades alike)
+	trace_begin_num("alpm_trans.add", count);
+	for (uint32_t i = 0; i < count; i++) {
+		alpm_pkg_t *pkg = find_repos(handle, packages[i]);
+		if (pkg == NULL) {
+			fprintf(stderr, "package %s not found in repositories\n", packages[i]);
+			result = -1;
+			break;
+		}
+
+		if (alpm_add_pkg(handle, pkg) < 0) {
+			fprintf(stderr, "failed to add %s: %s\n", packages[i], alpm_strerror(alpm_errno(handle)));
+			result = -1;
+			break;
+		}
+	}
+	trace_end("alpm_trans.add");
+
+	// Resolve dependencies
+	if (result == 0) {
+		trace_begin("alpm_trans.prepare", NULL);
+		if (alpm_trans_prepare(handle, &data) < 0) {
+			fprintf(stderr, "failed to prepare transaction: %s\n", alpm_strerror(alpm_errno(handle)));
+			free_problems(alpm_errno(handle), data);
+			data = NULL;
+			result = -1;
+		}
+		trace_end("alpm_trans.prepare");
 	}
 
-	int result = (alpm_sync_get_new_version(pkg, alpm_get_syncdbs(handle)) != NULL);
+	// Download & install
+	if (result == 0) {
+		trace_begin("alpm_trans.commit", NULL);
+		if (alpm_trans_commit(handle, &data) < 0) {
+			fprintf(stderr, "failed to commit transaction: %s\n", alpm_strerror(alpm_errno(handle)));
+			free_problems(alpm_errno(handle), data);
+			result = -1;
+		}
+		trace_end("alpm_trans.commit");
+	}
 
-	delete_handle(handle);
+	alpm_trans_release(handle);
 	return result;
 }
 
 /** Private functions */
 
+/**
+ * @brief Get process-wide ALPM handle, initializing on first use.
+ *
+ * @return ALPM handle with sync databases registered.
+ */
+alpm_handle_t *get_handle(void) {
+	if (shared_handle != NULL) {
+		return shared_handle;
+	}
+
+	trace_begin("alpm_init", NULL);
+	db_mtimes(&loaded_local, &loaded_sync);
+
+	alpm_errno_t err;
+	shared_handle = alpm_initialize(ROOT_DIR, pmm_alpm_db_path(), &err);
+	if (shared_handle == NULL) {
+		fprintf(stderr, "failed to initialize libalpm: %s\n", alpm_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	setup_alpm(shared_handle);
+	if (!release_registered) {
+		atexit(&release_handle);
+		release_registered = 1;
+	}
+	trace_end("alpm_init");
+
+	return shared_handle;
+}
+
+/**
+ * @brief Release process-wide ALPM handle.
+ */
+void release_handle(void) {
+	if (shared_handle != NULL) {
+		alpm_release(shared_handle);
+		shared_handle = NULL;
+		trans_ready = 0;
+	}
+}
+
+/**
+ * @brief Get modification times of the local and sync database directories.
+ *
+ * @param[out] local - Local database mtime (zero if missing).
+ * @param[out] sync - Sync database mtime (zero if missing).
+ */
+void db_mtimes(struct timespec *local, struct timespec *sync) {
+	struct stat info;
+	struct timespec zero = { 0 };
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/%s", pmm_alpm_db_path(), LOCAL_DB_DIR);
+	*local = (stat(path, &info) == 0) ? info.st_mtim : zero;
+
+	snprintf(path, sizeof(path), "%s/%s", pmm_alpm_db_path(), SYNC_DB_DIR);
+	*sync = (stat(path, &info) == 0) ? info.st_mtim : zero;
+}
+
 /**
  * @brief Find package in local repository.
  *
- * @param[in] handle - ALPM handle from make_handle.
+ * @param[in] handle - ALPM handle from get_handle.
  * @param[in] name - Package name.
  * @return ALPM package or NULL if not found.
  */
@@ -91,7 +317,7 @@ alpm_pkg_t *find_local(alpm_handle_t *handle, const char *name) {
 /**
  * @brief Find package in sync repositories.
  *
- * @param[in] handle - ALPM handle from make_handle.
+ * @param[in] handle - ALPM handle from get_handle.
  * @param[in] name - Package name.
  * @return ALPM package or NULL if not found.
  */
@@ -107,8 +333,159 @@ alpm_pkg_t *find_repos(alpm_handle_t *handle, const char *name) {
 	return NULL;
 }
 
+/**
+ * @brief Get newest version of a package across sync repositories.
+ *
+ * @param[in] handle - ALPM handle from get_handle.
+ * @param[in] name - Package name.
+ * @return Version or NULL if not found.
+ */
+const char *best_version(alpm_handle_t *handle, const char *name) {
+	const char *best = NULL;
+	for (alpm_list_t *i = alpm_get_syncdbs(handle); i != NULL; i = alpm_list_next(i)) {
+		alpm_pkg_t *pkg = alpm_db_get_pkg(i->data, name);
+		if (pkg == NULL) {
+			continue;
+		}
+
+		const char *version = alpm_pkg_get_version(pkg);
+		if (best == NULL || alpm_pkg_vercmp(version, best) > 0) {
+			best = version;
+		}
+	}
+
+	return best;
+}
+
+/**
+ * @brief Register sync databases.
+ *
+ * @param[in] handle - ALPM handle.
+ */
 void setup_alpm(alpm_handle_t *handle) {
-	alpm_register_syncdb(handle, "core", 0);
-	alpm_register_syncdb(handle, "extra", 0);
-	alpm_register_syncdb(handle, "multilib", 0);
+	for (uint32_t i = 0; i < sizeof(sync_repos) / sizeof(char *); i++) {
+		alpm_register_syncdb(handle, sync_repos[i], 0);
+	}
+}
+
+/**
+ * @brief Configure handle options needed for transactions, once per handle.
+ *
+ * @param[in] handle - ALPM handle from get_handle.
+ * @return Success code.
+ */
+int setup_trans(alpm_handle_t *handle) {
+	if (trans_ready) {
+		return 0;
+	}
+
+	struct utsname info;
+	if (uname(&info) < 0) {
+		fprintf(stderr, "failed to get system architecture\n");
+		return -1;
+	}
+
+	alpm_option_add_cachedir(handle, CACHE_DIR);
+	alpm_option_set_gpgdir(handle, GPG_DIR);
+	alpm_option_set_logfile(handle, LOG_FILE);
+	alpm_option_add_architecture(handle, info.machine);
+
+	for (alpm_list_t *i = alpm_get_syncdbs(handle); i != NULL; i = alpm_list_next(i)) {
+		if (add_servers(i->data, info.machine) < 0) {
+			return -1;
+		}
+	}
+
+	trans_ready = 1;
+	return 0;
+}
+
+/**
+ * @brief Add mirrors from pacman's mirrorlist to a sync database.
+ *
+ * @param[in] db - Sync database.
+ * @param[in] arch - System architecture.
+ * @return Success code.
+ */
+int add_servers(alpm_db_t *db, const char *arch) {
+	FILE *mirrors = fopen(MIRRORLIST, "r");
+	if (mirrors == NULL) {
+		fprintf(stderr, "failed to open %s\n", MIRRORLIST);
+		return -1;
+	}
+
+	const char *repo = alpm_db_get_name(db);
+	char line[1024];
+	while (fgets(line, sizeof(line), mirrors) != NULL) {
+		// Only active 'Server = url' lines
+		char *url = line + strspn(line, " \t");
+		if (strncmp(url, SERVER_PREFIX, strlen(SERVER_PREFIX)) != 0) {
+			continue;
+		}
+		url = strchr(url, '=');
+		if (url == NULL) {
+			continue;
+		}
+		url += 1 + strspn(url + 1, " \t");
+		url[strcspn(url, " \t\r\n")] = '\0';
+
+		// Expand $repo and $arch
+		char server[2048];
+		uint32_t len = 0;
+		while (*url != '\0' && len < sizeof(server) - 1) {
+			const char *subst = NULL;
+			if (strncmp(url, "$repo", 5) == 0) {
+				subst = repo;
+				url += 5;
+			} else if (strncmp(url, "$arch", 5) == 0) {
+				subst = arch;
+				url += 5;
+			}
+
+			if (subst != NULL) {
+				len += snprintf(server + len, sizeof(server) - len, "%s", subst);
+				if (len >= sizeof(server)) {
+					len = sizeof(server) - 1;
+				}
+			} else {
+				server[len++] = *url++;
+			}
+		}
+		server[len] = '\0';
+
+		alpm_db_add_server(db, server);
+	}
+
+	fclose(mirrors);
+	return 0;
+}
+
+/**
+ * @brief Free problem list of a failed transaction step, items included.
+ *
+ * @param[in] err - Error of the failed step (selects item type).
+ * @param[in] data - Problem list.
+ */
+void free_problems(alpm_errno_t err, alpm_list_t *data) {
+	switch (err) {
+		case ALPM_ERR_UNSATISFIED_DEPS:
+			alpm_list_free_inner(data, (alpm_list_fn_free)&alpm_depmissing_free);
+			break;
+		case ALPM_ERR_CONFLICTING_DEPS:
+			alpm_list_free_inner(data, (alpm_list_fn_free)&alpm_conflict_free);
+			break;
+		case ALPM_ERR_FILE_CONFLICTS:
+			alpm_list_free_inner(data, (alpm_list_fn_free)&alpm_fileconflict_free);
+			break;
+		case ALPM_ERR_PKG_INVALID:
+		case ALPM_ERR_PKG_INVALID_CHECKSUM:
+		case ALPM_ERR_PKG_INVALID_SIG:
+		case ALPM_ERR_PKG_INVALID_ARCH:
+			// Package names or file paths
+			alpm_list_free_inner(data, &free);
+			break;
+		default:
+			break;
+	}
+	alpm_list_free(data);
 }
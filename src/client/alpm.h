@@ -1,5 +1,11 @@
 #pragma once
 
+#include <stdint.h>
+
+#include "client.h"
+#include "../util/graph.h"
+#include "../util/vector.h"
+
 /**
  * @brief Check if package exists within pacman's repositories.
  *
@@ -17,9 +23,67 @@ int pmm_alpm_exists(const char *name);
 int pmm_alpm_installed(const char *name);
 
 /**
- * @brief Check if the local package is out of date.
+ * @brief Get installed version and the newest version in the sync repositories.
+ * Strings are owned by libalpm and stay valid until the handle is released.
  *
  * @param[in] name - Package name.
- * @return Boolean result.
+ * @param[out] installed - Installed version or NULL if not installed.
+ * @param[out] available - Repository version or NULL if not in any repository.
+ */
+void pmm_alpm_versions(const char *name, const char **installed, const char **available);
+
+/**
+ * @brief List explicitly installed packages.
+ *
+ * @param[out] packages - Vector of client_pkg to append to.
+ * @return Success code.
+ */
+int pmm_alpm_explicit(vector *packages);
+
+/**
+ * @brief List every package that is installed or in a sync repository, with
+ * the same versions as pmm_alpm_versions. Walks the package caches once
+ * instead of looking up each name.
+ *
+ * @param[out] packages - Vector of client_pkg to append to.
+ * @return Success code.
+ */
+int pmm_alpm_known(vector *packages);
+
+/**
+ * @brief Add every installed package as a node, with edges to its
+ * dependencies and provided names as aliases.
+ *
+ * @param[in] builder - Graph builder.
+ * @return Success code.
+ */
+int pmm_alpm_local_graph(graph_builder *builder);
+
+/**
+ * @brief Get signature of the local database (its modification time).
+ *
+ * @return Signature.
+ */
+uint64_t pmm_alpm_local_stamp(void);
+
+/**
+ * @brief Get pacman database directory (PMM_DBPATH or pacman's default).
+ *
+ * @return Directory path.
+ */
+const char *pmm_alpm_db_path(void);
+
+/**
+ * @brief Release the cached handle if pacman's databases changed since it was loaded.
+ */
+void pmm_alpm_refresh(void);
+
+/**
+ * @brief Install or upgrade packages in a single libalpm transaction.
+ * Requires root privileges.
+ *
+ * @param[in] packages - Package names.
+ * @param[in] count - Number of packages.
+ * @return Success code.
  */
-int pmm_alpm_outdated(const char *name);
+int pmm_alpm_install(const char **packages, uint32_t count);
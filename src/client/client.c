@@ -14,8 +14,14 @@ static const client *selected;
 static const client pacman = {
 	.exists = &pmm_alpm_exists,
 	.installed = &pmm_alpm_installed,
-	.outdated = &pmm_alpm_outdated,
-	.install = &pacman_install
+	.versions = &pmm_alpm_versions,
+	.explicit_packages = &pmm_alpm_explicit,
+	.known_packages = &pmm_alpm_known,
+	.local_graph = &pmm_alpm_local_graph,
+	.local_stamp = &pmm_alpm_local_stamp,
+	.install = &pacman_install,
+	.refresh = &pmm_alpm_refresh,
+	.db_path = &pmm_alpm_db_path
 };
 
 int client_set(const char *name) {
@@ -2,14 +2,43 @@
 
 #include <stdint.h>
 
+#include "../util/graph.h"
+#include "../util/vector.h"
+
+// Overrides the package database directory
+#define DB_PATH_ENV "PMM_DBPATH"
+
+// Package versions, strings are valid until refresh
+typedef struct {
+	const char *name;
+	// Installed version (NULL if not installed)
+	const char *installed;
+	// Newest repository version (NULL if none)
+	const char *available;
+} client_pkg;
+
 typedef struct {
 	// Queries
 	int (*exists)(const char *name);
 	int (*installed)(const char *name);
-	int (*outdated)(const char *name);
+	// Installed and best repository version (NULL if none), valid until refresh
+	void (*versions)(const char *name, const char **installed, const char **available);
+	// Append explicitly installed packages (client_pkg)
+	int (*explicit_packages)(vector *packages);
+	// Append every installed or repository package once (client_pkg)
+	int (*known_packages)(vector *packages);
+	// Add installed packages and their dependencies to a graph
+	int (*local_graph)(graph_builder *builder);
+	// Value that changes whenever installed packages change
+	uint64_t (*local_stamp)(void);
 
 	// Actions
 	int (*install)(const char **packages, uint32_t count);
+
+	// Drop cached state if the system changed (long-running use)
+	void (*refresh)(void);
+	// Package database directory
+	const char *(*db_path)(void);
 } client;
 
 int client_set(const char *name);
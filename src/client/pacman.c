@@ -1,9 +1,17 @@
 #include "pacman.h"
 
+#include <unistd.h>
+
+#include "alpm.h"
 #include "std_syntax.h"
 
 #define PACMAN "pacman"
 
-int pacman_install(char **packages, uint32_t count) {
+int pacman_install(const char **packages, uint32_t count) {
+	// Transact in-process when possible, otherwise escalate through pacman
+	if (geteuid() == 0) {
+		return pmm_alpm_install(packages, count);
+	}
+
 	return std_install(PACMAN, packages, count);
 }
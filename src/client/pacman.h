@@ -2,4 +2,4 @@
 
 #include <stdint.h>
 
-int pacman_install(char **packages, uint32_t count);
+int pacman_install(const char **packages, uint32_t count);
@@ -1,42 +1,51 @@
 #include "std_syntax.h"
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/wait.h>
 
+#include "../util/trace.h"
+
 #define ROOT_PROG "doas"
 #define SYNC "-S"
 #define EXPLICIT "--asexplicit"
 
-int std_install(char *program, char **packages, uint32_t count) {
+int std_install(char *program, const char **packages, uint32_t count) {
+	trace_begin_num("std_install.fork", count);
+	trace_flush();
 	pid_t pid = fork();
 
 	if (pid < 0) {
+		trace_end("std_install.fork");
 		return -1;
 	}
 
 	// Child
 	if (pid == 0) {
-		char *argv[count + 5];
+		const char *argv[count + 5];
 
 		argv[0] = ROOT_PROG;
 		argv[1] = program;
 		argv[2] = SYNC;
 		argv[3] = EXPLICIT;
 
-		memcpy(argv + 3, packages, count * sizeof(char *));
+		memcpy(argv + 4, packages, count * sizeof(char *));
 
-		argv[count + 3] = NULL;
+		argv[count + 4] = NULL;
 
-		execvp(argv[0], argv);
+		execvp(argv[0], (char *const *)argv);
 
 		// Reaches on exec error
-		return -1;
+		_exit(EXIT_FAILURE);
 	}
 
 	// Parent
+	trace_end("std_install.fork");
+	trace_begin("std_install.wait", program);
 	int result;
 	waitpid(pid, &result, 0);
+	trace_end("std_install.wait");
 	return WEXITSTATUS(result);
 }
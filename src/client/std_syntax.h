@@ -2,6 +2,6 @@
 
 #include <stdint.h>
 
-int std_install(char *program, char **packages, uint32_t count);
+int std_install(char *program, const char **packages, uint32_t count);
 
-int std_remove(char *program, char **packages, uint32_t count);
+int std_remove(char *program, const char **packages, uint32_t count);
@@ -2,11 +2,28 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "util/attr.h"
+#include "util/output.h"
 #include "tables/pkg.h"
+#include "tables/deps.h"
+#include "daemon/daemon.h"
+#include "daemon/remote.h"
+#include "daemon/watch.h"
+#include "client/client.h"
 
-#define PKG_TABLE "pkg.pmm"
+#define FORMAT_OPT "--format="
+#define CACHED_OPT "--cached"
+#define FILL_OPT "--fill="
+#define LEAF_OPT "--leaf="
+#define EXT_OPT "--ext="
+#define PAGE_SIZE_OPT "--page-size="
+#define DEFAULT_FILL 90
+
+int parse_list_opts(int argc, char **argv, out_format *format, int *cached);
+int check_args(command_op op, int argc, char **argv);
+int run_table_command(command_op op, int argc, char **argv);
 
 int usage(unused int argc, unused char **argv) {
 	printf("usage: pmm [command] <args>\n");
@@ -14,8 +31,17 @@ int usage(unused int argc, unused char **argv) {
 	printf("commands:\n");
 	printf("\thelp, --help, -h\t\tPrint usage information\n");
 	printf("\tversion, --version, -v\t\tPrint pmm version\n");
-	printf("\tadd\t\t\t\tAdd package\n");
+	printf("\tadd NAME...\t\t\tAdd packages\n");
 	printf("\tremove, rm\t\t\tRemove package\n");
+	printf("\tlist [--format=FMT] [--cached]\tList packages (text, tsv, json, ndjson)\n");
+	printf("\tinfo\t\t\t\tShow package\n");
+	printf("\tsync\t\t\t\tInstall and upgrade packages\n");
+	printf("\torphans\t\t\t\tList installed packages not needed by the manifest\n");
+	printf("\tdiff\t\t\t\tCompare manifest with explicitly installed packages\n");
+	printf("\tmerge OUT IN...\t\t\tMerge tables, counting hosts per package\n");
+	printf("\tdaemon\t\t\t\tServe commands over %s\n", DAEMON_SOCKET_ENV);
+	printf("\twatch\t\t\t\tKeep statuses updated as packages change\n");
+	printf("\tvacuum [--fill=PERCENT] [--leaf=fixed|slotted] [--page-size=BYTES]\n\t\t[--ext=plain|compressed]\n\t\t\t\t\tCompact table in key order\n");
 	printf("\n");
 	printf("see 'pmm [command] --help' for more information\n");
 
@@ -29,24 +55,14 @@ int version(unused int argc, unused char **argv) {
 }
 
 int add(int argc, char **argv) {
-	if (argc < 1) {
-		printf("add: no options given\n");
-		printf("see usage with 'pmm add --help'\n");
-		return EXIT_FAILURE;
-	}
-
-	pkg_table *pkgs = pkg_open(PKG_TABLE);
-	int result = pkg_add(pkgs, argv[0]);
-	if (result < 0) {
-		fprintf(stderr, "failed to add package\n");
+	if (check_args(OP_ADD, argc, argv) < 0) {
 		return EXIT_FAILURE;
 	}
 
-	pkg_save(pkgs);
-	return EXIT_SUCCESS;
+	return run_table_command(OP_ADD, argc, argv);
 }
 
-int rm(int argc, char **argv) {
+int rm(int argc, unused char **argv) {
 	if (argc < 1) {
 		printf("remove: no options given\n");
 		printf("see usage with 'pmm remove --help'\n");
@@ -57,30 +73,302 @@ int rm(int argc, char **argv) {
 }
 
 int list(int argc, char **argv) {
-	if (argc != 0) {
-		printf("list: not implemented\n");
-		printf("provide no arguments\n");
+	if (check_args(OP_LIST, argc, argv) < 0) {
 		return EXIT_FAILURE;
 	}
 
-	pkg_table *pkgs = pkg_open(PKG_TABLE);
-	pkg_check(pkgs);
-	pkg_print_all(pkgs);
-	pkg_save(pkgs);
+	return run_table_command(OP_LIST, argc, argv);
+}
 
-	return EXIT_SUCCESS;
+int info(int argc, char **argv) {
+	if (check_args(OP_INFO, argc, argv) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	return run_table_command(OP_INFO, argc, argv);
+}
+
+int synchronize(int argc, char **argv) {
+	if (check_args(OP_SYNC, argc, argv) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	return run_table_command(OP_SYNC, argc, argv);
 }
 
-int sync(int argc, char **argv) {
+int orphans(int argc, char **argv) {
+	if (check_args(OP_ORPHANS, argc, argv) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	return run_table_command(OP_ORPHANS, argc, argv);
+}
+
+int diff(int argc, char **argv) {
+	if (check_args(OP_DIFF, argc, argv) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	return run_table_command(OP_DIFF, argc, argv);
+}
+
+int merge(int argc, char **argv) {
+	if (argc < 2) {
+		printf("merge: expected output and input tables\n");
+		printf("usage: pmm merge out.pmm a.pmm b.pmm ...\n");
+		return EXIT_FAILURE;
+	}
+
+	int result = pkg_merge(argv[0], (const char **)argv + 1, argc - 1);
+	return (result == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int serve(int argc, unused char **argv) {
+	if (argc != 0) {
+		printf("daemon: provide no arguments\n");
+		return EXIT_FAILURE;
+	}
+
+	int result = daemon_serve(PKG_TABLE);
+	return (result == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int watch(int argc, unused char **argv) {
 	if (argc != 0) {
-		printf("sync: not implemented\n");
-		printf("provide no arguments\n");
+		printf("watch: provide no arguments\n");
+		printf("database directory can be set with %s\n", DB_PATH_ENV);
 		return EXIT_FAILURE;
 	}
 
-	pkg_table *pkgs = pkg_open(PKG_TABLE);
-	pkg_sync(pkgs);
+	int result = watch_run(PKG_TABLE, client_get()->db_path());
+	return (result == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int vacuum(int argc, char **argv) {
+	uint32_t fill = DEFAULT_FILL;
+	// Keep current leaf format unless asked otherwise
+	int leaf = -1;
+	uint32_t page_size = 0;
+	int compress = -1;
+	for (int i = 0; i < argc; i++) {
+		if (strncmp(argv[i], PAGE_SIZE_OPT, strlen(PAGE_SIZE_OPT)) == 0) {
+			page_size = strtoul(argv[i] + strlen(PAGE_SIZE_OPT), NULL, 10);
+			if (!valid_page_size(page_size)) {
+				printf("vacuum: page size must be a power of two between %d and %d\n",
+					PAGE_SIZE_MIN, PAGE_SIZE_MAX);
+				return EXIT_FAILURE;
+			}
+			continue;
+		}
+
+		if (strncmp(argv[i], EXT_OPT, strlen(EXT_OPT)) == 0) {
+			const char *value = argv[i] + strlen(EXT_OPT);
+			if (strcmp(value, "plain") == 0) {
+				compress = 0;
+			} else if (strcmp(value, "compressed") == 0) {
+				compress = 1;
+			} else {
+				printf("vacuum: unknown ext storage '%s'\n", value);
+				return EXIT_FAILURE;
+			}
+			continue;
+		}
+
+		if (strncmp(argv[i], LEAF_OPT, strlen(LEAF_OPT)) == 0) {
+			const char *value = argv[i] + strlen(LEAF_OPT);
+			if (strcmp(value, "fixed") == 0) {
+				leaf = PKG_FIXED;
+			} else if (strcmp(value, "slotted") == 0) {
+				leaf = PKG_SLOTTED;
+			} else {
+				printf("vacuum: unknown leaf format '%s'\n", value);
+				return EXIT_FAILURE;
+			}
+			continue;
+		}
+
+		if (strncmp(argv[i], FILL_OPT, strlen(FILL_OPT)) != 0) {
+			printf("vacuum: unknown option '%s'\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+
+		fill = strtoul(argv[i] + strlen(FILL_OPT), NULL, 10);
+		if (fill == 0 || fill > 100) {
+			printf("vacuum: fill must be between 1 and 100\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	// The daemon would keep serving the replaced file
+	if (remote_available()) {
+		fprintf(stderr, "daemon is running, stop it before vacuuming\n");
+		return EXIT_FAILURE;
+	}
+
+	pkg_table *pkgs = pkg_open_locked(PKG_TABLE);
+	if (pkgs == NULL) {
+		return EXIT_FAILURE;
+	}
+
+	pkg_format format = (leaf < 0) ? pkg_get_format(pkgs) : (pkg_format)leaf;
+	int result = pkg_vacuum(pkgs, PKG_TABLE, fill, format, page_size, compress);
+	table_close(pkgs);
+
+	return (result == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int command_run(pkg_table *pkgs, command_op op, int argc, char **argv) {
+	int result = -1;
+	out_format format;
+	int cached;
+	graph *deps;
+
+	// Requests from daemon clients skip the entry points
+	if (check_args(op, argc, argv) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	switch (op) {
+		case OP_LIST:
+			parse_list_opts(argc, argv, &format, &cached);
+			if (!cached) {
+				pkg_check(pkgs);
+			}
+			result = pkg_print_all(pkgs, format);
+			break;
+		case OP_INFO:
+			result = pkg_print_info(pkgs, argv[0]);
+			break;
+		case OP_ADD:
+			result = pkg_add_many(pkgs, argv, argc);
+			if (result < 0) {
+				fprintf(stderr, "failed to add package\n");
+			}
+			break;
+		case OP_SYNC:
+			result = pkg_sync(pkgs);
+			break;
+		case OP_ORPHANS:
+			deps = deps_graph(DEPS_TABLE);
+			result = pkg_orphans(pkgs, deps);
+			graph_free(deps);
+			break;
+		case OP_DIFF:
+			result = pkg_diff(pkgs);
+			break;
+	}
+
+	return (result == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** Private functions */
+
+/**
+ * @brief Parse list options.
+ *
+ * @param[in] argc - Argument count.
+ * @param[in] argv - Arguments.
+ * @param[out] format - Selected output format.
+ * @param[out] cached - Use stored statuses without rechecking.
+ * @return Success code.
+ */
+int parse_list_opts(int argc, char **argv, out_format *format, int *cached) {
+	*format = OUT_TEXT;
+	*cached = 0;
+	for (int i = 0; i < argc; i++) {
+		if (strcmp(argv[i], CACHED_OPT) == 0) {
+			*cached = 1;
+		} else if (strncmp(argv[i], FORMAT_OPT, strlen(FORMAT_OPT)) != 0
+			|| out_parse_format(argv[i] + strlen(FORMAT_OPT), format) < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Validate arguments of a table command, printing usage on error.
+ *
+ * @param[in] op - Command to run.
+ * @param[in] argc - Command argument count.
+ * @param[in] argv - Command arguments.
+ * @return Success code.
+ */
+int check_args(command_op op, int argc, char **argv) {
+	out_format format;
+	int cached;
+
+	switch (op) {
+		case OP_LIST:
+			if (parse_list_opts(argc, argv, &format, &cached) < 0) {
+				printf("list: unknown option\n");
+				printf("options: --format=text|tsv|json|ndjson, --cached\n");
+				return -1;
+			}
+			break;
+		case OP_INFO:
+			if (argc != 1) {
+				printf("info: expected one package name\n");
+				printf("see usage with 'pmm --help'\n");
+				return -1;
+			}
+			break;
+		case OP_ADD:
+			if (argc < 1) {
+				printf("add: no options given\n");
+				printf("see usage with 'pmm add --help'\n");
+				return -1;
+			}
+			break;
+		case OP_SYNC:
+			if (argc != 0) {
+				printf("sync: not implemented\n");
+				printf("provide no arguments\n");
+				return -1;
+			}
+			break;
+		case OP_ORPHANS:
+			if (argc != 0) {
+				printf("orphans: provide no arguments\n");
+				return -1;
+			}
+			break;
+		case OP_DIFF:
+			if (argc != 0) {
+				printf("diff: provide no arguments\n");
+				return -1;
+			}
+			break;
+		default:
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Run table command through the daemon, or directly if none is running.
+ *
+ * @param[in] op - Command to run.
+ * @param[in] argc - Command argument count.
+ * @param[in] argv - Command arguments.
+ * @return Exit code.
+ */
+int run_table_command(command_op op, int argc, char **argv) {
+	int result;
+	if (remote_run(op, argc, argv, &result) == 0) {
+		return result;
+	}
+
+	// Readers work on a snapshot and never wait for writers
+	pkg_table *pkgs = command_writes(op) ? pkg_open_locked(PKG_TABLE) : pkg_open(PKG_TABLE);
+	if (pkgs == NULL) {
+		return EXIT_FAILURE;
+	}
+
+	result = command_run(pkgs, op, argc, argv);
 	pkg_save(pkgs);
 
-	return EXIT_SUCCESS;
+	return result;
 }
@@ -1,8 +1,44 @@
 #pragma once
 
+#include "tables/pkg.h"
+
+#define PKG_TABLE "pkg.pmm"
+#define DEPS_TABLE "deps.pmm"
+
+// Commands operating on the package table
+typedef enum {
+	OP_LIST,
+	OP_INFO,
+	OP_ADD,
+	OP_SYNC,
+	OP_ORPHANS,
+	OP_DIFF
+} command_op;
+
+// Check if a command changes the table (run with the writer lock held)
+#define command_writes(op) ((op) == OP_ADD || (op) == OP_SYNC)
+
 int usage(int argc, char **argv);
 int version(int argc, char **argv);
 int add(int argc, char **argv);
 int rm(int argc, char **argv);
 int list(int argc, char **argv);
-int sync(int argc, char **argv);
+int info(int argc, char **argv);
+int synchronize(int argc, char **argv);
+int serve(int argc, char **argv);
+int watch(int argc, char **argv);
+int vacuum(int argc, char **argv);
+int orphans(int argc, char **argv);
+int diff(int argc, char **argv);
+int merge(int argc, char **argv);
+
+/**
+ * @brief Run a table command on an open table, validating its arguments.
+ *
+ * @param[in] pkgs - Package table.
+ * @param[in] op - Command to run.
+ * @param[in] argc - Command argument count.
+ * @param[in] argv - Command arguments.
+ * @return Exit code.
+ */
+int command_run(pkg_table *pkgs, command_op op, int argc, char **argv);
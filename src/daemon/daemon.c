@@ -0,0 +1,338 @@
+#include "daemon.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "protocol.h"
+#include "../commands.h"
+#include "../client/client.h"
+#include "../db/table.h"
+#include "../util/trace.h"
+
+#define BACKLOG 16
+
+// Table served to clients, reopened once other processes save it
+typedef struct {
+	const char *file;
+	pkg_table *pkgs;
+} served_table;
+
+static volatile sig_atomic_t running;
+
+int open_socket(const char *path);
+void handle_request(served_table *served, int conn);
+int recv_request(int conn, daemon_request *req, int *fds);
+void close_rights(struct cmsghdr *cmsg);
+int32_t run_with_fds(served_table *served, daemon_request *req, char **argv, int *fds);
+int prepare_table(served_table *served, int lock);
+void stop(int signal);
+
+int daemon_serve(const char *file) {
+	served_table served = { .file = file, .pkgs = NULL };
+	if (prepare_table(&served, 0) < 0) {
+		return -1;
+	}
+
+	const char *path = daemon_socket_path();
+	int sock = open_socket(path);
+	if (sock < 0) {
+		table_close(served.pkgs);
+		return -1;
+	}
+
+	// Interrupt accept on termination
+	struct sigaction action = { 0 };
+	action.sa_handler = &stop;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	fprintf(stderr, "pmm: serving on %s\n", path);
+
+	running = 1;
+	int result = 0;
+	while (running) {
+		int conn = accept(sock, NULL, NULL);
+		if (conn < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			fprintf(stderr, "failed to accept connection\n");
+			result = -1;
+			break;
+		}
+
+		handle_request(&served, conn);
+		close(conn);
+	}
+
+	close(sock);
+	unlink(path);
+	pkg_save(served.pkgs);
+	return result;
+}
+
+/** Private functions */
+
+/**
+ * @brief Create listening socket, replacing a stale one.
+ *
+ * @param[in] path - Socket path.
+ * @return Socket or -1 on error.
+ */
+int open_socket(const char *path) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "socket path too long\n");
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		fprintf(stderr, "failed to create socket\n");
+		return -1;
+	}
+
+	// Refuse to steal the socket of a live daemon
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+		fprintf(stderr, "daemon already running on %s\n", path);
+		close(sock);
+		return -1;
+	}
+	unlink(path);
+
+	// Only the owner may connect, clients get the daemon's access to the table
+	mode_t mask = umask(0077);
+	int bound = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+	umask(mask);
+	if (bound < 0 || chmod(path, S_IRUSR | S_IWUSR) < 0 || listen(sock, BACKLOG) < 0) {
+		fprintf(stderr, "failed to listen on %s\n", path);
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+/**
+ * @brief Read, run and answer one request.
+ *
+ * @param[in] served - Served table.
+ * @param[in] conn - Client connection.
+ */
+void handle_request(served_table *served, int conn) {
+	if (!daemon_same_user(conn)) {
+		fprintf(stderr, "rejected connection from another user\n");
+		return;
+	}
+
+	daemon_request req;
+	int fds[DAEMON_FD_COUNT];
+	if (recv_request(conn, &req, fds) < 0) {
+		return;
+	}
+	trace_begin_num("daemon_request", req.op);
+
+	// Receive and split arguments
+	char args[DAEMON_MAX_ARGS_LEN + 1];
+	char *argv[DAEMON_MAX_ARGC + 1];
+	daemon_response res = { .result = EXIT_FAILURE };
+	int valid = (recv_all(conn, args, req.args_len) == 0);
+
+	args[req.args_len] = '\0';
+	uint32_t count = 0;
+	uint32_t pos = 0;
+	// argc is at most DAEMON_MAX_ARGC (recv_request)
+	for (; valid && pos < req.args_len && count < req.argc; count++) {
+		argv[count] = args + pos;
+		pos += strlen(args + pos) + 1;
+	}
+	argv[count] = NULL;
+
+	// Exactly argc arguments, nothing after them
+	if (valid && count == req.argc && pos == req.args_len) {
+		res.result = run_with_fds(served, &req, argv, fds);
+	}
+
+	for (uint32_t i = 0; i < DAEMON_FD_COUNT; i++) {
+		close(fds[i]);
+	}
+
+	send_all(conn, &res, sizeof(res));
+	trace_end("daemon_request");
+}
+
+/**
+ * @brief Receive request header along with the client's stdio descriptors.
+ *
+ * @param[in] conn - Client connection.
+ * @param[out] req - Request header.
+ * @param[out] fds - Client stdio descriptors.
+ * @return Success code.
+ */
+int recv_request(int conn, daemon_request *req, int *fds) {
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int) * DAEMON_FD_COUNT)];
+	} control;
+	struct iovec iov = { .iov_base = req, .iov_len = sizeof(*req) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf)
+	};
+
+	ssize_t bytes = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+	if (bytes == 0) {
+		// Connection probe, no request
+		return -1;
+	}
+
+	// Take the first set of stdio descriptors, close anything else received
+	int found = 0;
+	struct cmsghdr *cmsg;
+	for (cmsg = CMSG_FIRSTHDR(&msg); bytes > 0 && cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (!found && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS
+				&& cmsg->cmsg_len == CMSG_LEN(sizeof(int) * DAEMON_FD_COUNT)) {
+			memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * DAEMON_FD_COUNT);
+			found = 1;
+		} else {
+			close_rights(cmsg);
+		}
+	}
+
+	// Truncated control data may have dropped descriptors
+	if (bytes < 0 || !found || (msg.msg_flags & MSG_CTRUNC)) {
+		fprintf(stderr, "malformed request\n");
+		for (uint32_t i = 0; found && i < DAEMON_FD_COUNT; i++) {
+			close(fds[i]);
+		}
+		return -1;
+	}
+
+	// Rest of the header, if split
+	if ((uint64_t)bytes < sizeof(*req)
+		&& recv_all(conn, (uint8_t *)req + bytes, sizeof(*req) - bytes) < 0) {
+		bytes = -1;
+	}
+
+	if (bytes < 0 || req->magic != DAEMON_MAGIC
+		|| req->op > OP_DIFF || req->args_len > DAEMON_MAX_ARGS_LEN || req->argc > DAEMON_MAX_ARGC) {
+		fprintf(stderr, "malformed request\n");
+		for (uint32_t i = 0; i < DAEMON_FD_COUNT; i++) {
+			close(fds[i]);
+		}
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Close descriptors passed in a control message, if it has any.
+ *
+ * @param[in] cmsg - Control message.
+ */
+void close_rights(struct cmsghdr *cmsg) {
+	if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len < CMSG_LEN(0)) {
+		return;
+	}
+
+	uint32_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	for (uint32_t i = 0; i < count; i++) {
+		int fd;
+		memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+		close(fd);
+	}
+}
+
+/**
+ * @brief Run command with stdio redirected to the client's descriptors.
+ * Commands that change the table hold the writer lock while they run.
+ *
+ * @param[in] served - Served table.
+ * @param[in] req - Request header.
+ * @param[in] argv - Command arguments.
+ * @param[in] fds - Client stdio descriptors.
+ * @return Exit code.
+ */
+int32_t run_with_fds(served_table *served, daemon_request *req, char **argv, int *fds) {
+	int saved[DAEMON_FD_COUNT];
+	fflush(stdout);
+	fflush(stderr);
+	for (int i = 0; i < DAEMON_FD_COUNT; i++) {
+		saved[i] = dup(i);
+		dup2(fds[i], i);
+	}
+
+	// Backend may be stale since last request
+	client_get()->refresh();
+
+	int lock = command_writes(req->op);
+	int32_t result = EXIT_FAILURE;
+	if (prepare_table(served, lock) == 0) {
+		result = command_run(served->pkgs, req->op, req->argc, argv);
+		if (table_flush(served->pkgs) < 0) {
+			result = EXIT_FAILURE;
+		}
+		table_unlock(served->pkgs);
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	for (int i = 0; i < DAEMON_FD_COUNT; i++) {
+		dup2(saved[i], i);
+		close(saved[i]);
+	}
+
+	return result;
+}
+
+/**
+ * @brief Bring the served table up to date for a request, reopening it if
+ * another process saved or replaced the file since it was opened.
+ *
+ * @param[in] served - Served table.
+ * @param[in] lock - Take the writer lock, kept until table_unlock.
+ * @return Success code.
+ */
+int prepare_table(served_table *served, int lock) {
+	while (served->pkgs == NULL || table_stale(served->pkgs) || (lock && table_lock(served->pkgs) != 0)) {
+		// Changes of failed requests are dropped with the old version
+		table_close(served->pkgs);
+
+		// Locked opens also upgrade older files, which readers cannot save
+		served->pkgs = pkg_open_locked(served->file);
+		if (served->pkgs == NULL) {
+			return -1;
+		}
+		if (lock) {
+			return 0;
+		}
+		table_unlock(served->pkgs);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Signal handler: stop serving.
+ *
+ * @param[in] signal - Signal number.
+ */
+void stop(int signal) {
+	(void)signal;
+	running = 0;
+}
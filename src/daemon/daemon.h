@@ -0,0 +1,14 @@
+#pragma once
+
+#include "protocol.h"
+
+/**
+ * @brief Serve table commands over the daemon socket until interrupted.
+ * The table stays open (and cached) between requests and is reopened once
+ * another process saves it. Commands that change the table take the writer
+ * lock only while they run.
+ *
+ * @param[in] file - Package table file.
+ * @return Success code.
+ */
+int daemon_serve(const char *file);
@@ -0,0 +1,101 @@
+#define _GNU_SOURCE
+#include "protocol.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+static char socket_path[PATH_MAX];
+
+uint64_t path_hash(const char *path);
+
+const char *daemon_socket_path(void) {
+	const char *path = getenv(DAEMON_SOCKET_ENV);
+	if (path != NULL && *path != '\0') {
+		return path;
+	}
+
+	if (*socket_path == '\0') {
+		const char *dir = getenv(DAEMON_RUNTIME_ENV);
+		if (dir == NULL || *dir != '/') {
+			dir = DAEMON_RUNTIME_FALLBACK;
+		}
+
+		// Tables are opened relative to the working directory
+		char cwd[PATH_MAX];
+		uint64_t hash = (getcwd(cwd, sizeof(cwd)) != NULL) ? path_hash(cwd) : 0;
+		snprintf(socket_path, sizeof(socket_path), "%s/pmm-%u-%016" PRIx64 ".sock", dir,
+			(unsigned)getuid(), hash);
+	}
+
+	return socket_path;
+}
+
+int daemon_same_user(int fd) {
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0 || len != sizeof(cred)) {
+		return 0;
+	}
+
+	return (cred.uid == geteuid());
+}
+
+int send_all(int fd, const void *buf, uint64_t len) {
+	const uint8_t *data = buf;
+	while (len > 0) {
+		ssize_t bytes = send(fd, data, len, MSG_NOSIGNAL);
+		if (bytes < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+
+		data += bytes;
+		len -= bytes;
+	}
+
+	return 0;
+}
+
+int recv_all(int fd, void *buf, uint64_t len) {
+	uint8_t *data = buf;
+	while (len > 0) {
+		ssize_t bytes = recv(fd, data, len, 0);
+		if (bytes < 0 && errno == EINTR) {
+			continue;
+		}
+		if (bytes <= 0) {
+			return -1;
+		}
+
+		data += bytes;
+		len -= bytes;
+	}
+
+	return 0;
+}
+
+/** Private functions */
+
+/**
+ * @brief Hash a path (FNV-1a).
+ *
+ * @param[in] path - Path.
+ * @return Hash.
+ */
+uint64_t path_hash(const char *path) {
+	uint64_t hash = 0xcbf29ce484222325;
+	for (; *path != '\0'; path++) {
+		hash = (hash ^ (uint8_t)*path) * 0x100000001b3;
+	}
+
+	return hash;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+
+#define DAEMON_SOCKET_ENV "PMM_SOCKET"
+// Default socket directory (XDG_RUNTIME_DIR, else /tmp)
+#define DAEMON_RUNTIME_ENV "XDG_RUNTIME_DIR"
+#define DAEMON_RUNTIME_FALLBACK "/tmp"
+#define DAEMON_DISABLE_ENV "PMM_NO_DAEMON"
+
+// "PMM1"
+#define DAEMON_MAGIC 0x504d4d31
+#define DAEMON_MAX_ARGS_LEN 4096
+// Each argument takes at least its terminator
+#define DAEMON_MAX_ARGC (DAEMON_MAX_ARGS_LEN / 2)
+// stdin, stdout, stderr of the client are passed along with the request
+#define DAEMON_FD_COUNT 3
+
+// Request header, followed by args_len bytes of null-terminated arguments
+typedef struct {
+	uint32_t magic;
+	uint32_t op;
+	uint32_t argc;
+	uint32_t args_len;
+} daemon_request;
+
+// Response: exit code of the command
+typedef struct {
+	int32_t result;
+} daemon_response;
+
+/**
+ * @brief Get daemon socket path: PMM_SOCKET, or a socket private to the user
+ * and the working directory (which holds the tables) in the runtime directory.
+ *
+ * @return Socket path.
+ */
+const char *daemon_socket_path(void);
+
+/**
+ * @brief Check that the other end of a socket runs as the same user.
+ *
+ * @param[in] fd - Connected socket.
+ * @return 1 if same user, 0 if not.
+ */
+int daemon_same_user(int fd);
+
+/**
+ * @brief Send whole buffer over a socket.
+ *
+ * @param[in] fd - Socket.
+ * @param[in] buf - Data.
+ * @param[in] len - Data length.
+ * @return Success code.
+ */
+int send_all(int fd, const void *buf, uint64_t len);
+
+/**
+ * @brief Receive exactly len bytes from a socket.
+ *
+ * @param[in] fd - Socket.
+ * @param[out] buf - Destination.
+ * @param[in] len - Bytes to receive.
+ * @return Success code.
+ */
+int recv_all(int fd, void *buf, uint64_t len);
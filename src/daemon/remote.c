@@ -0,0 +1,148 @@
+#include "remote.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "protocol.h"
+#include "../commands.h"
+#include "../util/trace.h"
+
+int connect_daemon(void);
+int send_request(int sock, command_op op, int argc, char **argv);
+
+int remote_run(command_op op, int argc, char **argv, int *result) {
+	if (getenv(DAEMON_DISABLE_ENV) != NULL) {
+		return -1;
+	}
+
+	// No daemon: run directly
+	int sock = connect_daemon();
+	if (sock < 0) {
+		return -1;
+	}
+
+	trace_begin_num("remote_run", op);
+	if (send_request(sock, op, argc, argv) < 0) {
+		trace_end("remote_run");
+		close(sock);
+		return -1;
+	}
+
+	// Request was delivered, do not fall back after this point
+	daemon_response res;
+	if (recv_all(sock, &res, sizeof(res)) < 0) {
+		fprintf(stderr, "lost connection to daemon\n");
+		res.result = EXIT_FAILURE;
+	}
+	trace_end("remote_run");
+
+	close(sock);
+	*result = res.result;
+	return 0;
+}
+
+int remote_available(void) {
+	int sock = connect_daemon();
+	if (sock < 0) {
+		return 0;
+	}
+
+	close(sock);
+	return 1;
+}
+
+/** Private functions */
+
+/**
+ * @brief Connect to daemon socket.
+ *
+ * @return Connected socket or -1 if no daemon of this user is listening.
+ */
+int connect_daemon(void) {
+	const char *path = daemon_socket_path();
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		return -1;
+	}
+
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(sock);
+		return -1;
+	}
+
+	// Do not hand stdio to a daemon of another user
+	if (!daemon_same_user(sock)) {
+		fprintf(stderr, "ignoring daemon of another user on %s\n", path);
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+/**
+ * @brief Send request header with stdio descriptors, then arguments.
+ *
+ * @param[in] sock - Connected daemon socket.
+ * @param[in] op - Command to run.
+ * @param[in] argc - Command argument count.
+ * @param[in] argv - Command arguments.
+ * @return Success code.
+ */
+int send_request(int sock, command_op op, int argc, char **argv) {
+	daemon_request req = {
+		.magic = DAEMON_MAGIC,
+		.op = op,
+		.argc = argc,
+		.args_len = 0
+	};
+	for (int i = 0; i < argc; i++) {
+		req.args_len += strlen(argv[i]) + 1;
+	}
+	if (req.args_len > DAEMON_MAX_ARGS_LEN) {
+		return -1;
+	}
+
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int) * DAEMON_FD_COUNT)];
+	} control;
+	struct iovec iov = { .iov_base = &req, .iov_len = sizeof(req) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf)
+	};
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * DAEMON_FD_COUNT);
+	int fds[DAEMON_FD_COUNT] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(req)) {
+		return -1;
+	}
+
+	// Null-terminated arguments
+	for (int i = 0; i < argc; i++) {
+		if (send_all(sock, argv[i], strlen(argv[i]) + 1) < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
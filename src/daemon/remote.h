@@ -0,0 +1,22 @@
+#pragma once
+
+#include "protocol.h"
+#include "../commands.h"
+
+/**
+ * @brief Run table command in a running daemon.
+ *
+ * @param[in] op - Command to run.
+ * @param[in] argc - Command argument count.
+ * @param[in] argv - Command arguments.
+ * @param[out] result - Exit code of the command.
+ * @return 0 if the daemon ran the command, -1 if it should run directly.
+ */
+int remote_run(command_op op, int argc, char **argv, int *result);
+
+/**
+ * @brief Check whether a daemon is listening.
+ *
+ * @return Boolean result.
+ */
+int remote_available(void);
@@ -0,0 +1,320 @@
+#include "watch.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "../client/client.h"
+#include "../util/vector.h"
+#include "../util/trace.h"
+
+#define LOCAL_DIR "local"
+#define SYNC_DIR "sync"
+#define LOCK_FILE "db.lck"
+#define SYNC_DB_SUFFIX ".db"
+// Wait for events to settle before rechecking
+#define QUIET_MS 250
+
+#define LOCAL_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM | IN_MOVE_SELF | IN_ONLYDIR)
+#define SYNC_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVE_SELF | IN_ONLYDIR)
+#define ROOT_EVENTS (IN_DELETE | IN_MOVED_FROM | IN_MOVE_SELF | IN_ONLYDIR)
+// Watched directory is gone or no longer at its path
+#define LOST_EVENTS (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)
+
+typedef struct {
+	const char *db_path;
+	int fd;
+	int wd_root;
+	int wd_local;
+	int wd_sync;
+	// Changed package names (char *)
+	vector *pending;
+	uint8_t sync_changed;
+	// A watched directory was replaced, watches must be added again
+	uint8_t lost;
+} watch_state;
+
+static volatile sig_atomic_t running;
+
+int add_watch(watch_state *state, const char *db_path, const char *dir, uint32_t mask);
+int add_watches(watch_state *state);
+void read_events(watch_state *state);
+void queue_entry(watch_state *state, const char *entry);
+int locked(const char *db_path);
+int apply_changes(const char *file, watch_state *state);
+void stop_watch(int signal);
+
+int watch_run(const char *file, const char *db_path) {
+	watch_state state = {
+		.db_path = db_path,
+		.fd = inotify_init1(IN_CLOEXEC),
+		.wd_root = -1,
+		.wd_local = -1,
+		.wd_sync = -1,
+		.pending = vec_new(sizeof(char *)),
+		.sync_changed = 0,
+		.lost = 0
+	};
+	if (state.fd < 0) {
+		fprintf(stderr, "failed to initialize inotify\n");
+		vec_free(state.pending);
+		return -1;
+	}
+
+	if (add_watches(&state) < 0) {
+		close(state.fd);
+		vec_free(state.pending);
+		return -1;
+	}
+
+	struct sigaction action = { 0 };
+	action.sa_handler = &stop_watch;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	fprintf(stderr, "pmm: watching %s\n", db_path);
+
+	int result = 0;
+	running = 1;
+	while (running) {
+		int dirty = (state.pending->count > 0 || state.sync_changed || state.lost);
+		struct pollfd pfd = { .fd = state.fd, .events = POLLIN };
+		int ready = poll(&pfd, 1, dirty ? QUIET_MS : -1);
+
+		if (ready < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			fprintf(stderr, "failed to wait for events\n");
+			result = -1;
+			break;
+		}
+
+		if (ready > 0) {
+			read_events(&state);
+			continue;
+		}
+
+		// Replaced directories are watched again once they settle too
+		if (state.lost && add_watches(&state) < 0) {
+			fprintf(stderr, "lost watch on %s\n", db_path);
+			result = -1;
+			break;
+		}
+
+		// Quiet period passed; pacman must also be done with the transaction
+		if (!locked(db_path) && apply_changes(file, &state) < 0) {
+			result = -1;
+			break;
+		}
+	}
+
+	for (uint32_t i = 0; i < state.pending->count; i++) {
+		free(*(char **)vec_at(state.pending, i));
+	}
+	vec_free(state.pending);
+	close(state.fd);
+	return result;
+}
+
+/** Private functions */
+
+/**
+ * @brief Watch a directory inside the database path.
+ *
+ * @param[in] state - Watch state.
+ * @param[in] db_path - Database directory.
+ * @param[in] dir - Subdirectory or NULL for db_path itself.
+ * @param[in] mask - Inotify event mask.
+ * @return Watch descriptor or -1.
+ */
+int add_watch(watch_state *state, const char *db_path, const char *dir, uint32_t mask) {
+	char path[PATH_MAX];
+	if (dir != NULL) {
+		snprintf(path, sizeof(path), "%s/%s", db_path, dir);
+	} else {
+		snprintf(path, sizeof(path), "%s", db_path);
+	}
+
+	int wd = inotify_add_watch(state->fd, path, mask);
+	if (wd < 0) {
+		fprintf(stderr, "warning: cannot watch %s\n", path);
+	}
+
+	return wd;
+}
+
+/**
+ * @brief Watch the database directories, replacing any earlier watches.
+ * Events may have been missed meanwhile, so all packages are rechecked.
+ *
+ * @param[in] state - Watch state.
+ * @return Success code (-1 if the local database cannot be watched).
+ */
+int add_watches(watch_state *state) {
+	int *wds[] = { &state->wd_root, &state->wd_local, &state->wd_sync };
+	for (uint32_t i = 0; i < sizeof(wds) / sizeof(wds[0]); i++) {
+		if (*wds[i] >= 0) {
+			inotify_rm_watch(state->fd, *wds[i]);
+		}
+	}
+
+	state->wd_root = add_watch(state, state->db_path, NULL, ROOT_EVENTS);
+	state->wd_local = add_watch(state, state->db_path, LOCAL_DIR, LOCAL_EVENTS);
+	state->wd_sync = add_watch(state, state->db_path, SYNC_DIR, SYNC_EVENTS);
+	state->sync_changed |= state->lost;
+	state->lost = 0;
+
+	return (state->wd_local < 0) ? -1 : 0;
+}
+
+/**
+ * @brief Read available inotify events and record changes.
+ *
+ * @param[in] state - Watch state.
+ */
+void read_events(watch_state *state) {
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+	ssize_t bytes = read(state->fd, buf, sizeof(buf));
+	for (ssize_t pos = 0; pos < bytes; ) {
+		struct inotify_event *event = (struct inotify_event *)(buf + pos);
+		pos += sizeof(struct inotify_event) + event->len;
+
+		// Dropped events may be for any package
+		if (event->mask & IN_Q_OVERFLOW) {
+			state->sync_changed = 1;
+			continue;
+		}
+
+		// Watched directory deleted or moved away
+		if ((event->mask & LOST_EVENTS) && (event->wd == state->wd_root
+				|| event->wd == state->wd_local || event->wd == state->wd_sync)) {
+			state->lost = 1;
+			continue;
+		}
+
+		if (event->len == 0) {
+			continue;
+		}
+
+		if (event->wd == state->wd_local && (event->mask & IN_ISDIR)) {
+			queue_entry(state, event->name);
+		} else if (event->wd == state->wd_sync) {
+			uint64_t len = strlen(event->name);
+			uint64_t suffix = strlen(SYNC_DB_SUFFIX);
+			if (len > suffix && strcmp(event->name + len - suffix, SYNC_DB_SUFFIX) == 0) {
+				state->sync_changed = 1;
+			}
+		}
+		// Root events (lock removal) only wake up the loop
+	}
+}
+
+/**
+ * @brief Queue package from a local database entry ('name-pkgver-pkgrel').
+ *
+ * @param[in] state - Watch state.
+ * @param[in] entry - Directory entry name.
+ */
+void queue_entry(watch_state *state, const char *entry) {
+	// Strip version and release
+	const char *rel = strrchr(entry, '-');
+	if (rel == NULL || rel == entry) {
+		return;
+	}
+
+	const char *ver = rel - 1;
+	while (ver > entry && *ver != '-') {
+		ver--;
+	}
+	if (ver == entry) {
+		return;
+	}
+
+	uint64_t len = ver - entry;
+	for (uint32_t i = 0; i < state->pending->count; i++) {
+		char *queued = *(char **)vec_at(state->pending, i);
+		if (strncmp(queued, entry, len) == 0 && queued[len] == '\0') {
+			return;
+		}
+	}
+
+	char *name = strndup(entry, len);
+	vec_push(state->pending, &name);
+}
+
+/**
+ * @brief Check whether pacman holds the database lock.
+ *
+ * @param[in] db_path - Database directory.
+ * @return Boolean result.
+ */
+int locked(const char *db_path) {
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", db_path, LOCK_FILE);
+
+	return access(path, F_OK) == 0;
+}
+
+/**
+ * @brief Recheck changed packages and write the table.
+ *
+ * @param[in] file - Package table file.
+ * @param[in] state - Watch state.
+ * @return Success code.
+ */
+int apply_changes(const char *file, watch_state *state) {
+	trace_begin_num("watch_apply", state->pending->count);
+	pkg_table *pkgs = pkg_open_locked(file);
+	if (pkgs == NULL) {
+		trace_end("watch_apply");
+		return -1;
+	}
+	client_get()->refresh();
+
+	// Sync database change may make any package outdated
+	uint32_t updated = 0;
+	if (state->sync_changed) {
+		pkg_check(pkgs);
+	} else {
+		for (uint32_t i = 0; i < state->pending->count; i++) {
+			if (pkg_update(pkgs, *(char **)vec_at(state->pending, i)) > 0) {
+				updated++;
+			}
+		}
+	}
+
+	if (state->sync_changed || updated > 0) {
+		fprintf(stderr, "pmm: %s\n", state->sync_changed ? "rechecked all packages" : "updated statuses");
+	}
+
+	for (uint32_t i = 0; i < state->pending->count; i++) {
+		free(*(char **)vec_at(state->pending, i));
+	}
+	state->pending->count = 0;
+	state->sync_changed = 0;
+
+	int result = pkg_save(pkgs);
+	trace_end("watch_apply");
+	return result;
+}
+
+/**
+ * @brief Signal handler: stop watching.
+ *
+ * @param[in] signal - Signal number.
+ */
+void stop_watch(int signal) {
+	(void)signal;
+	running = 0;
+}
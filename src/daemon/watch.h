@@ -0,0 +1,15 @@
+#pragma once
+
+#include "../tables/pkg.h"
+
+/**
+ * @brief Watch package databases and update stored statuses until interrupted.
+ * Each settled batch of events opens the table for writing and saves it,
+ * so other writers are only kept waiting while a batch is applied.
+ * Missed events (queue overflow, replaced directories) recheck all packages.
+ *
+ * @param[in] file - Package table file.
+ * @param[in] db_path - Package database directory (containing local/ and sync/).
+ * @return Success code.
+ */
+int watch_run(const char *file, const char *db_path);
@@ -0,0 +1,224 @@
+#include "aio.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "../util/vector.h"
+#include "../util/trace.h"
+
+#define ring_ptr(map, offset) ((uint32_t *)((uint8_t *)(map) + (offset)))
+
+int ring_setup(aio_engine *engine);
+int ring_enter(aio_engine *engine, uint32_t to_submit, uint32_t min_complete);
+
+aio_engine *aio_new(uint32_t depth) {
+	aio_engine *engine = calloc(1, sizeof(aio_engine));
+	engine->depth = depth;
+	engine->ring_fd = -1;
+
+	if (ring_setup(engine) < 0) {
+		engine->ring_fd = -1;
+		engine->done = vec_new(sizeof(aio_completion));
+	}
+
+	return engine;
+}
+
+int aio_read(aio_engine *engine, int fd, void *buf, uint32_t len, uint64_t offset, uint64_t tag) {
+	if (engine->in_flight == engine->depth) {
+		return -1;
+	}
+
+	// Fallback: read now, report on reap
+	if (engine->ring_fd < 0) {
+		ssize_t bytes = pread(fd, buf, len, offset);
+		aio_completion done = {
+			.tag = tag,
+			.result = (bytes < 0) ? -errno : bytes
+		};
+		vec_push(engine->done, &done);
+		engine->in_flight++;
+		return 0;
+	}
+
+	uint32_t tail = *engine->sq_tail;
+	uint32_t index = tail & *engine->sq_mask;
+	struct io_uring_sqe *sqe = (struct io_uring_sqe *)engine->sqes + index;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buf;
+	sqe->len = len;
+	sqe->off = offset;
+	sqe->user_data = tag;
+
+	engine->sq_array[index] = index;
+	__atomic_store_n(engine->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	engine->queued++;
+	engine->in_flight++;
+	return 0;
+}
+
+void aio_submit(aio_engine *engine) {
+	if (engine->ring_fd >= 0 && engine->queued > 0) {
+		ring_enter(engine, engine->queued, 0);
+	}
+}
+
+int aio_reap(aio_engine *engine, aio_completion *completion) {
+	if (engine->in_flight == 0) {
+		return -1;
+	}
+
+	if (engine->ring_fd < 0) {
+		*completion = *(aio_completion *)vec_at(engine->done, engine->done_head++);
+		engine->in_flight--;
+
+		// Reset fifo once drained
+		if (engine->done_head == engine->done->count) {
+			engine->done->count = 0;
+			engine->done_head = 0;
+		}
+		return 0;
+	}
+
+	uint32_t head = *engine->cq_head;
+	if (head == __atomic_load_n(engine->cq_tail, __ATOMIC_ACQUIRE)) {
+		trace_begin_num("aio_wait", engine->in_flight);
+		int result = ring_enter(engine, engine->queued, 1);
+		trace_end("aio_wait");
+		if (result < 0) {
+			return -1;
+		}
+	}
+
+	struct io_uring_cqe *cqe = (struct io_uring_cqe *)engine->cqes + (head & *engine->cq_mask);
+	completion->tag = cqe->user_data;
+	completion->result = cqe->res;
+	__atomic_store_n(engine->cq_head, head + 1, __ATOMIC_RELEASE);
+
+	engine->in_flight--;
+	return 0;
+}
+
+void aio_free(aio_engine *engine) {
+	if (engine == NULL) {
+		return;
+	}
+
+	if (engine->ring_fd >= 0) {
+		munmap(engine->sqes, engine->sqes_len);
+		if (engine->cq_map != engine->sq_map) {
+			munmap(engine->cq_map, engine->cq_map_len);
+		}
+		munmap(engine->sq_map, engine->sq_map_len);
+		close(engine->ring_fd);
+	} else {
+		vec_free(engine->done);
+	}
+
+	free(engine);
+}
+
+/** Private functions */
+
+/**
+ * @brief Create io_uring instance and map its rings.
+ *
+ * @param[in] engine - Engine object.
+ * @return Success code (-1 if io_uring is unavailable).
+ */
+int ring_setup(aio_engine *engine) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	int fd = syscall(__NR_io_uring_setup, engine->depth, &params);
+	if (fd < 0) {
+		return -1;
+	}
+	engine->ring_fd = fd;
+
+	// Map rings
+	engine->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	engine->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	int single_map = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (single_map && engine->cq_map_len > engine->sq_map_len) {
+		engine->sq_map_len = engine->cq_map_len;
+	}
+
+	engine->sq_map = mmap(NULL, engine->sq_map_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (engine->sq_map == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+
+	engine->cq_map = single_map ? engine->sq_map :
+		mmap(NULL, engine->cq_map_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	if (engine->cq_map == MAP_FAILED) {
+		munmap(engine->sq_map, engine->sq_map_len);
+		close(fd);
+		return -1;
+	}
+
+	engine->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+	engine->sqes = mmap(NULL, engine->sqes_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (engine->sqes == MAP_FAILED) {
+		if (!single_map) {
+			munmap(engine->cq_map, engine->cq_map_len);
+		}
+		munmap(engine->sq_map, engine->sq_map_len);
+		close(fd);
+		return -1;
+	}
+
+	engine->sq_head = ring_ptr(engine->sq_map, params.sq_off.head);
+	engine->sq_tail = ring_ptr(engine->sq_map, params.sq_off.tail);
+	engine->sq_mask = ring_ptr(engine->sq_map, params.sq_off.ring_mask);
+	engine->sq_array = ring_ptr(engine->sq_map, params.sq_off.array);
+	engine->cq_head = ring_ptr(engine->cq_map, params.cq_off.head);
+	engine->cq_tail = ring_ptr(engine->cq_map, params.cq_off.tail);
+	engine->cq_mask = ring_ptr(engine->cq_map, params.cq_off.ring_mask);
+	engine->cqes = (uint8_t *)engine->cq_map + params.cq_off.cqes;
+
+	// Kernel may round the depth up, never use more than asked for
+	if (params.sq_entries < engine->depth) {
+		engine->depth = params.sq_entries;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Submit queued reads and optionally wait for completions.
+ *
+ * @param[in] engine - Engine object.
+ * @param[in] to_submit - Queued reads to submit.
+ * @param[in] min_complete - Completions to wait for.
+ * @return Success code.
+ */
+int ring_enter(aio_engine *engine, uint32_t to_submit, uint32_t min_complete) {
+	uint32_t flags = (min_complete > 0) ? IORING_ENTER_GETEVENTS : 0;
+
+	int result;
+	do {
+		result = syscall(__NR_io_uring_enter, engine->ring_fd, to_submit, min_complete, flags, NULL, 0);
+	} while (result < 0 && errno == EINTR);
+
+	if (result < 0) {
+		return -1;
+	}
+
+	// Kernel consumes submissions in order
+	engine->queued -= ((uint32_t)result < to_submit) ? (uint32_t)result : to_submit;
+	return 0;
+}
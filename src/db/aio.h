@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "../util/vector.h"
+
+// Finished read
+typedef struct {
+	uint64_t tag;
+	// Bytes read or negative errno
+	int32_t result;
+} aio_completion;
+
+// Asynchronous read engine (io_uring, or synchronous pread fallback)
+typedef struct {
+	// Ring file descriptor, -1 when using the fallback
+	int ring_fd;
+	uint32_t depth;
+	// Reads queued but not yet handed to the kernel
+	uint32_t queued;
+	// Reads not yet reaped (including queued)
+	uint32_t in_flight;
+
+	// Submission ring
+	uint32_t *sq_head;
+	uint32_t *sq_tail;
+	uint32_t *sq_mask;
+	uint32_t *sq_array;
+	void *sqes;
+	// Completion ring
+	uint32_t *cq_head;
+	uint32_t *cq_tail;
+	uint32_t *cq_mask;
+	void *cqes;
+
+	// Mappings
+	void *sq_map;
+	size_t sq_map_len;
+	void *cq_map;
+	size_t cq_map_len;
+	size_t sqes_len;
+
+	// Fallback: completions of reads done at queue time (aio_completion)
+	vector *done;
+	uint32_t done_head;
+} aio_engine;
+
+/**
+ * @brief Create read engine. Falls back to pread if io_uring is unavailable.
+ *
+ * @param[in] depth - Maximum reads in flight.
+ * @return Engine object.
+ */
+aio_engine *aio_new(uint32_t depth);
+
+/**
+ * @brief Queue a read. Reads are started by aio_submit or aio_reap.
+ *
+ * @param[in] engine - Engine object.
+ * @param[in] fd - File to read from.
+ * @param[out] buf - Destination, must stay valid until reaped.
+ * @param[in] len - Bytes to read.
+ * @param[in] offset - File offset.
+ * @param[in] tag - Value returned with the completion.
+ * @return Success code (-1 if depth reached).
+ */
+int aio_read(aio_engine *engine, int fd, void *buf, uint32_t len, uint64_t offset, uint64_t tag);
+
+/**
+ * @brief Hand queued reads to the kernel without waiting.
+ *
+ * @param[in] engine - Engine object.
+ */
+void aio_submit(aio_engine *engine);
+
+/**
+ * @brief Wait for the next finished read.
+ *
+ * @param[in] engine - Engine object.
+ * @param[out] completion - Finished read.
+ * @return Success code (-1 if nothing is in flight).
+ */
+int aio_reap(aio_engine *engine, aio_completion *completion);
+
+/**
+ * @brief Delete engine. All reads must be reaped first.
+ *
+ * @param[in] engine - Engine object.
+ */
+void aio_free(aio_engine *engine);
@@ -0,0 +1,115 @@
+#include "bloom.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "defines.h"
+
+#define bit_set(bits, i) ((bits)[(i) / 8] |= (uint8_t)(1 << ((i) % 8)))
+#define bit_get(bits, i) (((bits)[(i) / 8] >> ((i) % 8)) & 1)
+
+// Largest filter, keeps bit indices within 32 bits
+#define BLOOM_MAX_BITS 0x80000000u
+
+void split_key(md5_t *key, uint64_t *first, uint64_t *step);
+
+bloom_filter *bloom_new(uint64_t keys) {
+	if (keys < BLOOM_MIN_KEYS) {
+		keys = BLOOM_MIN_KEYS;
+	}
+
+	uint64_t wanted = keys * BLOOM_BITS_PER_KEY;
+	uint32_t bit_count = 8;
+	while (bit_count < wanted && bit_count < BLOOM_MAX_BITS) {
+		bit_count *= 2;
+	}
+
+	bloom_filter *filter = malloc(sizeof(bloom_filter));
+	filter->key_count = 0;
+	filter->bit_count = bit_count;
+	filter->hash_count = BLOOM_HASHES;
+	filter->bits = calloc(bloom_bytes(filter), 1);
+
+	return filter;
+}
+
+bloom_filter *bloom_load(bloom_footer *footer, uint8_t *bits) {
+	bloom_filter *filter = malloc(sizeof(bloom_filter));
+	filter->key_count = footer->key_count;
+	filter->bit_count = footer->bit_count;
+	filter->hash_count = footer->hash_count;
+	filter->bits = bits;
+
+	return filter;
+}
+
+void bloom_store(bloom_filter *filter, bloom_footer *footer) {
+	footer->key_count = filter->key_count;
+	footer->bit_count = filter->bit_count;
+	footer->hash_count = filter->hash_count;
+	footer->magic = BLOOM_MAGIC;
+	footer->_padding = 0;
+}
+
+int bloom_valid(bloom_footer *footer) {
+	uint32_t bits = footer->bit_count;
+	return footer->magic == BLOOM_MAGIC
+		&& bits >= 8 && bits <= BLOOM_MAX_BITS && (bits & (bits - 1)) == 0
+		&& footer->hash_count > 0 && footer->hash_count <= 32;
+}
+
+void bloom_add(bloom_filter *filter, md5_t *key) {
+	uint64_t pos, step;
+	split_key(key, &pos, &step);
+
+	uint32_t mask = filter->bit_count - 1;
+	for (uint32_t i = 0; i < filter->hash_count; i++) {
+		bit_set(filter->bits, pos & mask);
+		pos += step;
+	}
+
+	filter->key_count++;
+}
+
+int bloom_maybe(bloom_filter *filter, md5_t *key) {
+	uint64_t pos, step;
+	split_key(key, &pos, &step);
+
+	uint32_t mask = filter->bit_count - 1;
+	for (uint32_t i = 0; i < filter->hash_count; i++) {
+		if (!bit_get(filter->bits, pos & mask)) {
+			return 0;
+		}
+		pos += step;
+	}
+
+	return 1;
+}
+
+void bloom_free(bloom_filter *filter) {
+	if (filter == NULL) {
+		return;
+	}
+
+	free(filter->bits);
+	free(filter);
+}
+
+/** Private functions */
+
+/**
+ * @brief Derive bit positions from a key (double hashing).
+ * Keys are MD5 hashes, so their halves are already uniform.
+ *
+ * @param[in] key - Hash key pointer.
+ * @param[out] first - First bit position.
+ * @param[out] step - Distance between positions (odd).
+ */
+void split_key(md5_t *key, uint64_t *first, uint64_t *step) {
+	uint64_t halves[2];
+	memcpy(halves, key, sizeof(halves));
+
+	*first = halves[0];
+	*step = halves[1] | 1;
+}
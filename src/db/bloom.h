@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "defines.h"
+
+// Filter density, about 1% false positives at capacity
+#define BLOOM_BITS_PER_KEY 10
+#define BLOOM_HASHES 7
+// Smallest capacity in keys
+#define BLOOM_MIN_KEYS 1024
+// Footer tag ("PMMB")
+#define BLOOM_MAGIC 0x424d4d50
+
+// Bloom filter over btree keys
+typedef struct {
+	// Keys added, including ones added more than once
+	uint64_t key_count;
+	// Power of two
+	uint32_t bit_count;
+	uint32_t hash_count;
+	uint8_t *bits;
+} bloom_filter;
+
+// Stored filter trailer, follows the bits at the very end of the file
+typedef struct {
+	uint64_t key_count;
+	uint32_t bit_count;
+	uint32_t hash_count;
+	uint32_t magic;
+	uint32_t _padding;
+} bloom_footer;
+
+// Get filter size in bytes
+#define bloom_bytes(filter) ((filter)->bit_count / 8)
+// Get number of keys the filter is sized for
+#define bloom_capacity(filter) ((filter)->bit_count / BLOOM_BITS_PER_KEY)
+
+/**
+ * @brief Create empty filter.
+ *
+ * @param[in] keys - Expected number of keys.
+ * @return Filter object.
+ */
+bloom_filter *bloom_new(uint64_t keys);
+
+/**
+ * @brief Create filter from its stored form.
+ *
+ * @param[in] footer - Stored trailer.
+ * @param[in] bits - Stored bits (ownership is taken).
+ * @return Filter object.
+ */
+bloom_filter *bloom_load(bloom_footer *footer, uint8_t *bits);
+
+/**
+ * @brief Get stored trailer of a filter.
+ *
+ * @param[in] filter - Filter object.
+ * @param[out] footer - Trailer to write after the bits.
+ */
+void bloom_store(bloom_filter *filter, bloom_footer *footer);
+
+/**
+ * @brief Check if a stored trailer describes a valid filter.
+ *
+ * @param[in] footer - Stored trailer.
+ * @return Boolean result.
+ */
+int bloom_valid(bloom_footer *footer);
+
+/**
+ * @brief Add key to filter.
+ *
+ * @param[in] filter - Filter object.
+ * @param[in] key - Hash key pointer.
+ */
+void bloom_add(bloom_filter *filter, md5_t *key);
+
+/**
+ * @brief Check if a key may have been added.
+ *
+ * @param[in] filter - Filter object.
+ * @param[in] key - Hash key pointer.
+ * @return 0 if the key was definitely never added.
+ */
+int bloom_maybe(bloom_filter *filter, md5_t *key);
+
+/**
+ * @brief Delete filter.
+ *
+ * @param[in] filter - Filter object.
+ */
+void bloom_free(bloom_filter *filter);
@@ -1,15 +1,38 @@
 #include "btree.h"
 
+#include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "defines.h"
 #include "table.h"
+#include "slotted.h"
+#include "hash.h"
+#include "bloom.h"
+#include "capture.h"
+#include "../util/trace.h"
 
-#define leaf_max_cells(leaf_ptr) (LEAF_DATA_MEM / leaf_ptr->record_length)
+// Leaves read ahead by iterators
+#define ITER_PREFETCH_LEAVES 16
+// Deepest btree handled by shared inserts
+#define SHARED_MAX_DEPTH 64
+// Shared insert needs the path latched for a split
+#define SHARED_RETRY 2
+
+#define leaf_max_cells(table, leaf_ptr) (leaf_data_mem(table_page_size(table)) / leaf_ptr->record_length)
 #define leaf_cell_at(leaf_ptr, i) (leaf_ptr->records + leaf_ptr->record_length * (i))
 #define leaf_cell_body_at(leaf_ptr, i) (leaf_cell_at(leaf_ptr, i) + sizeof(md5_t))
+#define leaf_body_length(leaf_ptr) (leaf_ptr->record_length - sizeof(md5_t))
+
+// Record of an insert batch
+typedef struct {
+	md5_t *key;
+	const uint8_t *record;
+	// Position in the batch, keeps equal keys in order
+	uint32_t index;
+} batch_entry;
 
 void leaf_init(btree_leaf *node, page_t page, uint32_t record_length);
 void inner_init(btree_inner *node, page_t page);
@@ -18,73 +41,420 @@ uint32_t inner_find_child(btree_inner *node, md5_t *key);
 btree_leaf *find_leaf(db_table *table, btree_inner *start, md5_t *key);
 btree_cursor *find_key(db_table *table, md5_t *key);
 int leaf_split_insert(btree_leaf *old_node, md5_t *key, void *record, btree_cursor *location);
+int attach_split(db_table *table, btree_header *old_node, btree_header *new_node, md5_t *old_max);
+int inner_split_insert(db_table *table, btree_inner *node, uint32_t index, md5_t *old_max, page_t pg_new);
 md5_t *max_key(db_table *table, btree_header *node);
+int slotted_split_insert(btree_slotted *old_node, md5_t *key, const void *record, uint32_t len, btree_cursor *location);
+md5_t *leaf_key_at(btree_header *node, uint32_t i);
+void *leaf_record_at(btree_header *node, uint32_t i, uint32_t *length);
+btree_header *next_load_leaf(btree_loader *loader);
+void prefetch_leaves(btree_cursor *iter, btree_header *leaf);
+uint64_t scan_keys(db_table *table, bloom_filter *filter);
+int compare_entries(const void *a, const void *b);
+btree_leaf *find_leaf_bound(db_table *table, md5_t *key, md5_t *bound, int *bounded);
+int leaf_merge_insert(db_table *table, btree_leaf *leaf, batch_entry *entries, uint32_t count,
+	btree_insert_mode mode, bloom_filter *filter);
+int insert_fixed(db_table *table, md5_t *key, void *record, btree_insert_mode mode);
+int insert_var(db_table *table, md5_t *key, const void *record, uint32_t len, btree_insert_mode mode);
+int insert_batch(db_table *table, md5_t *keys, const void *records, uint32_t record_length,
+	uint32_t count, btree_insert_mode mode);
+btree_loader *begin_load(db_table *table, uint32_t record_length, uint32_t fill);
+btree_loader *begin_load_slotted(db_table *table, uint32_t fill);
+int load_fixed(btree_loader *loader, md5_t *key, void *record);
+int load_var(btree_loader *loader, md5_t *key, const void *record, uint32_t len);
+int resize_load(btree_loader *loader, uint32_t record_length);
+void *find_record(db_table *table, md5_t *key, uint32_t *length);
+uint32_t find_batch(db_table *table, md5_t *keys, void **records, uint32_t *lengths, uint32_t count);
+void *cursor_next(btree_cursor *iter);
+void *cursor_peek(btree_cursor *iter, uint32_t offset, uint32_t *length);
+btree_stream *open_stream(db_table *table);
+void *stream_next(btree_stream *stream);
+int place_fixed(btree_leaf *target, btree_cursor *location, md5_t *key, void *record,
+	btree_insert_mode mode, bloom_filter *filter);
+int place_var(btree_slotted *target, btree_cursor *location, md5_t *key, const void *record, uint32_t len,
+	btree_insert_mode mode, bloom_filter *filter);
+int node_safe(db_table *table, btree_header *node, uint32_t len);
+btree_header *latch_root(db_table *table, int write_leaf);
+btree_header *latch_descend(db_table *table, btree_header *node, md5_t *key, int write_leaf);
+int insert_latched(db_table *table, btree_header *leaf, md5_t *key, const void *record, uint32_t len,
+	btree_insert_mode mode);
+int insert_optimistic(db_table *table, md5_t *key, const void *record, uint32_t len, btree_insert_mode mode);
+int insert_pessimistic(db_table *table, md5_t *key, const void *record, uint32_t len, btree_insert_mode mode);
+uint32_t hashed_length(db_table *table);
+void *find_hashed(db_table *table, md5_t *key, uint32_t *length);
+int insert_hashed(db_table *table, md5_t *key, const void *record, uint32_t len, btree_insert_mode mode);
 
 void btree_init(db_table *table, uint32_t record_length) {
+	uint64_t start = capture_begin();
+
 	// Get or create page 0
 	btree_leaf *root = table->cmeta.total_pages == 0 ?
 		table_new_norm_page(table, NULL) :
-		table_get_norm_page(table, 0);
+		table_write_norm_page(table, 0);
 	leaf_init(root, 0, record_length + sizeof(md5_t));
 	table->cmeta.root_page = 0;
+	table->cmeta.version &= ~META_HASH;
+	table_set_bloom(table, bloom_new(0));
+
+	capture_end(start, table, CAPTURE_INIT, 0, NULL, record_length, 0);
 }
 
-int btree_insert(db_table *table, md5_t *key, void *record) {
-	// Get insert node
-	btree_cursor *location = find_key(table, key);
-	btree_leaf *target = table_get_norm_page(table, location->pg_value);
+void btree_init_slotted(db_table *table) {
+	uint64_t start = capture_begin();
 
-	// Node is full, must split
-	if (target->cell_count == leaf_max_cells(target)) {
-		return leaf_split_insert(target, key, record, location);
+	// Get or create page 0
+	btree_slotted *root = table->cmeta.total_pages == 0 ?
+		table_new_norm_page(table, NULL) :
+		table_write_norm_page(table, 0);
+	slotted_init(root, 0, table_page_size(table));
+	table->cmeta.root_page = 0;
+	table->cmeta.version &= ~META_HASH;
+	table_set_bloom(table, bloom_new(0));
+
+	capture_end(start, table, CAPTURE_INIT_SLOTTED, 0, NULL, 0, 0);
+}
+
+btree_node_type btree_leaf_type(db_table *table) {
+	btree_header *node = table_get_norm_page(table, table->cmeta.root_page);
+	while (node->type == NODE_INNER) {
+		btree_inner *inner = (btree_inner *)node;
+		page_t pg_child = (inner->child_count > 0) ? inner->children[0].pg_child : inner->pg_right_child;
+		node = table_get_norm_page(table, pg_child);
 	}
 
-	// Inserting in the middle, move bigger elements
-	if (location->cell_num < target->cell_count) {
-		for (uint32_t i = target->cell_count; i > location->cell_num; i--) {
-			void *dest = leaf_cell_at(target, i);
-			void *src = leaf_cell_at(target,  i - 1);
-			memcpy(dest, src, target->record_length);
+	return node->type;
+}
+
+int btree_insert(db_table *table, md5_t *key, void *record, btree_insert_mode mode) {
+	uint64_t start = capture_begin();
+	int result = insert_fixed(table, key, record, mode);
+	capture_end(start, table, CAPTURE_INSERT, mode, key, 0, 0);
+	return result;
+}
+
+int btree_insert_var(db_table *table, md5_t *key, const void *record, uint32_t len, btree_insert_mode mode) {
+	uint64_t start = capture_begin();
+	int result = insert_var(table, key, record, len, mode);
+	capture_end(start, table, CAPTURE_INSERT_VAR, mode, key, len, 0);
+	return result;
+}
+
+int btree_insert_many(db_table *table, md5_t *keys, const void *records, uint32_t record_length,
+		uint32_t count, btree_insert_mode mode) {
+	uint64_t start = capture_begin();
+	int result = insert_batch(table, keys, records, record_length, count, mode);
+	if (capture_file != NULL && capture_stop(start, table, CAPTURE_INSERT_MANY, mode, NULL, record_length, count)) {
+		capture_keys(table, keys, count);
+	}
+	return result;
+}
+
+btree_loader *btree_load_begin(db_table *table, uint32_t record_length, uint32_t fill) {
+	uint64_t start = capture_begin();
+	btree_loader *loader = begin_load(table, record_length, fill);
+	capture_end(start, table, CAPTURE_LOAD_BEGIN, 0, NULL, record_length, fill);
+	return loader;
+}
+
+btree_loader *btree_load_begin_slotted(db_table *table, uint32_t fill) {
+	uint64_t start = capture_begin();
+	btree_loader *loader = begin_load_slotted(table, fill);
+	capture_end(start, table, CAPTURE_LOAD_BEGIN_SLOTTED, 0, NULL, 0, fill);
+	return loader;
+}
+
+int btree_load_add(btree_loader *loader, md5_t *key, void *record) {
+	uint64_t start = capture_begin();
+	int result = load_fixed(loader, key, record);
+	capture_end(start, loader->table, CAPTURE_LOAD_ADD, 0, key, 0, 0);
+	return result;
+}
+
+int btree_load_add_var(btree_loader *loader, md5_t *key, const void *record, uint32_t len) {
+	uint64_t start = capture_begin();
+	int result = load_var(loader, key, record, len);
+	capture_end(start, loader->table, CAPTURE_LOAD_ADD_VAR, 0, key, len, 0);
+	return result;
+}
+
+int btree_load_resize(btree_loader *loader, uint32_t record_length) {
+	uint64_t start = capture_begin();
+	int result = resize_load(loader, record_length);
+	capture_end(start, loader->table, CAPTURE_LOAD_RESIZE, 0, NULL, record_length, 0);
+	return result;
+}
+
+int btree_load_end(btree_loader *loader) {
+	uint64_t start = capture_begin();
+	db_table *table = loader->table;
+	btree_leaf *leaf = (btree_leaf *)loader->leaf;
+
+	btree_inner_child last = { .pg_child = leaf->header.pg_self };
+	if (leaf->cell_count > 0) {
+		md5_cp(&last.key, leaf_key_at(loader->leaf, leaf->cell_count - 1));
+	} else {
+		md5_zero(&last.key);
+	}
+	vec_push(loader->level, &last);
+
+	// Build levels until a single root remains
+	vector *level = loader->level;
+	while (level->count > 1) {
+		vector *parents = vec_new(sizeof(btree_inner_child));
+		uint32_t nodes = (level->count + loader->inner_children - 1) / loader->inner_children;
+
+		// Spread children evenly between nodes
+		uint32_t next = 0;
+		for (uint32_t n = 0; n < nodes; n++) {
+			uint32_t count = level->count / nodes + (n < level->count % nodes);
+
+			page_t page_buf;
+			btree_inner *node = table_new_norm_page(table, &page_buf);
+			inner_init(node, page_buf);
+			node->header.is_root = 0;
+
+			for (uint32_t i = 0; i < count; i++) {
+				btree_inner_child *entry = vec_at(level, next + i);
+				btree_header *child = table_write_norm_page(table, entry->pg_child);
+				child->is_root = 0;
+				child->pg_parent = page_buf;
+
+				if (i == count - 1) {
+					node->pg_right_child = entry->pg_child;
+				} else {
+					node->children[i] = *entry;
+				}
+			}
+			node->child_count = count - 1;
+
+			btree_inner_child done = *(btree_inner_child *)vec_at(level, next + count - 1);
+			done.pg_child = page_buf;
+			vec_push(parents, &done);
+			next += count;
 		}
+
+		vec_free(level);
+		level = parents;
 	}
 
-	// Insert record
-	md5_cp((md5_t *)leaf_cell_at(target, location->cell_num), key);
-	memcpy(leaf_cell_body_at(target, location->cell_num), record, target->record_length);
+	// Attach root
+	btree_inner_child *root_entry = vec_at(level, 0);
+	btree_header *root = table_write_norm_page(table, root_entry->pg_child);
+	root->is_root = 1;
+	root->pg_parent = INVALID_VAL;
+	table->cmeta.root_page = root_entry->pg_child;
 
-	target->cell_count++;
-	free(location);
+	vec_free(level);
+	free(loader);
+
+	// Keys are all in cache now
+	bloom_filter *filter = bloom_new(2 * scan_keys(table, NULL));
+	scan_keys(table, filter);
+	table_set_bloom(table, filter);
+
+	capture_end(start, table, CAPTURE_LOAD_END, 0, NULL, 0, 0);
 	return 0;
 }
 
+void *btree_find(db_table *table, md5_t *key, uint32_t *length) {
+	uint64_t start = capture_begin();
+	void *record = find_record(table, key, length);
+	capture_end(start, table, CAPTURE_FIND, record != NULL, key, 0, 0);
+	return record;
+}
+
+uint32_t btree_find_many(db_table *table, md5_t *keys, void **records, uint32_t *lengths, uint32_t count) {
+	uint64_t start = capture_begin();
+	uint32_t found = find_batch(table, keys, records, lengths, count);
+	if (capture_file != NULL && capture_stop(start, table, CAPTURE_FIND_MANY, found > 0, NULL, 0, count)) {
+		capture_keys(table, keys, count);
+	}
+	return found;
+}
+
+void btree_touch_key(db_table *table, md5_t *key) {
+	if (table_hashed(table)) {
+		hash_touch(table, key);
+		return;
+	}
+
+	table_write_norm_page(table, btree_find_leaf(table, key)->pg_self);
+}
+
+btree_header *btree_find_leaf(db_table *table, md5_t *key) {
+	btree_header *root_header = table_get_norm_page(table, table->cmeta.root_page);
+	if (root_header->type != NODE_INNER) {
+		return root_header;
+	}
+
+	return &find_leaf(table, (btree_inner *)root_header, key)->header;
+}
+
+bloom_filter *btree_key_filter(db_table *table) {
+	bloom_filter *filter = table_get_bloom(table);
+	if (filter != NULL && filter->key_count < bloom_capacity(filter)) {
+		return filter;
+	}
+
+	// Size with room to grow, rebuilding doubles each time
+	filter = bloom_new(2 * scan_keys(table, NULL));
+	scan_keys(table, filter);
+	table_set_bloom(table, filter);
+	return filter;
+}
+
 btree_cursor *btree_iter(db_table *table) {
+	// Hash cursors have their own type
+	if (table_hashed(table)) {
+		fprintf(stderr, "hash tables are walked with hash_iter\n");
+		return NULL;
+	}
+
+	uint64_t start = capture_begin();
 	md5_t zero_key;
 	md5_zero(&zero_key);
 
-	return find_key(table, &zero_key);
+	btree_cursor *iter = find_key(table, &zero_key);
+	iter->prefetch = ITER_PREFETCH_LEAVES;
+	prefetch_leaves(iter, table_get_norm_page(table, iter->pg_value));
+
+	capture_end(start, table, CAPTURE_ITER, 0, NULL, 0, 0);
+	return iter;
 }
 
 void *btree_next(btree_cursor *iter) {
-	if (iter->end) {
-		return NULL;
+	uint64_t start = capture_begin();
+	void *record = cursor_next(iter);
+	capture_end(start, iter->table, CAPTURE_NEXT, record != NULL, NULL, 0, 0);
+	return record;
+}
+
+void *btree_peek(btree_cursor *iter, uint32_t offset, uint32_t *length) {
+	uint64_t start = capture_begin();
+	void *record = cursor_peek(iter, offset, length);
+	capture_end(start, iter->table, CAPTURE_PEEK, record != NULL, NULL, 0, offset);
+	return record;
+}
+
+void btree_touch(btree_cursor *iter) {
+	table_write_norm_page(iter->table, iter->pg_record);
+}
+
+btree_stream *btree_stream_open(db_table *table) {
+	uint64_t start = capture_begin();
+	btree_stream *stream = open_stream(table);
+	capture_end(start, table, CAPTURE_STREAM_OPEN, stream != NULL, NULL, 0, 0);
+	return stream;
+}
+
+void *btree_stream_next(btree_stream *stream) {
+	uint64_t start = capture_begin();
+	void *record = stream_next(stream);
+	capture_end(start, stream->table, CAPTURE_STREAM_NEXT, record != NULL, NULL, 0, 0);
+	return record;
+}
+
+void btree_stream_close(btree_stream *stream) {
+	if (stream == NULL) {
+		return;
 	}
 
-	// Retrieve record
-	btree_leaf *page = table_get_norm_page(iter->table, iter->pg_value);
-	void* record = leaf_cell_body_at(page, iter->cell_num);
+	uint64_t start = capture_begin();
+	db_table *table = stream->table;
+	free(stream->leaf);
+	free(stream);
+	capture_end(start, table, CAPTURE_STREAM_CLOSE, 0, NULL, 0, 0);
+}
 
-	// Update iterator
-	iter->cell_num++;
-	if (iter->cell_num == page->cell_count) {
-		if (page->pg_next_leaf == INVALID_VAL) {
-			iter->end = 1;
-		} else {
-			iter->pg_value = page->pg_next_leaf;
-			iter->cell_num = 0;
+int btree_share(db_table *table) {
+	if (table->cmeta.root_page == INVALID_VAL || table_hashed(table)) {
+		fprintf(stderr, "table has no btree to share\n");
+		return -1;
+	}
+
+	// Filter bits cannot be set by several threads, rebuilt afterwards
+	table_set_bloom(table, NULL);
+	table_share(table);
+	return 0;
+}
+
+void btree_unshare(db_table *table) {
+	if (table->shared == NULL) {
+		return;
+	}
+
+	table_unshare(table);
+	btree_key_filter(table);
+}
+
+int btree_shared_insert(db_table *table, md5_t *key, const void *record, uint32_t len, btree_insert_mode mode) {
+	// Most inserts fit their leaf, splits descend again holding the path
+	int result = insert_optimistic(table, key, record, len, mode);
+	if (result == SHARED_RETRY) {
+		result = insert_pessimistic(table, key, record, len, mode);
+	}
+
+	return result;
+}
+
+int btree_shared_find(db_table *table, md5_t *key, void *record, uint32_t size, uint32_t *length) {
+	btree_header *leaf = latch_descend(table, latch_root(table, 0), key, 0);
+	if (leaf == NULL) {
+		return -1;
+	}
+
+	uint32_t cell = (leaf->type == NODE_SLOTTED) ?
+		slotted_find_cell((btree_slotted *)leaf, key) :
+		leaf_find_cell((btree_leaf *)leaf, key);
+
+	int found = (cell < ((btree_leaf *)leaf)->cell_count && md5_eq(*key, *leaf_key_at(leaf, cell)));
+	if (found) {
+		uint32_t record_length;
+		void *data = leaf_record_at(leaf, cell, &record_length);
+		memcpy(record, data, (record_length < size) ? record_length : size);
+		if (length != NULL) {
+			*length = record_length;
 		}
 	}
 
-	return record;
+	table_unlatch(table, leaf->pg_self);
+	return found;
+}
+
+int btree_shared_scan(db_table *table, btree_visit visit, void *data) {
+	md5_t zero_key;
+	md5_zero(&zero_key);
+	btree_header *leaf = latch_descend(table, latch_root(table, 0), &zero_key, 0);
+	if (leaf == NULL) {
+		return -1;
+	}
+
+	// Latch next leaf before leaving the current one, splits only move
+	// records to the right
+	int result = 0;
+	while (1) {
+		btree_leaf *node = (btree_leaf *)leaf;
+		for (uint32_t i = 0; i < node->cell_count && result == 0; i++) {
+			uint32_t length;
+			void *record = leaf_record_at(leaf, i, &length);
+			result = visit(leaf_key_at(leaf, i), record, length, data);
+		}
+		if (result != 0 || node->pg_next_leaf == INVALID_VAL) {
+			break;
+		}
+
+		page_t pg_next = node->pg_next_leaf;
+		btree_header *next = table_get_norm_page(table, pg_next);
+		if (table_latch(table, pg_next, 0) < 0) {
+			result = -1;
+			break;
+		}
+		table_unlatch(table, leaf->pg_self);
+		leaf = next;
+	}
+
+	table_unlatch(table, leaf->pg_self);
+	return result;
 }
 
 /** Private functions */
@@ -202,7 +572,7 @@ btree_leaf *find_leaf(db_table *table, btree_inner *start, md5_t *key) {
 	btree_header *child = table_get_norm_page(table, pg_child);
 
 	// Recurse if another inner node found
-	if (child->type == NODE_LEAF) {
+	if (child->type != NODE_INNER) {
 		return (btree_leaf *)child;
 	} else {
 		return find_leaf(table, (btree_inner *)child, key);
@@ -217,18 +587,23 @@ btree_leaf *find_leaf(db_table *table, btree_inner *start, md5_t *key) {
  * @return Cursor object pointing to location.
  */
 btree_cursor *find_key(db_table *table, md5_t *key) {
+	trace_begin("btree_descend", NULL);
 	btree_cursor *cur = malloc(sizeof(btree_cursor));
 	cur->table = table;
 
-	btree_header *root_header = table_get_norm_page(table, table->cmeta.root_page);
-	btree_leaf *target = (root_header->type == NODE_LEAF) ?
-		(btree_leaf *)root_header :
-		find_leaf(table, (btree_inner *)root_header, key);
+	btree_leaf *target = (btree_leaf *)btree_find_leaf(table, key);
 
 	cur->pg_value = target->header.pg_self;
-	cur->cell_num = leaf_find_cell(target, key);
+	cur->cell_num = (target->header.type == NODE_SLOTTED) ?
+		slotted_find_cell((btree_slotted *)target, key) :
+		leaf_find_cell(target, key);
+	cur->length = 0;
+	cur->pg_record = INVALID_VAL;
+	cur->prefetch = 0;
+	cur->pg_window_parent = INVALID_VAL;
 	cur->end = (cur->cell_num == target->cell_count && target->pg_next_leaf == INVALID_VAL);
 
+	trace_end("btree_descend");
 	return cur;
 }
 
@@ -242,65 +617,154 @@ btree_cursor *find_key(db_table *table, md5_t *key) {
  * @return Success code.
  */
 int leaf_split_insert(btree_leaf *old_node, md5_t *key, void *record, btree_cursor *location) {
+	db_table *table = location->table;
+	uint32_t length = old_node->record_length;
+	uint32_t total = leaf_max_cells(table, old_node) + 1;
+
 	// Create new node
 	page_t page_buf;
-	btree_leaf *new_node = (btree_leaf *)table_new_norm_page(location->table, &page_buf);
-	leaf_init(new_node, page_buf, old_node->record_length);
+	btree_leaf *new_node = (btree_leaf *)table_new_norm_page(table, &page_buf);
+	leaf_init(new_node, page_buf, length);
 
-	// Calculate split sizes
-	uint32_t split_left = (leaf_max_cells(old_node) + 1) / 2;
-	uint32_t split_right = (leaf_max_cells(old_node) + 1) - split_left;
+	// Merge old cells and new record
+	uint8_t *cells = malloc(total * length);
+	uint32_t pos = location->cell_num;
+	memcpy(cells, old_node->records, pos * length);
+	md5_cp((md5_t *)(cells + pos * length), key);
+	memcpy(cells + pos * length + sizeof(md5_t), record, length - sizeof(md5_t));
+	memcpy(cells + (pos + 1) * length, leaf_cell_at(old_node, pos), (old_node->cell_count - pos) * length);
 
 	// Split items between pages
-	for (uint32_t i = 0; i <= leaf_max_cells(old_node); i++) {
-		btree_leaf *target_node = (i >= split_left) ? new_node : old_node;
-		void *dest = leaf_cell_at(target_node, i);
+	uint32_t split_left = total / 2;
+	uint32_t split_right = total - split_left;
+	memcpy(old_node->records, cells, split_left * length);
+	memcpy(new_node->records, cells + split_left * length, split_right * length);
+	free(cells);
 
-		if (i == location->cell_num) {
-			md5_cp((md5_t *)dest, key);
-			memcpy(leaf_cell_body_at(target_node, i), record, target_node->record_length);
-			continue;
-		}
+	old_node->cell_count = split_left;
+	new_node->cell_count = split_right;
 
-		void *src = (i > location->cell_num) ?
-			leaf_cell_at(old_node, i - 1) :
-			leaf_cell_at(old_node, i);
+	// Keep leaf chain intact
+	new_node->pg_next_leaf = old_node->pg_next_leaf;
+	old_node->pg_next_leaf = new_node->header.pg_self;
 
-		memcpy(dest, src, target_node->record_length);
-	}
+	return attach_split(table, (btree_header *)old_node, (btree_header *)new_node,
+		(md5_t *)leaf_cell_at(old_node, split_left - 1));
+}
 
-	// Update counts
-	old_node->cell_count = split_left;
-	new_node->cell_count = split_right;
+/**
+ * @brief Register a split node with its parent.
+ * New node must hold keys right after old node's keys.
+ *
+ * @param[in] table - Table object.
+ * @param[in] old_node - Node that was split (left half).
+ * @param[in] new_node - New node (right half).
+ * @param[in] old_max - Max key remaining in old node.
+ * @return Success code.
+ */
+int attach_split(db_table *table, btree_header *old_node, btree_header *new_node, md5_t *old_max) {
+	page_t page_buf;
+	table_write_norm_page(table, old_node->pg_self);
 
-	// Attach to parent
-	if (old_node->header.is_root) {
-		// Create new root node
-		btree_inner *new_root = table_new_norm_page(location->table, &page_buf);
+	// Splitting root: create new root node
+	if (old_node->is_root) {
+		btree_inner *new_root = table_new_norm_page(table, &page_buf);
 		inner_init(new_root, page_buf);
-		location->table->cmeta.root_page = page_buf;
+		table->cmeta.root_page = page_buf;
 
-		// Attach children
 		new_root->child_count = 1;
-		md5_cp(&new_root->children[0].key, max_key(location->table, (btree_header *)old_node));
-		new_root->children[0].pg_child = old_node->header.pg_self;
-		new_root->pg_right_child = new_node->header.pg_self;
+		md5_cp(&new_root->children[0].key, old_max);
+		new_root->children[0].pg_child = old_node->pg_self;
+		new_root->pg_right_child = new_node->pg_self;
+
+		old_node->is_root = 0;
+		old_node->pg_parent = page_buf;
+		new_node->is_root = 0;
+		new_node->pg_parent = page_buf;
+		return 0;
+	}
+
+	btree_inner *parent = table_write_norm_page(table, old_node->pg_parent);
+	new_node->is_root = 0;
+	new_node->pg_parent = old_node->pg_parent;
+
+	// Find old node's position in parent
+	uint32_t index = 0;
+	while (index < parent->child_count && parent->children[index].pg_child != old_node->pg_self) {
+		index++;
+	}
+
+	if (parent->child_count == inner_keys(table_page_size(table))) {
+		return inner_split_insert(table, parent, index, old_max, new_node->pg_self);
+	}
+
+	// Old node keeps range up to old_max, new node takes its previous slot
+	memmove(&parent->children[index + 1], &parent->children[index],
+		(parent->child_count - index) * sizeof(btree_inner_child));
+	parent->children[index].pg_child = old_node->pg_self;
+	md5_cp(&parent->children[index].key, old_max);
+	if (index == parent->child_count) {
+		parent->pg_right_child = new_node->pg_self;
 	} else {
-		return -1;
-		// TODO: implement
-		/* page_buf = old_node->header.pg_parent; */
-		/* btree_inner *parent = table_get_norm_page(location->table, page_buf); */
-		// TODO: update old node
-		// TODO: internal insert
+		parent->children[index + 1].pg_child = new_node->pg_self;
+	}
+	parent->child_count++;
+
+	return 0;
+}
+
+/**
+ * @brief Split full inner node while inserting a split child.
+ *
+ * @param[in] table - Table object.
+ * @param[in] node - Full inner node.
+ * @param[in] index - Position of the split child (child_count for right child).
+ * @param[in] old_max - Max key of the split child.
+ * @param[in] pg_new - New sibling of the split child.
+ * @return Success code.
+ */
+int inner_split_insert(db_table *table, btree_inner *node, uint32_t index, md5_t *old_max, page_t pg_new) {
+	// Merge entries, right child included as last entry (its key is unused)
+	uint32_t total = node->child_count + 2;
+	btree_inner_child *entries = malloc(total * sizeof(btree_inner_child));
+	memcpy(entries, node->children, index * sizeof(btree_inner_child));
+	entries[index].pg_child = (index == node->child_count) ? node->pg_right_child : node->children[index].pg_child;
+	md5_cp(&entries[index].key, old_max);
+	memcpy(&entries[index + 1], &node->children[index],
+		(node->child_count - index) * sizeof(btree_inner_child));
+	entries[index + 1].pg_child = pg_new;
+	if (index == node->child_count) {
+		md5_zero(&entries[index + 1].key);
 	}
+	entries[total - 1].pg_child = (index == node->child_count) ? pg_new : node->pg_right_child;
 
-	// De-root nodes
-	old_node->header.is_root = 0;
-	old_node->header.pg_parent = page_buf;
+	// Left keeps entries [0, split), entry split becomes its right child
+	uint32_t split = total / 2 - 1;
+	md5_t separator;
+	md5_cp(&separator, &entries[split].key);
+
+	page_t page_buf;
+	btree_inner *new_node = table_new_norm_page(table, &page_buf);
+	inner_init(new_node, page_buf);
 	new_node->header.is_root = 0;
-	new_node->header.pg_parent = page_buf;
 
-	return 0;
+	node->child_count = split;
+	memcpy(node->children, entries, split * sizeof(btree_inner_child));
+	node->pg_right_child = entries[split].pg_child;
+
+	new_node->child_count = total - split - 2;
+	memcpy(new_node->children, &entries[split + 1], new_node->child_count * sizeof(btree_inner_child));
+	new_node->pg_right_child = entries[total - 1].pg_child;
+	free(entries);
+
+	// Children of new node change parent
+	for (uint32_t i = 0; i <= new_node->child_count; i++) {
+		page_t pg_child = (i == new_node->child_count) ? new_node->pg_right_child : new_node->children[i].pg_child;
+		btree_header *child = table_write_norm_page(table, pg_child);
+		child->pg_parent = page_buf;
+	}
+
+	return attach_split(table, (btree_header *)node, (btree_header *)new_node, &separator);
 }
 
 /**
@@ -311,11 +775,1184 @@ int leaf_split_insert(btree_leaf *old_node, md5_t *key, void *record, btree_curs
  * @return Hash key pointer to max key.
  */
 md5_t *max_key(db_table *table, btree_header *node) {
-	if (node->type == NODE_LEAF) {
-		btree_leaf *full_node = (btree_leaf *)node;
-		return (md5_t *)leaf_cell_at(full_node, full_node->cell_count - 1);
+	if (node->type != NODE_INNER) {
+		return leaf_key_at(node, ((btree_leaf *)node)->cell_count - 1);
 	} else {
 		btree_inner *full_node = (btree_inner *)node;
 		return max_key(table, table_get_norm_page(table, full_node->pg_right_child));
 	}
 }
+
+/**
+ * @brief Split the slotted leaf node and insert record at desired location.
+ * Cells are divided by size so both halves hold about the same bytes.
+ *
+ * @param[in] old_node - Old (target) leaf node.
+ * @param[in] key - Hash key pointer.
+ * @param[in] record - Data record to insert.
+ * @param[in] len - Record length.
+ * @param[in] location - Location to place the record.
+ * @return Success code.
+ */
+int slotted_split_insert(btree_slotted *old_node, md5_t *key, const void *record, uint32_t len, btree_cursor *location) {
+	db_table *table = location->table;
+	uint32_t pos = location->cell_num;
+	uint32_t total = old_node->cell_count + 1;
+
+	page_t page_buf;
+	btree_slotted *new_node = table_new_norm_page(table, &page_buf);
+	slotted_init(new_node, page_buf, table_page_size(table));
+
+	// Work from a copy, old node is rebuilt in place
+	btree_slotted *copy = malloc(table_page_size(table));
+	memcpy(copy, old_node, table_page_size(table));
+
+	// Split point: first cell past half of the bytes
+	uint32_t total_bytes = slotted_cell_size(len);
+	for (uint32_t i = 0; i < copy->cell_count; i++) {
+		total_bytes += slotted_cell_size(slotted_cell_at(copy, i)->length);
+	}
+
+	uint32_t split = 0;
+	uint32_t left_bytes = 0;
+	while (split < total - 1 && left_bytes < total_bytes / 2) {
+		uint32_t cell_len = (split == pos) ? len : slotted_cell_at(copy, split - (split > pos))->length;
+		left_bytes += slotted_cell_size(cell_len);
+		split++;
+	}
+
+	// Redistribute cells
+	page_t pg_next = old_node->pg_next_leaf;
+	uint8_t is_root = old_node->header.is_root;
+	page_t pg_parent = old_node->header.pg_parent;
+	slotted_init(old_node, old_node->header.pg_self, table_page_size(table));
+	old_node->header.is_root = is_root;
+	old_node->header.pg_parent = pg_parent;
+
+	for (uint32_t i = 0; i < total; i++) {
+		btree_slotted *target = (i < split) ? old_node : new_node;
+		if (i == pos) {
+			slotted_insert(target, target->cell_count, key, record, len);
+		} else {
+			slotted_cell *cell = slotted_cell_at(copy, i - (i > pos));
+			slotted_insert(target, target->cell_count, &cell->key, cell->payload, cell->length);
+		}
+	}
+	free(copy);
+
+	// Keep leaf chain intact
+	new_node->pg_next_leaf = pg_next;
+	old_node->pg_next_leaf = new_node->header.pg_self;
+
+	return attach_split(table, &old_node->header, &new_node->header,
+		&slotted_cell_at(old_node, old_node->cell_count - 1)->key);
+}
+
+/**
+ * @brief Get key of a leaf cell (any leaf format).
+ *
+ * @param[in] node - Leaf node.
+ * @param[in] i - Cell index.
+ * @return Hash key pointer.
+ */
+md5_t *leaf_key_at(btree_header *node, uint32_t i) {
+	if (node->type == NODE_SLOTTED) {
+		return &slotted_cell_at((btree_slotted *)node, i)->key;
+	}
+
+	return (md5_t *)leaf_cell_at(((btree_leaf *)node), i);
+}
+
+/**
+ * @brief Get record of a leaf cell (any leaf format).
+ *
+ * @param[in] node - Leaf node.
+ * @param[in] i - Cell index.
+ * @param[out] length - Record length.
+ * @return Pointer to record (excluding key).
+ */
+void *leaf_record_at(btree_header *node, uint32_t i, uint32_t *length) {
+	if (node->type == NODE_SLOTTED) {
+		slotted_cell *cell = slotted_cell_at((btree_slotted *)node, i);
+		*length = cell->length;
+		return cell->payload;
+	}
+
+	btree_leaf *leaf = (btree_leaf *)node;
+	*length = leaf_body_length(leaf);
+	return leaf_cell_body_at(leaf, i);
+}
+
+/**
+ * @brief Finish current bulk-load leaf and start the next one.
+ *
+ * @param[in] loader - Bulk loader.
+ * @return New leaf node.
+ */
+btree_header *next_load_leaf(btree_loader *loader) {
+	btree_leaf *leaf = (btree_leaf *)loader->leaf;
+
+	btree_inner_child done = { .pg_child = leaf->header.pg_self };
+	md5_cp(&done.key, leaf_key_at(loader->leaf, leaf->cell_count - 1));
+	vec_push(loader->level, &done);
+
+	page_t page_buf;
+	void *next = table_new_norm_page(loader->table, &page_buf);
+	if (loader->leaf_type == NODE_SLOTTED) {
+		slotted_init(next, page_buf, table_page_size(loader->table));
+	} else {
+		leaf_init(next, page_buf, leaf->record_length);
+	}
+	leaf->pg_next_leaf = page_buf;
+
+	loader->leaf = next;
+	return next;
+}
+
+/**
+ * @brief Read ahead leaves following the cursor's leaf.
+ * Leaf numbers come from the parent: the whole window is queued on entering
+ * a parent, afterwards one more leaf per step keeps it full.
+ *
+ * @param[in] iter - Table iterator.
+ * @param[in] leaf - Leaf the cursor just moved to.
+ */
+void prefetch_leaves(btree_cursor *iter, btree_header *leaf) {
+	if (iter->prefetch == 0 || leaf->is_root) {
+		return;
+	}
+
+	btree_inner *parent = table_get_norm_page(iter->table, leaf->pg_parent);
+	uint32_t index = 0;
+	while (index < parent->child_count && parent->children[index].pg_child != leaf->pg_self) {
+		index++;
+	}
+
+	uint32_t first = (iter->pg_window_parent == leaf->pg_parent) ? index + iter->prefetch : index + 1;
+	iter->pg_window_parent = leaf->pg_parent;
+
+	for (uint32_t i = first; i <= index + iter->prefetch && i <= parent->child_count; i++) {
+		page_t pg_child = (i == parent->child_count) ? parent->pg_right_child : parent->children[i].pg_child;
+		table_prefetch_norm_page(iter->table, pg_child);
+	}
+	table_prefetch_submit(iter->table);
+}
+
+/**
+ * @brief Walk all leaf keys.
+ *
+ * @param[in] table - Table object.
+ * @param[in] filter - Filter to add keys to (NULL to only count).
+ * @return Number of keys.
+ */
+uint64_t scan_keys(db_table *table, bloom_filter *filter) {
+	md5_t zero_key;
+	md5_zero(&zero_key);
+
+	uint64_t count = 0;
+	btree_leaf *leaf = (btree_leaf *)btree_find_leaf(table, &zero_key);
+	while (1) {
+		if (filter != NULL) {
+			for (uint32_t i = 0; i < leaf->cell_count; i++) {
+				bloom_add(filter, leaf_key_at(&leaf->header, i));
+			}
+		}
+		count += leaf->cell_count;
+
+		if (leaf->pg_next_leaf == INVALID_VAL) {
+			return count;
+		}
+		leaf = table_get_norm_page(table, leaf->pg_next_leaf);
+	}
+}
+
+/**
+ * @brief Order batch entries by key, then by batch position (qsort).
+ *
+ * @param[in] a - First entry.
+ * @param[in] b - Second entry.
+ * @return Comparison result.
+ */
+int compare_entries(const void *a, const void *b) {
+	const batch_entry *first = a;
+	const batch_entry *second = b;
+
+	if (md5_eq(*first->key, *second->key)) {
+		return (first->index > second->index) - (first->index < second->index);
+	}
+
+	return md5_ls(*first->key, *second->key) ? -1 : 1;
+}
+
+/**
+ * @brief Find leaf for key along with the largest key it may hold.
+ *
+ * @param[in] table - Table object.
+ * @param[in] key - Hash key pointer.
+ * @param[out] bound - Largest key routed to the leaf.
+ * @param[out] bounded - 0 if the leaf is the rightmost one (no bound).
+ * @return Leaf node best fit for key.
+ */
+btree_leaf *find_leaf_bound(db_table *table, md5_t *key, md5_t *bound, int *bounded) {
+	*bounded = 0;
+
+	// Child keys only narrow going down, the last one seen is the bound
+	btree_header *node = table_get_norm_page(table, table->cmeta.root_page);
+	while (node->type == NODE_INNER) {
+		btree_inner *inner = (btree_inner *)node;
+		uint32_t index = inner_find_child(inner, key);
+		if (index == inner->child_count) {
+			node = table_get_norm_page(table, inner->pg_right_child);
+		} else {
+			md5_cp(bound, &inner->children[index].key);
+			*bounded = 1;
+			node = table_get_norm_page(table, inner->children[index].pg_child);
+		}
+	}
+
+	return (btree_leaf *)node;
+}
+
+/**
+ * @brief Merge sorted batch records into a leaf, splitting it if needed.
+ *
+ * @param[in] table - Table object.
+ * @param[in] leaf - Target leaf node.
+ * @param[in] entries - Sorted records, all routed to the leaf.
+ * @param[in] count - Number of records.
+ * @param[in] mode - Handling of an existing key.
+ * @param[in] filter - Key filter to add new keys to.
+ * @return Success code.
+ */
+int leaf_merge_insert(db_table *table, btree_leaf *leaf, batch_entry *entries, uint32_t count,
+		btree_insert_mode mode, bloom_filter *filter) {
+	if (leaf->header.type != NODE_LEAF) {
+		return -1;
+	}
+	table_write_norm_page(table, leaf->header.pg_self);
+
+	uint32_t length = leaf->record_length;
+	uint8_t *cells = malloc((uint64_t)(leaf->cell_count + count) * length);
+	uint32_t total = 0;
+	uint32_t old = 0;
+	uint32_t i = 0;
+	while (old < leaf->cell_count || i < count) {
+		// Existing cells go first among equal keys
+		if (i == count || (old < leaf->cell_count && !md5_gr(*(md5_t *)leaf_cell_at(leaf, old), *entries[i].key))) {
+			memcpy(cells + total * length, leaf_cell_at(leaf, old), length);
+			total++;
+			old++;
+			continue;
+		}
+
+		// Equal keys are adjacent, so only the last cell can match
+		batch_entry *entry = &entries[i++];
+		uint8_t *cell = cells + total * length;
+		if (mode != INSERT_ALWAYS && total > 0 && md5_eq(*entry->key, *(md5_t *)(cell - length))) {
+			if (mode == INSERT_REPLACE) {
+				memcpy(cell - length + sizeof(md5_t), entry->record, length - sizeof(md5_t));
+			}
+			continue;
+		}
+
+		md5_cp((md5_t *)cell, entry->key);
+		memcpy(cell + sizeof(md5_t), entry->record, length - sizeof(md5_t));
+		bloom_add(filter, entry->key);
+		total++;
+	}
+
+	// Spread cells evenly over as few leaves as hold them
+	uint32_t max = leaf_max_cells(table, leaf);
+	uint32_t pieces = (total + max - 1) / max;
+	uint32_t done = 0;
+	int result = 0;
+	btree_leaf *node = leaf;
+	for (uint32_t p = 0; p < pieces && result == 0; p++) {
+		uint32_t take = total / pieces + (p < total % pieces);
+		if (p > 0) {
+			page_t page_buf;
+			btree_leaf *next = table_new_norm_page(table, &page_buf);
+			leaf_init(next, page_buf, length);
+			memcpy(next->records, cells + done * length, take * length);
+			next->cell_count = take;
+
+			// Keep leaf chain intact
+			next->pg_next_leaf = node->pg_next_leaf;
+			node->pg_next_leaf = page_buf;
+
+			result = attach_split(table, &node->header, &next->header,
+				(md5_t *)leaf_cell_at(node, node->cell_count - 1));
+			node = next;
+		} else {
+			memcpy(node->records, cells, take * length);
+			node->cell_count = take;
+		}
+		done += take;
+	}
+
+	free(cells);
+	return result;
+}
+
+/**
+ * @brief Insert fixed-length record (see btree_insert).
+ *
+ * @param[in] table - Table object.
+ * @param[in] key - Hash key pointer to insert.
+ * @param[in] record - Data record to insert.
+ * @param[in] mode - Handling of an existing key.
+ * @return Status code (1 if an existing record was kept).
+ */
+int insert_fixed(db_table *table, md5_t *key, void *record, btree_insert_mode mode) {
+	if (table_hashed(table)) {
+		return hash_insert(table, key, record, mode);
+	}
+	bloom_filter *filter = btree_key_filter(table);
+
+	// Get insert node
+	btree_cursor *location = find_key(table, key);
+	btree_leaf *target = table_get_norm_page(table, location->pg_value);
+	if (target->header.type != NODE_LEAF) {
+		free(location);
+		return -1;
+	}
+
+	int result = place_fixed(target, location, key, record, mode, filter);
+	free(location);
+	return result;
+}
+
+/**
+ * @brief Insert variable-length record (see btree_insert_var).
+ *
+ * @param[in] table - Table object.
+ * @param[in] key - Hash key pointer to insert.
+ * @param[in] record - Data record to insert.
+ * @param[in] len - Record length.
+ * @param[in] mode - Handling of an existing key.
+ * @return Status code (1 if an existing record was kept).
+ */
+int insert_var(db_table *table, md5_t *key, const void *record, uint32_t len, btree_insert_mode mode) {
+	if (table_hashed(table)) {
+		return insert_hashed(table, key, record, len, mode);
+	}
+	if (len > slotted_max_record(table_page_size(table))) {
+		return -1;
+	}
+	bloom_filter *filter = btree_key_filter(table);
+
+	// Get insert node
+	btree_cursor *location = find_key(table, key);
+	btree_slotted *target = table_get_norm_page(table, location->pg_value);
+	if (target->header.type != NODE_SLOTTED) {
+		free(location);
+		return -1;
+	}
+
+	int result = place_var(target, location, key, record, len, mode, filter);
+	free(location);
+	return result;
+}
+
+/**
+ * @brief Insert fixed-length records in one pass (see btree_insert_many).
+ *
+ * @param[in] table - Table object.
+ * @param[in] keys - Keys to insert.
+ * @param[in] records - Records, in key order of the keys array.
+ * @param[in] record_length - Distance between records.
+ * @param[in] count - Number of records.
+ * @param[in] mode - Handling of existing keys.
+ * @return Status code.
+ */
+int insert_batch(db_table *table, md5_t *keys, const void *records, uint32_t record_length,
+		uint32_t count, btree_insert_mode mode) {
+	if (count == 0) {
+		return 0;
+	}
+
+	// Hash tables have no leaves to merge into
+	if (table_hashed(table)) {
+		int result = 0;
+		for (uint32_t i = 0; i < count && result >= 0; i++) {
+			const uint8_t *record = (const uint8_t *)records + (uint64_t)i * record_length;
+			result = insert_hashed(table, &keys[i], record, record_length, mode);
+		}
+		return (result < 0) ? -1 : 0;
+	}
+
+	btree_leaf *first = (btree_leaf *)btree_find_leaf(table, &keys[0]);
+	if (first->header.type != NODE_LEAF || leaf_body_length(first) > record_length) {
+		return -1;
+	}
+
+	trace_begin("btree_insert_many", NULL);
+	batch_entry *batch = malloc(count * sizeof(batch_entry));
+	for (uint32_t i = 0; i < count; i++) {
+		batch[i].key = &keys[i];
+		batch[i].record = (const uint8_t *)records + (uint64_t)i * record_length;
+		batch[i].index = i;
+	}
+	qsort(batch, count, sizeof(batch_entry), &compare_entries);
+
+	// One descent per target leaf, taking every key up to its bound
+	int result = 0;
+	uint32_t next = 0;
+	while (next < count && result == 0) {
+		bloom_filter *filter = btree_key_filter(table);
+
+		md5_t bound;
+		int bounded;
+		btree_leaf *leaf = find_leaf_bound(table, batch[next].key, &bound, &bounded);
+		uint32_t end = next + 1;
+		while (end < count && (!bounded || !md5_gr(*batch[end].key, bound))) {
+			end++;
+		}
+
+		result = leaf_merge_insert(table, leaf, batch + next, end - next, mode, filter);
+		next = end;
+	}
+
+	free(batch);
+	trace_end("btree_insert_many");
+	return result;
+}
+
+/**
+ * @brief Create loader for fixed-length records (see btree_load_begin).
+ *
+ * @param[in] table - Empty table object.
+ * @param[in] record_length - Length of individual record.
+ * @param[in] fill - Leaf and inner node fill percentage.
+ * @return Loader or NULL.
+ */
+btree_loader *begin_load(db_table *table, uint32_t record_length, uint32_t fill) {
+	if (table_hashed(table) || table->cmeta.total_pages != 0 || fill == 0 || fill > 100) {
+		return NULL;
+	}
+
+	btree_loader *loader = malloc(sizeof(btree_loader));
+	loader->table = table;
+	loader->leaf_type = NODE_LEAF;
+	loader->fill = fill;
+	loader->level = vec_new(sizeof(btree_inner_child));
+
+	page_t page_buf;
+	btree_leaf *leaf = table_new_norm_page(table, &page_buf);
+	leaf_init(leaf, page_buf, record_length + sizeof(md5_t));
+	loader->leaf = &leaf->header;
+	table->cmeta.root_page = page_buf;
+
+	// At least one cell per leaf and two children per inner node
+	loader->leaf_fill = leaf_max_cells(table, leaf) * fill / 100;
+	loader->inner_children = (inner_keys(table_page_size(table)) + 1) * fill / 100;
+	if (loader->leaf_fill < 1) {
+		loader->leaf_fill = 1;
+	}
+	if (loader->inner_children < 2) {
+		loader->inner_children = 2;
+	}
+
+	return loader;
+}
+
+/**
+ * @brief Create loader for variable-length records (see btree_load_begin_slotted).
+ *
+ * @param[in] table - Empty table object.
+ * @param[in] fill - Leaf and inner node fill percentage.
+ * @return Loader or NULL.
+ */
+btree_loader *begin_load_slotted(db_table *table, uint32_t fill) {
+	if (table_hashed(table) || table->cmeta.total_pages != 0 || fill == 0 || fill > 100) {
+		return NULL;
+	}
+
+	btree_loader *loader = malloc(sizeof(btree_loader));
+	loader->table = table;
+	loader->leaf_type = NODE_SLOTTED;
+	loader->fill = fill;
+	loader->level = vec_new(sizeof(btree_inner_child));
+
+	page_t page_buf;
+	btree_slotted *leaf = table_new_norm_page(table, &page_buf);
+	slotted_init(leaf, page_buf, table_page_size(table));
+	loader->leaf = &leaf->header;
+	table->cmeta.root_page = page_buf;
+
+	// Fill is measured in used bytes for slotted leaves
+	loader->leaf_fill = slotted_data_mem(table_page_size(table)) * fill / 100;
+	loader->inner_children = (inner_keys(table_page_size(table)) + 1) * fill / 100;
+	if (loader->inner_children < 2) {
+		loader->inner_children = 2;
+	}
+
+	return loader;
+}
+
+/**
+ * @brief Append fixed-length record to loaded btree (see btree_load_add).
+ *
+ * @param[in] loader - Loader from btree_load_begin.
+ * @param[in] key - Hash key pointer, must be greater than previous key.
+ * @param[in] record - Data record to append.
+ * @return Status code.
+ */
+int load_fixed(btree_loader *loader, md5_t *key, void *record) {
+	if (loader->leaf_type != NODE_LEAF) {
+		return -1;
+	}
+	btree_leaf *leaf = (btree_leaf *)loader->leaf;
+
+	// Keys must arrive in order
+	if (leaf->cell_count > 0 && !md5_gr(*key, *(md5_t *)leaf_cell_at(leaf, leaf->cell_count - 1))) {
+		return -1;
+	}
+
+	// Leaf reached target fill, start next one
+	if (leaf->cell_count == loader->leaf_fill) {
+		leaf = (btree_leaf *)next_load_leaf(loader);
+	}
+
+	md5_cp((md5_t *)leaf_cell_at(leaf, leaf->cell_count), key);
+	memcpy(leaf_cell_body_at(leaf, leaf->cell_count), record, leaf_body_length(leaf));
+	leaf->cell_count++;
+
+	return 0;
+}
+
+/**
+ * @brief Append variable-length record to loaded btree (see btree_load_add_var).
+ *
+ * @param[in] loader - Loader from btree_load_begin_slotted.
+ * @param[in] key - Hash key pointer, must be greater than previous key.
+ * @param[in] record - Data record to append (excluding key).
+ * @param[in] len - Record length.
+ * @return Status code.
+ */
+int load_var(btree_loader *loader, md5_t *key, const void *record, uint32_t len) {
+	uint32_t page_size = table_page_size(loader->table);
+	if (loader->leaf_type != NODE_SLOTTED || len > slotted_max_record(page_size)) {
+		return -1;
+	}
+	btree_slotted *leaf = (btree_slotted *)loader->leaf;
+
+	// Keys must arrive in order
+	if (leaf->cell_count > 0 && !md5_gr(*key, slotted_cell_at(leaf, leaf->cell_count - 1)->key)) {
+		return -1;
+	}
+
+	// Leaf reached target fill (or is full), start next one
+	uint32_t used = slotted_data_mem(page_size) - slotted_free(leaf);
+	uint32_t needed = slotted_cell_size(len) + sizeof(uint16_t);
+	if (leaf->cell_count > 0 && (used + needed > loader->leaf_fill || needed > slotted_free(leaf))) {
+		leaf = (btree_slotted *)next_load_leaf(loader);
+	}
+
+	return slotted_insert(leaf, leaf->cell_count, key, record, len);
+}
+
+/**
+ * @brief Change record length of loaded records (see btree_load_resize).
+ *
+ * @param[in] loader - Loader from btree_load_begin.
+ * @param[in] record_length - Length of individual record.
+ * @return Status code.
+ */
+int resize_load(btree_loader *loader, uint32_t record_length) {
+	if (loader->leaf_type != NODE_LEAF || record_length + sizeof(md5_t) > leaf_data_mem(table_page_size(loader->table))) {
+		return -1;
+	}
+	btree_leaf *leaf = (btree_leaf *)loader->leaf;
+	if (leaf->record_length == record_length + sizeof(md5_t)) {
+		return 0;
+	}
+
+	if (leaf->cell_count > 0) {
+		leaf = (btree_leaf *)next_load_leaf(loader);
+	}
+	leaf->record_length = record_length + sizeof(md5_t);
+
+	loader->leaf_fill = leaf_max_cells(loader->table, leaf) * loader->fill / 100;
+	if (loader->leaf_fill < 1) {
+		loader->leaf_fill = 1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Find record by key (see btree_find).
+ *
+ * @param[in] table - Table object.
+ * @param[in] key - Hash key pointer to find.
+ * @param[out] length - Record length (may be NULL).
+ * @return Pointer to record (excluding key) or NULL if not found.
+ */
+void *find_record(db_table *table, md5_t *key, uint32_t *length) {
+	if (table_hashed(table)) {
+		return find_hashed(table, key, length);
+	}
+
+	// Skip descent for keys never added
+	bloom_filter *filter = table_get_bloom(table);
+	if (filter != NULL && !bloom_maybe(filter, key)) {
+		return NULL;
+	}
+
+	btree_cursor *location = find_key(table, key);
+	btree_header *leaf = table_get_norm_page(table, location->pg_value);
+	uint32_t cell = location->cell_num;
+	free(location);
+
+	if (cell == ((btree_leaf *)leaf)->cell_count || !md5_eq(*key, *leaf_key_at(leaf, cell))) {
+		return NULL;
+	}
+
+	uint32_t buf;
+	return leaf_record_at(leaf, cell, (length != NULL) ? length : &buf);
+}
+
+/**
+ * @brief Find records for many keys in one pass (see btree_find_many).
+ *
+ * @param[in] table - Table object.
+ * @param[in] keys - Hash keys, in any order.
+ * @param[out] records - Record pointers in the order of keys.
+ * @param[out] lengths - Record lengths in the order of keys.
+ * @param[in] count - Number of keys.
+ * @return Number of keys found.
+ */
+uint32_t find_batch(db_table *table, md5_t *keys, void **records, uint32_t *lengths, uint32_t count) {
+	uint32_t found = 0;
+	if (table_hashed(table)) {
+		for (uint32_t i = 0; i < count; i++) {
+			records[i] = find_hashed(table, &keys[i], &lengths[i]);
+			found += (records[i] != NULL);
+		}
+		return found;
+	}
+
+	// Skip keys never added
+	bloom_filter *filter = table_get_bloom(table);
+	batch_entry *batch = malloc((count > 0 ? count : 1) * sizeof(batch_entry));
+	uint32_t total = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		records[i] = NULL;
+		lengths[i] = 0;
+		if (filter == NULL || bloom_maybe(filter, &keys[i])) {
+			batch[total].key = &keys[i];
+			batch[total].record = NULL;
+			batch[total].index = i;
+			total++;
+		}
+	}
+	qsort(batch, total, sizeof(batch_entry), &compare_entries);
+
+	// One descent per leaf, its cells are merged with the keys up to its bound
+	uint32_t next = 0;
+	while (next < total) {
+		md5_t bound;
+		int bounded;
+		btree_header *leaf = (btree_header *)find_leaf_bound(table, batch[next].key, &bound, &bounded);
+		uint32_t cell_count = ((btree_leaf *)leaf)->cell_count;
+		uint32_t cell = 0;
+		do {
+			md5_t *key = batch[next].key;
+			while (cell < cell_count && md5_ls(*leaf_key_at(leaf, cell), *key)) {
+				cell++;
+			}
+			if (cell < cell_count && md5_eq(*key, *leaf_key_at(leaf, cell))) {
+				uint32_t index = batch[next].index;
+				records[index] = leaf_record_at(leaf, cell, &lengths[index]);
+				found++;
+			}
+			next++;
+		} while (next < total && (!bounded || !md5_gr(*batch[next].key, bound)));
+	}
+
+	free(batch);
+	return found;
+}
+
+/**
+ * @brief Advance cursor (see btree_next).
+ *
+ * @param[in] iter - Table iterator.
+ * @return Pointer to record or NULL at the end.
+ */
+void *cursor_next(btree_cursor *iter) {
+	if (iter->end) {
+		return NULL;
+	}
+
+	// Retrieve record
+	btree_leaf *page = table_get_norm_page(iter->table, iter->pg_value);
+	void* record = leaf_record_at(&page->header, iter->cell_num, &iter->length);
+	iter->pg_record = iter->pg_value;
+
+	// Update iterator
+	iter->cell_num++;
+	if (iter->cell_num == page->cell_count) {
+		if (page->pg_next_leaf == INVALID_VAL) {
+			iter->end = 1;
+		} else {
+			iter->pg_value = page->pg_next_leaf;
+			iter->cell_num = 0;
+			prefetch_leaves(iter, table_get_norm_page(iter->table, iter->pg_value));
+		}
+	}
+
+	return record;
+}
+
+/**
+ * @brief Look at record ahead of cursor (see btree_peek).
+ *
+ * @param[in] iter - Table iterator.
+ * @param[in] offset - Records past the next one.
+ * @param[out] length - Record length (may be NULL).
+ * @return Pointer to record or NULL if not in the current leaf.
+ */
+void *cursor_peek(btree_cursor *iter, uint32_t offset, uint32_t *length) {
+	btree_leaf *page = table_get_norm_page(iter->table, iter->pg_value);
+	if (iter->end || iter->cell_num + offset >= page->cell_count) {
+		return NULL;
+	}
+
+	uint32_t buf;
+	return leaf_record_at(&page->header, iter->cell_num + offset, (length != NULL) ? length : &buf);
+}
+
+/**
+ * @brief Start leaf scan reading from the file (see btree_stream_open).
+ *
+ * @param[in] table - Table object.
+ * @return Stream or NULL.
+ */
+btree_stream *open_stream(db_table *table) {
+	if (table_hashed(table)) {
+		fprintf(stderr, "hash tables cannot be streamed\n");
+		return NULL;
+	}
+
+	btree_stream *stream = malloc(sizeof(btree_stream));
+	stream->table = table;
+	stream->leaf = malloc(table_page_size(table));
+	stream->cell_num = 0;
+	stream->end = 0;
+	stream->length = 0;
+
+	if (table->cmeta.root_page == INVALID_VAL) {
+		stream->end = 1;
+		return stream;
+	}
+
+	// Descend along the leftmost children
+	page_t page = table->cmeta.root_page;
+	while (1) {
+		if (table_read_direct(table, page, 0, stream->leaf, table_page_size(table)) < 0) {
+			btree_stream_close(stream);
+			return NULL;
+		}
+
+		if (stream->leaf->type != NODE_INNER) {
+			break;
+		}
+
+		btree_inner *inner = (btree_inner *)stream->leaf;
+		page = (inner->child_count > 0) ? inner->children[0].pg_child : inner->pg_right_child;
+	}
+
+	btree_leaf *leaf = (btree_leaf *)stream->leaf;
+	if (leaf->cell_count == 0 && leaf->pg_next_leaf == INVALID_VAL) {
+		stream->end = 1;
+	}
+
+	return stream;
+}
+
+/**
+ * @brief Advance leaf scan (see btree_stream_next).
+ *
+ * @param[in] stream - Stream object.
+ * @return Pointer to record or NULL at the end.
+ */
+void *stream_next(btree_stream *stream) {
+	// Leaves share cell_count and pg_next_leaf layout
+	btree_leaf *leaf = (btree_leaf *)stream->leaf;
+
+	// Move to next leaf only now, the previous record stays valid until here
+	while (!stream->end && stream->cell_num == leaf->cell_count) {
+		if (leaf->pg_next_leaf == INVALID_VAL || table_read_direct(stream->table, leaf->pg_next_leaf, 0,
+				stream->leaf, table_page_size(stream->table)) < 0) {
+			stream->end = 1;
+		}
+		stream->cell_num = 0;
+	}
+
+	if (stream->end) {
+		return NULL;
+	}
+
+	void *record = leaf_record_at(stream->leaf, stream->cell_num, &stream->length);
+	md5_cp(&stream->key, leaf_key_at(stream->leaf, stream->cell_num));
+	stream->cell_num++;
+
+	if (stream->cell_num == leaf->cell_count && leaf->pg_next_leaf == INVALID_VAL) {
+		stream->end = 1;
+	}
+
+	return record;
+}
+
+/**
+ * @brief Place fixed-length record in its leaf, splitting it if full.
+ *
+ * @param[in] target - Leaf node.
+ * @param[in] location - Location to place the record.
+ * @param[in] key - Hash key pointer to insert.
+ * @param[in] record - Data record to insert.
+ * @param[in] mode - Handling of an existing key.
+ * @param[in] filter - Key filter to add the key to (NULL for none).
+ * @return Status code (1 if an existing record was kept).
+ */
+int place_fixed(btree_leaf *target, btree_cursor *location, md5_t *key, void *record,
+		btree_insert_mode mode, bloom_filter *filter) {
+	db_table *table = location->table;
+
+	// Key may exist, it would be at the insert position
+	uint32_t pos = location->cell_num;
+	if (mode != INSERT_ALWAYS && (filter == NULL || bloom_maybe(filter, key)) && pos < target->cell_count
+			&& md5_eq(*key, *(md5_t *)leaf_cell_at(target, pos))) {
+		if (mode == INSERT_IF_ABSENT) {
+			return 1;
+		}
+
+		table_write_norm_page(table, location->pg_value);
+		memcpy(leaf_cell_body_at(target, pos), record, leaf_body_length(target));
+		return 0;
+	}
+	table_write_norm_page(table, location->pg_value);
+	if (filter != NULL) {
+		bloom_add(filter, key);
+	}
+
+	// Node is full, must split
+	if (target->cell_count == leaf_max_cells(table, target)) {
+		return leaf_split_insert(target, key, record, location);
+	}
+
+	// Inserting in the middle, move bigger elements
+	if (location->cell_num < target->cell_count) {
+		for (uint32_t i = target->cell_count; i > location->cell_num; i--) {
+			void *dest = leaf_cell_at(target, i);
+			void *src = leaf_cell_at(target,  i - 1);
+			memcpy(dest, src, target->record_length);
+		}
+	}
+
+	// Insert record
+	md5_cp((md5_t *)leaf_cell_at(target, location->cell_num), key);
+	memcpy(leaf_cell_body_at(target, location->cell_num), record, leaf_body_length(target));
+
+	target->cell_count++;
+	return 0;
+}
+
+/**
+ * @brief Place variable-length record in its slotted leaf, splitting it if
+ * the record does not fit.
+ *
+ * @param[in] target - Slotted leaf node.
+ * @param[in] location - Location to place the record.
+ * @param[in] key - Hash key pointer to insert.
+ * @param[in] record - Data record to insert.
+ * @param[in] len - Record length.
+ * @param[in] mode - Handling of an existing key.
+ * @param[in] filter - Key filter to add the key to (NULL for none).
+ * @return Status code (1 if an existing record was kept).
+ */
+int place_var(btree_slotted *target, btree_cursor *location, md5_t *key, const void *record, uint32_t len,
+		btree_insert_mode mode, bloom_filter *filter) {
+	db_table *table = location->table;
+	if (len > slotted_max_record(table_page_size(table))) {
+		return -1;
+	}
+
+	// Key may exist, it would be at the insert position
+	uint32_t pos = location->cell_num;
+	if (mode != INSERT_ALWAYS && (filter == NULL || bloom_maybe(filter, key)) && pos < target->cell_count
+			&& md5_eq(*key, slotted_cell_at(target, pos)->key)) {
+		if (mode == INSERT_IF_ABSENT) {
+			return 1;
+		}
+		table_write_norm_page(table, location->pg_value);
+
+		// Same heap size: overwrite in place, otherwise insert anew below
+		slotted_cell *cell = slotted_cell_at(target, pos);
+		if (slotted_cell_size(cell->length) == slotted_cell_size(len)) {
+			cell->length = len;
+			memcpy(cell->payload, record, len);
+			return 0;
+		}
+		slotted_remove(target, pos, table_page_size(table));
+	} else {
+		table_write_norm_page(table, location->pg_value);
+		if (filter != NULL) {
+			bloom_add(filter, key);
+		}
+	}
+
+	// Split if record does not fit
+	int result = slotted_insert(target, location->cell_num, key, record, len);
+	if (result < 0) {
+		result = slotted_split_insert(target, key, record, len, location);
+	}
+
+	return result;
+}
+
+/**
+ * @brief Check if inserting into a node cannot split it.
+ *
+ * @param[in] table - Table object.
+ * @param[in] node - Node (latched).
+ * @param[in] len - Record length for slotted leaves.
+ * @return 1 if safe, 0 if a split may reach the parent.
+ */
+int node_safe(db_table *table, btree_header *node, uint32_t len) {
+	switch (node->type) {
+	case NODE_INNER:
+		return ((btree_inner *)node)->child_count < inner_keys(table_page_size(table));
+	case NODE_SLOTTED:
+		return slotted_free((btree_slotted *)node) >= slotted_cell_size(len) + sizeof(uint16_t);
+	default:
+		return ((btree_leaf *)node)->cell_count < leaf_max_cells(table, ((btree_leaf *)node));
+	}
+}
+
+/**
+ * @brief Latch root node of a shared table.
+ * Inner nodes are read latched, a leaf is write latched if requested.
+ *
+ * @param[in] table - Shared table object.
+ * @param[in] write_leaf - Write latch the root if it is a leaf.
+ * @return Root node (latched) or NULL on failure.
+ */
+btree_header *latch_root(db_table *table, int write_leaf) {
+	// Root cannot split while the root latch is read locked
+	pthread_rwlock_rdlock(&table->shared->root_latch);
+	page_t pg_root = table->cmeta.root_page;
+	btree_header *root = table_get_norm_page(table, pg_root);
+	if (table_latch(table, pg_root, 0) < 0) {
+		root = NULL;
+	} else if (write_leaf && root->type != NODE_INNER) {
+		// Latch is created, relatching cannot fail
+		table_unlatch(table, pg_root);
+		table_latch(table, pg_root, 1);
+	}
+	pthread_rwlock_unlock(&table->shared->root_latch);
+
+	return root;
+}
+
+/**
+ * @brief Descend from a latched node to the leaf for a key, latching each
+ * child before releasing its parent.
+ *
+ * @param[in] table - Shared table object.
+ * @param[in] node - Start node (latched like latch_root, or NULL).
+ * @param[in] key - Hash key pointer.
+ * @param[in] write_leaf - Write latch the leaf.
+ * @return Leaf node (latched) or NULL on failure.
+ */
+btree_header *latch_descend(db_table *table, btree_header *node, md5_t *key, int write_leaf) {
+	while (node != NULL && node->type == NODE_INNER) {
+		btree_inner *inner = (btree_inner *)node;
+		uint32_t index = inner_find_child(inner, key);
+		page_t pg_child = (index == inner->child_count) ? inner->pg_right_child : inner->children[index].pg_child;
+		btree_header *child = table_get_norm_page(table, pg_child);
+
+		// Page types never change, held parent keeps the leaf from splitting
+		if (table_latch(table, pg_child, 0) < 0) {
+			table_unlatch(table, node->pg_self);
+			return NULL;
+		}
+		if (write_leaf && child->type != NODE_INNER) {
+			table_unlatch(table, pg_child);
+			table_latch(table, pg_child, 1);
+		}
+
+		table_unlatch(table, node->pg_self);
+		node = child;
+	}
+
+	return node;
+}
+
+/**
+ * @brief Insert into a write latched leaf.
+ *
+ * @param[in] table - Shared table object.
+ * @param[in] leaf - Leaf node (write latched).
+ * @param[in] key - Hash key pointer to insert.
+ * @param[in] record - Data record to insert.
+ * @param[in] len - Record length.
+ * @param[in] mode - Handling of an existing key.
+ * @return Status code (1 if an existing record was kept).
+ */
+int insert_latched(db_table *table, btree_header *leaf, md5_t *key, const void *record, uint32_t len,
+		btree_insert_mode mode) {
+	btree_cursor location = {
+		.table = table,
+		.pg_value = leaf->pg_self
+	};
+
+	if (leaf->type == NODE_SLOTTED) {
+		location.cell_num = slotted_find_cell((btree_slotted *)leaf, key);
+		return place_var((btree_slotted *)leaf, &location, key, record, len, mode, NULL);
+	}
+
+	btree_leaf *target = (btree_leaf *)leaf;
+	location.cell_num = leaf_find_cell(target, key);
+	return place_fixed(target, &location, key, (void *)record, mode, NULL);
+}
+
+/**
+ * @brief Insert with only the leaf write latched.
+ *
+ * @param[in] table - Shared table object.
+ * @param[in] key - Hash key pointer to insert.
+ * @param[in] record - Data record to insert.
+ * @param[in] len - Record length.
+ * @param[in] mode - Handling of an existing key.
+ * @return Status code, SHARED_RETRY if the leaf may split.
+ */
+int insert_optimistic(db_table *table, md5_t *key, const void *record, uint32_t len, btree_insert_mode mode) {
+	btree_header *leaf = latch_descend(table, latch_root(table, 1), key, 1);
+	if (leaf == NULL) {
+		return -1;
+	}
+
+	int result = SHARED_RETRY;
+	if (node_safe(table, leaf, len)) {
+		result = insert_latched(table, leaf, key, record, len, mode);
+	}
+
+	table_unlatch(table, leaf->pg_self);
+	return result;
+}
+
+/**
+ * @brief Insert with the path write latched from the last node that
+ * cannot split.
+ *
+ * @param[in] table - Shared table object.
+ * @param[in] key - Hash key pointer to insert.
+ * @param[in] record - Data record to insert.
+ * @param[in] len - Record length.
+ * @param[in] mode - Handling of an existing key.
+ * @return Status code.
+ */
+int insert_pessimistic(db_table *table, md5_t *key, const void *record, uint32_t len, btree_insert_mode mode) {
+	page_t held[SHARED_MAX_DEPTH];
+	uint32_t depth = 0;
+
+	// Root latch is kept while the root may split
+	pthread_rwlock_wrlock(&table->shared->root_latch);
+	int root_held = 1;
+	page_t pg_node = table->cmeta.root_page;
+	btree_header *node;
+	while (1) {
+		node = table_get_norm_page(table, pg_node);
+		if (table_latch(table, pg_node, 1) < 0) {
+			node = NULL;
+			break;
+		}
+
+		// Split stops here, ancestors can be released
+		if (node_safe(table, node, len)) {
+			for (uint32_t i = 0; i < depth; i++) {
+				table_unlatch(table, held[i]);
+			}
+			depth = 0;
+			if (root_held) {
+				pthread_rwlock_unlock(&table->shared->root_latch);
+				root_held = 0;
+			}
+		}
+
+		if (depth == SHARED_MAX_DEPTH) {
+			fprintf(stderr, "btree too deep for shared insert\n");
+			exit(EXIT_FAILURE);
+		}
+		held[depth++] = pg_node;
+		if (node->type != NODE_INNER) {
+			break;
+		}
+
+		btree_inner *inner = (btree_inner *)node;
+		uint32_t index = inner_find_child(inner, key);
+		pg_node = (index == inner->child_count) ? inner->pg_right_child : inner->children[index].pg_child;
+	}
+
+	int result = (node != NULL) ? insert_latched(table, node, key, record, len, mode) : -1;
+
+	for (uint32_t i = 0; i < depth; i++) {
+		table_unlatch(table, held[i]);
+	}
+	if (root_held) {
+		pthread_rwlock_unlock(&table->shared->root_latch);
+	}
+
+	return result;
+}
+
+/**
+ * @brief Get record length of a hash table.
+ *
+ * @param[in] table - Hash table object.
+ * @return Record length (excluding key).
+ */
+uint32_t hashed_length(db_table *table) {
+	hash_directory *dir = table_get_norm_page(table, table->cmeta.root_page);
+	return dir->record_length - sizeof(md5_t);
+}
+
+/**
+ * @brief Find record in a hash table (see btree_find).
+ *
+ * @param[in] table - Hash table object.
+ * @param[in] key - Hash key pointer to find.
+ * @param[out] length - Record length (if not NULL).
+ * @return Pointer to record (excluding key) or NULL if not found.
+ */
+void *find_hashed(db_table *table, md5_t *key, uint32_t *length) {
+	void *record = hash_find(table, key);
+	if (record != NULL && length != NULL) {
+		*length = hashed_length(table);
+	}
+
+	return record;
+}
+
+/**
+ * @brief Insert record into a hash table, which only holds records of its
+ * own length (see btree_insert_var).
+ *
+ * @param[in] table - Hash table object.
+ * @param[in] key - Hash key pointer to insert.
+ * @param[in] record - Data record to insert.
+ * @param[in] len - Record length, at least the table's record length.
+ * @param[in] mode - Handling of an existing key.
+ * @return Status code (1 if an existing record was kept).
+ */
+int insert_hashed(db_table *table, md5_t *key, const void *record, uint32_t len, btree_insert_mode mode) {
+	if (len < hashed_length(table)) {
+		fprintf(stderr, "record is shorter than the hash table records\n");
+		return -1;
+	}
+
+	return hash_insert(table, key, record, mode);
+}
@@ -4,11 +4,14 @@
 
 #include "defines.h"
 #include "table.h"
+#include "../util/vector.h"
 
 // Header: node type
 typedef enum {
 	NODE_INNER,
-	NODE_LEAF
+	NODE_LEAF,
+	// Variable-length records, see slotted.h
+	NODE_SLOTTED
 } btree_node_type;
 
 // Node header
@@ -27,33 +30,44 @@ typedef struct {
 	md5_t key;
 } btree_inner_child;
 
-#define INNER_DATA_MEM (PAGE_SIZE - sizeof(btree_header) - sizeof(page_t) - sizeof(uint32_t))
-#define INNER_KEYS (INNER_DATA_MEM / sizeof(btree_inner_child))
-#define INNER_PADDING (INNER_DATA_MEM % sizeof(btree_inner_child))
-
-// Inner node, sizeof = PAGE_SIZE
+// Inner node, children fill the rest of the page
 typedef struct {
 	btree_header header;
 	page_t pg_right_child;
 	// Excluding right child
 	uint32_t child_count;
-	btree_inner_child children[INNER_KEYS];
-	uint8_t _padding[INNER_PADDING];
+	btree_inner_child children[];
 } btree_inner;
 
-/** Leaf/Data Nodes */
+// Get max children (excluding right child) for page size
+#define inner_keys(page_size) (((page_size) - sizeof(btree_inner)) / sizeof(btree_inner_child))
 
-#define LEAF_DATA_MEM (PAGE_SIZE - sizeof(btree_header) - sizeof(page_t) - sizeof(uint32_t) * 2)
+/** Leaf/Data Nodes */
 
-// Leaf node, sizeof = PAGE_SIZE
+// Leaf node, records fill the rest of the page
 typedef struct {
 	btree_header header;
 	page_t pg_next_leaf;
 	uint32_t cell_count;
 	uint32_t record_length;
-	uint8_t records[LEAF_DATA_MEM];
+	uint8_t records[];
 } btree_leaf;
 
+// Get record memory for page size
+#define leaf_data_mem(page_size) ((page_size) - sizeof(btree_leaf))
+
+/** Inserting */
+
+// Handling of keys already in the btree
+typedef enum {
+	// Add another record under the key (caller knows the key is new)
+	INSERT_ALWAYS,
+	// Overwrite existing record
+	INSERT_REPLACE,
+	// Keep existing record
+	INSERT_IF_ABSENT
+} btree_insert_mode;
+
 /** Cursors */
 
 typedef struct {
@@ -61,8 +75,46 @@ typedef struct {
 	page_t pg_value;
 	uint32_t cell_num;
 	uint8_t end;
+	// Length and leaf of last record returned by btree_next
+	uint32_t length;
+	page_t pg_record;
+	// Leaves to read ahead (0 disables) and parent they were taken from
+	uint32_t prefetch;
+	page_t pg_window_parent;
 } btree_cursor;
 
+// Leaf scan reading pages straight from the file, one leaf in memory
+typedef struct {
+	db_table *table;
+	btree_header *leaf;
+	uint32_t cell_num;
+	uint8_t end;
+	// Key and length of last record returned by btree_stream_next
+	md5_t key;
+	uint32_t length;
+} btree_stream;
+
+/** Bulk loading */
+
+typedef struct {
+	db_table *table;
+	btree_node_type leaf_type;
+	// Target fill: cells for fixed leaves, bytes for slotted leaves
+	uint32_t leaf_fill;
+	// Fill percentage the targets come from
+	uint32_t fill;
+	uint32_t inner_children;
+	btree_header *leaf;
+	// Completed nodes of the level being built (btree_inner_child)
+	vector *level;
+} btree_loader;
+
+/** Shared tables */
+
+// Called with each record of a shared scan while its leaf is latched, must
+// not change the table. A nonzero result stops the scan.
+typedef int (*btree_visit)(md5_t *key, const void *record, uint32_t length, void *data);
+
 /**
  * @brief Initialize empty database btree.
  *
@@ -71,28 +123,287 @@ typedef struct {
  */
 void btree_init(db_table *table, uint32_t record_length);
 
+/**
+ * @brief Initialize empty database btree with slotted (variable-length) leaves.
+ *
+ * @param[in] table - Table object.
+ */
+void btree_init_slotted(db_table *table);
+
+/**
+ * @brief Get leaf format of btree.
+ *
+ * @param[in] table - Table object.
+ * @return NODE_LEAF (fixed-length records) or NODE_SLOTTED.
+ */
+btree_node_type btree_leaf_type(db_table *table);
+
 /**
  * @brief Insert record into the database btree.
+ * Keys missing from the key filter skip the duplicate check.
+ *
+ * @param[in] table - Table object.
+ * @param[in] key - Hash key pointer to insert.
+ * @param[in] record - Data record to insert (excluding key).
+ * @param[in] mode - Handling of an existing key.
+ * @return Status code (1 if an existing record was kept).
+ */
+int btree_insert(db_table *table, md5_t *key, void *record, btree_insert_mode mode);
+
+/**
+ * @brief Insert variable-length record into a slotted btree.
  *
  * @param[in] table - Table object.
  * @param[in] key - Hash key pointer to insert.
  * @param[in] record - Data record to insert (excluding key).
+ * @param[in] len - Record length, at most slotted_max_record().
+ * @param[in] mode - Handling of an existing key.
+ * @return Status code (1 if an existing record was kept).
+ */
+int btree_insert_var(db_table *table, md5_t *key, const void *record, uint32_t len, btree_insert_mode mode);
+
+/**
+ * @brief Insert a batch of records into a btree with fixed-length leaves.
+ * The batch is sorted, then each target leaf is found once and merged with
+ * all of its new records in one pass, splitting into as many leaves as needed.
+ * Hash tables take the records one at a time.
+ *
+ * @param[in] table - Table object.
+ * @param[in] keys - Hash keys, in any order.
+ * @param[in] records - Data records (excluding key), in the order of keys.
+ * @param[in] record_length - Distance between records, leaves written with
+ * shorter records store the start of each.
+ * @param[in] count - Number of records.
+ * @param[in] mode - Handling of an existing key, earlier records in the
+ * batch count as existing for later ones with the same key.
  * @return Status code.
  */
-int btree_insert(db_table *table, md5_t *key, void *record);
+int btree_insert_many(db_table *table, md5_t *keys, const void *records, uint32_t record_length,
+	uint32_t count, btree_insert_mode mode);
+
+/**
+ * @brief Get filter over all keys of the btree, building it if the table
+ * has none or it is over capacity. Inserts must add their keys to it.
+ *
+ * @param[in] table - Table object.
+ * @return Filter object (owned by the table).
+ */
+bloom_filter *btree_key_filter(db_table *table);
+
+/**
+ * @brief Start building a btree bottom-up in an empty table.
+ *
+ * @param[in] table - Empty table object.
+ * @param[in] record_length - Length of individual record.
+ * @param[in] fill - Target node fill factor in percent (1-100).
+ * @return Loader object or NULL (also for hash tables).
+ */
+btree_loader *btree_load_begin(db_table *table, uint32_t record_length, uint32_t fill);
+
+/**
+ * @brief Start building a slotted btree bottom-up in an empty table.
+ *
+ * @param[in] table - Empty table object.
+ * @param[in] fill - Target node fill factor in percent (1-100).
+ * @return Loader object or NULL (also for hash tables).
+ */
+btree_loader *btree_load_begin_slotted(db_table *table, uint32_t fill);
+
+/**
+ * @brief Append record to a bulk-loaded btree.
+ *
+ * @param[in] loader - Loader from btree_load_begin.
+ * @param[in] key - Hash key pointer, must be greater than previous key.
+ * @param[in] record - Data record to append (excluding key).
+ * @return Status code.
+ */
+int btree_load_add(btree_loader *loader, md5_t *key, void *record);
+
+/**
+ * @brief Append variable-length record to a bulk-loaded slotted btree.
+ *
+ * @param[in] loader - Loader from btree_load_begin_slotted.
+ * @param[in] key - Hash key pointer, must be greater than previous key.
+ * @param[in] record - Data record to append (excluding key).
+ * @param[in] len - Record length, at most slotted_max_record().
+ * @return Status code.
+ */
+int btree_load_add_var(btree_loader *loader, md5_t *key, const void *record, uint32_t len);
+
+/**
+ * @brief Change record length of records appended next.
+ * Records of the new length start a new leaf (older files mix lengths).
+ *
+ * @param[in] loader - Loader from btree_load_begin.
+ * @param[in] record_length - Length of individual record.
+ * @return Status code.
+ */
+int btree_load_resize(btree_loader *loader, uint32_t record_length);
+
+/**
+ * @brief Build inner levels and free loader.
+ *
+ * @param[in] loader - Loader from btree_load_begin.
+ * @return Status code.
+ */
+int btree_load_end(btree_loader *loader);
+
+/**
+ * @brief Find record by key.
+ * Records changed in place are saved only once marked (btree_touch_key).
+ *
+ * @param[in] table - Table object.
+ * @param[in] key - Hash key pointer to find.
+ * @param[out] length - Record length (if not NULL).
+ * @return Pointer to record (excluding key) or NULL if not found.
+ */
+void *btree_find(db_table *table, md5_t *key, uint32_t *length);
+
+/**
+ * @brief Find records for many keys in one pass.
+ * The keys are sorted and each leaf holding any of them is found once, then
+ * walked alongside its keys. Hash tables look up the keys one at a time.
+ *
+ * @param[in] table - Table object.
+ * @param[in] keys - Hash keys, in any order.
+ * @param[out] records - Record pointers (excluding key) in the order of keys,
+ * NULL where not found. Valid until the table is changed.
+ * @param[out] lengths - Record lengths in the order of keys.
+ * @param[in] count - Number of keys.
+ * @return Number of keys found.
+ */
+uint32_t btree_find_many(db_table *table, md5_t *keys, void **records, uint32_t *lengths, uint32_t count);
+
+/**
+ * @brief Mark the page holding a key's record as changed, so the record
+ * written in place is saved.
+ *
+ * @param[in] table - Table object.
+ * @param[in] key - Hash key pointer of the record.
+ */
+void btree_touch_key(db_table *table, md5_t *key);
+
+/**
+ * @brief Find leaf that holds a key or would hold it if inserted.
+ * Used by specialized btrees (see btree_typed.h).
+ *
+ * @param[in] table - Table object.
+ * @param[in] key - Hash key pointer.
+ * @return Leaf node (any leaf format).
+ */
+btree_header *btree_find_leaf(db_table *table, md5_t *key);
 
 /**
  * @brief Create new table iterator cursor.
  *
  * @param[in] table - Table from which to read.
- * @return Returns cursor to first element, should be walked with btree_next
+ * @return Returns cursor to first element, should be walked with btree_next.
+ * NULL for hash tables, which are walked with hash_iter.
  */
 btree_cursor *btree_iter(db_table *table);
 
 /**
  * @brief Returns next record of a table.
+ * Upcoming leaves are prefetched while walking, see btree_cursor.prefetch.
  *
  * @param[in/out] iter - Table iterator obtained from btree_iter.
  * @return Pointer to record.
  */
 void *btree_next(btree_cursor *iter);
+
+/**
+ * @brief Look at a record ahead of the cursor in the current leaf.
+ *
+ * @param[in] iter - Table iterator.
+ * @param[in] offset - Records past the next one.
+ * @param[out] length - Record length (if not NULL).
+ * @return Pointer to record or NULL if past the current leaf.
+ */
+void *btree_peek(btree_cursor *iter, uint32_t offset, uint32_t *length);
+
+/**
+ * @brief Mark the leaf of the last record returned by btree_next as changed,
+ * so the record written in place is saved.
+ *
+ * @param[in] iter - Table iterator.
+ */
+void btree_touch(btree_cursor *iter);
+
+/**
+ * @brief Start a scan that bypasses the page cache, for reading many tables
+ * at once in bounded memory. The table must have no unsaved changes.
+ *
+ * @param[in] table - Table object.
+ * @return Stream object or NULL on read error or for hash tables.
+ */
+btree_stream *btree_stream_open(db_table *table);
+
+/**
+ * @brief Get next record in key order.
+ * The record is valid until the next call.
+ *
+ * @param[in] stream - Stream object.
+ * @return Pointer to record (excluding key) or NULL at the end.
+ */
+void *btree_stream_next(btree_stream *stream);
+
+/**
+ * @brief Delete stream.
+ *
+ * @param[in] stream - Stream object.
+ */
+void btree_stream_close(btree_stream *stream);
+
+/**
+ * @brief Let threads use the btree at once through the btree_shared_* calls
+ * (see table_share). Writers latch pages top-down and release ancestors once
+ * a node cannot split. The key filter is dropped until btree_unshare.
+ *
+ * @param[in] table - Table object with a btree.
+ * @return Success code.
+ */
+int btree_share(db_table *table);
+
+/**
+ * @brief Return btree to single-threaded use, once all threads are done.
+ * Rebuilds the key filter.
+ *
+ * @param[in] table - Table object.
+ */
+void btree_unshare(db_table *table);
+
+/**
+ * @brief Insert record into a shared btree (see btree_insert).
+ *
+ * @param[in] table - Shared table object.
+ * @param[in] key - Hash key pointer to insert.
+ * @param[in] record - Data record to insert.
+ * @param[in] len - Record length for slotted leaves (ignored for fixed leaves).
+ * @param[in] mode - Handling of an existing key.
+ * @return Status code (1 if an existing record was kept).
+ */
+int btree_shared_insert(db_table *table, md5_t *key, const void *record, uint32_t len, btree_insert_mode mode);
+
+/**
+ * @brief Find record in a shared btree and copy it out.
+ *
+ * @param[in] table - Shared table object.
+ * @param[in] key - Hash key pointer to find.
+ * @param[out] record - Buffer for the record (excluding key).
+ * @param[in] size - Buffer size, longer records are cut short.
+ * @param[out] length - Record length (may be NULL).
+ * @return 1 if found, 0 if not, -1 on error.
+ */
+int btree_shared_find(db_table *table, md5_t *key, void *record, uint32_t size, uint32_t *length);
+
+/**
+ * @brief Visit records of a shared btree in key order. Leaves are latched
+ * one at a time, so records inserted meanwhile may or may not be visited.
+ *
+ * @param[in] table - Shared table object.
+ * @param[in] visit - Called with each record.
+ * @param[in] data - Passed to visit.
+ * @return 0 after the last record, otherwise the result that stopped the scan
+ * (-1 on error).
+ */
+int btree_shared_scan(db_table *table, btree_visit visit, void *data);
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "defines.h"
+#include "table.h"
+#include "btree.h"
+#include "bloom.h"
+#include "capture.h"
+
+// Type-specialized btree for fixed-length records.
+//
+// BTREE_DEFINE(prefix, type) defines prefix_btree_find, prefix_btree_insert
+// and prefix_btree_load_add, working like their generic counterparts but with
+// the record length known at compile time. Cell offsets and copies use a
+// constant stride, so the compiler folds and unrolls them.
+//
+// Only leaves made for the type are handled in place. Splits, slotted leaves
+// and leaves written with another record length (older files) go through the
+// generic functions.
+//
+// Calls are captured as their generic counterparts (see capture.h).
+
+// Cell length (key and record) of a record type
+#define btree_cell_length(record_type) (sizeof(md5_t) + sizeof(record_type))
+
+// Check if leaf holds cells of a record type
+#define btree_leaf_of(leaf, record_type) \
+	((leaf)->header.type == NODE_LEAF && (leaf)->record_length == btree_cell_length(record_type))
+
+#define BTREE_DEFINE(prefix, record_type) \
+\
+/**
+ * @brief Find position or best placement of key inside leaf node.
+ *
+ * @param[in] leaf - Leaf node holding cells of the type.
+ * @param[in] key - Hash key pointer.
+ * @return Cell index inside leaf node.
+ */ \
+static inline uint32_t prefix##_leaf_find_cell(btree_leaf *leaf, md5_t *key) { \
+	uint32_t min = 0; \
+	uint32_t max = leaf->cell_count; \
+	while (min != max) { \
+		uint32_t cell = (min + max) / 2; \
+		md5_t *cell_key = (md5_t *)(leaf->records + btree_cell_length(record_type) * cell); \
+		if (md5_eq(*key, *cell_key)) { \
+			return cell; \
+		} \
+		if (md5_ls(*key, *cell_key)) { \
+			max = cell; \
+		} else { \
+			min = cell + 1; \
+		} \
+	} \
+	return min; \
+} \
+\
+/**
+ * @brief Find record by key (see btree_find).
+ *
+ * @param[in] table - Table object.
+ * @param[in] key - Hash key pointer to find.
+ * @param[out] length - Record length, shorter than the type for older records.
+ * @return Pointer to record (excluding key) or NULL if not found.
+ */ \
+static inline record_type *prefix##_find_record(db_table *table, md5_t *key, uint32_t *length) { \
+	if (table_hashed(table)) { \
+		return btree_find(table, key, length); \
+	} \
+	bloom_filter *filter = table_get_bloom(table); \
+	if (filter != NULL && !bloom_maybe(filter, key)) { \
+		return NULL; \
+	} \
+	btree_leaf *leaf = (btree_leaf *)btree_find_leaf(table, key); \
+	if (!btree_leaf_of(leaf, record_type)) { \
+		return btree_find(table, key, length); \
+	} \
+	uint32_t cell = prefix##_leaf_find_cell(leaf, key); \
+	uint8_t *found = leaf->records + btree_cell_length(record_type) * cell; \
+	if (cell == leaf->cell_count || !md5_eq(*key, *(md5_t *)found)) { \
+		return NULL; \
+	} \
+	if (length != NULL) { \
+		*length = sizeof(record_type); \
+	} \
+	return (record_type *)(found + sizeof(md5_t)); \
+} \
+\
+static inline record_type *prefix##_btree_find(db_table *table, md5_t *key, uint32_t *length) { \
+	uint64_t start = capture_begin(); \
+	record_type *record = prefix##_find_record(table, key, length); \
+	capture_end(start, table, CAPTURE_FIND, record != NULL, key, 0, 0); \
+	return record; \
+} \
+\
+/**
+ * @brief Insert record into the database btree (see btree_insert).
+ *
+ * @param[in] table - Table object.
+ * @param[in] key - Hash key pointer to insert.
+ * @param[in] record - Data record to insert.
+ * @param[in] mode - Handling of an existing key.
+ * @return Status code (1 if an existing record was kept).
+ */ \
+static inline int prefix##_insert_record(db_table *table, md5_t *key, const record_type *record, \
+		btree_insert_mode mode) { \
+	if (table_hashed(table)) { \
+		return btree_insert(table, key, (void *)record, mode); \
+	} \
+	bloom_filter *filter = btree_key_filter(table); \
+	btree_leaf *leaf = (btree_leaf *)btree_find_leaf(table, key); \
+	uint32_t max_cells = leaf_data_mem(table_page_size(table)) / btree_cell_length(record_type); \
+	if (!btree_leaf_of(leaf, record_type) || leaf->cell_count == max_cells) { \
+		return btree_insert(table, key, (void *)record, mode); \
+	} \
+	uint32_t pos = prefix##_leaf_find_cell(leaf, key); \
+	uint8_t *cell = leaf->records + btree_cell_length(record_type) * pos; \
+	if (mode != INSERT_ALWAYS && bloom_maybe(filter, key) && pos < leaf->cell_count \
+			&& md5_eq(*key, *(md5_t *)cell)) { \
+		if (mode == INSERT_IF_ABSENT) { \
+			return 1; \
+		} \
+		table_write_norm_page(table, leaf->header.pg_self); \
+		memcpy(cell + sizeof(md5_t), record, sizeof(record_type)); \
+		return 0; \
+	} \
+	table_write_norm_page(table, leaf->header.pg_self); \
+	bloom_add(filter, key); \
+	memmove(cell + btree_cell_length(record_type), cell, (leaf->cell_count - pos) * btree_cell_length(record_type)); \
+	md5_cp((md5_t *)cell, key); \
+	memcpy(cell + sizeof(md5_t), record, sizeof(record_type)); \
+	leaf->cell_count++; \
+	return 0; \
+} \
+\
+static inline int prefix##_btree_insert(db_table *table, md5_t *key, const record_type *record, \
+		btree_insert_mode mode) { \
+	uint64_t start = capture_begin(); \
+	int result = prefix##_insert_record(table, key, record, mode); \
+	capture_end(start, table, CAPTURE_INSERT, mode, key, 0, 0); \
+	return result; \
+} \
+\
+/**
+ * @brief Append record to a bulk-loaded btree (see btree_load_add).
+ *
+ * @param[in] loader - Loader from btree_load_begin.
+ * @param[in] key - Hash key pointer, must be greater than previous key.
+ * @param[in] record - Data record to append.
+ * @return Status code.
+ */ \
+static inline int prefix##_load_record(btree_loader *loader, md5_t *key, const record_type *record) { \
+	btree_leaf *leaf = (btree_leaf *)loader->leaf; \
+	if (!btree_leaf_of(leaf, record_type) || leaf->cell_count == 0 || leaf->cell_count == loader->leaf_fill) { \
+		return btree_load_add(loader, key, (void *)record); \
+	} \
+	uint8_t *cell = leaf->records + btree_cell_length(record_type) * leaf->cell_count; \
+	if (!md5_gr(*key, *(md5_t *)(cell - btree_cell_length(record_type)))) { \
+		return -1; \
+	} \
+	md5_cp((md5_t *)cell, key); \
+	memcpy(cell + sizeof(md5_t), record, sizeof(record_type)); \
+	leaf->cell_count++; \
+	return 0; \
+} \
+\
+static inline int prefix##_btree_load_add(btree_loader *loader, md5_t *key, const record_type *record) { \
+	uint64_t start = capture_begin(); \
+	int result = prefix##_load_record(loader, key, record); \
+	capture_end(start, loader->table, CAPTURE_LOAD_ADD, 0, key, 0, 0); \
+	return result; \
+}
@@ -0,0 +1,158 @@
+#include "capture.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "defines.h"
+#include "table.h"
+
+FILE *capture_file = NULL;
+
+static pid_t capture_pid;
+// Calls being timed, only the outermost is recorded
+static uint32_t capture_depth = 0;
+static uint16_t capture_tables = 0;
+
+static const char *op_names[CAPTURE_OP_COUNT] = {
+	"open", "flush", "close", "compress", "replace",
+	"init", "init_slotted", "insert", "insert_var", "insert_many", "batch_key", "find",
+	"find_many",
+	"iter", "next", "peek", "stream_open", "stream_next", "stream_close",
+	"load_begin", "load_begin_slotted", "load_add", "load_add_var", "load_resize", "load_end",
+	"ext_insert", "ext_view", "ext_read", "ext_read_direct", "ext_access", "ext_prefetch",
+	"hash_init", "hash_insert", "hash_find", "hash_iter", "hash_next"
+};
+
+void capture_close(void);
+uint64_t now_ns(void);
+void write_record(capture_record *record);
+
+void capture_init(void) {
+	const char *path = getenv(CAPTURE_ENV);
+	if (path == NULL || *path == '\0') {
+		return;
+	}
+
+	capture_file = fopen(path, "wb");
+	if (capture_file == NULL) {
+		fprintf(stderr, "warning: failed to open capture file %s\n", path);
+		return;
+	}
+
+	capture_pid = getpid();
+	capture_header header = {
+		.magic = CAPTURE_MAGIC,
+		.version = CAPTURE_VERSION
+	};
+	fwrite(&header, sizeof(capture_header), 1, capture_file);
+	atexit(&capture_close);
+}
+
+uint64_t capture_start(void) {
+	capture_depth++;
+	return now_ns();
+}
+
+int capture_stop(uint64_t start, db_table *table, capture_op op, uint8_t mode, const void *key,
+		uint32_t length, uint64_t arg) {
+	uint64_t end = now_ns();
+	if (--capture_depth > 0) {
+		return 0;
+	}
+
+	// Forked children must not write into the parent's capture
+	if (getpid() != capture_pid) {
+		return 0;
+	}
+
+	if (op == CAPTURE_OPEN && table != NULL) {
+		table->capture_id = ++capture_tables;
+	}
+
+	capture_record record = {
+		.op = op,
+		.mode = mode,
+		.table = (table != NULL) ? table->capture_id : 0,
+		.length = length,
+		.nsec = end - start,
+		.arg = arg
+	};
+	if (key != NULL) {
+		memcpy(record.key, key, sizeof(record.key));
+	} else {
+		memset(record.key, 0, sizeof(record.key));
+	}
+	write_record(&record);
+
+	return 1;
+}
+
+uint64_t capture_path(const char *path) {
+	uint64_t hash = 0xcbf29ce484222325;
+	for (const char *c = path; *c != '\0'; c++) {
+		hash = (hash ^ (uint8_t)*c) * 0x100000001b3;
+	}
+
+	return hash;
+}
+
+void capture_keys(db_table *table, md5_t *keys, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		capture_record record = {
+			.op = CAPTURE_BATCH_KEY,
+			.mode = 0,
+			.table = table->capture_id,
+			.length = 0,
+			.nsec = 0,
+			.arg = i
+		};
+		memcpy(record.key, &keys[i], sizeof(record.key));
+		write_record(&record);
+	}
+}
+
+const char *capture_op_name(capture_op op) {
+	return (op < CAPTURE_OP_COUNT) ? op_names[op] : "unknown";
+}
+
+/** Private functions */
+
+/**
+ * @brief Close capture file.
+ */
+void capture_close(void) {
+	if (capture_file == NULL || getpid() != capture_pid) {
+		return;
+	}
+
+	fclose(capture_file);
+	capture_file = NULL;
+}
+
+/**
+ * @brief Get monotonic time.
+ *
+ * @return Nanoseconds.
+ */
+uint64_t now_ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * @brief Append record to capture file.
+ *
+ * @param[in] record - Record.
+ */
+void write_record(capture_record *record) {
+	if (fwrite(record, sizeof(capture_record), 1, capture_file) != 1) {
+		fprintf(stderr, "warning: failed to write capture, stopping\n");
+		fclose(capture_file);
+		capture_file = NULL;
+	}
+}
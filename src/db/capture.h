@@ -0,0 +1,155 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "defines.h"
+#include "table.h"
+
+#define CAPTURE_ENV "PMM_CAPTURE"
+// File tag ("PMMC") and record layout version
+#define CAPTURE_MAGIC 0x434d4d50
+#define CAPTURE_VERSION 2
+// Open mode flags: file already held pages, writer lock was taken,
+// opened read-only
+#define CAPTURE_EXISTING 0x1
+#define CAPTURE_LOCKED 0x2
+#define CAPTURE_READ_ONLY 0x4
+
+// Captured storage calls, shared btree calls (btree_shared_*) are not captured
+typedef enum {
+	// Tables: key holds the path hash (capture_path), length the page size,
+	// arg the identity and mode the open mode flags
+	CAPTURE_OPEN,
+	CAPTURE_FLUSH,
+	CAPTURE_CLOSE,
+	// Mode is the compression choice
+	CAPTURE_COMPRESS,
+	// Key holds the source path hash, arg the destination path hash and mode
+	// is set if the file was replaced
+	CAPTURE_REPLACE,
+	// Btrees: length is the record length where one is given
+	CAPTURE_INIT,
+	CAPTURE_INIT_SLOTTED,
+	CAPTURE_INSERT,
+	CAPTURE_INSERT_VAR,
+	// Arg is the key count, the keys follow as CAPTURE_BATCH_KEY records
+	CAPTURE_INSERT_MANY,
+	CAPTURE_BATCH_KEY,
+	// Mode is set if the key was found
+	CAPTURE_FIND,
+	// As CAPTURE_INSERT_MANY, mode is set if any key was found
+	CAPTURE_FIND_MANY,
+	CAPTURE_ITER,
+	CAPTURE_NEXT,
+	// Arg is the offset
+	CAPTURE_PEEK,
+	CAPTURE_STREAM_OPEN,
+	CAPTURE_STREAM_NEXT,
+	CAPTURE_STREAM_CLOSE,
+	// Arg is the fill
+	CAPTURE_LOAD_BEGIN,
+	CAPTURE_LOAD_BEGIN_SLOTTED,
+	CAPTURE_LOAD_ADD,
+	CAPTURE_LOAD_ADD_VAR,
+	CAPTURE_LOAD_RESIZE,
+	CAPTURE_LOAD_END,
+	// Ext data: key holds the locator (ext_t), length the bytes read and
+	// arg the offset read from
+	CAPTURE_EXT_INSERT,
+	CAPTURE_EXT_VIEW,
+	CAPTURE_EXT_READ,
+	CAPTURE_EXT_READ_DIRECT,
+	CAPTURE_EXT_ACCESS,
+	CAPTURE_EXT_PREFETCH,
+	// Hash tables: as their btree counterparts
+	CAPTURE_HASH_INIT,
+	CAPTURE_HASH_INSERT,
+	CAPTURE_HASH_FIND,
+	CAPTURE_HASH_ITER,
+	CAPTURE_HASH_NEXT,
+	CAPTURE_OP_COUNT
+} capture_op;
+
+// File header
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+} capture_header;
+
+// Captured call, records follow the header back to back
+typedef struct {
+	uint8_t op;
+	// Insert mode or flag, see capture_op
+	uint8_t mode;
+	// Table the call worked on, numbered from 1 in open order
+	uint16_t table;
+	uint32_t length;
+	// Call duration
+	uint64_t nsec;
+	uint64_t arg;
+	// Key or ext locator
+	uint8_t key[16];
+} capture_record;
+
+// Capture output, NULL when capturing is disabled
+extern FILE *capture_file;
+
+// Start timing a storage call (0 when disabled)
+#define capture_begin() ((capture_file != NULL) ? capture_start() : 0)
+// Record a storage call started with capture_begin (no-op when disabled)
+#define capture_end(start, table, op, mode, key, length, arg) \
+	do { if (capture_file != NULL) capture_stop(start, table, op, mode, key, length, arg); } while (0)
+
+/**
+ * @brief Enable capturing if PMM_CAPTURE is set in the environment.
+ */
+void capture_init(void);
+
+/**
+ * @brief Start timing a storage call. Use the capture_begin macro.
+ * Calls made while another is timed are part of it and not recorded.
+ *
+ * @return Start time (ns).
+ */
+uint64_t capture_start(void);
+
+/**
+ * @brief Record a storage call. Use the capture_end macro.
+ *
+ * @param[in] start - Start time from capture_start.
+ * @param[in] table - Table the call worked on.
+ * @param[in] op - Call.
+ * @param[in] mode - Insert mode or flag.
+ * @param[in] key - Key or ext locator (16 bytes) or NULL.
+ * @param[in] length - Record or data length.
+ * @param[in] arg - Call argument, see capture_op.
+ * @return 1 if the call was recorded (not nested in another).
+ */
+int capture_stop(uint64_t start, db_table *table, capture_op op, uint8_t mode, const void *key,
+	uint32_t length, uint64_t arg);
+
+/**
+ * @brief Hash table path, identifying the file across opens.
+ *
+ * @param[in] path - Table path.
+ * @return Path hash (FNV-1a).
+ */
+uint64_t capture_path(const char *path);
+
+/**
+ * @brief Record keys of a recorded CAPTURE_INSERT_MANY or CAPTURE_FIND_MANY call.
+ *
+ * @param[in] table - Table the call worked on.
+ * @param[in] keys - Keys as passed to the call.
+ * @param[in] count - Number of keys.
+ */
+void capture_keys(db_table *table, md5_t *keys, uint32_t count);
+
+/**
+ * @brief Get name of a captured call.
+ *
+ * @param[in] op - Call.
+ * @return Name.
+ */
+const char *capture_op_name(capture_op op);
@@ -7,12 +7,30 @@
 typedef unsigned __int128 uint128_t;
 #endif // __GNUC__
 
-#define PAGE_SIZE 4096
-#define INVALID_VAL UINT32_MAX
+// Page size limits (powers of two), chosen per table at creation
+#define PAGE_SIZE_MIN 512
+#define PAGE_SIZE_MAX 65536
+#define DEFAULT_PAGE_SIZE 4096
+#define valid_page_size(size) ((size) >= PAGE_SIZE_MIN && (size) <= PAGE_SIZE_MAX && ((size) & ((size) - 1)) == 0)
+
+// Metadata format version
+// Versions 1 and 2 use 32-bit page numbers and are rewritten on open
+// Version 3 has no page map and is rewritten by the first save
+#define META_VERSION 4
+#define META_VERSION_COMPACT 3
+#define META_VERSION_32 2
+// Flags kept in the high bits of the version field
+#define META_EXT_COMPRESSED 0x80000000u
+#define META_BLOOM 0x40000000u
+#define META_HASH 0x20000000u
+#define META_FLAGS (META_EXT_COMPRESSED | META_BLOOM | META_HASH)
+#define meta_version(meta) ((meta).version & ~META_FLAGS)
+#define INVALID_VAL UINT64_MAX
+#define INVALID_VAL_32 UINT32_MAX
 #define INVALID_EXT UINT64_MAX
 
 // Btree Entry Types
-typedef uint32_t page_t;
+typedef uint64_t page_t;
 #ifdef uint128_t
 typedef uint128_t md5_t;
 #else
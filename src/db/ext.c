@@ -1,37 +1,201 @@
 #include "ext.h"
 
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "defines.h"
 #include "table.h"
+#include "capture.h"
 
-#define ext_page(ptr) ((ptr) / PAGE_SIZE)
-#define ext_part(ptr) ((ptr) % PAGE_SIZE)
-#define ext_space(ptr) (PAGE_SIZE - ext_part(ptr))
+// Most overflow pages queued by one prefetch
+#define PREFETCH_OVERFLOW_MAX 16
+
+#define ext_page(ptr, size) ((ptr) / (size))
+#define ext_part(ptr, size) ((ptr) % (size))
+#define ext_space(ptr, size) ((size) - ext_part(ptr, size))
+
+const void *view_data(db_table *table, ext_t *locator);
+uint64_t read_data(db_table *table, ext_t *locator, uint64_t offset, void *buf, uint64_t n);
+int read_file(db_table *table, ext_t *locator, void *buf);
 
 ext_t ext_insert(db_table *table, const void *data, const uint64_t len) {
-	// Find new location
+	uint64_t start = capture_begin();
+	uint32_t page_size = table_page_size(table);
+
+	// Values that fit in a page never cross into the next one (see ext_view),
+	// larger ones fill the current page and continue in overflow pages
 	uint64_t end_ptr = table->cmeta.ext_end_ptr;
-	void *ext_page = (ext_space(end_ptr) < len || ext_part(end_ptr) == 0) ?
-		table_new_ext_page(table, NULL) :
-		table_get_ext_page(table, ext_page(end_ptr));
-	void *dest = ext_page + ext_part(end_ptr);
-
-	// Write to page
-	memcpy(dest, data, len);
-	ext_t loc = {
-		.ptr = end_ptr,
-		.len = len
-	};
+	uint64_t pos = end_ptr;
+	if (ext_part(end_ptr, page_size) == 0 || (len <= page_size && ext_space(end_ptr, page_size) < len)) {
+		pos = UINT64_MAX;
+	}
+
+	ext_t loc = { .ptr = pos, .len = len };
+	uint64_t written = 0;
+	do {
+		void *ext_page;
+		if (pos == UINT64_MAX || ext_part(pos, page_size) == 0) {
+			page_t index;
+			ext_page = table_new_ext_page(table, &index);
+			pos = (uint64_t)index * page_size;
+			if (written == 0) {
+				loc.ptr = pos;
+			}
+		} else {
+			ext_page = table_write_ext_page(table, ext_page(pos, page_size));
+		}
+
+		uint64_t chunk = ext_space(pos, page_size);
+		if (chunk > len - written) {
+			chunk = len - written;
+		}
+
+		memcpy(ext_page + ext_part(pos, page_size), (const uint8_t *)data + written, chunk);
+		written += chunk;
+		pos += chunk;
+	} while (written < len);
 
 	// Increment end
-	table->cmeta.ext_end_ptr += len;
+	table->cmeta.ext_end_ptr = pos;
 
+	capture_end(start, table, CAPTURE_EXT_INSERT, 0, &loc, len, 0);
 	return loc;
 }
 
+const void *ext_view(db_table *table, ext_t *locator) {
+	uint64_t start = capture_begin();
+	const void *data = view_data(table, locator);
+	capture_end(start, table, CAPTURE_EXT_VIEW, data != NULL, locator, 0, 0);
+	return data;
+}
+
+uint64_t ext_read(db_table *table, ext_t *locator, uint64_t offset, void *buf, uint64_t n) {
+	uint64_t start = capture_begin();
+	uint64_t done = read_data(table, locator, offset, buf, n);
+	capture_end(start, table, CAPTURE_EXT_READ, 0, locator, done, offset);
+	return done;
+}
+
+int ext_read_direct(db_table *table, ext_t *locator, void *buf) {
+	uint64_t start = capture_begin();
+	int result = read_file(table, locator, buf);
+	capture_end(start, table, CAPTURE_EXT_READ_DIRECT, 0, locator, locator->len, 0);
+	return result;
+}
+
 void ext_access(db_table *table, ext_t *locator, void *buf) {
-	void *page = table_get_ext_page(table, ext_page(locator->ptr));
-	void *src = page + ext_part(locator->ptr);
-	memcpy(buf, src, locator->len);
+	uint64_t start = capture_begin();
+	ext_read(table, locator, 0, buf, locator->len);
+	capture_end(start, table, CAPTURE_EXT_ACCESS, 0, locator, locator->len, 0);
+}
+
+void ext_prefetch(db_table *table, ext_t *locator) {
+	uint64_t start = capture_begin();
+	uint32_t page_size = table_page_size(table);
+	page_t first = ext_page(locator->ptr, page_size);
+	page_t last = ext_page(locator->ptr + (locator->len > 0 ? locator->len - 1 : 0), page_size);
+	if (last - first >= PREFETCH_OVERFLOW_MAX) {
+		last = first + PREFETCH_OVERFLOW_MAX - 1;
+	}
+
+	for (page_t page = first; page <= last; page++) {
+		table_prefetch_ext_page(table, page);
+	}
+
+	capture_end(start, table, CAPTURE_EXT_PREFETCH, 0, locator, 0, 0);
+}
+
+/** Private functions */
+
+/**
+ * @brief Get data in place (see ext_view).
+ *
+ * @param[in] table - Table object.
+ * @param[in] locator - Ext page locator.
+ * @return Pointer to data or NULL if it spans overflow pages.
+ */
+const void *view_data(db_table *table, ext_t *locator) {
+	uint32_t page_size = table_page_size(table);
+	if (ext_part(locator->ptr, page_size) + locator->len > page_size) {
+		return NULL;
+	}
+
+	void *page = table_get_ext_page(table, ext_page(locator->ptr, page_size));
+	return page + ext_part(locator->ptr, page_size);
+}
+
+/**
+ * @brief Copy part of located data (see ext_read).
+ *
+ * @param[in] table - Table object.
+ * @param[in] locator - Ext page locator.
+ * @param[in] offset - Start offset inside the data.
+ * @param[out] buf - Output buffer.
+ * @param[in] n - Most bytes to read.
+ * @return Bytes read.
+ */
+uint64_t read_data(db_table *table, ext_t *locator, uint64_t offset, void *buf, uint64_t n) {
+	if (offset >= locator->len) {
+		return 0;
+	}
+	if (n > locator->len - offset) {
+		n = locator->len - offset;
+	}
+
+	// Overflow pages follow each other, ptr addresses the ext section linearly
+	uint32_t page_size = table_page_size(table);
+	uint64_t pos = locator->ptr + offset;
+	uint64_t done = 0;
+	while (done < n) {
+		uint64_t chunk = ext_space(pos, page_size);
+		if (chunk > n - done) {
+			chunk = n - done;
+		}
+
+		void *page = table_get_ext_page(table, ext_page(pos, page_size));
+		memcpy((uint8_t *)buf + done, page + ext_part(pos, page_size), chunk);
+		done += chunk;
+		pos += chunk;
+	}
+
+	return n;
+}
+
+/**
+ * @brief Read located data from the file (see ext_read_direct).
+ *
+ * @param[in] table - Table object.
+ * @param[in] locator - Ext page locator.
+ * @param[out] buf - Output buffer (locator->len bytes).
+ * @return Success code.
+ */
+int read_file(db_table *table, ext_t *locator, void *buf) {
+	// Plain pages are read straight from the file
+	if (!table_ext_compressed(table)) {
+		return table_read_direct(table, table->fmeta.ext_start, locator->ptr, buf, locator->len);
+	}
+
+	// Compressed pages are expanded one at a time
+	uint32_t page_size = table_page_size(table);
+	uint8_t *page = malloc(page_size);
+	uint64_t pos = locator->ptr;
+	uint64_t done = 0;
+	while (done < locator->len) {
+		uint64_t chunk = ext_space(pos, page_size);
+		if (chunk > locator->len - done) {
+			chunk = locator->len - done;
+		}
+
+		if (table_read_ext_direct(table, ext_page(pos, page_size), page) < 0) {
+			free(page);
+			return -1;
+		}
+		memcpy((uint8_t *)buf + done, page + ext_part(pos, page_size), chunk);
+		done += chunk;
+		pos += chunk;
+	}
+	free(page);
+
+	return 0;
 }
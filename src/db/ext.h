@@ -5,13 +5,58 @@
 
 /**
  * @brief Insert data into the extension section.
+ * Data larger than a page continues in consecutive overflow pages.
  *
  * @param[in] table - Table object.
  * @param[in] data - Data to insert.
+ * @param[in] len - Data length.
  * @return Ext page resource locator.
  */
 ext_t ext_insert(db_table *table, const void *data, const uint64_t len);
 
+/**
+ * @brief Start reading the page holding located data in the background.
+ *
+ * @param[in] table - Table object.
+ * @param[in] locator - Ext page locator.
+ */
+void ext_prefetch(db_table *table, ext_t *locator);
+
+/**
+ * @brief Get data pointed to by a locator in place, without copying.
+ * Points into the cached ext page, which stays valid until the table is
+ * closed (pages are never evicted). Data is not null-terminated.
+ *
+ * @param[in] table - Table object.
+ * @param[in] locator - Ext page locator.
+ * @return Pointer to data or NULL if it spans overflow pages (use ext_read).
+ */
+const void *ext_view(db_table *table, ext_t *locator);
+
+/**
+ * @brief Read part of the data pointed to by a locator.
+ * Only the pages holding the requested range are loaded.
+ *
+ * @param[in] table - Table object.
+ * @param[in] locator - Ext page locator.
+ * @param[in] offset - Offset into the data.
+ * @param[out] buf - Buffer to copy data to.
+ * @param[in] n - Bytes to read.
+ * @return Bytes read (less than n at the end of the data).
+ */
+uint64_t ext_read(db_table *table, ext_t *locator, uint64_t offset, void *buf, uint64_t n);
+
+/**
+ * @brief Read all data pointed to by a locator straight from the file,
+ * without caching ext pages. Only valid for tables without unsaved changes.
+ *
+ * @param[in] table - Table object.
+ * @param[in] locator - Ext page locator.
+ * @param[out] buf - Buffer of at least locator->len bytes.
+ * @return Success code.
+ */
+int ext_read_direct(db_table *table, ext_t *locator, void *buf);
+
 /**
  * @brief Access data pointed to by a locator.
  *
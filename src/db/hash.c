@@ -0,0 +1,394 @@
+#include "hash.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "defines.h"
+#include "table.h"
+#include "btree.h"
+#include "capture.h"
+
+#define bucket_cell_at(dir, bucket, i) ((bucket)->records + (uint64_t)(dir)->record_length * (i))
+#define bucket_capacity(table, dir) hash_bucket_cells(table_page_size(table), (dir)->record_length)
+
+uint64_t key_bits(md5_t *key);
+uint32_t max_depth(uint32_t page_size);
+void bucket_init(hash_bucket *bucket, uint32_t local_depth);
+page_t *entry_at(db_table *table, hash_directory *dir, uint64_t index, int write);
+uint8_t *chain_find(db_table *table, hash_directory *dir, page_t *pg_bucket, md5_t *key);
+void place_cell(hash_directory *dir, hash_bucket *bucket, md5_t *key, const void *record);
+void double_directory(db_table *table, hash_directory *dir);
+void split_bucket(db_table *table, hash_directory *dir, page_t pg_bucket, uint64_t bits);
+int add_record(db_table *table, md5_t *key, const void *record, btree_insert_mode mode);
+void *lookup_record(db_table *table, md5_t *key);
+void *cursor_advance(hash_cursor *iter);
+
+void hash_init(db_table *table, uint32_t record_length) {
+	uint64_t start = capture_begin();
+
+	// Directory takes page 0 like a btree root
+	hash_directory *dir = table->cmeta.total_pages == 0 ?
+		table_new_norm_page(table, NULL) :
+		table_write_norm_page(table, 0);
+	dir->global_depth = 0;
+	dir->record_length = record_length + sizeof(md5_t);
+	dir->segment_count = 1;
+	dir->_padding = 0;
+
+	page_t pg_segment, pg_bucket;
+	page_t *segment = table_new_norm_page(table, &pg_segment);
+	hash_bucket *bucket = table_new_norm_page(table, &pg_bucket);
+	bucket_init(bucket, 0);
+	segment[0] = pg_bucket;
+	dir->segments[0] = pg_segment;
+
+	table->cmeta.root_page = 0;
+	table->cmeta.version |= META_HASH;
+	table_set_bloom(table, NULL);
+
+	capture_end(start, table, CAPTURE_HASH_INIT, 0, NULL, record_length, 0);
+}
+
+int hash_insert(db_table *table, md5_t *key, const void *record, btree_insert_mode mode) {
+	uint64_t start = capture_begin();
+	int result = add_record(table, key, record, mode);
+	capture_end(start, table, CAPTURE_HASH_INSERT, mode, key, 0, 0);
+	return result;
+}
+
+void *hash_find(db_table *table, md5_t *key) {
+	uint64_t start = capture_begin();
+	void *record = lookup_record(table, key);
+	capture_end(start, table, CAPTURE_HASH_FIND, record != NULL, key, 0, 0);
+	return record;
+}
+
+void hash_touch(db_table *table, md5_t *key) {
+	hash_directory *dir = table_get_norm_page(table, table->cmeta.root_page);
+	page_t pg_bucket = *entry_at(table, dir, key_bits(key) & (((uint64_t)1 << dir->global_depth) - 1), 0);
+	if (chain_find(table, dir, &pg_bucket, key) != NULL) {
+		table_write_norm_page(table, pg_bucket);
+	}
+}
+
+hash_cursor *hash_iter(db_table *table) {
+	uint64_t start = capture_begin();
+	hash_directory *dir = table_get_norm_page(table, table->cmeta.root_page);
+
+	hash_cursor *iter = malloc(sizeof(hash_cursor));
+	iter->table = table;
+	iter->index = 0;
+	iter->pg_bucket = *entry_at(table, dir, 0, 0);
+	iter->cell_num = 0;
+	md5_zero(&iter->key);
+
+	capture_end(start, table, CAPTURE_HASH_ITER, 0, NULL, 0, 0);
+	return iter;
+}
+
+void *hash_next(hash_cursor *iter) {
+	uint64_t start = capture_begin();
+	void *record = cursor_advance(iter);
+	capture_end(start, iter->table, CAPTURE_HASH_NEXT, record != NULL, NULL, 0, 0);
+	return record;
+}
+
+/** Private functions */
+
+/**
+ * @brief Get key bits used for directory lookups.
+ *
+ * @param[in] key - Hash key pointer.
+ * @return Low 64 bits of the key.
+ */
+uint64_t key_bits(md5_t *key) {
+	uint64_t bits;
+	memcpy(&bits, key, sizeof(bits));
+	return bits;
+}
+
+/**
+ * @brief Get deepest directory fitting the segment list.
+ *
+ * @param[in] page_size - Page size.
+ * @return Max global depth.
+ */
+uint32_t max_depth(uint32_t page_size) {
+	uint32_t depth = 0;
+	while (((uint64_t)2 << depth) <= hash_segment_entries(page_size)) {
+		depth++;
+	}
+
+	uint32_t segments = hash_directory_segments(page_size);
+	while (segments > 1) {
+		segments /= 2;
+		depth++;
+	}
+
+	return depth;
+}
+
+/**
+ * @brief Initialize empty bucket page.
+ *
+ * @param[out] bucket - Bucket page.
+ * @param[in] local_depth - Key bits shared by its records.
+ */
+void bucket_init(hash_bucket *bucket, uint32_t local_depth) {
+	bucket->local_depth = local_depth;
+	bucket->cell_count = 0;
+	bucket->pg_overflow = INVALID_VAL;
+}
+
+/**
+ * @brief Get directory entry.
+ *
+ * @param[in] table - Table object.
+ * @param[in] dir - Directory.
+ * @param[in] index - Entry index (below 2^global_depth).
+ * @param[in] write - Entry is changed.
+ * @return Pointer to bucket page number inside its segment.
+ */
+page_t *entry_at(db_table *table, hash_directory *dir, uint64_t index, int write) {
+	uint64_t entries = hash_segment_entries(table_page_size(table));
+	page_t pg_segment = dir->segments[index / entries];
+	page_t *segment = write ? table_write_norm_page(table, pg_segment) : table_get_norm_page(table, pg_segment);
+	return &segment[index % entries];
+}
+
+/**
+ * @brief Find key in a bucket and its overflow pages.
+ *
+ * @param[in] table - Table object.
+ * @param[in] dir - Directory.
+ * @param[in,out] pg_bucket - Bucket page, set to the page holding the cell.
+ * @param[in] key - Hash key pointer.
+ * @return Cell or NULL if not found.
+ */
+uint8_t *chain_find(db_table *table, hash_directory *dir, page_t *pg_bucket, md5_t *key) {
+	while (1) {
+		hash_bucket *bucket = table_get_norm_page(table, *pg_bucket);
+		for (uint32_t i = 0; i < bucket->cell_count; i++) {
+			uint8_t *cell = bucket_cell_at(dir, bucket, i);
+			if (md5_eq(*key, *(md5_t *)cell)) {
+				return cell;
+			}
+		}
+
+		if (bucket->pg_overflow == INVALID_VAL) {
+			return NULL;
+		}
+		*pg_bucket = bucket->pg_overflow;
+	}
+}
+
+/**
+ * @brief Append cell to a bucket page with room.
+ *
+ * @param[in] dir - Directory.
+ * @param[in] bucket - Bucket page.
+ * @param[in] key - Hash key pointer.
+ * @param[in] record - Data record.
+ */
+void place_cell(hash_directory *dir, hash_bucket *bucket, md5_t *key, const void *record) {
+	uint8_t *cell = bucket_cell_at(dir, bucket, bucket->cell_count);
+	md5_cp((md5_t *)cell, key);
+	memcpy(cell + sizeof(md5_t), record, dir->record_length - sizeof(md5_t));
+	bucket->cell_count++;
+}
+
+/**
+ * @brief Double directory, new entries point at the buckets of the entries
+ * they differ from by the top bit.
+ *
+ * @param[in] table - Table object.
+ * @param[in] dir - Directory (below max depth).
+ */
+void double_directory(db_table *table, hash_directory *dir) {
+	uint64_t entries = (uint64_t)1 << dir->global_depth;
+	uint32_t page_size = table_page_size(table);
+	table_write_norm_page(table, table->cmeta.root_page);
+
+	if (2 * entries <= hash_segment_entries(page_size)) {
+		page_t *segment = table_write_norm_page(table, dir->segments[0]);
+		memcpy(segment + entries, segment, entries * sizeof(page_t));
+	} else {
+		// Segments are full, the second half is a copy of them
+		uint32_t count = dir->segment_count;
+		for (uint32_t i = 0; i < count; i++) {
+			page_t pg_copy;
+			page_t *copy = table_new_norm_page(table, &pg_copy);
+			memcpy(copy, table_get_norm_page(table, dir->segments[i]), page_size);
+			dir->segments[count + i] = pg_copy;
+		}
+		dir->segment_count = 2 * count;
+	}
+
+	dir->global_depth++;
+}
+
+/**
+ * @brief Split bucket by its next key bit.
+ *
+ * @param[in] table - Table object.
+ * @param[in] dir - Directory (deeper than the bucket).
+ * @param[in] pg_bucket - Bucket page (without overflow pages).
+ * @param[in] bits - Key bits of any key routed to the bucket.
+ */
+void split_bucket(db_table *table, hash_directory *dir, page_t pg_bucket, uint64_t bits) {
+	hash_bucket *bucket = table_write_norm_page(table, pg_bucket);
+	uint64_t high = (uint64_t)1 << bucket->local_depth;
+
+	page_t pg_new;
+	hash_bucket *sibling = table_new_norm_page(table, &pg_new);
+	bucket_init(sibling, bucket->local_depth + 1);
+	bucket->local_depth++;
+
+	// Records with the new bit set move, the rest stay packed
+	uint32_t kept = 0;
+	for (uint32_t i = 0; i < bucket->cell_count; i++) {
+		uint8_t *cell = bucket_cell_at(dir, bucket, i);
+		if (key_bits((md5_t *)cell) & high) {
+			memcpy(bucket_cell_at(dir, sibling, sibling->cell_count), cell, dir->record_length);
+			sibling->cell_count++;
+		} else {
+			if (kept != i) {
+				memcpy(bucket_cell_at(dir, bucket, kept), cell, dir->record_length);
+			}
+			kept++;
+		}
+	}
+	bucket->cell_count = kept;
+
+	// Entries sharing the bucket's bits and the new bit go to the sibling
+	uint64_t entries = (uint64_t)1 << dir->global_depth;
+	for (uint64_t i = (bits & (high - 1)) | high; i < entries; i += 2 * high) {
+		*entry_at(table, dir, i, 1) = pg_new;
+	}
+}
+
+/**
+ * @brief Insert record (see hash_insert).
+ *
+ * @param[in] table - Hash table object.
+ * @param[in] key - Hash key pointer to insert.
+ * @param[in] record - Data record to insert.
+ * @param[in] mode - Handling of an existing key.
+ * @return Status code (1 if an existing record was kept).
+ */
+int add_record(db_table *table, md5_t *key, const void *record, btree_insert_mode mode) {
+	hash_directory *dir = table_get_norm_page(table, table->cmeta.root_page);
+	uint64_t bits = key_bits(key);
+	uint32_t capacity = bucket_capacity(table, dir);
+	uint32_t depth_limit = max_depth(table_page_size(table));
+
+	while (1) {
+		page_t pg_bucket = *entry_at(table, dir, bits & (((uint64_t)1 << dir->global_depth) - 1), 0);
+		hash_bucket *bucket = table_get_norm_page(table, pg_bucket);
+
+		// Key may exist anywhere in the chain
+		if (mode != INSERT_ALWAYS) {
+			page_t pg_cell = pg_bucket;
+			uint8_t *cell = chain_find(table, dir, &pg_cell, key);
+			if (cell != NULL) {
+				if (mode == INSERT_IF_ABSENT) {
+					return 1;
+				}
+
+				table_write_norm_page(table, pg_cell);
+				memcpy(cell + sizeof(md5_t), record, dir->record_length - sizeof(md5_t));
+				return 0;
+			}
+		}
+
+		if (bucket->cell_count < capacity) {
+			place_cell(dir, table_write_norm_page(table, pg_bucket), key, record);
+			return 0;
+		}
+
+		// Split while the directory can tell the halves apart, equal key
+		// bits may take several splits
+		if (bucket->local_depth < depth_limit && bucket->pg_overflow == INVALID_VAL) {
+			if (bucket->local_depth == dir->global_depth) {
+				double_directory(table, dir);
+			}
+			split_bucket(table, dir, pg_bucket, bits);
+			continue;
+		}
+
+		// Deepest bucket grows a chain, only its last page has room
+		while (bucket->cell_count == capacity && bucket->pg_overflow != INVALID_VAL) {
+			pg_bucket = bucket->pg_overflow;
+			bucket = table_get_norm_page(table, pg_bucket);
+		}
+		bucket = table_write_norm_page(table, pg_bucket);
+		if (bucket->cell_count == capacity) {
+			page_t pg_overflow;
+			hash_bucket *overflow = table_new_norm_page(table, &pg_overflow);
+			bucket_init(overflow, bucket->local_depth);
+			bucket->pg_overflow = pg_overflow;
+			bucket = overflow;
+		}
+
+		place_cell(dir, bucket, key, record);
+		return 0;
+	}
+}
+
+/**
+ * @brief Find record (see hash_find).
+ *
+ * @param[in] table - Hash table object.
+ * @param[in] key - Hash key pointer to find.
+ * @return Pointer to record (excluding key) or NULL if not found.
+ */
+void *lookup_record(db_table *table, md5_t *key) {
+	hash_directory *dir = table_get_norm_page(table, table->cmeta.root_page);
+	page_t pg_bucket = *entry_at(table, dir, key_bits(key) & (((uint64_t)1 << dir->global_depth) - 1), 0);
+
+	uint8_t *cell = chain_find(table, dir, &pg_bucket, key);
+	return (cell != NULL) ? cell + sizeof(md5_t) : NULL;
+}
+
+/**
+ * @brief Advance cursor (see hash_next).
+ * Each bucket is walked from the first directory entry pointing at it.
+ *
+ * @param[in] iter - Cursor.
+ * @return Pointer to record or NULL at the end.
+ */
+void *cursor_advance(hash_cursor *iter) {
+	db_table *table = iter->table;
+	hash_directory *dir = table_get_norm_page(table, table->cmeta.root_page);
+	uint64_t entries = (uint64_t)1 << dir->global_depth;
+
+	while (iter->pg_bucket != INVALID_VAL) {
+		hash_bucket *bucket = table_get_norm_page(table, iter->pg_bucket);
+		if (iter->cell_num < bucket->cell_count) {
+			uint8_t *cell = bucket_cell_at(dir, bucket, iter->cell_num);
+			iter->cell_num++;
+			md5_cp(&iter->key, (md5_t *)cell);
+			return cell + sizeof(md5_t);
+		}
+
+		iter->cell_num = 0;
+		if (bucket->pg_overflow != INVALID_VAL) {
+			iter->pg_bucket = bucket->pg_overflow;
+			continue;
+		}
+
+		// Later entries of a bucket repeat its low local_depth bits
+		iter->pg_bucket = INVALID_VAL;
+		while (++iter->index < entries) {
+			page_t pg_next = *entry_at(table, dir, iter->index, 0);
+			hash_bucket *next = table_get_norm_page(table, pg_next);
+			if (iter->index < ((uint64_t)1 << next->local_depth)) {
+				iter->pg_bucket = pg_next;
+				break;
+			}
+		}
+	}
+
+	return NULL;
+}
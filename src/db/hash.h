@@ -0,0 +1,119 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "defines.h"
+#include "table.h"
+#include "btree.h"
+
+// Extendible hash table layout, selected with hash_init (META_HASH).
+//
+// Keys are uniformly distributed hashes, so the low bits of a key pick its
+// bucket directly. The directory (root page) lists segment pages, which hold
+// the bucket page number of each directory entry. A full bucket splits in
+// two by one more key bit, doubling the directory if needed, so an insert
+// only changes its bucket and directory entries. Once the directory cannot
+// grow, full buckets continue in overflow pages.
+//
+// Records are fixed-length and unordered. Shared access (btree_share) and
+// key filters are not supported. Finds and inserts through the btree calls
+// are passed to the hash table, its cursors, streams and loaders fail.
+
+/** Pages */
+
+// Directory, root page of the table
+typedef struct {
+	// Directory holds 2^global_depth entries
+	uint32_t global_depth;
+	// Cell length (key and record)
+	uint32_t record_length;
+	uint32_t segment_count;
+	uint32_t _padding;
+	// Segment pages, entry i is in segment i / hash_segment_entries
+	page_t segments[];
+} hash_directory;
+
+// Bucket, cells fill the rest of the page
+typedef struct {
+	// Key bits shared by all records of the bucket
+	uint32_t local_depth;
+	uint32_t cell_count;
+	// Next page of a full bucket (INVALID_VAL if none)
+	page_t pg_overflow;
+	uint8_t records[];
+} hash_bucket;
+
+// Get directory entries per segment page
+#define hash_segment_entries(page_size) ((page_size) / sizeof(page_t))
+// Get segment pages a directory can list
+#define hash_directory_segments(page_size) (((page_size) - sizeof(hash_directory)) / sizeof(page_t))
+// Get cells per bucket page
+#define hash_bucket_cells(page_size, record_length) (((page_size) - sizeof(hash_bucket)) / (record_length))
+
+/** Cursors */
+
+typedef struct {
+	db_table *table;
+	// Directory entry of the bucket being walked
+	uint64_t index;
+	// Bucket or overflow page (INVALID_VAL at the end)
+	page_t pg_bucket;
+	uint32_t cell_num;
+	// Key of last record returned by hash_next
+	md5_t key;
+} hash_cursor;
+
+/**
+ * @brief Initialize empty hash table, marking the table layout in its
+ * metadata (META_HASH).
+ *
+ * @param[in] table - Table object.
+ * @param[in] record_length - Length of individual record.
+ */
+void hash_init(db_table *table, uint32_t record_length);
+
+/**
+ * @brief Insert record into hash table.
+ *
+ * @param[in] table - Hash table object.
+ * @param[in] key - Hash key pointer to insert.
+ * @param[in] record - Data record to insert.
+ * @param[in] mode - Handling of an existing key.
+ * @return Status code (1 if an existing record was kept).
+ */
+int hash_insert(db_table *table, md5_t *key, const void *record, btree_insert_mode mode);
+
+/**
+ * @brief Find record by key.
+ *
+ * @param[in] table - Hash table object.
+ * @param[in] key - Hash key pointer to find.
+ * @return Pointer to record (excluding key) or NULL if not found.
+ */
+void *hash_find(db_table *table, md5_t *key);
+
+/**
+ * @brief Mark the page holding a key's record as changed, so a record
+ * written in place is saved (see btree_touch_key).
+ *
+ * @param[in] table - Hash table object.
+ * @param[in] key - Hash key pointer.
+ */
+void hash_touch(db_table *table, md5_t *key);
+
+/**
+ * @brief Create cursor over all records, in no particular order.
+ * Records may not be inserted while walking.
+ *
+ * @param[in] table - Hash table object.
+ * @return Cursor, walked with hash_next and released with free.
+ */
+hash_cursor *hash_iter(db_table *table);
+
+/**
+ * @brief Get next record of a hash table.
+ *
+ * @param[in/out] iter - Cursor obtained from hash_iter.
+ * @return Pointer to record (excluding key) or NULL at the end.
+ */
+void *hash_next(hash_cursor *iter);
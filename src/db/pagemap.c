@@ -0,0 +1,166 @@
+#include "pagemap.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "defines.h"
+
+#define CHUNK_SIZE (1 << PAGE_MAP_CHUNK_BITS)
+#define chunk_of(page) ((page) >> PAGE_MAP_CHUNK_BITS)
+#define slot_of(page) ((page) & (CHUNK_SIZE - 1))
+
+page_dir *new_dir(uint64_t size);
+void **get_chunk(page_map *map, page_t page);
+page_dir *grow_dir(page_map *map, uint64_t chunk);
+
+page_map *page_map_new(page_t pages) {
+	page_map *map = malloc(sizeof(page_map));
+	uint64_t chunks = chunk_of(pages + CHUNK_SIZE - 1);
+	map->dir = new_dir((chunks > 0) ? chunks : 1);
+	pthread_mutex_init(&map->grow_lock, NULL);
+
+	return map;
+}
+
+void *page_map_get(page_map *map, page_t page) {
+	page_dir *dir = __atomic_load_n(&map->dir, __ATOMIC_ACQUIRE);
+	if (dir == NULL || chunk_of(page) >= dir->size) {
+		return NULL;
+	}
+
+	void **chunk = __atomic_load_n(&dir->chunks[chunk_of(page)], __ATOMIC_ACQUIRE);
+	if (chunk == NULL) {
+		return NULL;
+	}
+
+	return __atomic_load_n(&chunk[slot_of(page)], __ATOMIC_ACQUIRE);
+}
+
+void *page_map_put(page_map *map, page_t page, void *value) {
+	void **chunk = get_chunk(map, page);
+	if (chunk == NULL) {
+		return NULL;
+	}
+
+	void *expected = NULL;
+	if (!__atomic_compare_exchange_n(&chunk[slot_of(page)], &expected, value, 0,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		return expected;
+	}
+
+	return value;
+}
+
+void page_map_free(page_map *map, void (*release)(void *value)) {
+	if (map == NULL) {
+		return;
+	}
+
+	// Current directory lists every chunk
+	page_dir *dir = map->dir;
+	for (uint64_t i = 0; dir != NULL && i < dir->size; i++) {
+		void **chunk = dir->chunks[i];
+		if (chunk == NULL) {
+			continue;
+		}
+
+		for (uint32_t j = 0; j < CHUNK_SIZE && release != NULL; j++) {
+			if (chunk[j] != NULL) {
+				release(chunk[j]);
+			}
+		}
+		free(chunk);
+	}
+
+	while (dir != NULL) {
+		page_dir *retired = dir->retired;
+		free(dir);
+		dir = retired;
+	}
+	pthread_mutex_destroy(&map->grow_lock);
+	free(map);
+}
+
+/** Private functions */
+
+/**
+ * @brief Allocate empty directory.
+ *
+ * @param[in] size - Number of chunks.
+ * @return Directory or NULL if too large.
+ */
+page_dir *new_dir(uint64_t size) {
+	if (size > (SIZE_MAX - sizeof(page_dir)) / sizeof(void **)) {
+		return NULL;
+	}
+
+	page_dir *dir = calloc(1, sizeof(page_dir) + size * sizeof(void **));
+	if (dir != NULL) {
+		dir->size = size;
+	}
+
+	return dir;
+}
+
+/**
+ * @brief Get chunk holding a page entry, creating it if needed.
+ *
+ * @param[in] map - Map object.
+ * @param[in] page - Page number.
+ * @return Chunk or NULL if it could not be created.
+ */
+void **get_chunk(page_map *map, page_t page) {
+	page_dir *dir = __atomic_load_n(&map->dir, __ATOMIC_ACQUIRE);
+	if (dir != NULL && chunk_of(page) < dir->size) {
+		void **chunk = __atomic_load_n(&dir->chunks[chunk_of(page)], __ATOMIC_ACQUIRE);
+		if (chunk != NULL) {
+			return chunk;
+		}
+	}
+
+	// Chunks are only created in the current directory, so a copy made
+	// while growing never misses one
+	pthread_mutex_lock(&map->grow_lock);
+	dir = grow_dir(map, chunk_of(page));
+	void **chunk = NULL;
+	if (dir != NULL) {
+		chunk = dir->chunks[chunk_of(page)];
+		if (chunk == NULL) {
+			chunk = calloc(CHUNK_SIZE, sizeof(void *));
+			__atomic_store_n(&dir->chunks[chunk_of(page)], chunk, __ATOMIC_RELEASE);
+		}
+	}
+	pthread_mutex_unlock(&map->grow_lock);
+
+	return chunk;
+}
+
+/**
+ * @brief Make the directory hold a chunk, replacing it with a larger copy
+ * if needed. The grow lock must be held.
+ *
+ * @param[in] map - Map object.
+ * @param[in] chunk - Chunk number.
+ * @return Current directory or NULL if it could not grow.
+ */
+page_dir *grow_dir(page_map *map, uint64_t chunk) {
+	page_dir *dir = map->dir;
+	if (dir == NULL || chunk < dir->size) {
+		return dir;
+	}
+
+	// Doubling keeps the copying linear in the number of chunks
+	uint64_t size = (dir->size > UINT64_MAX / 2) ? UINT64_MAX : dir->size * 2;
+	page_dir *grown = new_dir((size > chunk) ? size : chunk + 1);
+	if (grown == NULL) {
+		return NULL;
+	}
+
+	memcpy(grown->chunks, dir->chunks, dir->size * sizeof(void **));
+	grown->retired = dir;
+	__atomic_store_n(&map->dir, grown, __ATOMIC_RELEASE);
+
+	return grown;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "defines.h"
+
+// Entries per chunk
+#define PAGE_MAP_CHUNK_BITS 12
+
+// Directory of chunk pointers, replaced by a larger copy when it fills up
+typedef struct page_dir {
+	// Chunks the directory can hold
+	uint64_t size;
+	// Replaced directory, kept for threads still reading it
+	struct page_dir *retired;
+	void **chunks[];
+} page_dir;
+
+// Map of page numbers to pointers, in chunks allocated on first use.
+// Entries are set once and never move, so threads can look them up while
+// others add entries.
+typedef struct {
+	page_dir *dir;
+	// Held while creating chunks or growing the directory
+	pthread_mutex_t grow_lock;
+} page_map;
+
+/**
+ * @brief Create empty map.
+ *
+ * @param[in] pages - Expected number of pages, the map grows past it.
+ * @return Map object.
+ */
+page_map *page_map_new(page_t pages);
+
+/**
+ * @brief Look up page entry.
+ *
+ * @param[in] map - Map object.
+ * @param[in] page - Page number.
+ * @return Entry or NULL if not set.
+ */
+void *page_map_get(page_map *map, page_t page);
+
+/**
+ * @brief Set page entry unless another thread set it first.
+ *
+ * @param[in] map - Map object.
+ * @param[in] page - Page number.
+ * @param[in] value - Entry to set (not NULL).
+ * @return Entry in the map, value or the one set before. NULL if the map
+ * could not grow.
+ */
+void *page_map_put(page_map *map, page_t page, void *value);
+
+/**
+ * @brief Delete map, releasing its entries.
+ *
+ * @param[in] map - Map object.
+ * @param[in] release - Called with each entry (may be NULL).
+ */
+void page_map_free(page_map *map, void (*release)(void *value));
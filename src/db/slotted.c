@@ -0,0 +1,88 @@
+#include "slotted.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "defines.h"
+#include "btree.h"
+
+void slotted_init(btree_slotted *node, page_t page, uint32_t page_size) {
+	node->header.type = NODE_SLOTTED;
+	node->header.is_root = 1;
+	node->header.pg_self = page;
+	node->header.pg_parent = INVALID_VAL;
+
+	node->pg_next_leaf = INVALID_VAL;
+	node->cell_count = 0;
+	node->heap_start = slotted_data_mem(page_size);
+	node->_reserved = 0;
+	node->_padding = 0;
+}
+
+uint32_t slotted_free(btree_slotted *node) {
+	return node->heap_start - node->cell_count * sizeof(uint16_t);
+}
+
+uint32_t slotted_find_cell(btree_slotted *node, md5_t *key) {
+	uint32_t min = 0;
+	uint32_t max = node->cell_count;
+
+	// Binary search over slots
+	while (min != max) {
+		uint32_t cell = (min + max) / 2;
+		md5_t *cell_key = &slotted_cell_at(node, cell)->key;
+
+		if (md5_eq(*key, *cell_key)) {
+			return cell;
+		}
+
+		if (md5_ls(*key, *cell_key)) {
+			max = cell;
+		} else {
+			min = cell + 1;
+		}
+	}
+
+	return min;
+}
+
+int slotted_insert(btree_slotted *node, uint32_t pos, md5_t *key, const void *record, uint32_t len) {
+	uint32_t size = slotted_cell_size(len);
+	if (slotted_free(node) < size + sizeof(uint16_t)) {
+		return -1;
+	}
+
+	// Place cell at heap top
+	node->heap_start -= size;
+	slotted_cell *cell = (slotted_cell *)(node->data + node->heap_start);
+	md5_cp(&cell->key, key);
+	cell->length = len;
+	cell->_padding = 0;
+	memcpy(cell->payload, record, len);
+
+	// Shift slots to keep key order
+	uint16_t *slots = slotted_slots(node);
+	memmove(slots + pos + 1, slots + pos, (node->cell_count - pos) * sizeof(uint16_t));
+	slots[pos] = node->heap_start;
+	node->cell_count++;
+
+	return 0;
+}
+
+void slotted_remove(btree_slotted *node, uint32_t pos, uint32_t page_size) {
+	// Rebuild from a copy, leaves no hole in the heap
+	btree_slotted *copy = malloc(page_size);
+	memcpy(copy, node, page_size);
+
+	node->heap_start = slotted_data_mem(page_size);
+	node->cell_count = 0;
+	for (uint32_t i = 0; i < copy->cell_count; i++) {
+		if (i != pos) {
+			slotted_cell *cell = slotted_cell_at(copy, i);
+			slotted_insert(node, node->cell_count, &cell->key, cell->payload, cell->length);
+		}
+	}
+
+	free(copy);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "defines.h"
+#include "btree.h"
+
+// Cell stored in the page heap
+typedef struct {
+	md5_t key;
+	uint32_t length;
+	uint32_t _padding;
+	uint8_t payload[];
+} slotted_cell;
+
+// Slotted leaf node, data fills the rest of the page
+// Shares header, pg_next_leaf and cell_count layout with btree_leaf.
+// Slots (uint16_t cell offsets, in key order) grow up from the start of data,
+// cells grow down from the end.
+typedef struct {
+	btree_header header;
+	page_t pg_next_leaf;
+	uint32_t cell_count;
+	uint16_t heap_start;
+	uint16_t _reserved;
+	uint32_t _padding;
+	uint8_t data[];
+} btree_slotted;
+
+// Get slot and cell memory for page size
+#define slotted_data_mem(page_size) ((page_size) - sizeof(btree_slotted))
+// Largest record payload, keeps at least four records per page
+#define slotted_max_record(page_size) (slotted_data_mem(page_size) / 4 - sizeof(slotted_cell) - sizeof(uint16_t))
+
+// Get slot array
+#define slotted_slots(node) ((uint16_t *)(node)->data)
+// Get cell by index
+#define slotted_cell_at(node, i) ((slotted_cell *)((node)->data + slotted_slots(node)[i]))
+// Heap bytes used by a record of given length (8-byte aligned)
+#define slotted_cell_size(len) ((sizeof(slotted_cell) + (len) + 7) & ~(uint32_t)7)
+
+/**
+ * @brief Initialize slotted leaf node.
+ *
+ * @param[in] node - Node location.
+ * @param[in] page - Node location in database.
+ * @param[in] page_size - Table page size.
+ */
+void slotted_init(btree_slotted *node, page_t page, uint32_t page_size);
+
+/**
+ * @brief Free bytes in node.
+ *
+ * @param[in] node - Slotted node.
+ * @return Bytes available for slots and cells.
+ */
+uint32_t slotted_free(btree_slotted *node);
+
+/**
+ * @brief Find position or best placement of key inside node.
+ *
+ * @param[in] node - Slotted node.
+ * @param[in] key - Hash key pointer.
+ * @return Cell index.
+ */
+uint32_t slotted_find_cell(btree_slotted *node, md5_t *key);
+
+/**
+ * @brief Insert record at position if it fits.
+ *
+ * @param[in] node - Slotted node.
+ * @param[in] pos - Cell index to insert at.
+ * @param[in] key - Hash key pointer.
+ * @param[in] record - Record data.
+ * @param[in] len - Record length.
+ * @return Success code (-1 if the node is full).
+ */
+int slotted_insert(btree_slotted *node, uint32_t pos, md5_t *key, const void *record, uint32_t len);
+
+/**
+ * @brief Remove record at position, compacting the heap.
+ *
+ * @param[in] node - Slotted node.
+ * @param[in] pos - Cell index.
+ * @param[in] page_size - Table page size.
+ */
+void slotted_remove(btree_slotted *node, uint32_t pos, uint32_t page_size);
@@ -1,263 +1,1842 @@
 #include "table.h"
 
 #include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 
 #include "defines.h"
 #include "../util/vector.h"
+#include "../util/arena.h"
+#include "../util/trace.h"
+#include "../util/lz4.h"
+#include "upgrade.h"
+#include "capture.h"
+#include "pagemap.h"
 
 // Get normal page count
 #define norm_count(meta) meta.ext_start
 // Get extension page count
 #define ext_count(meta) (meta.total_pages - meta.ext_start)
-// Get location of page in file
-#define locate_page(page) (sizeof(db_meta) + (page) * PAGE_SIZE)
+// Most cache entries reserved up front
+#define CACHE_RESERVE_MAX 4096
+// Most page reads in flight
+#define PREFETCH_DEPTH 64
+// Get metadata length in file
+#define meta_length(table) (table_legacy(table) ? sizeof(db_meta_32) : \
+	(meta_version((table)->fmeta) == META_VERSION_COMPACT) ? offsetof(db_meta, map_offset) : sizeof(db_meta))
+// Get location of page in a file without page map
+#define locate_page(table, page) (meta_length(table) + (page) * (uint64_t)table_page_size(table))
+// Get page map entries per chunk (chunks are page sized)
+#define map_chunk(table) (table_page_size(table) / sizeof(page_block))
+// Get page map chunks needed for a number of pages
+#define chunk_count(table, pages) (((pages) + map_chunk(table) - 1) / map_chunk(table))
+// Reads of metadata being rewritten are retried
+#define META_READ_TRIES 8
+// Rewritten files are written next to the table
+#define COPY_SUFFIX ".XXXXXX"
+// Open modes (open_table)
+#define OPEN_LOCKED 0x1
+#define OPEN_READ_ONLY 0x2
+// Serialize cache changes of shared tables
+#define lock_cache(table) \
+	do { if ((table)->shared != NULL) pthread_mutex_lock(&(table)->shared->cache_lock); } while (0)
+#define unlock_cache(table) \
+	do { if ((table)->shared != NULL) pthread_mutex_unlock(&(table)->shared->cache_lock); } while (0)
 
-int flush_cache(vector *cache, int fd, uint32_t offset);
-db_page *load_to_cache(vector *cache, int fd, page_t page_num);
+db_table *open_table(const char *file, uint32_t identity, uint32_t page_size, uint8_t mode);
+int lock_current(int fd, const char *file, int wait);
+int read_meta(int fd, uint8_t *buf);
+int write_changes(db_table *table);
+int rewrite_table(db_table *table);
+int append_changes(db_table *table);
+int append_pages(db_table *table, file_map *map, uint8_t ext, uint64_t *pos);
+page_block *changed_chunk(db_table *table, file_map *map, uint8_t ext, uint64_t chunk);
+page_block *copy_chunk(db_table *table, uint8_t ext, uint64_t chunk);
+int write_meta(db_table *table);
+int table_dirty(db_table *table);
+void clear_dirty(db_table *table);
+int flush_cache(db_table *table, vector *cache, page_t offset);
+int flush_compressed(db_table *table);
+int pack_ext(db_table *table, uint8_t **section, uint64_t *section_len);
+int load_ext_index(db_table *table);
+int load_map(db_table *table);
+void free_map(file_map *map);
+int find_stored(db_table *table, page_t page_in_file, page_block *block);
+int read_stored(db_table *table, page_t page_in_file, void *buf);
+int read_at(int fd, void *buf, uint64_t n, uint64_t offset);
+int load_bloom(db_table *table);
+int flush_bloom(db_table *table, uint64_t *pos);
+db_page *load_to_cache(db_table *table, uint8_t ext, page_t page_num);
+db_page *get_page(db_table *table, uint8_t ext, page_t page_num);
+db_page *find_cached(db_table *table, uint8_t ext, page_t page_num);
+db_page *fetch_page(db_table *table, uint8_t ext, page_t page_num);
+db_page *cache_page(db_table *table, uint8_t ext, page_t page_num, void *frame, uint8_t dirty);
+pthread_rwlock_t *get_latch(db_table *table, page_t page_num);
+void free_latch(void *latch);
+void prefetch_page(db_table *table, page_t page_num, uint8_t ext);
+int await_prefetch(db_table *table, page_t page_num, uint8_t ext);
+void finish_prefetch(db_table *table);
+void drain_prefetch(db_table *table);
+void upgrade_meta(db_meta_32 *stored, db_meta *meta);
+int save_changes(db_table *table);
+int replace_file(const char *src, const char *dest);
+void record_open(uint64_t start, db_table *table, const char *file, uint32_t identity, uint32_t page_size,
+	uint8_t mode);
 
-db_table *table_open(const char *file, uint32_t identity) {
-	db_table *t = malloc(sizeof(db_table));
-
-	// Open database file
-	int fd = open(file, O_RDWR | O_CREAT, 0644);
-	if (fd < 0) {
-		fprintf(stderr, "failed to open database table\n");
-		return NULL;
-	}
-	t->fd = fd;
-	t->fsize = lseek(fd, 0, SEEK_END);
-
-	if (t->fsize == 0) {
-		// Fresh file: create new metadata
-		t->fmeta.table_identity = identity;
-		t->fmeta.total_pages = 0;
-		t->fmeta.ext_start = 0;
-		t->fmeta.root_page = INVALID_VAL;
-		t->fmeta.ext_end_ptr = 0;
-	} else {
-		// Load saved table identity
-		uint32_t file_table_identity;
-		lseek(fd, 0, SEEK_SET);
-		int64_t bytes = read(fd, &file_table_identity, sizeof(uint32_t));
-		if (bytes != sizeof(uint32_t)) {
-			fprintf(stderr, "failed to read table version from file\n");
-			return NULL;
-		}
-		
-		// Identity check
-		if (file_table_identity != identity) {
-			fprintf(stderr, "this table contains other data\n");
-			fprintf(stderr, "aborting open\n");
-			return NULL;
-		}
-
-		// Okay, can load metadata now
-		lseek(fd, 0, SEEK_SET);
-		bytes = read(fd, &t->fmeta, sizeof(db_meta));
-		if (bytes != sizeof(db_meta)) {
-			fprintf(stderr, "failed to read table metadata\n");
-			return NULL;
-		}
-	}
-	t->cmeta = t->fmeta;
+db_table *table_open(const char *file, uint32_t identity, uint32_t page_size) {
+	uint64_t start = capture_begin();
+	db_table *table = open_table(file, identity, page_size, 0);
+	record_open(start, table, file, identity, page_size, 0);
+	return table;
+}
 
-	// Allocate cache objects
-	t->norm_cache = vec_new(sizeof(db_page));
-	t->ext_cache = vec_new(sizeof(db_page));
+db_table *table_open_locked(const char *file, uint32_t identity, uint32_t page_size) {
+	uint64_t start = capture_begin();
+	db_table *table = open_table(file, identity, page_size, OPEN_LOCKED);
+	record_open(start, table, file, identity, page_size, CAPTURE_LOCKED);
+	return table;
+}
 
-	return t;
+db_table *table_open_read(const char *file, uint32_t identity) {
+	uint64_t start = capture_begin();
+	db_table *table = open_table(file, identity, 0, OPEN_READ_ONLY);
+	record_open(start, table, file, identity, 0, CAPTURE_READ_ONLY);
+	return table;
 }
 
 int table_save(db_table *table) {
 	if (table == NULL) {
 		return -1;
 	}
+	trace_begin("table_save", NULL);
 
-	// Write metadata
-	lseek(table->fd, 0, SEEK_SET);
-	if (write(table->fd, &table->cmeta, sizeof(db_meta)) != sizeof(db_meta)) {
-		fprintf(stderr, "failed to write metadata\n");
-		return -1;
-	}
+	int result = table_flush(table);
+	table_close(table);
 
-	// Move ext pages if spaces needed
-	uint32_t norm_delta = norm_count(table->cmeta) - norm_count(table->fmeta);
-	if (norm_delta > 0 && table->fmeta.total_pages > 0) {
-		uint8_t buf[PAGE_SIZE];
-		for (uint32_t i = table->fmeta.total_pages - 1; i >= table->fmeta.ext_start; i--) {
-			lseek(table->fd, locate_page(i), SEEK_SET);
-			if (read(table->fd, buf, PAGE_SIZE) != PAGE_SIZE) {
-				fprintf(stderr, "failed to read page\n");
-				return -1;
-			}
+	trace_end("table_save");
+	return result;
+}
 
-			lseek(table->fd, locate_page(i + norm_delta), SEEK_SET);
-			if (write(table->fd, buf, PAGE_SIZE) != PAGE_SIZE) {
-				fprintf(stderr, "failed to write page\n");
-				return -1;
-			}
-		}
+void table_close(db_table *table) {
+	if (table == NULL) {
+		return;
 	}
+	uint64_t start = capture_begin();
+	table_unshare(table);
 
-	// Flush caches to file
-	flush_cache(table->norm_cache, table->fd, 0);
-	flush_cache(table->ext_cache, table->fd, table->cmeta.ext_start);
+	// Kernel may still be writing into frames
+	drain_prefetch(table);
+	if (!table->aio_lost) {
+		aio_free(table->aio);
+	}
+	if (table->prefetching != NULL) {
+		vec_free(table->prefetching);
+	}
 
-	// Cleanup
 	vec_free(table->norm_cache);
 	vec_free(table->ext_cache);
+	page_map_free(table->norm_map, &free);
+	page_map_free(table->ext_map, &free);
+	if (!table->aio_lost) {
+		arena_free(table->arena);
+	}
+	free(table->ext_index);
+	free_map(table->map);
+	bloom_free(table->bloom);
+	free(table->path);
 	close(table->fd);
+	capture_end(start, table, CAPTURE_CLOSE, 0, NULL, 0, 0);
 	free(table);
+}
+
+bloom_filter *table_get_bloom(db_table *table) {
+	if (table->bloom == NULL && (table->cmeta.version & META_BLOOM) && load_bloom(table) < 0) {
+		table->cmeta.version &= ~META_BLOOM;
+	}
+
+	return table->bloom;
+}
+
+void table_set_bloom(db_table *table, bloom_filter *filter) {
+	bloom_free(table->bloom);
+	table->bloom = filter;
+	if (filter != NULL) {
+		table->cmeta.version |= META_BLOOM;
+	} else {
+		table->cmeta.version &= ~META_BLOOM;
+	}
+}
 
+int table_set_ext_compressed(db_table *table, int compressed) {
+	if (ext_count(table->fmeta) > 0) {
+		fprintf(stderr, "ext storage can only be chosen for empty tables\n");
+		return -1;
+	}
+
+	uint64_t start = capture_begin();
+	if (compressed) {
+		table->cmeta.version |= META_EXT_COMPRESSED;
+	} else {
+		table->cmeta.version &= ~META_EXT_COMPRESSED;
+	}
+
+	capture_end(start, table, CAPTURE_COMPRESS, compressed != 0, NULL, 0, 0);
 	return 0;
 }
 
-void *table_get_norm_page(db_table *table, page_t page_num) {
-	if (page_num >= table->cmeta.ext_start) {
-		fprintf(stderr, "tried to access page outside of database\n");
-		exit(EXIT_FAILURE);
+int table_replace(const char *src, const char *dest) {
+	uint64_t start = capture_begin();
+	int result = replace_file(src, dest);
+	if (capture_file != NULL) {
+		uint64_t key[2] = { capture_path(src), 0 };
+		capture_stop(start, NULL, CAPTURE_REPLACE, result == 0, key, 0, capture_path(dest));
 	}
+	return result;
+}
 
-	// Check cache
-	for (uint32_t i = 0; i < table->norm_cache->count; i++) {
-		db_page *page = vec_at(table->norm_cache, i);
-		if (page_num == page->pg_num) {
-			return page->raw_data;
-		}
+int table_flush(db_table *table) {
+	uint64_t start = capture_begin();
+	int result = save_changes(table);
+	capture_end(start, table, CAPTURE_FLUSH, 0, NULL, 0, 0);
+	return result;
+}
+
+int table_stale(db_table *table) {
+	struct stat held;
+	struct stat current;
+	if (fstat(table->fd, &held) < 0 || stat(table->path, &current) < 0) {
+		return 1;
 	}
 
-	// Cache miss
-	// fmeta does not need to be checked
-	db_page *loaded_page = load_to_cache(table->norm_cache, table->fd, page_num);
-	if (loaded_page == NULL) {
-		fprintf(stderr, "failed to load page from cache\n");
-		exit(EXIT_FAILURE);
+	return held.st_dev != current.st_dev || held.st_ino != current.st_ino
+		|| (uint64_t)current.st_size != table->fsize;
+}
+
+int table_lock(db_table *table) {
+	if (table->read_only) {
+		fprintf(stderr, "cannot lock table opened read-only\n");
+		return -1;
+	}
+	if (table->locked) {
+		return 0;
+	}
+
+	// Lock of a replaced file is released again
+	if (lock_current(table->fd, table->path, 1) < 0) {
+		return 1;
+	}
+	if (table_stale(table)) {
+		flock(table->fd, LOCK_UN);
+		return 1;
+	}
+
+	table->locked = 1;
+	return 0;
+}
+
+void table_unlock(db_table *table) {
+	if (table->locked) {
+		flock(table->fd, LOCK_UN);
+		table->locked = 0;
 	}
+}
 
-	return loaded_page->raw_data;
+void *table_get_norm_page(db_table *table, page_t page_num) {
+	return get_page(table, 0, page_num)->raw_data;
 }
 
 void *table_get_ext_page(db_table *table, page_t page_num) {
-	if (page_num >= table->cmeta.total_pages) {
-		fprintf(stderr, "tried to access page outside of database\n");
-		exit(EXIT_FAILURE);
+	return get_page(table, 1, page_num)->raw_data;
+}
+
+void *table_write_norm_page(db_table *table, page_t page_num) {
+	// Shared tables mark pages without holding the cache lock
+	db_page *page = get_page(table, 0, page_num);
+	__atomic_store_n(&page->dirty, 1, __ATOMIC_RELAXED);
+	return page->raw_data;
+}
+
+void *table_write_ext_page(db_table *table, page_t page_num) {
+	db_page *page = get_page(table, 1, page_num);
+	__atomic_store_n(&page->dirty, 1, __ATOMIC_RELAXED);
+	return page->raw_data;
+}
+
+int table_read_direct(db_table *table, page_t page_num, uint64_t offset, void *buf, uint64_t n) {
+	uint32_t page_size = table_page_size(table);
+	if (page_num * page_size + offset + n > table->fmeta.total_pages * page_size) {
+		fprintf(stderr, "tried to read outside of database\n");
+		return -1;
 	}
 
-	// Check cache
-	for (uint32_t i = 0; i < table->ext_cache->count; i++) {
-		db_page *page = vec_at(table->ext_cache, i);
-		if (page_num == page->pg_num) {
-			return page->raw_data;
+	// Pages stored next to each other are read at once
+	page_t page = page_num + offset / page_size;
+	uint64_t part = offset % page_size;
+	uint64_t run_start = 0;
+	uint64_t run_len = 0;
+	uint8_t *run_buf = buf;
+	uint64_t done = 0;
+	while (done < n) {
+		page_block block;
+		if (find_stored(table, page, &block) < 0 || block.len != page_size) {
+			fprintf(stderr, "failed to read file\n");
+			return -1;
+		}
+
+		uint64_t chunk = (page_size - part < n - done) ? page_size - part : n - done;
+		if (run_len > 0 && block.offset + part != run_start + run_len) {
+			if (read_at(table->fd, run_buf, run_len, run_start) < 0) {
+				fprintf(stderr, "failed to read file\n");
+				return -1;
+			}
+			run_len = 0;
+		}
+		if (run_len == 0) {
+			run_start = block.offset + part;
+			run_buf = (uint8_t *)buf + done;
 		}
+
+		run_len += chunk;
+		done += chunk;
+		page++;
+		part = 0;
+	}
+
+	if (run_len > 0 && read_at(table->fd, run_buf, run_len, run_start) < 0) {
+		fprintf(stderr, "failed to read file\n");
+		return -1;
 	}
 
-	// Cache miss
-	uint32_t page_in_file = table->fmeta.ext_start + page_num;
-	db_page *loaded_page = load_to_cache(table->ext_cache, table->fd, page_in_file);
-	loaded_page->pg_num = page_num;
+	return 0;
+}
 
-	if (loaded_page == NULL) {
-		fprintf(stderr, "failed to load page from cache\n");
-		exit(EXIT_FAILURE);
+int table_read_ext_direct(db_table *table, page_t page_num, void *buf) {
+	if (page_num >= ext_count(table->fmeta)) {
+		fprintf(stderr, "tried to read outside of database\n");
+		return -1;
 	}
 
-	return loaded_page->raw_data;
+	return read_stored(table, table->fmeta.ext_start + page_num, buf);
+}
+
+void table_prefetch_norm_page(db_table *table, page_t page_num) {
+	// Pages past the file's normal section only exist in cache
+	if (page_num < table->fmeta.ext_start) {
+		prefetch_page(table, page_num, 0);
+	}
+}
+
+void table_prefetch_ext_page(db_table *table, page_t page_num) {
+	// Compressed pages are not page sized on disk
+	if (!table_ext_compressed(table) && page_num < ext_count(table->fmeta)) {
+		prefetch_page(table, page_num, 1);
+	}
+}
+
+void table_prefetch_submit(db_table *table) {
+	if (table->aio != NULL) {
+		aio_submit(table->aio);
+	}
 }
 
 void *table_new_norm_page(db_table *table, page_t *index) {
 	// Create page in cache
-	db_page new_page = {
-		.pg_num = table->cmeta.ext_start,
-		.raw_data = calloc(1, PAGE_SIZE)
-	};
-	vec_push(table->norm_cache, &new_page);
+	lock_cache(table);
+	page_t page_num = table->cmeta.ext_start;
+	db_page *page = cache_page(table, 0, page_num, arena_calloc(table->arena), 1);
+	if (page == NULL) {
+		exit(EXIT_FAILURE);
+	}
+
+	// Update cmeta, shared tables check bounds without the lock
+	__atomic_store_n(&table->cmeta.ext_start, page_num + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&table->cmeta.total_pages, table->cmeta.total_pages + 1, __ATOMIC_RELAXED);
+	unlock_cache(table);
 
-	// Update cmeta
-	table->cmeta.ext_start++;
-	table->cmeta.total_pages++;
-	
 	if (index != NULL) {
-		*index = new_page.pg_num;
+		*index = page_num;
 	}
-	return new_page.raw_data;
+	return page->raw_data;
 }
 
 void *table_new_ext_page(db_table *table, page_t *index) {
 	// Create page in cache
-	db_page new_page = {
-		.pg_num = table->cmeta.total_pages - table->cmeta.ext_start,
-		.raw_data = calloc(1, PAGE_SIZE)
-	};
-	db_page *inserted = vec_push(table->ext_cache, &new_page);
-	if (inserted == NULL) {
-		fprintf(stderr, "failed to create new page in cache\n");
+	lock_cache(table);
+	page_t page_num = table->cmeta.total_pages - table->cmeta.ext_start;
+	db_page *page = cache_page(table, 1, page_num, arena_calloc(table->arena), 1);
+	if (page == NULL) {
 		exit(EXIT_FAILURE);
 	}
 
 	// Update cmeta
-	table->cmeta.total_pages++;
-	
+	__atomic_store_n(&table->cmeta.total_pages, table->cmeta.total_pages + 1, __ATOMIC_RELAXED);
+	unlock_cache(table);
+
 	if (index != NULL) {
-		*index = inserted->pg_num;
+		*index = page_num;
+	}
+	return page->raw_data;
+}
+
+void table_share(db_table *table) {
+	if (table->shared != NULL) {
+		return;
+	}
+
+	// Prefetching is single-threaded
+	drain_prefetch(table);
+
+	table_shared *shared = malloc(sizeof(table_shared));
+	pthread_mutex_init(&shared->cache_lock, NULL);
+	pthread_rwlock_init(&shared->root_latch, NULL);
+	shared->latches = page_map_new(table->cmeta.ext_start);
+	table->shared = shared;
+}
+
+void table_unshare(db_table *table) {
+	if (table->shared == NULL) {
+		return;
+	}
+
+	page_map_free(table->shared->latches, &free_latch);
+	pthread_rwlock_destroy(&table->shared->root_latch);
+	pthread_mutex_destroy(&table->shared->cache_lock);
+	free(table->shared);
+	table->shared = NULL;
+}
+
+int table_latch(db_table *table, page_t page_num, int write) {
+	pthread_rwlock_t *latch = get_latch(table, page_num);
+	if (latch == NULL) {
+		return -1;
+	}
+
+	if (write) {
+		pthread_rwlock_wrlock(latch);
+	} else {
+		pthread_rwlock_rdlock(latch);
 	}
-	return inserted->raw_data;
+	return 0;
+}
+
+void table_unlatch(db_table *table, page_t page_num) {
+	pthread_rwlock_unlock(page_map_get(table->shared->latches, page_num));
 }
 
 /** Private functions */
 
 /**
- * @brief Save table cache to file.
+ * @brief Open table file and load its metadata.
  *
- * @param[in] cache - Table cache.
- * @param[in] fd - File descriptior.
- * @param[in] offset - Write page offset.
+ * @param[in] file - Filename.
+ * @param[in] identity - Expected table identity (type stored).
+ * @param[in] page_size - Page size if the file is created (0 for default).
+ * @param[in] mode - Open mode flags (OPEN_LOCKED to wait for and keep the
+ * writer lock, OPEN_READ_ONLY to never create or write the file).
+ * @return New db_table object.
+ */
+db_table *open_table(const char *file, uint32_t identity, uint32_t page_size, uint8_t mode) {
+	uint8_t lock = (mode & OPEN_LOCKED) != 0;
+	uint8_t read_only = (mode & OPEN_READ_ONLY) != 0;
+	if (page_size == 0) {
+		page_size = DEFAULT_PAGE_SIZE;
+	}
+	if (!valid_page_size(page_size)) {
+		fprintf(stderr, "invalid page size %u\n", page_size);
+		return NULL;
+	}
+
+	trace_begin("table_open", file);
+
+	// Open database file, locking the version that is current
+	int fd;
+	while (1) {
+		fd = read_only ? open(file, O_RDONLY) : open(file, O_RDWR | O_CREAT, 0644);
+		if (fd < 0) {
+			fprintf(stderr, "failed to open database table\n");
+			trace_end("table_open");
+			return NULL;
+		}
+		if (!lock || lock_current(fd, file, 1) == 0) {
+			break;
+		}
+		close(fd);
+	}
+
+	db_meta meta;
+	int64_t size = lseek(fd, 0, SEEK_END);
+	if (size == 0) {
+		// Fresh file: create new metadata
+		meta.table_identity = identity;
+		meta.total_pages = 0;
+		meta.ext_start = 0;
+		meta.version = META_VERSION;
+		meta.root_page = INVALID_VAL;
+		meta.ext_end_ptr = 0;
+		meta.page_size = page_size;
+		meta._padding = 0;
+		meta.map_offset = 0;
+	} else {
+		// Load saved table identity
+		uint8_t stored_meta[sizeof(db_meta)];
+		if (read_meta(fd, stored_meta) < 0) {
+			fprintf(stderr, "failed to read table version from file\n");
+			close(fd);
+			trace_end("table_open");
+			return NULL;
+		}
+		memcpy(&meta.table_identity, stored_meta, sizeof(uint32_t));
+
+		// Identity check
+		if (meta.table_identity != identity) {
+			fprintf(stderr, "this table contains other data\n");
+			fprintf(stderr, "aborting open\n");
+			close(fd);
+			trace_end("table_open");
+			return NULL;
+		}
+
+		// Okay, can load metadata now, version is in the same place for all
+		db_meta_32 stored;
+		memcpy(&stored, stored_meta, sizeof(db_meta_32));
+		if (meta_version(stored) == META_VERSION) {
+			memcpy(&meta, stored_meta, sizeof(db_meta));
+		} else if (meta_version(stored) == META_VERSION_COMPACT) {
+			memcpy(&meta, stored_meta, offsetof(db_meta, map_offset));
+			meta.map_offset = 0;
+		} else {
+			upgrade_meta(&stored, &meta);
+		}
+		if (!valid_page_size(meta.page_size)) {
+			fprintf(stderr, "failed to read table metadata\n");
+			close(fd);
+			trace_end("table_open");
+			return NULL;
+		}
+	}
+
+	db_table *t = malloc(sizeof(db_table));
+	t->fd = fd;
+	t->fsize = size;
+	t->path = strdup(file);
+	t->locked = lock;
+	t->read_only = read_only;
+	t->capture_id = 0;
+	t->fmeta = meta;
+	t->cmeta = meta;
+
+	// Allocate cache objects, sized for the pages already in the file
+	t->norm_cache = vec_new(sizeof(db_page *));
+	t->ext_cache = vec_new(sizeof(db_page *));
+	uint64_t norm_pages = norm_count(t->cmeta);
+	uint64_t ext_pages = ext_count(t->cmeta);
+	t->norm_map = page_map_new(norm_pages);
+	t->ext_map = page_map_new(ext_pages);
+	vec_reserve(t->norm_cache, (norm_pages < CACHE_RESERVE_MAX) ? norm_pages : CACHE_RESERVE_MAX);
+	vec_reserve(t->ext_cache, (ext_pages < CACHE_RESERVE_MAX) ? ext_pages : CACHE_RESERVE_MAX);
+	t->arena = arena_new(t->cmeta.page_size);
+	t->aio = NULL;
+	t->prefetching = NULL;
+	t->aio_lost = 0;
+	t->ext_index = NULL;
+	t->map = NULL;
+	t->bloom = NULL;
+	t->shared = NULL;
+
+	// Older format, readers load the new version in memory
+	if (table_legacy(t) && !lock) {
+		db_table *upgraded = upgrade_read(t);
+		table_close(t);
+		trace_end("table_open");
+
+		return upgraded;
+	}
+
+	// Older format, writers rewrite the file, then open the new version
+	if (table_legacy(t)) {
+		int result = upgrade_table(t);
+		table_close(t);
+		trace_end("table_open");
+
+		return (result == 0) ? open_table(file, identity, page_size, mode) : NULL;
+	}
+
+	trace_end("table_open");
+	return t;
+}
+
+/**
+ * @brief Take the writer lock on an open table file, then check that the
+ * file is still the current version (not replaced while waiting).
+ *
+ * @param[in] fd - Open table file.
+ * @param[in] file - Filename.
+ * @param[in] wait - Wait for other writers instead of failing.
+ * @return Success code (-1 if busy or replaced).
+ */
+int lock_current(int fd, const char *file, int wait) {
+	if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+		if (errno != EWOULDBLOCK || !wait) {
+			return -1;
+		}
+
+		fprintf(stderr, "waiting for another process to release %s\n", file);
+		if (flock(fd, LOCK_EX) < 0) {
+			return -1;
+		}
+	}
+
+	struct stat held;
+	struct stat current;
+	if (fstat(fd, &held) < 0 || stat(file, &current) < 0
+			|| held.st_dev != current.st_dev || held.st_ino != current.st_ino) {
+		flock(fd, LOCK_UN);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Read the start of the file holding the metadata.
+ * Saves rewrite the metadata in place, it is read until two reads agree.
+ *
+ * @param[in] fd - Open table file.
+ * @param[out] buf - Destination (sizeof(db_meta), zeroed past the end of file).
  * @return Success code.
  */
-int flush_cache(vector *cache, int fd, uint32_t offset) {
-	for (uint32_t i = 0; i < cache->count; i++) {
-		db_page *page = vec_at(cache, i);
-		uint64_t place = locate_page(page->pg_num + offset);
-		lseek(fd, place, SEEK_SET);
-		/* lseek(fd, locate_page(page->pg_num + offset), SEEK_SET); */
-		if (write(fd, page->raw_data, PAGE_SIZE) != PAGE_SIZE) {
-			fprintf(stderr, "failed to flush page\n");
+int read_meta(int fd, uint8_t *buf) {
+	uint8_t check[sizeof(db_meta)];
+	for (int i = 0; i < META_READ_TRIES; i++) {
+		memset(buf, 0, sizeof(db_meta));
+		memset(check, 0, sizeof(db_meta));
+		if (pread(fd, buf, sizeof(db_meta), 0) < (ssize_t)sizeof(db_meta_32)
+				|| pread(fd, check, sizeof(db_meta), 0) < (ssize_t)sizeof(db_meta_32)) {
 			return -1;
 		}
+		if (memcmp(buf, check, sizeof(db_meta)) == 0) {
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * @brief Write the whole table into an empty file, without page map.
+ * Metadata goes last, once the pages are on disk.
+ *
+ * @param[in] table - Table object.
+ * @return Success code.
+ */
+int write_changes(db_table *table) {
+	// Pages go where the new metadata puts them
+	table->cmeta.map_offset = 0;
+	table->fmeta = table->cmeta;
+	free_map(table->map);
+	table->map = NULL;
+
+	int result;
+	if (table_ext_compressed(table)) {
+		result = flush_compressed(table);
+	} else {
+		trace_begin_num("table_save.flush", table->norm_cache->count + table->ext_cache->count);
+		result = flush_cache(table, table->norm_cache, 0);
+		if (result == 0) {
+			result = flush_cache(table, table->ext_cache, table->cmeta.ext_start);
+		}
+		uint64_t data_end = locate_page(table, table->cmeta.total_pages);
+		if (result == 0) {
+			result = flush_bloom(table, &data_end);
+		}
+		trace_end("table_save.flush");
+	}
+
+	if (result == 0 && fsync(table->fd) < 0) {
+		fprintf(stderr, "failed to sync %s\n", table->path);
+		result = -1;
+	}
+	if (result == 0) {
+		result = write_meta(table);
+	}
+
+	return result;
+}
 
-		// Free cache object
-		free(page->raw_data);
+/**
+ * @brief Rewrite a file without page map (version 3) whole in the current
+ * format, into a new file that replaces it.
+ * The table is left on the new version (and locked, if it was).
+ *
+ * @param[in] table - Table object.
+ * @return Success code.
+ */
+int rewrite_table(db_table *table) {
+	// New file is written from cache
+	trace_begin_num("table_save.rewrite", table->cmeta.total_pages);
+	for (page_t i = 0; i < norm_count(table->cmeta); i++) {
+		get_page(table, 0, i)->dirty = 1;
+	}
+	for (page_t i = 0; i < ext_count(table->cmeta); i++) {
+		get_page(table, 1, i)->dirty = 1;
+	}
+
+	char copy_path[PATH_MAX];
+	snprintf(copy_path, sizeof(copy_path), "%s" COPY_SUFFIX, table->path);
+	int fd = mkstemp(copy_path);
+	if (fd < 0) {
+		fprintf(stderr, "failed to create %s\n", copy_path);
+		trace_end("table_save.rewrite");
+		return -1;
+	}
+
+	// New file is not visible to others until the rename, lock it before
+	struct stat st;
+	int result = 0;
+	if (fstat(table->fd, &st) < 0 || fchmod(fd, st.st_mode & 0777) < 0 || flock(fd, LOCK_EX) < 0) {
+		fprintf(stderr, "failed to create %s\n", copy_path);
+		result = -1;
+	}
+
+	int old_fd = table->fd;
+	uint32_t old_version = table->cmeta.version;
+	table->fd = fd;
+	table->cmeta.version = (table->cmeta.version & META_FLAGS) | META_VERSION;
+	if (result == 0) {
+		result = write_changes(table);
+	}
+	if (result == 0) {
+		result = table_replace(copy_path, table->path);
+	}
+	trace_end("table_save.rewrite");
+
+	if (result < 0) {
+		// Stay on the old version, the caller restores the cache state
+		table->fd = old_fd;
+		table->cmeta.version = old_version;
+		unlink(copy_path);
+		close(fd);
+		return -1;
 	}
 
+	close(old_fd);
 	return 0;
 }
 
 /**
- * @brief Load page from file to cache.
+ * @brief Append changed pages and page map chunks after the end of the
+ * file, then publish them by rewriting the metadata.
+ * Files without page map get a whole one with their first append.
  *
- * @param[in] cache - Table cache.
- * @param[in] fd - Table file descriptior.
- * @param[in] page_num - Page number.
- * @return Pointer to db_page object in cache with requested page.
+ * @param[in] table - Table object.
+ * @return Success code.
  */
-db_page *load_to_cache(vector *cache, int fd, page_t page_num) {
-	void *page_buffer = malloc(PAGE_SIZE);
+int append_changes(db_table *table) {
+	uint32_t page_size = table_page_size(table);
+	uint8_t mapped = (table->fmeta.map_offset != 0);
+	if (mapped && load_map(table) < 0) {
+		return -1;
+	}
 
-	// Read page
-	lseek(fd, locate_page(page_num), SEEK_SET);
-	if (read(fd, page_buffer, PAGE_SIZE) != PAGE_SIZE) {
-		fprintf(stderr, "failed to read file\n");
-		return NULL;
+	// New map keeps the chunks of unchanged pages in place
+	file_map *map = malloc(sizeof(file_map));
+	map->norm_chunks = chunk_count(table, norm_count(table->cmeta));
+	map->ext_chunks = chunk_count(table, ext_count(table->cmeta));
+	uint64_t count = map->norm_chunks + map->ext_chunks;
+	map->offsets = calloc(count + 1, sizeof(uint64_t));
+	map->chunks = calloc(count + 1, sizeof(page_block *));
+	if (mapped) {
+		file_map *old = table->map;
+		memcpy(map->offsets, old->offsets, old->norm_chunks * sizeof(uint64_t));
+		memcpy(map->offsets + map->norm_chunks, old->offsets + old->norm_chunks,
+			old->ext_chunks * sizeof(uint64_t));
 	}
 
-	db_page page = {
-		.pg_num = page_num,
-		.raw_data = page_buffer
-	};
+	uint64_t pos = table->fsize;
+	trace_begin_num("table_save.flush", table->norm_cache->count + table->ext_cache->count);
+	int result = append_pages(table, map, 0, &pos);
+	if (result == 0) {
+		result = append_pages(table, map, 1, &pos);
+	}
+	for (uint64_t i = 0; i < count && result == 0 && !mapped; i++) {
+		if (map->chunks[i] == NULL) {
+			uint8_t ext = (i >= map->norm_chunks);
+			map->chunks[i] = copy_chunk(table, ext, ext ? i - map->norm_chunks : i);
+			result = (map->chunks[i] != NULL) ? 0 : -1;
+		}
+	}
+
+	// Then the changed chunks, the filter and the chunk offsets
+	for (uint64_t i = 0; i < count && result == 0; i++) {
+		if (map->chunks[i] == NULL) {
+			continue;
+		}
+		if (pwrite(table->fd, map->chunks[i], page_size, pos) != page_size) {
+			fprintf(stderr, "failed to write page map\n");
+			result = -1;
+		}
+		map->offsets[i] = pos;
+		pos += page_size;
+	}
+	if (result == 0) {
+		result = flush_bloom(table, &pos);
+	}
+	uint64_t map_offset = pos;
+	if (result == 0 && pwrite(table->fd, map->offsets, count * sizeof(uint64_t), pos)
+			!= (int64_t)(count * sizeof(uint64_t))) {
+		fprintf(stderr, "failed to write page map\n");
+		result = -1;
+	}
+	if (result == 0 && fsync(table->fd) < 0) {
+		fprintf(stderr, "failed to sync %s\n", table->path);
+		result = -1;
+	}
+	trace_end("table_save.flush");
+
+	if (result < 0) {
+		// Nothing points past the old end, later saves start from there again
+		free_map(map);
+		if (ftruncate(table->fd, table->fsize) < 0) {
+			fprintf(stderr, "failed to truncate %s\n", table->path);
+		}
+		return -1;
+	}
+
+	// Publish
+	table->cmeta.map_offset = map_offset;
+	if (write_meta(table) < 0) {
+		table->cmeta.map_offset = table->fmeta.map_offset;
+		free_map(map);
+		return -1;
+	}
+
+	// Unchanged chunks already read carry over
+	file_map *old = table->map;
+	for (uint64_t i = 0; old != NULL && i < old->norm_chunks + old->ext_chunks; i++) {
+		uint64_t moved = (i < old->norm_chunks) ? i : i - old->norm_chunks + map->norm_chunks;
+		if (map->chunks[moved] == NULL) {
+			map->chunks[moved] = old->chunks[i];
+			old->chunks[i] = NULL;
+		}
+	}
+	free_map(old);
+	table->map = map;
+	// Compressed ext section of the file without page map is not used again
+	free(table->ext_index);
+	table->ext_index = NULL;
+	table->fmeta = table->cmeta;
+
+	return 0;
+}
+
+/**
+ * @brief Append changed pages of a cache and point a new page map at them.
+ * Ext pages of compressed tables are compressed one by one.
+ *
+ * @param[in] table - Table object.
+ * @param[in] map - New page map.
+ * @param[in] ext - Append ext pages.
+ * @param[in,out] pos - File offset to append at.
+ * @return Success code.
+ */
+int append_pages(db_table *table, file_map *map, uint8_t ext, uint64_t *pos) {
+	uint32_t page_size = table_page_size(table);
+	vector *cache = ext ? table->ext_cache : table->norm_cache;
+	uint8_t *packed = (ext && table_ext_compressed(table)) ? malloc(page_size) : NULL;
+	for (uint32_t i = 0; i < cache->count; i++) {
+		db_page *page = *(db_page **)vec_at(cache, i);
+		if (!page->dirty) {
+			continue;
+		}
+
+		// Keep pages raw unless compression saves space
+		void *data = page->raw_data;
+		uint32_t len = page_size;
+		uint32_t packed_len = (packed != NULL) ? lz4_compress(data, page_size, packed, page_size - 1) : 0;
+		if (packed_len > 0) {
+			data = packed;
+			len = packed_len;
+		}
+
+		page_block *chunk = changed_chunk(table, map, ext, page->pg_num / map_chunk(table));
+		if (chunk == NULL || pwrite(table->fd, data, len, *pos) != len) {
+			fprintf(stderr, "failed to flush page\n");
+			free(packed);
+			return -1;
+		}
+
+		page_block block = {
+			.offset = *pos,
+			.len = len,
+			._padding = 0
+		};
+		chunk[page->pg_num % map_chunk(table)] = block;
+		*pos += len;
+	}
+
+	free(packed);
+	return 0;
+}
+
+/**
+ * @brief Get page map chunk of a new map for changing, copying it from the
+ * file version in use on first change.
+ *
+ * @param[in] table - Table object.
+ * @param[in] map - New page map.
+ * @param[in] ext - Chunk of ext pages.
+ * @param[in] chunk - Chunk number (relative to ext chunks for ext pages).
+ * @return Chunk or NULL on failure.
+ */
+page_block *changed_chunk(db_table *table, file_map *map, uint8_t ext, uint64_t chunk) {
+	uint64_t index = ext ? map->norm_chunks + chunk : chunk;
+	if (map->chunks[index] == NULL) {
+		map->chunks[index] = copy_chunk(table, ext, chunk);
+	}
+
+	return map->chunks[index];
+}
+
+/**
+ * @brief Copy page map chunk of the file version in use.
+ * Entries of pages not in the file are left empty.
+ *
+ * @param[in] table - Table object.
+ * @param[in] ext - Chunk of ext pages.
+ * @param[in] chunk - Chunk number (relative to ext chunks for ext pages).
+ * @return New chunk or NULL on failure.
+ */
+page_block *copy_chunk(db_table *table, uint8_t ext, uint64_t chunk) {
+	uint64_t per_chunk = map_chunk(table);
+	page_block *copy = calloc(per_chunk, sizeof(page_block));
+	page_t stored = ext ? ext_count(table->fmeta) : norm_count(table->fmeta);
+	for (page_t i = chunk * per_chunk; i < stored && i < (chunk + 1) * per_chunk; i++) {
+		page_t page_in_file = ext ? table->fmeta.ext_start + i : i;
+		if (find_stored(table, page_in_file, &copy[i % per_chunk]) < 0) {
+			free(copy);
+			return NULL;
+		}
+	}
+
+	return copy;
+}
+
+/**
+ * @brief Write metadata at the start of the file, publishing the new
+ * version, and wait for it to reach the disk.
+ *
+ * @param[in] table - Table object.
+ * @return Success code.
+ */
+int write_meta(db_table *table) {
+	trace_begin("table_save.meta", NULL);
+	int result = 0;
+	if (pwrite(table->fd, &table->cmeta, sizeof(db_meta), 0) != sizeof(db_meta) || fsync(table->fd) < 0) {
+		fprintf(stderr, "failed to write metadata\n");
+		result = -1;
+	}
+	trace_end("table_save.meta");
+
+	return result;
+}
+
+/**
+ * @brief Check for changes not in the file.
+ *
+ * @param[in] table - Table object.
+ * @return Boolean result.
+ */
+int table_dirty(db_table *table) {
+	if (memcmp(&table->cmeta, &table->fmeta, sizeof(db_meta)) != 0) {
+		return 1;
+	}
+
+	for (uint32_t i = 0; i < table->norm_cache->count; i++) {
+		if ((*(db_page **)vec_at(table->norm_cache, i))->dirty) {
+			return 1;
+		}
+	}
+	for (uint32_t i = 0; i < table->ext_cache->count; i++) {
+		if ((*(db_page **)vec_at(table->ext_cache, i))->dirty) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Mark all cached pages as saved.
+ *
+ * @param[in] table - Table object.
+ */
+void clear_dirty(db_table *table) {
+	for (uint32_t i = 0; i < table->norm_cache->count; i++) {
+		(*(db_page **)vec_at(table->norm_cache, i))->dirty = 0;
+	}
+	for (uint32_t i = 0; i < table->ext_cache->count; i++) {
+		(*(db_page **)vec_at(table->ext_cache, i))->dirty = 0;
+	}
+}
+
+/**
+ * @brief Save changed pages of table cache to file.
+ *
+ * @param[in] table - Table object.
+ * @param[in] cache - Table cache.
+ * @param[in] offset - Write page offset.
+ * @return Success code.
+ */
+int flush_cache(db_table *table, vector *cache, page_t offset) {
+	uint32_t page_size = table_page_size(table);
+	for (uint32_t i = 0; i < cache->count; i++) {
+		db_page *page = *(db_page **)vec_at(cache, i);
+		if (!page->dirty) {
+			continue;
+		}
+
+		if (pwrite(table->fd, page->raw_data, page_size, locate_page(table, page->pg_num + offset)) != page_size) {
+			fprintf(stderr, "failed to flush page\n");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Save normal pages and write the compressed ext section after them.
+ *
+ * @param[in] table - Table object.
+ * @return Success code.
+ */
+int flush_compressed(db_table *table) {
+	trace_begin_num("table_save.pack_ext", ext_count(table->cmeta));
+	uint8_t *section;
+	uint64_t section_len;
+	int result = pack_ext(table, &section, &section_len);
+	trace_end("table_save.pack_ext");
+	if (result < 0) {
+		return -1;
+	}
+
+	trace_begin_num("table_save.flush", table->norm_cache->count + 1);
+	result = flush_cache(table, table->norm_cache, 0);
+	uint64_t place = locate_page(table, table->cmeta.ext_start);
+	if (result == 0) {
+		if (pwrite(table->fd, section, section_len, place) != (int64_t)section_len) {
+			fprintf(stderr, "failed to write ext section\n");
+			result = -1;
+		}
+	}
+	uint64_t data_end = place + section_len;
+	if (result == 0) {
+		result = flush_bloom(table, &data_end);
+	}
+	trace_end("table_save.flush");
+
+	// Section starts with the new index
+	uint64_t index_len = ext_count(table->cmeta) * sizeof(page_block);
+	free(table->ext_index);
+	table->ext_index = malloc(index_len + 1);
+	memcpy(table->ext_index, section, index_len);
+	free(section);
+
+	return result;
+}
+
+/**
+ * @brief Build compressed ext section from cached pages.
+ *
+ * @param[in] table - Table object.
+ * @param[out] section - New section (free after use).
+ * @param[out] section_len - New section length.
+ * @return Success code.
+ */
+int pack_ext(db_table *table, uint8_t **section, uint64_t *section_len) {
+	uint32_t page_size = table_page_size(table);
+	uint64_t count = ext_count(table->cmeta);
+	void **cached = calloc(count + 1, sizeof(void *));
+	for (uint32_t i = 0; i < table->ext_cache->count; i++) {
+		db_page *page = *(db_page **)vec_at(table->ext_cache, i);
+		cached[page->pg_num] = page->raw_data;
+	}
+
+	uint64_t index_len = (uint64_t)count * sizeof(page_block);
+	uint64_t cap = index_len + page_size;
+	uint64_t pos = index_len;
+	uint8_t *out = malloc(cap);
+	for (page_t i = 0; i < count; i++) {
+		if (pos + page_size > cap) {
+			cap *= 2;
+			out = realloc(out, cap);
+		}
+
+		// Keep pages raw unless compression saves space
+		if (cached[i] == NULL) {
+			fprintf(stderr, "ext page %" PRIu64 " is missing\n", i);
+			free(cached);
+			free(out);
+			return -1;
+		}
+
+		// Keep pages raw unless compression saves space
+		uint32_t len = lz4_compress(cached[i], page_size, out + pos, page_size - 1);
+		if (len == 0) {
+			memcpy(out + pos, cached[i], page_size);
+			len = page_size;
+		}
+
+		page_block block = {
+			.offset = pos,
+			.len = len,
+			._padding = 0
+		};
+		memcpy(out + i * sizeof(page_block), &block, sizeof(page_block));
+		pos += len;
+	}
+	free(cached);
+
+	*section = out;
+	*section_len = pos;
+	return 0;
+}
+
+/**
+ * @brief Read block index of the compressed ext section in file.
+ *
+ * @param[in] table - Table object.
+ * @return Success code.
+ */
+int load_ext_index(db_table *table) {
+	if (table->ext_index != NULL) {
+		return 0;
+	}
+
+	uint64_t count = ext_count(table->fmeta);
+	page_block *index = malloc(count * sizeof(page_block) + 1);
+	if (read_at(table->fd, index, count * sizeof(page_block),
+			locate_page(table, table->fmeta.ext_start)) < 0) {
+		fprintf(stderr, "failed to read ext index\n");
+		free(index);
+		return -1;
+	}
+
+	// Blocks must follow the index and fit a page when expanded
+	uint64_t index_len = count * sizeof(page_block);
+	for (page_t i = 0; i < count; i++) {
+		if (index[i].len == 0 || index[i].len > table_page_size(table) || index[i].offset < index_len) {
+			fprintf(stderr, "ext index is corrupt\n");
+			free(index);
+			return -1;
+		}
+	}
+
+	table->ext_index = index;
+	return 0;
+}
+
+/**
+ * @brief Read page map chunk offsets of the file.
+ *
+ * @param[in] table - Table object.
+ * @return Success code.
+ */
+int load_map(db_table *table) {
+	if (table->map != NULL) {
+		return 0;
+	}
+
+	file_map *map = malloc(sizeof(file_map));
+	map->norm_chunks = chunk_count(table, norm_count(table->fmeta));
+	map->ext_chunks = chunk_count(table, ext_count(table->fmeta));
+	uint64_t count = map->norm_chunks + map->ext_chunks;
+	map->offsets = malloc(count * sizeof(uint64_t) + 1);
+	map->chunks = calloc(count + 1, sizeof(page_block *));
+	if (table->fmeta.map_offset + count * sizeof(uint64_t) > table->fsize
+			|| read_at(table->fd, map->offsets, count * sizeof(uint64_t), table->fmeta.map_offset) < 0) {
+		fprintf(stderr, "failed to read page map\n");
+		free_map(map);
+		return -1;
+	}
+
+	// Chunks are written before the offsets
+	for (uint64_t i = 0; i < count; i++) {
+		if (map->offsets[i] + table_page_size(table) > table->fmeta.map_offset) {
+			fprintf(stderr, "page map is corrupt\n");
+			free_map(map);
+			return -1;
+		}
+	}
+
+	table->map = map;
+	return 0;
+}
+
+/**
+ * @brief Free page map.
+ *
+ * @param[in] map - Page map or NULL.
+ */
+void free_map(file_map *map) {
+	if (map == NULL) {
+		return;
+	}
+
+	for (uint64_t i = 0; i < map->norm_chunks + map->ext_chunks; i++) {
+		free(map->chunks[i]);
+	}
+	free(map->chunks);
+	free(map->offsets);
+	free(map);
+}
+
+/**
+ * @brief Find where a page of the file version in use is stored.
+ *
+ * @param[in] table - Table object.
+ * @param[in] page_in_file - Page number in file (ext pages follow normal pages).
+ * @param[out] block - Page location (absolute offset).
+ * @return Success code.
+ */
+int find_stored(db_table *table, page_t page_in_file, page_block *block) {
+	uint32_t page_size = table_page_size(table);
+	if (page_in_file >= table->fmeta.total_pages) {
+		return -1;
+	}
+
+	// Files without page map keep pages in order
+	uint8_t ext = (page_in_file >= table->fmeta.ext_start);
+	page_t page_num = ext ? page_in_file - table->fmeta.ext_start : page_in_file;
+	if (table->fmeta.map_offset == 0 && (!ext || !(table->fmeta.version & META_EXT_COMPRESSED))) {
+		block->offset = locate_page(table, page_in_file);
+		block->len = page_size;
+		block->_padding = 0;
+		return 0;
+	}
+	if (table->fmeta.map_offset == 0) {
+		if (load_ext_index(table) < 0) {
+			return -1;
+		}
+		*block = table->ext_index[page_num];
+		block->offset += locate_page(table, table->fmeta.ext_start);
+		return 0;
+	}
+
+	if (load_map(table) < 0) {
+		return -1;
+	}
+	file_map *map = table->map;
+	uint64_t chunk = (ext ? map->norm_chunks : 0) + page_num / map_chunk(table);
+	if (map->chunks[chunk] == NULL) {
+		page_block *stored = malloc(page_size);
+		if (read_at(table->fd, stored, page_size, map->offsets[chunk]) < 0) {
+			fprintf(stderr, "failed to read page map\n");
+			free(stored);
+			return -1;
+		}
+		map->chunks[chunk] = stored;
+	}
+
+	*block = map->chunks[chunk][page_num % map_chunk(table)];
+	if (block->len == 0 || block->len > page_size || block->offset + block->len > table->fsize) {
+		fprintf(stderr, "page map is corrupt\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Read a page of the file version in use, decompressing it if
+ * stored compressed.
+ *
+ * @param[in] table - Table object.
+ * @param[in] page_in_file - Page number in file (ext pages follow normal pages).
+ * @param[out] buf - Destination (size = table_page_size(table)).
+ * @return Success code.
+ */
+int read_stored(db_table *table, page_t page_in_file, void *buf) {
+	page_block block;
+	if (find_stored(table, page_in_file, &block) < 0) {
+		return -1;
+	}
+
+	uint32_t page_size = table_page_size(table);
+	if (block.len == page_size) {
+		return read_at(table->fd, buf, page_size, block.offset);
+	}
+
+	trace_begin_num("page_decompress", page_in_file);
+	uint8_t *stored = malloc(block.len);
+	int result = read_at(table->fd, stored, block.len, block.offset);
+	if (result == 0 && lz4_decompress(stored, block.len, buf, page_size) != page_size) {
+		fprintf(stderr, "page %" PRIu64 " is corrupt\n", page_in_file);
+		result = -1;
+	}
+	free(stored);
+	trace_end("page_decompress");
+
+	return result;
+}
+
+/**
+ * @brief Read exactly n bytes at an offset.
+ *
+ * @param[in] fd - File descriptor.
+ * @param[out] buf - Destination.
+ * @param[in] n - Bytes to read.
+ * @param[in] offset - File offset.
+ * @return Success code.
+ */
+int read_at(int fd, void *buf, uint64_t n, uint64_t offset) {
+	uint64_t done = 0;
+	while (done < n) {
+		ssize_t bytes = pread(fd, (uint8_t *)buf + done, n - done, offset + done);
+		if (bytes <= 0) {
+			return -1;
+		}
+		done += bytes;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Read key filter from the end of the file version in use.
+ *
+ * @param[in] table - Table object.
+ * @return Success code.
+ */
+int load_bloom(db_table *table) {
+	// Filter ends where the page map starts, or with the file
+	int64_t size = (table->fmeta.map_offset != 0) ? table->fmeta.map_offset : table->fsize;
+	bloom_footer footer;
+	if (size < (int64_t)(meta_length(table) + sizeof(bloom_footer))
+			|| read_at(table->fd, &footer, sizeof(bloom_footer), size - sizeof(bloom_footer)) < 0
+			|| !bloom_valid(&footer)) {
+		return -1;
+	}
+
+	uint64_t bytes = footer.bit_count / 8;
+	if ((uint64_t)size < meta_length(table) + sizeof(bloom_footer) + bytes) {
+		return -1;
+	}
+
+	uint8_t *bits = malloc(bytes);
+	if (read_at(table->fd, bits, bytes, size - sizeof(bloom_footer) - bytes) < 0) {
+		free(bits);
+		return -1;
+	}
+
+	table->bloom = bloom_load(&footer, bits);
+	return 0;
+}
+
+/**
+ * @brief Write key filter after the table data.
+ *
+ * @param[in] table - Table object.
+ * @param[in,out] pos - File offset past the last page, moved past the filter.
+ * @return Success code.
+ */
+int flush_bloom(db_table *table, uint64_t *pos) {
+	if (table->bloom == NULL) {
+		return 0;
+	}
+
+	bloom_footer footer;
+	bloom_store(table->bloom, &footer);
+	uint64_t bytes = bloom_bytes(table->bloom);
+	if (pwrite(table->fd, table->bloom->bits, bytes, *pos) != (int64_t)bytes
+			|| pwrite(table->fd, &footer, sizeof(bloom_footer), *pos + bytes) != sizeof(bloom_footer)) {
+		fprintf(stderr, "failed to write key filter\n");
+		return -1;
+	}
+
+	*pos += bytes + sizeof(bloom_footer);
+	return 0;
+}
+
+/**
+ * @brief Load page from file to cache.
+ *
+ * @param[in] table - Table object.
+ * @param[in] ext - Page is an extension page.
+ * @param[in] page_num - Page number (relative to ext section for ext pages).
+ * @return Cached page or NULL on failure.
+ */
+db_page *load_to_cache(db_table *table, uint8_t ext, page_t page_num) {
+	trace_begin_num("page_load", page_num);
+	void *page_buffer = arena_alloc(table->arena);
+
+	// Read page
+	page_t page_in_file = ext ? table->fmeta.ext_start + page_num : page_num;
+	if (page_buffer == NULL || read_stored(table, page_in_file, page_buffer) < 0) {
+		fprintf(stderr, "failed to read file\n");
+		if (page_buffer != NULL) {
+			arena_release(table->arena, page_buffer);
+		}
+		trace_end("page_load");
+		return NULL;
+	}
+	trace_end("page_load");
+
+	return cache_page(table, ext, page_num, page_buffer, 0);
+}
+
+/**
+ * @brief Widen metadata of a version 1 or 2 file.
+ * Version 1 files always used 4096 byte pages and left the version and
+ * page size fields as struct padding.
+ * The version stays below META_VERSION, pages keep the 32-bit layout.
+ *
+ * @param[in] stored - Metadata as read from file.
+ * @param[out] meta - Metadata in memory.
+ */
+void upgrade_meta(db_meta_32 *stored, db_meta *meta) {
+	if (meta_version(*stored) != META_VERSION_32 || !valid_page_size(stored->page_size)) {
+		stored->version = META_VERSION_32;
+		stored->page_size = 4096;
+	}
+
+	meta->table_identity = stored->table_identity;
+	meta->page_size = stored->page_size;
+	meta->_padding = 0;
+	meta->version = stored->version;
+	meta->total_pages = stored->total_pages;
+	meta->ext_start = stored->ext_start;
+	meta->ext_end_ptr = stored->ext_end_ptr;
+	meta->root_page = (stored->root_page == INVALID_VAL_32) ? INVALID_VAL : stored->root_page;
+	meta->map_offset = 0;
+}
+
+/**
+ * @brief Get page from cache, loading it on a miss. Exits on failure.
+ *
+ * @param[in] table - Table object.
+ * @param[in] ext - Page is an extension page.
+ * @param[in] page_num - Page number.
+ * @return Cached page.
+ */
+db_page *get_page(db_table *table, uint8_t ext, page_t page_num) {
+	page_t limit = ext ? __atomic_load_n(&table->cmeta.total_pages, __ATOMIC_RELAXED) :
+		__atomic_load_n(&table->cmeta.ext_start, __ATOMIC_RELAXED);
+	if (page_num >= limit) {
+		fprintf(stderr, "tried to access page outside of database\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Cached pages never move, shared tables lock only on a miss
+	db_page *page = find_cached(table, ext, page_num);
+	if (page == NULL) {
+		lock_cache(table);
+		page = fetch_page(table, ext, page_num);
+		unlock_cache(table);
+	}
+	if (page == NULL) {
+		fprintf(stderr, "failed to load page from cache\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return page;
+}
+
+/**
+ * @brief Find page in cache.
+ *
+ * @param[in] table - Table object.
+ * @param[in] ext - Page is an extension page.
+ * @param[in] page_num - Page number.
+ * @return Cached page or NULL if not cached.
+ */
+db_page *find_cached(db_table *table, uint8_t ext, page_t page_num) {
+	return page_map_get(ext ? table->ext_map : table->norm_map, page_num);
+}
+
+/**
+ * @brief Get page into cache on a miss, waiting for it if being prefetched.
+ * Shared tables must hold the cache lock.
+ *
+ * @param[in] table - Table object.
+ * @param[in] ext - Page is an extension page.
+ * @param[in] page_num - Page number.
+ * @return Cached page or NULL on failure.
+ */
+db_page *fetch_page(db_table *table, uint8_t ext, page_t page_num) {
+	// Another thread may have loaded it meanwhile
+	db_page *page = find_cached(table, ext, page_num);
+	if (page == NULL && await_prefetch(table, page_num, ext) == 0) {
+		page = find_cached(table, ext, page_num);
+	}
+	if (page != NULL) {
+		return page;
+	}
+
+	return load_to_cache(table, ext, page_num);
+}
+
+/**
+ * @brief Add page frame to cache.
+ *
+ * @param[in] table - Table object.
+ * @param[in] ext - Page is an extension page.
+ * @param[in] page_num - Page number.
+ * @param[in] frame - Page frame from the table's arena.
+ * @param[in] dirty - Page is not in the file yet.
+ * @return Cached page or NULL on failure (frame is released).
+ */
+db_page *cache_page(db_table *table, uint8_t ext, page_t page_num, void *frame, uint8_t dirty) {
+	db_page *page = malloc(sizeof(db_page));
+	if (page != NULL) {
+		page->pg_num = page_num;
+		page->raw_data = frame;
+		page->dirty = dirty;
+	}
+	if (frame == NULL || page == NULL || page_map_put(ext ? table->ext_map : table->norm_map, page_num, page) != page) {
+		fprintf(stderr, "failed to create new page in cache\n");
+		if (frame != NULL) {
+			arena_release(table->arena, frame);
+		}
+		free(page);
+		return NULL;
+	}
+
+	vec_push(ext ? table->ext_cache : table->norm_cache, &page);
+	return page;
+}
+
+/**
+ * @brief Get latch of a page, creating it on first use.
+ *
+ * @param[in] table - Shared table object.
+ * @param[in] page_num - Page number.
+ * @return Latch or NULL on failure.
+ */
+pthread_rwlock_t *get_latch(db_table *table, page_t page_num) {
+	pthread_rwlock_t *latch = page_map_get(table->shared->latches, page_num);
+	if (latch != NULL) {
+		return latch;
+	}
+
+	// Threads racing to create the latch keep the first one
+	pthread_rwlock_t *fresh = malloc(sizeof(pthread_rwlock_t));
+	pthread_rwlock_init(fresh, NULL);
+	latch = page_map_put(table->shared->latches, page_num, fresh);
+	if (latch != fresh) {
+		pthread_rwlock_destroy(fresh);
+		free(fresh);
+	}
+	if (latch == NULL) {
+		fprintf(stderr, "failed to create page latch\n");
+	}
+
+	return latch;
+}
+
+/**
+ * @brief Delete page latch (page_map_free).
+ *
+ * @param[in] latch - Latch.
+ */
+void free_latch(void *latch) {
+	pthread_rwlock_destroy(latch);
+	free(latch);
+}
+
+/**
+ * @brief Queue background read of a page that exists in the file.
+ *
+ * @param[in] table - Table object.
+ * @param[in] page_num - Page number (relative to ext section for ext pages).
+ * @param[in] ext - Page is an extension page.
+ */
+void prefetch_page(db_table *table, page_t page_num, uint8_t ext) {
+	// Reads in flight are not shared between threads
+	if (table->shared != NULL || table->aio_lost || find_cached(table, ext, page_num) != NULL) {
+		return;
+	}
+
+	// Compressed pages are not page sized on disk
+	page_t page_in_file = ext ? table->fmeta.ext_start + page_num : page_num;
+	page_block block;
+	if (find_stored(table, page_in_file, &block) < 0 || block.len != table_page_size(table)) {
+		return;
+	}
+
+	if (table->aio == NULL) {
+		table->aio = aio_new(PREFETCH_DEPTH);
+		table->prefetching = vec_new(sizeof(db_prefetch));
+	}
+
+	for (uint32_t i = 0; i < table->prefetching->count; i++) {
+		db_prefetch *pending = vec_at(table->prefetching, i);
+		if (pending->pg_num == page_num && pending->ext == ext) {
+			return;
+		}
+	}
+
+	// Make room by finishing the oldest reads
+	while (table->prefetching->count >= table->aio->depth) {
+		finish_prefetch(table);
+	}
+
+	db_prefetch pending = {
+		.pg_num = page_num,
+		.ext = ext,
+		.raw_data = arena_alloc(table->arena)
+	};
+	if (pending.raw_data == NULL) {
+		return;
+	}
+
+	if (aio_read(table->aio, table->fd, pending.raw_data, table_page_size(table),
+			block.offset, (uintptr_t)pending.raw_data) < 0) {
+		arena_release(table->arena, pending.raw_data);
+		return;
+	}
+	vec_push(table->prefetching, &pending);
+}
+
+/**
+ * @brief Wait for a page being prefetched to land in cache.
+ *
+ * @param[in] table - Table object.
+ * @param[in] page_num - Page number.
+ * @param[in] ext - Page is an extension page.
+ * @return Success code (-1 if the page was not being read).
+ */
+int await_prefetch(db_table *table, page_t page_num, uint8_t ext) {
+	if (table->prefetching == NULL) {
+		return -1;
+	}
+
+	int found = 0;
+	for (uint32_t i = 0; i < table->prefetching->count && !found; i++) {
+		db_prefetch *pending = vec_at(table->prefetching, i);
+		found = (pending->pg_num == page_num && pending->ext == ext);
+	}
+	if (!found) {
+		return -1;
+	}
+
+	// Completions arrive in any order
+	while (find_cached(table, ext, page_num) == NULL && table->prefetching->count > 0) {
+		finish_prefetch(table);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Reap one finished read and move its page to cache.
+ * Failed or short reads are retried synchronously; pages that still cannot
+ * be read are dropped and reported when accessed.
+ *
+ * @param[in] table - Table object.
+ */
+void finish_prefetch(db_table *table) {
+	aio_completion done;
+	if (aio_reap(table->aio, &done) < 0) {
+		// Engine lost track, forget everything. Frames of reads still in
+		// flight cannot be reused, stop prefetching and leak them instead.
+		if (table->aio->in_flight > 0) {
+			table->aio_lost = 1;
+		} else {
+			for (uint32_t i = 0; i < table->prefetching->count; i++) {
+				db_prefetch *pending = vec_at(table->prefetching, i);
+				arena_release(table->arena, pending->raw_data);
+			}
+		}
+		table->prefetching->count = 0;
+		return;
+	}
+
+	// Take entry out (swap with last)
+	db_prefetch finished = { .raw_data = NULL };
+	for (uint32_t i = 0; i < table->prefetching->count; i++) {
+		db_prefetch *pending = vec_at(table->prefetching, i);
+		if ((uintptr_t)pending->raw_data == done.tag) {
+			finished = *pending;
+			*pending = *(db_prefetch *)vec_at(table->prefetching, table->prefetching->count - 1);
+			table->prefetching->count--;
+			break;
+		}
+	}
+	if (finished.raw_data == NULL) {
+		return;
+	}
+
+	if (done.result != (int32_t)table_page_size(table)) {
+		page_t page_in_file = finished.ext ? table->fmeta.ext_start + finished.pg_num : finished.pg_num;
+		if (read_stored(table, page_in_file, finished.raw_data) < 0) {
+			arena_release(table->arena, finished.raw_data);
+			return;
+		}
+	}
+
+	cache_page(table, finished.ext, finished.pg_num, finished.raw_data, 0);
+}
+
+/**
+ * @brief Wait for all reads in flight.
+ *
+ * @param[in] table - Table object.
+ */
+void drain_prefetch(db_table *table) {
+	if (table->prefetching == NULL) {
+		return;
+	}
+
+	aio_submit(table->aio);
+	while (table->prefetching->count > 0) {
+		finish_prefetch(table);
+	}
+}
+
+/**
+ * @brief Save changes to the file (see table_flush).
+ *
+ * @param[in] table - Table object.
+ * @return Success code (1 if changes were dropped).
+ */
+int save_changes(db_table *table) {
+	// Pending reads use the old layout
+	drain_prefetch(table);
+	if (!table_dirty(table)) {
+		return 0;
+	}
+	if (table->read_only) {
+		fprintf(stderr, "cannot save table opened read-only\n");
+		return -1;
+	}
+	if (table_legacy(table)) {
+		fprintf(stderr, "cannot save table in an older format\n");
+		return -1;
+	}
+
+	// Readers save only if no writer holds or has replaced the table
+	if (!table->locked && lock_current(table->fd, table->path, 0) < 0) {
+		return 1;
+	}
+
+	// Cache must keep describing the old file if the save fails
+	db_meta old_meta = table->fmeta;
+	// Filter is written with the pages
+	table_get_bloom(table);
+
+	struct stat st;
+	int result;
+	if (fstat(table->fd, &st) < 0) {
+		fprintf(stderr, "failed to read size of %s\n", table->path);
+		result = -1;
+	} else if ((uint64_t)st.st_size != table->fsize) {
+		// Another process saved since the table was opened
+		result = 1;
+	} else if (st.st_size == 0) {
+		// Nothing to keep a snapshot of
+		result = write_changes(table);
+	} else if (meta_version(table->fmeta) == META_VERSION_COMPACT) {
+		result = rewrite_table(table);
+	} else {
+		result = append_changes(table);
+	}
+
+	if (result < 0) {
+		table->fmeta = old_meta;
+		// Block index may be of the new file
+		free(table->ext_index);
+		table->ext_index = NULL;
+	} else if (result == 0) {
+		clear_dirty(table);
+		if (fstat(table->fd, &st) == 0) {
+			table->fsize = st.st_size;
+		}
+	}
+
+	if (!table->locked) {
+		flock(table->fd, LOCK_UN);
+	}
+
+	return result;
+}
+
+/**
+ * @brief Replace file (see table_replace).
+ *
+ * @param[in] src - Path of the new file.
+ * @param[in] dest - Path to replace.
+ * @return Success code.
+ */
+int replace_file(const char *src, const char *dest) {
+	// New file contents must be on disk before the rename
+	int fd = open(src, O_RDONLY);
+	if (fd < 0 || fsync(fd) < 0) {
+		fprintf(stderr, "failed to sync %s\n", src);
+		if (fd >= 0) {
+			close(fd);
+		}
+		return -1;
+	}
+	close(fd);
+
+	if (rename(src, dest) < 0) {
+		fprintf(stderr, "failed to replace %s\n", dest);
+		return -1;
+	}
+
+	// Persist the rename itself
+	char dir[PATH_MAX];
+	snprintf(dir, sizeof(dir), "%s", dest);
+	char *slash = strrchr(dir, '/');
+	if (slash != NULL) {
+		*slash = '\0';
+	} else {
+		strcpy(dir, ".");
+	}
+
+	fd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Record table open.
+ *
+ * @param[in] start - Start time from capture_begin.
+ * @param[in] table - Opened table or NULL.
+ * @param[in] file - Table path.
+ * @param[in] identity - Table identity.
+ * @param[in] page_size - Requested page size.
+ * @param[in] mode - Open mode flags.
+ */
+void record_open(uint64_t start, db_table *table, const char *file, uint32_t identity, uint32_t page_size,
+		uint8_t mode) {
+	if (capture_file == NULL) {
+		return;
+	}
+
+	if (table != NULL) {
+		page_size = table_page_size(table);
+		if (table->fmeta.total_pages > 0) {
+			mode |= CAPTURE_EXISTING;
+		}
+	}
 
-	return vec_push(cache, &page);
+	uint64_t key[2] = { capture_path(file), 0 };
+	capture_stop(start, table, CAPTURE_OPEN, mode, key, page_size, identity);
 }
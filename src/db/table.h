@@ -1,16 +1,30 @@
 #pragma once
 
 #include <stdint.h>
+#include <pthread.h>
 
 #include "defines.h"
 #include "../util/vector.h"
+#include "../util/arena.h"
+#include "aio.h"
+#include "bloom.h"
+#include "pagemap.h"
 
 // Page pointer
 typedef struct {
 	page_t pg_num;
 	void *raw_data;
+	// Set when the page is handed out for writing, dirty pages are saved
+	uint8_t dirty;
 } db_page;
 
+// Page read in flight
+typedef struct {
+	page_t pg_num;
+	uint8_t ext;
+	void *raw_data;
+} db_prefetch;
+
 // Cache manager
 typedef struct {
 	uint32_t page_count;
@@ -18,50 +32,292 @@ typedef struct {
 	db_page *data;
 } db_cache;
 
+// Location of a stored page
+// Offsets are relative to the ext section in its block index, absolute in
+// a page map. Pages stored uncompressed have len equal to the page size
+typedef struct {
+	uint64_t offset;
+	uint32_t len;
+	uint32_t _padding;
+} page_block;
+
 // Metadata information
+// Version field keeps its place in all versions
+// Files written whole have no page map (map_offset 0): normal pages follow
+// the metadata in order, then the ext section. With META_EXT_COMPRESSED,
+// the ext section holds a page_block per page followed by the LZ4
+// compressed pages
+// Other files list page locations in a page map: the file offsets of its
+// chunks (normal pages' chunks first), each chunk holding the page_blocks
+// of page_size / sizeof(page_block) pages. Compressed ext pages are stored
+// one by one
+// With META_BLOOM, a key filter and its bloom_footer follow the last page,
+// or precede the page map
+// With META_HASH, the root page is a hash directory (see hash.h) instead of
+// a btree root
 typedef struct {
 	uint32_t table_identity;
-	uint32_t total_pages;
-	uint32_t ext_start;
+	uint32_t page_size;
+	uint32_t _padding;
+	uint32_t version;
+	uint64_t total_pages;
+	uint64_t ext_start;
 	uint64_t ext_end_ptr;
 	page_t root_page;
+	// Version 4 and later
+	uint64_t map_offset;
 } db_meta;
 
+// Metadata of versions 1 and 2 (32-bit page numbers)
+// Version 1 files have no version or page size (struct padding)
+typedef struct {
+	uint32_t table_identity;
+	uint32_t total_pages;
+	uint32_t ext_start;
+	uint32_t version;
+	uint64_t ext_end_ptr;
+	uint32_t root_page;
+	uint32_t page_size;
+} db_meta_32;
+
+// Page map of the file version in use (see db_meta)
+typedef struct {
+	uint64_t norm_chunks;
+	uint64_t ext_chunks;
+	// File offsets of chunks, normal pages' chunks first
+	uint64_t *offsets;
+	// Chunks read so far (NULL until used)
+	page_block **chunks;
+} file_map;
+
+// State of a table shared between threads (see table_share)
+typedef struct {
+	// Guards cache misses, page creation and the frame arena
+	pthread_mutex_t cache_lock;
+	// Guards the root page number, taken before the root page's latch
+	pthread_rwlock_t root_latch;
+	// Normal page latches (pthread_rwlock_t), created on first use
+	page_map *latches;
+} table_shared;
+
 // Database table
+// Saves append changed pages and the changed parts of the page map past the
+// end of the file, then publish them by rewriting the metadata. Stored pages
+// are never overwritten, so readers keep a consistent snapshot of the
+// version they opened. Old page versions stay in the file until it is
+// rewritten whole ('pmm vacuum'). Writers hold an exclusive lock on the
+// current version while the table is open, readers save only if the table
+// is not in use and unchanged since they opened it.
 typedef struct {
 	// Database file info
 	int fd;
-	uint32_t fsize;
+	// Size of the file at open or last save
+	uint64_t fsize;
+	char *path;
+	uint8_t locked;
+	// Opened with table_open_read, changes cannot be saved
+	uint8_t read_only;
+	// Table number in captured calls (see capture.h)
+	uint16_t capture_id;
 	db_meta fmeta;
 	// Cache
 	db_meta cmeta;
+	// Cached pages (db_page *)
 	vector *norm_cache;
 	vector *ext_cache;
+	// Cached pages by page number (db_page)
+	page_map *norm_map;
+	page_map *ext_map;
+	// Page frames of both caches
+	page_arena *arena;
+	// Asynchronous reads (created by first prefetch)
+	aio_engine *aio;
+	vector *prefetching;
+	// Engine failed with reads in flight: their frames, the arena and the
+	// engine are never freed since the kernel may still write into them
+	uint8_t aio_lost;
+	// Block index of compressed ext section in file (loaded on first use)
+	page_block *ext_index;
+	// Page map of the file (loaded on first use)
+	file_map *map;
+	// Key filter (loaded on first use)
+	bloom_filter *bloom;
+	// Set while threads share the table
+	table_shared *shared;
 } db_table;
 
+// Get page size of table
+#define table_page_size(table) ((table)->cmeta.page_size)
+// Check if the file uses 32-bit page numbers (upgraded on open, see table_open)
+#define table_legacy(table) (meta_version((table)->fmeta) <= META_VERSION_32)
+// Check if ext pages are stored compressed
+#define table_ext_compressed(table) (((table)->cmeta.version & META_EXT_COMPRESSED) != 0)
+// Check if records are kept in a hash table (see hash.h)
+#define table_hashed(table) (((table)->cmeta.version & META_HASH) != 0)
+
 /**
  * @brief Load database table.
+ * Files in an older format (32-bit page numbers) are loaded in memory and
+ * left unchanged, saving changes to them is dropped (see table_flush).
  *
  * @param[in] file - Filename.
  * @param[in] identity - Expected table identity (type stored).
+ * @param[in] page_size - Page size if the file is created (0 for default).
  * @return New db_table object.
  */
-db_table *table_open(const char *file, uint32_t identity);
+db_table *table_open(const char *file, uint32_t identity, uint32_t page_size);
+
+/**
+ * @brief Load database table for writing, waiting for other writers.
+ * The table stays locked until closed. Files with 32-bit page numbers are
+ * rewritten in the current format first.
+ *
+ * @param[in] file - Filename.
+ * @param[in] identity - Expected table identity (type stored).
+ * @param[in] page_size - Page size if the file is created (0 for default).
+ * @return New db_table object.
+ */
+db_table *table_open_locked(const char *file, uint32_t identity, uint32_t page_size);
+
+/**
+ * @brief Load existing database table for reading only.
+ * The file is never created, upgraded or written, saving changes fails.
+ *
+ * @param[in] file - Filename.
+ * @param[in] identity - Expected table identity (type stored).
+ * @return New db_table object.
+ */
+db_table *table_open_read(const char *file, uint32_t identity);
 
 /**
  * @brief Save database to disk & close database object.
  *
  * @param[in] table - Table object.
- * @return Success code.
+ * @return Success code (see table_flush).
  */
 int table_save(db_table *table);
 
+/**
+ * @brief Choose whether ext pages are stored compressed, starting with the
+ * next save. Normal pages are never compressed.
+ * Only possible while the file holds no ext pages.
+ *
+ * @param[in] table - Table object.
+ * @param[in] compressed - Compress ext pages.
+ * @return Success code.
+ */
+int table_set_ext_compressed(db_table *table, int compressed);
+
+/**
+ * @brief Get key filter stored with the table, loading it if needed.
+ *
+ * @param[in] table - Table object.
+ * @return Filter or NULL if the table has none.
+ */
+bloom_filter *table_get_bloom(db_table *table);
+
+/**
+ * @brief Replace key filter, it is stored with the table from the next save.
+ *
+ * @param[in] table - Table object.
+ * @param[in] filter - New filter (ownership is taken) or NULL to drop it.
+ */
+void table_set_bloom(db_table *table, bloom_filter *filter);
+
+/**
+ * @brief Close database object, discarding unsaved changes.
+ *
+ * @param[in] table - Table object.
+ */
+void table_close(db_table *table);
+
+/**
+ * @brief Durably replace a table file with another (atomic rename).
+ *
+ * @param[in] src - Complete new table file.
+ * @param[in] dest - Table file to replace.
+ * @return Success code.
+ */
+int table_replace(const char *src, const char *dest);
+
+/**
+ * @brief Write pending changes to disk, keeping table open and cached.
+ * Tables opened without a lock are saved only if no other process holds
+ * the lock or has replaced or written the file since. The cache is left
+ * unchanged if saving fails. Version 3 files are rewritten whole by their
+ * first save, later saves append.
+ *
+ * @param[in] table - Table object.
+ * @return Success code (1 if changes were dropped as the table is in use).
+ */
+int table_flush(db_table *table);
+
+/**
+ * @brief Check if another process saved or replaced the file since the
+ * table was opened or last saved. Stale tables should be reopened.
+ *
+ * @param[in] table - Table object.
+ * @return Boolean result.
+ */
+int table_stale(db_table *table);
+
+/**
+ * @brief Take the writer lock of a table opened without it, waiting for
+ * other writers. The table must not be stale once locked.
+ *
+ * @param[in] table - Table object.
+ * @return Success code (1 if the table is stale, it is left unlocked).
+ */
+int table_lock(db_table *table);
+
+/**
+ * @brief Release the writer lock, letting other writers save.
+ *
+ * @param[in] table - Table object.
+ */
+void table_unlock(db_table *table);
+
+/**
+ * @brief Let threads use the table at once. Page reads and page creation
+ * become thread-safe, page latches (table_latch) guard page contents.
+ * Pending prefetches are finished, none are started while shared.
+ * Other calls must wait for table_unshare.
+ *
+ * @param[in] table - Table object.
+ */
+void table_share(db_table *table);
+
+/**
+ * @brief Return table to single-threaded use, once all threads are done.
+ *
+ * @param[in] table - Table object.
+ */
+void table_unshare(db_table *table);
+
+/**
+ * @brief Latch a normal page of a shared table.
+ *
+ * @param[in] table - Shared table object.
+ * @param[in] page_num - Page number.
+ * @param[in] write - Take the latch exclusively.
+ * @return Success code.
+ */
+int table_latch(db_table *table, page_t page_num, int write);
+
+/**
+ * @brief Release a page latch taken with table_latch.
+ *
+ * @param[in] table - Shared table object.
+ * @param[in] page_num - Page number.
+ */
+void table_unlatch(db_table *table, page_t page_num);
+
 /**
  * @brief Load a normal page from database.
  *
  * @param[in] table - Table object.
  * @param[in] page_num - Page number to retrieve.
- * @return Database page (size = PAGE_SIZE).
+ * @return Database page (size = table_page_size(table)).
  */
 void *table_get_norm_page(db_table *table, page_t page_num);
 
@@ -70,16 +326,86 @@ void *table_get_norm_page(db_table *table, page_t page_num);
  *
  * @param[in] table - Table object.
  * @param[in] page_num - Page number to retrieve.
- * @return Database page (size = PAGE_SIZE).
+ * @return Database page (size = table_page_size(table)).
  */
 void *table_get_ext_page(db_table *table, page_t page_num);
 
+/**
+ * @brief Load a normal page for writing, it is saved by the next flush.
+ * Pages changed through table_get_norm_page are not saved.
+ *
+ * @param[in] table - Table object.
+ * @param[in] page_num - Page number to retrieve.
+ * @return Database page (size = table_page_size(table)).
+ */
+void *table_write_norm_page(db_table *table, page_t page_num);
+
+/**
+ * @brief Load an extension page for writing (see table_write_norm_page).
+ *
+ * @param[in] table - Table object.
+ * @param[in] page_num - Page number to retrieve.
+ * @return Database page (size = table_page_size(table)).
+ */
+void *table_write_ext_page(db_table *table, page_t page_num);
+
+/**
+ * @brief Read from the file, bypassing the cache.
+ * Only valid for tables without unsaved changes.
+ *
+ * @param[in] table - Table object.
+ * @param[in] page_num - Page number in file (ext pages follow normal pages).
+ * @param[in] offset - Offset from the start of the page.
+ * @param[out] buf - Destination.
+ * @param[in] n - Bytes to read.
+ * @return Success code.
+ */
+int table_read_direct(db_table *table, page_t page_num, uint64_t offset, void *buf, uint64_t n);
+
+/**
+ * @brief Read an ext page from the file, bypassing the cache.
+ * Compressed pages are decompressed. Only valid for tables without unsaved
+ * changes.
+ *
+ * @param[in] table - Table object.
+ * @param[in] page_num - Ext page number.
+ * @param[out] buf - Destination (size = table_page_size(table)).
+ * @return Success code.
+ */
+int table_read_ext_direct(db_table *table, page_t page_num, void *buf);
+
+/**
+ * @brief Start reading a normal page into cache in the background.
+ * Does nothing if the page is cached, already being read, or not on disk.
+ *
+ * @param[in] table - Table object.
+ * @param[in] page_num - Page number to read.
+ */
+void table_prefetch_norm_page(db_table *table, page_t page_num);
+
+/**
+ * @brief Start reading an extension page into cache in the background.
+ * Does nothing if the page is cached, already being read, not on disk,
+ * or stored compressed.
+ *
+ * @param[in] table - Table object.
+ * @param[in] page_num - Page number to read.
+ */
+void table_prefetch_ext_page(db_table *table, page_t page_num);
+
+/**
+ * @brief Hand queued prefetches to the kernel.
+ *
+ * @param[in] table - Table object.
+ */
+void table_prefetch_submit(db_table *table);
+
 /**
  * @brief Create a new normal database page.
  *
  * @param[in] table - Table object.
  * @param[out] index - New page index (if not NULL).
- * @return Database page (size = PAGE_SIZE).
+ * @return Database page (size = table_page_size(table)).
  */
 void *table_new_norm_page(db_table *table, page_t *index);
 
@@ -88,6 +414,6 @@ void *table_new_norm_page(db_table *table, page_t *index);
  *
  * @param[in] table - Table object.
  * @param[out] index - New page index (if not NULL).
- * @return Database page (size = PAGE_SIZE).
+ * @return Database page (size = table_page_size(table)).
  */
 void *table_new_ext_page(db_table *table, page_t *index);
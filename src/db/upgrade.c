@@ -0,0 +1,264 @@
+#include "upgrade.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "defines.h"
+#include "table.h"
+#include "btree.h"
+#include "slotted.h"
+#include "../util/trace.h"
+
+// New file is built next to the old one
+#define UPGRADE_SUFFIX ".upgrade"
+// Scratch file of upgrades kept in memory
+#define SCRATCH_DIR_ENV "TMPDIR"
+#define SCRATCH_DIR "/tmp"
+#define SCRATCH_NAME "pmm-upgrade.XXXXXX"
+// Leaf and inner node fill of the rebuilt btree
+#define UPGRADE_FILL 90
+
+// Node layouts of version 1 and 2 files, page numbers are 32-bit
+typedef struct {
+	btree_node_type type;
+	uint8_t is_root;
+	uint32_t pg_self;
+	uint32_t pg_parent;
+} header_32;
+
+typedef struct {
+	uint32_t pg_child;
+	md5_t key;
+} inner_child_32;
+
+typedef struct {
+	header_32 header;
+	uint32_t pg_right_child;
+	uint32_t child_count;
+	inner_child_32 children[];
+} inner_32;
+
+typedef struct {
+	header_32 header;
+	uint32_t pg_next_leaf;
+	uint32_t cell_count;
+	uint32_t record_length;
+	uint8_t records[];
+} leaf_32;
+
+typedef struct {
+	header_32 header;
+	uint32_t pg_next_leaf;
+	uint32_t cell_count;
+	uint16_t heap_start;
+	uint16_t _reserved;
+	uint32_t _padding;
+	uint8_t data[];
+} slotted_32;
+
+db_table *build_upgrade(db_table *table, const char *fresh_file);
+header_32 *first_leaf(db_table *table);
+int copy_records(db_table *table, db_table *fresh);
+int copy_leaf(btree_loader *loader, header_32 *leaf);
+void copy_ext(db_table *table, db_table *fresh);
+
+int upgrade_table(db_table *table) {
+	trace_begin("table_upgrade", table->path);
+
+	char fresh_file[PATH_MAX];
+	snprintf(fresh_file, sizeof(fresh_file), "%s" UPGRADE_SUFFIX, table->path);
+	unlink(fresh_file);
+
+	db_table *fresh = build_upgrade(table, fresh_file);
+	int result = (fresh != NULL && table_save(fresh) == 0) ? 0 : -1;
+	if (result == 0) {
+		result = table_replace(fresh_file, table->path);
+	} else {
+		fprintf(stderr, "failed to upgrade %s\n", table->path);
+		unlink(fresh_file);
+	}
+
+	trace_end("table_upgrade");
+	return result;
+}
+
+db_table *upgrade_read(db_table *table) {
+	trace_begin("table_upgrade", table->path);
+
+	const char *dir = getenv(SCRATCH_DIR_ENV);
+	char fresh_file[PATH_MAX];
+	snprintf(fresh_file, sizeof(fresh_file), "%s/" SCRATCH_NAME,
+		(dir != NULL && *dir != '\0') ? dir : SCRATCH_DIR);
+	int fd = mkstemp(fresh_file);
+	if (fd < 0) {
+		fprintf(stderr, "failed to create %s\n", fresh_file);
+		trace_end("table_upgrade");
+		return NULL;
+	}
+	close(fd);
+
+	// Scratch file is only reachable through the table
+	db_table *fresh = build_upgrade(table, fresh_file);
+	if (fresh != NULL && table_flush(fresh) != 0) {
+		table_close(fresh);
+		fresh = NULL;
+	}
+	unlink(fresh_file);
+	if (fresh == NULL) {
+		fprintf(stderr, "failed to read %s\n", table->path);
+	} else {
+		// Old file is never the current version, so saves are dropped
+		free(fresh->path);
+		fresh->path = strdup(table->path);
+		fresh->read_only = table->read_only;
+	}
+
+	trace_end("table_upgrade");
+	return fresh;
+}
+
+/** Private functions */
+
+/**
+ * @brief Copy an old table into a new table in the current format.
+ * Ext pages are copied as they are, so ext locators stay valid.
+ *
+ * @param[in] table - Old table.
+ * @param[in] fresh_file - File of the new table (empty).
+ * @return New table with unsaved changes or NULL on error.
+ */
+db_table *build_upgrade(db_table *table, const char *fresh_file) {
+	db_table *fresh = table_open(fresh_file, table->fmeta.table_identity, table_page_size(table));
+	if (fresh == NULL) {
+		return NULL;
+	}
+
+	int result = table_set_ext_compressed(fresh, table_ext_compressed(table));
+	if (result == 0) {
+		result = copy_records(table, fresh);
+	}
+	if (result < 0) {
+		table_close(fresh);
+		return NULL;
+	}
+	copy_ext(table, fresh);
+
+	return fresh;
+}
+
+/**
+ * @brief Find leftmost leaf of an old btree.
+ *
+ * @param[in] table - Old table.
+ * @return Leaf node header.
+ */
+header_32 *first_leaf(db_table *table) {
+	header_32 *node = table_get_norm_page(table, table->fmeta.root_page);
+	while (node->type == NODE_INNER) {
+		inner_32 *inner = (inner_32 *)node;
+		uint32_t pg_child = (inner->child_count > 0) ? inner->children[0].pg_child : inner->pg_right_child;
+		node = table_get_norm_page(table, pg_child);
+	}
+
+	return node;
+}
+
+/**
+ * @brief Bulk load records of an old btree into the new table, in key order.
+ *
+ * @param[in] table - Old table.
+ * @param[in] fresh - New empty table.
+ * @return Success code.
+ */
+int copy_records(db_table *table, db_table *fresh) {
+	if (table->fmeta.root_page == INVALID_VAL) {
+		return 0;
+	}
+
+	header_32 *leaf = first_leaf(table);
+	btree_node_type type = leaf->type;
+	btree_loader *loader = (type == NODE_SLOTTED) ?
+		btree_load_begin_slotted(fresh, UPGRADE_FILL) :
+		btree_load_begin(fresh, ((leaf_32 *)leaf)->record_length - sizeof(md5_t), UPGRADE_FILL);
+	if (loader == NULL) {
+		return -1;
+	}
+
+	int result = 0;
+	while (result == 0) {
+		// Leaves of a btree share their format
+		if (leaf->type != type) {
+			fprintf(stderr, "btree mixes leaf formats\n");
+			result = -1;
+			break;
+		}
+
+		result = copy_leaf(loader, leaf);
+		uint32_t pg_next = ((leaf_32 *)leaf)->pg_next_leaf;
+		if (pg_next == INVALID_VAL_32) {
+			break;
+		}
+		leaf = table_get_norm_page(table, pg_next);
+	}
+
+	if (btree_load_end(loader) < 0) {
+		result = -1;
+	}
+
+	return result;
+}
+
+/**
+ * @brief Append records of an old leaf to the new btree.
+ *
+ * @param[in] loader - Loader of the new btree.
+ * @param[in] leaf - Old leaf node.
+ * @return Success code.
+ */
+int copy_leaf(btree_loader *loader, header_32 *leaf) {
+	if (leaf->type == NODE_SLOTTED) {
+		slotted_32 *node = (slotted_32 *)leaf;
+		uint16_t *slots = (uint16_t *)node->data;
+		for (uint32_t i = 0; i < node->cell_count; i++) {
+			slotted_cell *cell = (slotted_cell *)(node->data + slots[i]);
+			if (btree_load_add_var(loader, &cell->key, cell->payload, cell->length) < 0) {
+				return -1;
+			}
+		}
+
+		return 0;
+	}
+
+	// Older records of a table may be shorter, keep their length
+	leaf_32 *node = (leaf_32 *)leaf;
+	if (btree_load_resize(loader, node->record_length - sizeof(md5_t)) < 0) {
+		return -1;
+	}
+	for (uint32_t i = 0; i < node->cell_count; i++) {
+		uint8_t *cell = node->records + i * node->record_length;
+		if (btree_load_add(loader, (md5_t *)cell, cell + sizeof(md5_t)) < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Copy ext pages of the old table in order.
+ *
+ * @param[in] table - Old table.
+ * @param[in] fresh - New table.
+ */
+void copy_ext(db_table *table, db_table *fresh) {
+	uint32_t page_size = table_page_size(table);
+	for (page_t i = 0; i < table->fmeta.total_pages - table->fmeta.ext_start; i++) {
+		page_t index;
+		memcpy(table_new_ext_page(fresh, &index), table_get_ext_page(table, i), page_size);
+	}
+	fresh->cmeta.ext_end_ptr = table->fmeta.ext_end_ptr;
+}
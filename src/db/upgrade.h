@@ -0,0 +1,23 @@
+#pragma once
+
+#include "table.h"
+
+/**
+ * @brief Rewrite table file of an older format (see table_legacy) in the
+ * current format. Records and ext pages are copied unchanged, so ext
+ * locators stay valid. The caller must hold the writer lock.
+ *
+ * @param[in] table - Table opened from the old file.
+ * @return Success code.
+ */
+int upgrade_table(db_table *table);
+
+/**
+ * @brief Load table of an older format (see table_legacy) in the current
+ * format without changing its file. The new version is kept in memory:
+ * saving it fails for read-only tables and is dropped otherwise.
+ *
+ * @param[in] table - Table opened from the old file.
+ * @return New table object or NULL on error.
+ */
+db_table *upgrade_read(db_table *table);
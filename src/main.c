@@ -5,6 +5,8 @@
 
 #include "commands.h"
 #include "client/client.h"
+#include "util/trace.h"
+#include "db/capture.h"
 
 #define CLIENT "pacman"
 
@@ -29,8 +31,22 @@ static const command table[] = {
 	{ "rm", &rm },
 	// List
 	{ "list", &list },
+	// Info
+	{ "info", &info },
 	// Sync
-	{ "sync", &sync }
+	{ "sync", &synchronize },
+	// Daemon
+	{ "daemon", &serve },
+	// Watch
+	{ "watch", &watch },
+	// Vacuum
+	{ "vacuum", &vacuum },
+	// Orphans
+	{ "orphans", &orphans },
+	// Diff
+	{ "diff", &diff },
+	// Merge
+	{ "merge", &merge }
 };
 
 int main(int argc, char **argv) {
@@ -41,6 +57,8 @@ int main(int argc, char **argv) {
 	}
 
 	client_set(CLIENT);
+	trace_init();
+	capture_init();
 
 	char *subcommand = argv[1];
 	for (uint32_t i = 0; i < sizeof(table) / sizeof(command); i++) {
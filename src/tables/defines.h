@@ -2,5 +2,6 @@
 
 // Table identity value
 typedef enum {
-	PKG
+	PKG,
+	DEPS
 } table_identity;
@@ -0,0 +1,137 @@
+#include "deps.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "defines.h"
+
+#include "../client/client.h"
+#include "../db/defines.h"
+#include "../db/table.h"
+#include "../db/btree.h"
+#include "../db/btree_typed.h"
+#include "../db/hash.h"
+#include "../db/ext.h"
+#include "../util/graph.h"
+
+#define REBUILD_SUFFIX ".rebuild.XXXXXX"
+
+BTREE_DEFINE(deps, deps_record)
+
+graph *load_graph(const char *file, md5_t *key);
+graph *build_graph(const char *file, md5_t *key);
+
+graph *deps_graph(const char *file) {
+	// Signature is the key, zero padded
+	uint64_t stamp = client_get()->local_stamp();
+	md5_t key;
+	memset(&key, 0, sizeof(key));
+	memcpy(&key, &stamp, sizeof(stamp));
+
+	graph *g = load_graph(file, &key);
+	if (g != NULL) {
+		return g;
+	}
+
+	return build_graph(file, &key);
+}
+
+/** Private functions */
+
+/**
+ * @brief Load cached graph.
+ *
+ * @param[in] file - Table file name.
+ * @param[in] key - Local database signature.
+ * @return Graph object or NULL if not cached.
+ */
+graph *load_graph(const char *file, md5_t *key) {
+	if (access(file, F_OK) != 0) {
+		return NULL;
+	}
+
+	db_table *table = table_open(file, DEPS, 0);
+	if (table == NULL) {
+		return NULL;
+	}
+
+	// Tables cached before hash tables hold a btree
+	graph *g = NULL;
+	deps_record *record = NULL;
+	if (table->cmeta.root_page != INVALID_VAL) {
+		record = table_hashed(table) ? hash_find(table, key) : deps_btree_find(table, key, NULL);
+	}
+	if (record != NULL) {
+		void *blob = malloc(record->graph.len);
+		if (ext_read(table, &record->graph, 0, blob, record->graph.len) == record->graph.len) {
+			g = graph_load(blob, record->graph.len);
+		} else {
+			free(blob);
+		}
+	}
+
+	table_close(table);
+	return g;
+}
+
+/**
+ * @brief Build graph from the client and store it as the only table entry.
+ *
+ * @param[in] file - Table file name.
+ * @param[in] key - Local database signature.
+ * @return Graph object or NULL on error.
+ */
+graph *build_graph(const char *file, md5_t *key) {
+	graph_builder *builder = graph_builder_new();
+	if (client_get()->local_graph(builder) < 0) {
+		// Building is the only way to release a builder
+		graph_free(graph_build(builder));
+		return NULL;
+	}
+	graph *g = graph_build(builder);
+
+	// Build next to the old table so the rename stays on one filesystem,
+	// under a unique name since other processes may rebuild at the same time
+	char tmp_file[PATH_MAX];
+	snprintf(tmp_file, sizeof(tmp_file), "%s" REBUILD_SUFFIX, file);
+	int fd = mkstemp(tmp_file);
+	if (fd < 0) {
+		fprintf(stderr, "warning: failed to cache dependency graph\n");
+		return g;
+	}
+	// Same mode as a table created by table_open
+	fchmod(fd, 0644);
+	close(fd);
+
+	db_table *table = table_open(tmp_file, DEPS, 0);
+	if (table == NULL) {
+		unlink(tmp_file);
+		return g;
+	}
+	hash_init(table, sizeof(deps_record));
+
+	deps_record record = {
+		.graph = ext_insert(table, g->blob, g->blob_len)
+	};
+
+	int result = hash_insert(table, key, &record, INSERT_ALWAYS);
+	if (table_save(table) < 0) {
+		result = -1;
+	}
+	if (result == 0) {
+		result = table_replace(tmp_file, file);
+	}
+
+	// Graph is still usable if caching fails
+	if (result < 0) {
+		fprintf(stderr, "warning: failed to cache dependency graph\n");
+		unlink(tmp_file);
+	}
+
+	return g;
+}
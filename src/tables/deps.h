@@ -0,0 +1,19 @@
+#pragma once
+
+#include "../db/defines.h"
+#include "../util/graph.h"
+
+// Cached graph, keyed by the local database signature
+typedef struct {
+	ext_t graph;
+} deps_record;
+
+/**
+ * @brief Get dependency graph of installed packages.
+ * The graph is loaded from the table if it was built for the current local
+ * database, otherwise it is rebuilt and the table replaced.
+ *
+ * @param[in] file - Table file name.
+ * @return Graph object or NULL on error.
+ */
+graph *deps_graph(const char *file);
@@ -3,31 +3,162 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
 #include <openssl/md5.h>
 
 #include "defines.h"
 
 #include "../util/color.h"
+#include "../util/output.h"
 #include "../util/vector.h"
+#include "../util/vercmp.h"
 #include "../client/client.h"
 #include "../db/defines.h"
 #include "../db/table.h"
 #include "../db/btree.h"
+#include "../db/btree_typed.h"
+#include "../db/slotted.h"
 #include "../db/ext.h"
 
-pkg_status check_status(const client *cl, const char *pkg);
+#define VACUUM_SUFFIX ".vacuum"
+#define MERGE_SUFFIX ".merge"
+// Leaf fill factor of merged tables in percent
+#define MERGE_FILL 90
+// Longest field stored inline in slotted leaves
+#define FIELD_INLINE_MAX 255
+// Version snapshot offset in slotted records
+#define VERSIONS_ALIGN sizeof(uint64_t)
+#define align_versions(offset) (((offset) + VERSIONS_ALIGN - 1) & ~(VERSIONS_ALIGN - 1))
+// Fixed-size fields after name and group in slotted records
+#define PKG_TRAILER_LEN (sizeof(pkg_versions) + sizeof(uint32_t))
+// Largest encoded slotted record
+#define PKG_RECORD_MAX (sizeof(pkg_status) + 2 * (sizeof(uint16_t) + FIELD_INLINE_MAX) \
+	+ VERSIONS_ALIGN - 1 + PKG_TRAILER_LEN)
+// Record field ends within length
+#define has_field(length, type, field) ((length) >= offsetof(type, field) + sizeof(((type *)0)->field))
+// Field tags in slotted records (otherwise inline length)
+#define FIELD_EXT 0xffff
+#define FIELD_NONE 0xfffe
+// Host count of a record
+#define pkg_hosts(ref) (((ref)->hosts != NULL) ? *(ref)->hosts : 1)
+// Record holds versions from a check
+#define has_snapshot(ref) ((ref)->versions != NULL && (ref)->versions->taken)
+// Field for ext data locator
+#define ext_field(locator) ((pkg_field){ .data = NULL, .ext = (locator) })
 
-pkg_table *pkg_open(const char *file) {
-	pkg_table *table = table_open(file, PKG);
-	if (table == NULL) {
-		return NULL;
-	}
+// Fixed leaf operations specialized for pkg records
+BTREE_DEFINE(pkg, pkg)
 
-	if (table->cmeta.root_page == INVALID_VAL) {
-		btree_init(table, sizeof(pkg));
-	}
+static const char *const status_names[] = {
+	"missing",
+	"old",
+	"ok"
+};
 
-	return table;
+static const color_t status_colors[] = {
+	RED,
+	YELLOW,
+	GREEN
+};
+
+// Difference between manifest and system
+typedef enum {
+	DIFF_MISSING,
+	DIFF_EXTRA,
+	DIFF_OUTDATED
+} diff_kind;
+
+static const char diff_signs[] = {
+	'-',
+	'+',
+	'~'
+};
+
+static const color_t diff_colors[] = {
+	RED,
+	WHITE,
+	YELLOW
+};
+
+// Reported difference
+typedef struct {
+	diff_kind kind;
+	char *name;
+} diff_entry;
+
+// Client package with its table key
+typedef struct {
+	md5_t key;
+	client_pkg *package;
+} keyed_pkg;
+
+// Table being merged
+typedef struct {
+	pkg_table *table;
+	btree_stream *stream;
+	pkg_format format;
+	// Current record (NULL when exhausted)
+	void *record;
+	// Position in input list, earlier inputs win ties
+	uint32_t index;
+} merge_input;
+
+void query_pkg(const client *cl, const char *name, client_pkg *current);
+pkg_status check_status(pkg_table *table, const client_pkg *current, pkg_versions *versions);
+int refresh_status(pkg_table *table, const client_pkg *current, pkg_ref *package);
+void store_version(pkg_table *table, ext_t *locator, const char *version);
+pkg_status version_status(const char *installed, uint32_t installed_len,
+	const char *available, uint32_t available_len);
+pkg_status snapshot_status(pkg_table *table, pkg_ref *package);
+void copy_versions(db_table *src, db_table *dest, pkg_versions *versions, pkg_versions *copy);
+void hash_name(const char *name, md5_t *hash);
+md5_t *record_key(pkg_format format, void *record);
+keyed_pkg *sort_keyed(vector *packages);
+client_pkg *match_keyed(keyed_pkg *sorted, uint32_t count, uint32_t *next, md5_t *key);
+client_pkg *find_keyed(keyed_pkg *sorted, uint32_t count, md5_t *key);
+int compare_keyed(const void *a, const void *b);
+int compare_diffs(const void *a, const void *b);
+void add_diff(vector *diffs, diff_kind kind, char *name);
+int merge_level(const char *file, const char **inputs, uint32_t count, uint32_t level);
+int merge_pass(const char *file, const char **inputs, uint32_t count);
+int merge_write(pkg_table *fresh, btree_loader *loader, merge_input **heap, uint32_t *heap_count);
+void advance_input(merge_input *input);
+int input_less(merge_input *a, merge_input *b);
+void heap_up(merge_input **heap, uint32_t pos);
+void heap_down(merge_input **heap, uint32_t count, uint32_t pos);
+const char *input_field(merge_input *input, pkg_field *field, char **owned);
+pkg_table *init_pkgs(pkg_table *table);
+int find_pkg(pkg_table *table, const char *name, pkg_ref *ref);
+ext_t stored_pkg(pkg_table *table, const char *name, void *record, uint32_t length, pkg_versions *versions);
+void decode_pkg(pkg_format format, void *record, uint32_t length, pkg_ref *ref);
+void *next_pkg(pkg_table *table, btree_cursor *iter, pkg_format format, pkg_ref *ref);
+void prefetch_field(pkg_table *table, pkg_field *field);
+uint32_t encode_pkg(pkg_table *table, pkg_status status, const char *name, uint32_t name_len,
+	const ext_t *name_ext, const char *group, uint32_t group_len, pkg_versions *versions, uint32_t hosts,
+	uint8_t *buf);
+uint8_t *encode_field(pkg_table *table, const char *value, uint32_t len, const ext_t *stored, uint8_t *buf);
+uint32_t field_len(pkg_field *field);
+const char *field_view(db_table *table, pkg_field *field);
+const char *field_bytes(db_table *table, pkg_field *field, char **owned);
+void field_read(db_table *table, pkg_field *field, char *buf);
+uint32_t field_push(db_table *table, pkg_field *field, vector *buf);
+ext_t copy_field(db_table *src, db_table *dest, pkg_field *field);
+void print_field(db_table *table, pkg_field *field, int json);
+void print_version(db_table *table, ext_t *locator, int json);
+void print_text(db_table *table, pkg_ref *package, pkg_status status);
+void print_tsv(db_table *table, pkg_ref *package, pkg_status status);
+void print_json(db_table *table, pkg_ref *package, pkg_status status);
+uint32_t new_page_size(void);
+
+pkg_table *pkg_open(const char *file) {
+	return init_pkgs(table_open(file, PKG, new_page_size()));
+}
+
+pkg_table *pkg_open_locked(const char *file) {
+	return init_pkgs(table_open_locked(file, PKG, new_page_size()));
 }
 
 int pkg_save(pkg_table *table) {
@@ -52,48 +183,323 @@ int pkg_add(pkg_table *table, const char *name) {
 
 	// Generate hash
 	md5_t hash;
-	// TODO: use a non-deprecated way
-	MD5((uint8_t *)name, strlen(name), md5_req_ptr(hash));
+	hash_name(name, &hash);
+
+	// Most added packages are new, the insert builds the filter anyway
+	void *stored = NULL;
+	uint32_t length = 0;
+	if (table_hashed(table) || bloom_maybe(btree_key_filter(table), &hash)) {
+		stored = pkg_btree_find(table, &hash, &length);
+	}
+
+	// Adding again keeps ext data that is still current
+	pkg_versions versions;
+	ext_t name_ext = stored_pkg(table, name, stored, length, &versions);
+	client_pkg current;
+	query_pkg(cl, name, &current);
+	pkg_status status = check_status(table, &current, &versions);
+	if (pkg_get_format(table) == PKG_SLOTTED) {
+		uint8_t buf[PKG_RECORD_MAX];
+		uint32_t len = encode_pkg(table, status, name, strlen(name), &name_ext, NULL, 0, &versions, 1, buf);
+		return btree_insert_var(table, &hash, buf, len, INSERT_REPLACE);
+	}
 
 	// Create record
 	pkg record = {
-		.name = ext_insert(table, name, strlen(name)),
+		.name = (name_ext.ptr != INVALID_EXT) ? name_ext : ext_insert(table, name, strlen(name)),
 		.group = { .ptr = INVALID_EXT, .len = 0 },
-		.status = check_status(cl, name)
+		.status = status,
+		.versions = versions,
+		.hosts = 1
 	};
 
-	return btree_insert(table, &hash, &record);
+	return pkg_btree_insert(table, &hash, &record, INSERT_REPLACE);
 }
 
-int pkg_check(pkg_table *table) {
+int pkg_add_many(pkg_table *table, char **names, uint32_t count) {
 	if (table == NULL) {
 		return -1;
 	}
+	if (count == 1) {
+		return pkg_add(table, names[0]);
+	}
 
+	// Versions of every package in one walk instead of a query per name
 	const client *cl = client_get();
+	vector *known = vec_new(sizeof(client_pkg));
+	if (cl->known_packages(known) < 0) {
+		vec_free(known);
+		return -1;
+	}
+	keyed_pkg *sorted = sort_keyed(known);
+
+	md5_t *keys = malloc(count * sizeof(md5_t));
+	client_pkg **current = malloc(count * sizeof(client_pkg *));
+	int result = 0;
+	for (uint32_t i = 0; i < count && result == 0; i++) {
+		hash_name(names[i], &keys[i]);
+		current[i] = find_keyed(sorted, known->count, &keys[i]);
+		if (current[i] == NULL || current[i]->available == NULL) {
+			fprintf(stderr, "package %s does not exist\n", names[i]);
+			result = -1;
+		}
+	}
+
+	pkg *records = malloc(count * sizeof(pkg));
+	void **stored = malloc(count * sizeof(void *));
+	uint32_t *lengths = malloc(count * sizeof(uint32_t));
+	if (result == 0) {
+		// Resolve every name in one ordered pass, taking what is kept before
+		// any insert moves the stored records. The insert builds the filter
+		// anyway, so the lookup can skip new names.
+		if (!table_hashed(table)) {
+			btree_key_filter(table);
+		}
+		btree_find_many(table, keys, stored, lengths, count);
+		for (uint32_t i = 0; i < count; i++) {
+			records[i].name = stored_pkg(table, names[i], stored[i], lengths[i], &records[i].versions);
+		}
+	}
+
+	// Slotted records vary in length, insert them one by one
+	int slotted = (pkg_get_format(table) == PKG_SLOTTED);
+	for (uint32_t i = 0; i < count && result == 0; i++) {
+		ext_t name_ext = records[i].name;
+		pkg_status status = check_status(table, current[i], &records[i].versions);
+		if (slotted) {
+			uint8_t buf[PKG_RECORD_MAX];
+			uint32_t len = encode_pkg(table, status, names[i], strlen(names[i]), &name_ext, NULL, 0,
+				&records[i].versions, 1, buf);
+			result = btree_insert_var(table, &keys[i], buf, len, INSERT_REPLACE);
+			continue;
+		}
+
+		records[i].name = (name_ext.ptr != INVALID_EXT) ? name_ext : ext_insert(table, names[i], strlen(names[i]));
+		records[i].group = (ext_t){ .ptr = INVALID_EXT, .len = 0 };
+		records[i].status = status;
+		records[i].hosts = 1;
+	}
+
+	if (!slotted && result == 0) {
+		result = btree_insert_many(table, keys, records, sizeof(pkg), count, INSERT_REPLACE);
+	}
+
+	free(keys);
+	free(current);
+	free(records);
+	free(stored);
+	free(lengths);
+	free(sorted);
+	vec_free(known);
+	return result;
+}
+
+pkg_format pkg_get_format(pkg_table *table) {
+	return (btree_leaf_type(table) == NODE_SLOTTED) ? PKG_SLOTTED : PKG_FIXED;
+}
+
+int pkg_vacuum(pkg_table *table, const char *file, uint32_t fill, pkg_format format, uint32_t page_size, int compress) {
+	if (table == NULL) {
+		return -1;
+	}
+
+	// Build next to the original so the rename stays on one filesystem
+	char tmp_file[PATH_MAX];
+	snprintf(tmp_file, sizeof(tmp_file), "%s" VACUUM_SUFFIX, file);
+	unlink(tmp_file);
+
+	if (page_size == 0) {
+		page_size = table_page_size(table);
+	}
+
+	if (compress < 0) {
+		compress = table_ext_compressed(table);
+	}
+
+	pkg_table *fresh = table_open(tmp_file, PKG, page_size);
+	if (fresh == NULL) {
+		return -1;
+	}
+	table_set_ext_compressed(fresh, compress);
+
+	btree_loader *loader = (format == PKG_SLOTTED) ?
+		btree_load_begin_slotted(fresh, fill) :
+		btree_load_begin(fresh, sizeof(pkg), fill);
+	if (loader == NULL) {
+		table_close(fresh);
+		unlink(tmp_file);
+		return -1;
+	}
+
+	// Copy in key order; ext data is laid out in the same order
+	int result = 0;
+	pkg_format src_format = pkg_get_format(table);
 	btree_cursor *iter = btree_iter(table);
-	while (!iter->end) {
-		pkg *package = btree_next(iter);
+	while (!iter->end && result == 0) {
+		pkg_ref package;
+		void *raw = next_pkg(table, iter, src_format, &package);
+		md5_t *key = record_key(src_format, raw);
+
+		pkg_versions versions;
+		copy_versions(table, fresh, package.versions, &versions);
+
+		if (format == PKG_SLOTTED) {
+			// Fields are re-encoded, inlined where they fit
+			char *name_copy = NULL;
+			char *group_copy = NULL;
+			uint8_t buf[PKG_RECORD_MAX];
+			uint32_t len = encode_pkg(fresh, *package.status,
+				field_bytes(table, &package.name, &name_copy), field_len(&package.name), NULL,
+				field_bytes(table, &package.group, &group_copy), field_len(&package.group),
+				&versions, pkg_hosts(&package), buf);
+			free(name_copy);
+			free(group_copy);
+
+			result = btree_load_add_var(loader, key, buf, len);
+		} else {
+			pkg record = {
+				.name = copy_field(table, fresh, &package.name),
+				.group = copy_field(table, fresh, &package.group),
+				.status = *package.status,
+				.versions = versions,
+				.hosts = pkg_hosts(&package)
+			};
+
+			result = pkg_btree_load_add(loader, key, &record);
+		}
+	}
+	free(iter);
+
+	if (btree_load_end(loader) < 0) {
+		result = -1;
+	}
+
+	if (result < 0) {
+		table_close(fresh);
+	}
+	if (result < 0 || table_save(fresh) < 0) {
+		fprintf(stderr, "failed to rebuild table\n");
+		unlink(tmp_file);
+		return -1;
+	}
+
+	return table_replace(tmp_file, file);
+}
+
+int pkg_merge(const char *file, const char **inputs, uint32_t count) {
+	if (count == 0) {
+		return -1;
+	}
+
+	return merge_level(file, inputs, count, 0);
+}
+
+int pkg_print_info(pkg_table *table, const char *name) {
+	if (table == NULL) {
+		return -1;
+	}
+
+	pkg_ref package;
+	if (find_pkg(table, name, &package) < 0) {
+		fprintf(stderr, "package %s is not in the manifest\n", name);
+		return -1;
+	}
+
+	// Refresh status of this package only
+	client_pkg current;
+	query_pkg(client_get(), name, &current);
+	if (refresh_status(table, &current, &package)) {
+		md5_t hash;
+		hash_name(name, &hash);
+		btree_touch_key(table, &hash);
+	}
+
+	out_begin(OUT_TEXT);
+	out_str("Name:    ");
+	print_field(table, &package.name, 0);
+	out_str("\nGroup:   ");
+	if (field_len(&package.group) > 0) {
+		print_field(table, &package.group, 0);
+	} else {
+		out_str("none");
+	}
+	out_str("\nVersion: ");
+	print_version(table, has_snapshot(&package) ? &package.versions->installed : NULL, 0);
+	out_str("\nLatest:  ");
+	print_version(table, has_snapshot(&package) ? &package.versions->available : NULL, 0);
+	out_str("\nStatus:  ");
+	out_color(status_colors[*package.status]);
+	out_str(status_names[*package.status]);
+	out_color(WHITE);
+	out_char('\n');
+
+	return out_flush();
+}
+
+int pkg_update(pkg_table *table, const char *name) {
+	if (table == NULL) {
+		return -1;
+	}
+
+	pkg_ref package;
+	if (find_pkg(table, name, &package) < 0) {
+		return 0;
+	}
+
+	client_pkg current;
+	query_pkg(client_get(), name, &current);
+	if (refresh_status(table, &current, &package)) {
+		md5_t hash;
+		hash_name(name, &hash);
+		btree_touch_key(table, &hash);
+	}
+	return 1;
+}
+
+int pkg_check(pkg_table *table) {
+	if (table == NULL) {
+		return -1;
+	}
 
-		// Get name
-		char name[package->name.len + 1];
-		ext_access(table, &package->name, name);
-		name[package->name.len] = '\0';
+	vector *known = vec_new(sizeof(client_pkg));
+	if (client_get()->known_packages(known) < 0) {
+		vec_free(known);
+		return -1;
+	}
+	keyed_pkg *sorted = sort_keyed(known);
+
+	// Merge join with a single table scan
+	pkg_format format = pkg_get_format(table);
+	btree_cursor *iter = btree_iter(table);
+	vector *name_buf = vec_new(sizeof(char));
+	uint32_t next = 0;
+	while (!iter->end) {
+		pkg_ref package;
+		md5_t *key = record_key(format, next_pkg(table, iter, format, &package));
+		client_pkg *current = match_keyed(sorted, known->count, &next, key);
 
 		// Check if package exists
-		if (!cl->exists(name)) {
+		if (current == NULL || current->available == NULL) {
+			name_buf->count = 0;
+			const char *name = vec_at(name_buf, field_push(table, &package.name, name_buf));
 			fprintf(stderr, "warning: package %s does not exist\n", name);
 			continue;
 		}
 
 		// Get status
-		package->status = check_status(cl, name);
+		if (refresh_status(table, current, &package)) {
+			btree_touch(iter);
+		}
 	}
+	free(iter);
+	vec_free(name_buf);
+	free(sorted);
+	vec_free(known);
 
 	return 0;
 }
 
-int pkg_print_all(pkg_table *table) {
+int pkg_print_all(pkg_table *table, out_format format) {
 	if (table == NULL) {
 		return -1;
 	}
@@ -101,51 +507,73 @@ int pkg_print_all(pkg_table *table) {
 	uint32_t missing = 0;
 	uint32_t old = 0;
 	uint32_t ok = 0;
+	uint8_t first = 1;
+
+	out_begin(format);
+	if (format == OUT_JSON) {
+		out_char('[');
+	}
 
+	pkg_format leaf_format = pkg_get_format(table);
 	btree_cursor *iter = btree_iter(table);
 	while (!iter->end) {
-		pkg *package = btree_next(iter);
+		pkg_ref ref;
+		next_pkg(table, iter, leaf_format, &ref);
+		pkg_ref *package = &ref;
+		pkg_status status = snapshot_status(table, package);
 
-		// Set color
-		switch (package->status) {
+		switch (status) {
 			case PKG_MISSING:
-				printf_color(RED);
 				missing++;
 				break;
 			case PKG_OLD:
-				printf_color(YELLOW);
 				old++;
 				break;
 			case PKG_OK:
-				printf_color(GREEN);
 				ok++;
 				break;
 		}
 
-		// Print name
-		char name[package->name.len + 1];
-		ext_access(table, &package->name, name);
-		name[package->name.len] = '\0';
-		printf("%s", name);
-
-		// Print group
-		if (package->group.ptr != INVALID_EXT) {
-			char group[package->group.len + 1];
-			ext_access(table, &package->group, group);
-			group[package->group.len] = '\0';
-			printf(" (%s)", group);
+		switch (format) {
+			case OUT_TEXT:
+				print_text(table, package, status);
+				break;
+			case OUT_TSV:
+				print_tsv(table, package, status);
+				break;
+			case OUT_JSON:
+				if (!first) {
+					out_char(',');
+				}
+				print_json(table, package, status);
+				first = 0;
+				break;
+			case OUT_NDJSON:
+				print_json(table, package, status);
+				out_char('\n');
+				break;
 		}
-
-		putchar('\n');
 	}
 
-	uint32_t installed = old + ok;
-	uint32_t total = installed + missing;
-	printf_color(WHITE);
-	printf("Installed: %u / %u | Up to date: %u / %u\n", installed, total, ok, installed);
+	if (format == OUT_TEXT) {
+		uint32_t installed = old + ok;
+		uint32_t total = installed + missing;
+		out_color(WHITE);
+		out_str("Installed: ");
+		out_uint(installed);
+		out_str(" / ");
+		out_uint(total);
+		out_str(" | Up to date: ");
+		out_uint(ok);
+		out_str(" / ");
+		out_uint(installed);
+		out_char('\n');
+	} else if (format == OUT_JSON) {
+		out_str("]\n");
+	}
 
 	free(iter);
-	return 0;
+	return out_flush();
 }
 
 int pkg_sync(pkg_table *table) {
@@ -154,50 +582,1231 @@ int pkg_sync(pkg_table *table) {
 	}
 
 	const client *cl = client_get();
+	vector *known = vec_new(sizeof(client_pkg));
+	if (cl->known_packages(known) < 0) {
+		vec_free(known);
+		return -1;
+	}
+	keyed_pkg *sorted = sort_keyed(known);
+
+	pkg_format format = pkg_get_format(table);
 	btree_cursor *iter = btree_iter(table);
 
-	vector *installs = vec_new(sizeof(char *));
-	vector *updates = vec_new(sizeof(pkg *));
+	// Names of packages to install
+	vector *name_buf = vec_new(sizeof(char));
+	vector *installs = vec_new(sizeof(uint32_t));
+	vector *updates = vec_new(sizeof(pkg_ref));
 
+	// Merge join with a single table scan
+	uint32_t next = 0;
 	while (!iter->end) {
-		pkg *package = btree_next(iter);
-
-		// Get name
-		char *name = malloc(package->name.len + 1);
-		ext_access(table, &package->name, name);
-		name[package->name.len] = '\0';
+		pkg_ref package;
+		md5_t *key = record_key(format, next_pkg(table, iter, format, &package));
 
 		// Update status
-		package->status = check_status(cl, name);
+		uint8_t changed = refresh_status(table, match_keyed(sorted, known->count, &next, key), &package);
 
-		if (package->status == PKG_MISSING) {
+		// Missing packages get installed, old ones upgraded (record
+		// changes once installed)
+		if (*package.status != PKG_OK) {
+			btree_touch(iter);
+			uint32_t name = field_push(table, &package.name, name_buf);
 			vec_push(installs, &name);
 			vec_push(updates, &package);
+		} else if (changed) {
+			btree_touch(iter);
 		}
 	}
+	free(iter);
+	free(sorted);
+	vec_free(known);
 
-	// Do install
-	int res = cl->install(installs->raw_array, installs->count);
+	// Do install, the buffer no longer moves
+	const char **names = malloc((installs->count + 1) * sizeof(char *));
+	for (uint32_t i = 0; i < installs->count; i++) {
+		names[i] = vec_at(name_buf, *(uint32_t *)vec_at(installs, i));
+	}
+	int res = (installs->count == 0) ? 0 : cl->install(names, installs->count);
 	if (res == 0) {
+		// Repository version is now installed
 		for (uint32_t i = 0; i < updates->count; i++) {
-			pkg *package = *(pkg **)vec_at(updates, i);
-			package->status = PKG_OK;
+			pkg_ref *package = vec_at(updates, i);
+			*package->status = PKG_OK;
+			if (package->versions != NULL) {
+				package->versions->installed = package->versions->available;
+			}
 		}
 	}
 
-	for (uint32_t i = 0; i < installs->count; i++) {
-		free(*(char **)vec_at(installs, i));
-	}
-
+	free(names);
+	vec_free(name_buf);
 	vec_free(installs);
 	vec_free(updates);
-	return 0;
+	return res;
+}
+
+int pkg_diff(pkg_table *table) {
+	if (table == NULL) {
+		return -1;
+	}
+
+	const client *cl = client_get();
+	vector *installed = vec_new(sizeof(client_pkg));
+	if (cl->explicit_packages(installed) < 0) {
+		vec_free(installed);
+		return -1;
+	}
+
+	uint32_t count = installed->count;
+	keyed_pkg *sorted = sort_keyed(installed);
+
+	// Merge join with a single table scan
+	vector *diffs = vec_new(sizeof(diff_entry));
+	pkg_format format = pkg_get_format(table);
+	btree_cursor *iter = btree_iter(table);
+	uint32_t next = 0;
+	while (!iter->end) {
+		pkg_ref package;
+		md5_t *key = record_key(format, next_pkg(table, iter, format, &package));
+
+		// Installed packages ordered before this entry are not in the manifest
+		while (next < count && md5_ls(sorted[next].key, *key)) {
+			add_diff(diffs, DIFF_EXTRA, strdup(sorted[next++].package->name));
+		}
+
+		if (next < count && md5_eq(sorted[next].key, *key)) {
+			client_pkg *match = sorted[next++].package;
+			if (match->available != NULL && vercmp(match->available, strlen(match->available),
+					match->installed, strlen(match->installed)) > 0) {
+				add_diff(diffs, DIFF_OUTDATED, strdup(match->name));
+			}
+			continue;
+		}
+
+		char *name = malloc(field_len(&package.name) + 1);
+		field_read(table, &package.name, name);
+		add_diff(diffs, DIFF_MISSING, name);
+	}
+	free(iter);
+
+	while (next < count) {
+		add_diff(diffs, DIFF_EXTRA, strdup(sorted[next++].package->name));
+	}
+
+	// Report by name
+	qsort(diffs->raw_array, diffs->count, sizeof(diff_entry), &compare_diffs);
+
+	uint32_t totals[3] = { 0 };
+	out_begin(OUT_TEXT);
+	for (uint32_t i = 0; i < diffs->count; i++) {
+		diff_entry *diff = vec_at(diffs, i);
+		totals[diff->kind]++;
+
+		out_color(diff_colors[diff->kind]);
+		out_char(diff_signs[diff->kind]);
+		out_char(' ');
+		out_str(diff->name);
+		out_char('\n');
+		free(diff->name);
+	}
+
+	out_color(WHITE);
+	out_str("Missing: ");
+	out_uint(totals[DIFF_MISSING]);
+	out_str(" | Extra: ");
+	out_uint(totals[DIFF_EXTRA]);
+	out_str(" | Outdated: ");
+	out_uint(totals[DIFF_OUTDATED]);
+	out_char('\n');
+
+	free(sorted);
+	vec_free(diffs);
+	vec_free(installed);
+	return out_flush();
+}
+
+int pkg_orphans(pkg_table *table, graph *deps) {
+	if (table == NULL || deps == NULL) {
+		return -1;
+	}
+
+	// Installed manifest entries are the roots
+	vector *roots = vec_new(sizeof(uint32_t));
+	// Names spanning ext overflow pages are copied into one buffer
+	vector *name_buf = vec_new(sizeof(char));
+	pkg_format format = pkg_get_format(table);
+	btree_cursor *iter = btree_iter(table);
+	while (!iter->end) {
+		pkg_ref package;
+		next_pkg(table, iter, format, &package);
+
+		const char *name = field_view(table, &package.name);
+		if (name == NULL && field_len(&package.name) > 0) {
+			name_buf->count = 0;
+			name = vec_at(name_buf, field_push(table, &package.name, name_buf));
+		}
+
+		uint32_t node = graph_find_len(deps, (name != NULL) ? name : "", field_len(&package.name));
+		if (node != GRAPH_NONE) {
+			vec_push(roots, &node);
+		}
+	}
+	free(iter);
+	vec_free(name_buf);
+
+	uint8_t *reached = graph_reach(deps, roots->raw_array, roots->count);
+
+	out_begin(OUT_TEXT);
+	for (uint32_t i = 0; i < deps->node_count; i++) {
+		if (!reached[i]) {
+			out_str(graph_node_name(deps, i));
+			out_char('\n');
+		}
+	}
+
+	free(reached);
+	vec_free(roots);
+	return out_flush();
 }
 
 /** Private functions */
 
-pkg_status check_status(const client *cl, const char *pkg) {
-	return (!cl->installed(pkg)) ? PKG_MISSING
-		: (cl->outdated(pkg)) ? PKG_OLD
-		: PKG_OK;
+/**
+ * @brief Create btree in a new package table.
+ *
+ * @param[in] table - Opened table or NULL.
+ * @return Table object.
+ */
+pkg_table *init_pkgs(pkg_table *table) {
+	if (table == NULL) {
+		return NULL;
+	}
+
+	if (table->cmeta.root_page == INVALID_VAL) {
+		btree_init(table, sizeof(pkg));
+	}
+
+	return table;
+}
+
+/**
+ * @brief Compute table key for a package name.
+ *
+ * @param[in] name - Package name.
+ * @param[out] hash - Key.
+ */
+void hash_name(const char *name, md5_t *hash) {
+	// TODO: use a non-deprecated way
+	MD5((uint8_t *)name, strlen(name), (uint8_t *)hash);
+}
+
+/**
+ * @brief Get key of a record returned by the table iterator.
+ *
+ * @param[in] format - Leaf record format.
+ * @param[in] record - Record in leaf.
+ * @return Key stored with the record.
+ */
+md5_t *record_key(pkg_format format, void *record) {
+	return (format == PKG_SLOTTED) ?
+		&((slotted_cell *)((uint8_t *)record - sizeof(slotted_cell)))->key :
+		(md5_t *)((uint8_t *)record - sizeof(md5_t));
+}
+
+/**
+ * @brief Key client packages and sort them in table order.
+ *
+ * @param[in] packages - Vector of client_pkg, must not change while in use.
+ * @return Sorted packages (one entry per package).
+ */
+keyed_pkg *sort_keyed(vector *packages) {
+	keyed_pkg *sorted = malloc((packages->count + 1) * sizeof(keyed_pkg));
+	for (uint32_t i = 0; i < packages->count; i++) {
+		sorted[i].package = vec_at(packages, i);
+		hash_name(sorted[i].package->name, &sorted[i].key);
+	}
+	qsort(sorted, packages->count, sizeof(keyed_pkg), &compare_keyed);
+
+	return sorted;
+}
+
+/**
+ * @brief Advance a merge of sorted client packages to a table key.
+ *
+ * @param[in] sorted - Packages from sort_keyed.
+ * @param[in] count - Number of packages.
+ * @param[in,out] next - Merge position, keys only grow between calls.
+ * @param[in] key - Table key.
+ * @return Package with the key or NULL if none.
+ */
+client_pkg *match_keyed(keyed_pkg *sorted, uint32_t count, uint32_t *next, md5_t *key) {
+	while (*next < count && md5_ls(sorted[*next].key, *key)) {
+		(*next)++;
+	}
+
+	if (*next < count && md5_eq(sorted[*next].key, *key)) {
+		return sorted[(*next)++].package;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Find client package by table key.
+ *
+ * @param[in] sorted - Packages from sort_keyed.
+ * @param[in] count - Number of packages.
+ * @param[in] key - Table key.
+ * @return Package with the key or NULL if none.
+ */
+client_pkg *find_keyed(keyed_pkg *sorted, uint32_t count, md5_t *key) {
+	keyed_pkg probe;
+	md5_cp(&probe.key, key);
+
+	keyed_pkg *found = bsearch(&probe, sorted, count, sizeof(keyed_pkg), &compare_keyed);
+	return (found != NULL) ? found->package : NULL;
+}
+
+/**
+ * @brief Order keyed packages like table keys (qsort).
+ *
+ * @param[in] a - First package.
+ * @param[in] b - Second package.
+ * @return Comparison result.
+ */
+int compare_keyed(const void *a, const void *b) {
+	const keyed_pkg *first = a;
+	const keyed_pkg *second = b;
+
+	return md5_ls(first->key, second->key) ? -1 : md5_gr(first->key, second->key);
+}
+
+/**
+ * @brief Order differences by package name (qsort).
+ *
+ * @param[in] a - First difference.
+ * @param[in] b - Second difference.
+ * @return Comparison result.
+ */
+int compare_diffs(const void *a, const void *b) {
+	return strcmp(((const diff_entry *)a)->name, ((const diff_entry *)b)->name);
+}
+
+/**
+ * @brief Record a difference.
+ *
+ * @param[in] diffs - Vector of diff_entry.
+ * @param[in] kind - Kind of difference.
+ * @param[in] name - Package name (ownership is taken).
+ */
+void add_diff(vector *diffs, diff_kind kind, char *name) {
+	diff_entry diff = {
+		.kind = kind,
+		.name = name
+	};
+	vec_push(diffs, &diff);
+}
+
+/**
+ * @brief Merge tables, going through temporary tables if there are too many
+ * to open at once.
+ *
+ * @param[in] file - Output table file name.
+ * @param[in] inputs - Input table file names.
+ * @param[in] count - Number of inputs.
+ * @param[in] level - Nesting level (names temporary tables).
+ * @return Status code.
+ */
+int merge_level(const char *file, const char **inputs, uint32_t count, uint32_t level) {
+	if (count <= MERGE_FAN_IN) {
+		return merge_pass(file, inputs, count);
+	}
+
+	// Merge groups, then merge the results
+	uint32_t groups = (count + MERGE_FAN_IN - 1) / MERGE_FAN_IN;
+	char **temps = malloc(groups * sizeof(char *));
+	uint32_t made = 0;
+	int result = 0;
+	while (made < groups && result == 0) {
+		uint32_t first = made * MERGE_FAN_IN;
+		uint32_t size = (count - first < MERGE_FAN_IN) ? count - first : MERGE_FAN_IN;
+
+		temps[made] = malloc(PATH_MAX);
+		snprintf(temps[made], PATH_MAX, "%s" MERGE_SUFFIX ".%u.%u", file, level, made);
+		result = merge_pass(temps[made], inputs + first, size);
+		made++;
+	}
+
+	if (result == 0) {
+		result = merge_level(file, (const char **)temps, groups, level + 1);
+	}
+
+	for (uint32_t i = 0; i < made; i++) {
+		unlink(temps[i]);
+		free(temps[i]);
+	}
+	free(temps);
+
+	return result;
+}
+
+/**
+ * @brief Merge up to MERGE_FAN_IN tables into a new table.
+ * Inputs are read through streams, so only one leaf per input is in memory.
+ *
+ * @param[in] file - Output table file name.
+ * @param[in] inputs - Input table file names.
+ * @param[in] count - Number of inputs.
+ * @return Status code.
+ */
+int merge_pass(const char *file, const char **inputs, uint32_t count) {
+	// Build next to the output so the rename stays on one filesystem
+	char tmp_file[PATH_MAX];
+	snprintf(tmp_file, sizeof(tmp_file), "%s" MERGE_SUFFIX, file);
+	unlink(tmp_file);
+
+	pkg_table *fresh = table_open(tmp_file, PKG, new_page_size());
+	if (fresh == NULL) {
+		return -1;
+	}
+	btree_loader *loader = btree_load_begin_slotted(fresh, MERGE_FILL);
+	if (loader == NULL) {
+		table_close(fresh);
+		unlink(tmp_file);
+		return -1;
+	}
+
+	merge_input *opened = calloc(count, sizeof(merge_input));
+	merge_input **heap = malloc(count * sizeof(merge_input *));
+	uint32_t heap_count = 0;
+	int result = 0;
+	for (uint32_t i = 0; i < count && result == 0; i++) {
+		opened[i].index = i;
+		// Inputs are never written (nor upgraded if in an older format)
+		opened[i].table = table_open_read(inputs[i], PKG);
+		opened[i].stream = (opened[i].table != NULL) ? btree_stream_open(opened[i].table) : NULL;
+		if (opened[i].stream == NULL) {
+			fprintf(stderr, "failed to read %s\n", inputs[i]);
+			result = -1;
+			break;
+		}
+
+		opened[i].format = (opened[i].stream->leaf->type == NODE_SLOTTED) ? PKG_SLOTTED : PKG_FIXED;
+		// Output is compressed if any input is
+		if (table_ext_compressed(opened[i].table)) {
+			table_set_ext_compressed(fresh, 1);
+		}
+		advance_input(&opened[i]);
+		if (opened[i].record != NULL) {
+			heap[heap_count] = &opened[i];
+			heap_up(heap, heap_count++);
+		}
+	}
+
+	while (heap_count > 0 && result == 0) {
+		result = merge_write(fresh, loader, heap, &heap_count);
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		btree_stream_close(opened[i].stream);
+		if (opened[i].table != NULL) {
+			table_close(opened[i].table);
+		}
+	}
+	free(opened);
+	free(heap);
+
+	if (btree_load_end(loader) < 0) {
+		result = -1;
+	}
+
+	if (result < 0) {
+		table_close(fresh);
+	}
+	if (result < 0 || table_save(fresh) < 0) {
+		fprintf(stderr, "failed to merge tables\n");
+		unlink(tmp_file);
+		return -1;
+	}
+
+	return table_replace(tmp_file, file);
+}
+
+/**
+ * @brief Write the smallest key of all inputs, summing host counts of every
+ * input holding it, and advance those inputs.
+ *
+ * @param[in] fresh - Output table.
+ * @param[in] loader - Output bulk loader.
+ * @param[in,out] heap - Inputs with records, smallest key first.
+ * @param[in,out] heap_count - Number of inputs in heap.
+ * @return Status code.
+ */
+int merge_write(pkg_table *fresh, btree_loader *loader, merge_input **heap, uint32_t *heap_count) {
+	// Take out the winner, its record stays valid while others advance
+	merge_input *first = heap[0];
+	heap[0] = heap[--*heap_count];
+	heap_down(heap, *heap_count, 0);
+
+	pkg_ref package;
+	decode_pkg(first->format, first->record, first->stream->length, &package);
+	uint32_t hosts = pkg_hosts(&package);
+
+	while (*heap_count > 0 && md5_eq(heap[0]->stream->key, first->stream->key)) {
+		merge_input *same = heap[0];
+		pkg_ref other;
+		decode_pkg(same->format, same->record, same->stream->length, &other);
+		hosts += pkg_hosts(&other);
+
+		advance_input(same);
+		if (same->record == NULL) {
+			heap[0] = heap[--*heap_count];
+		}
+		heap_down(heap, *heap_count, 0);
+	}
+
+	// Versions are per host, so none are kept
+	pkg_versions versions = {
+		.installed = { .ptr = INVALID_EXT, .len = 0 },
+		.available = { .ptr = INVALID_EXT, .len = 0 },
+		.taken = 0,
+		._padding = 0
+	};
+
+	char *name_copy = NULL;
+	char *group_copy = NULL;
+	const char *name = input_field(first, &package.name, &name_copy);
+	const char *group = input_field(first, &package.group, &group_copy);
+	int result = -1;
+	if (name != NULL || field_len(&package.name) == 0) {
+		uint8_t buf[PKG_RECORD_MAX];
+		uint32_t len = encode_pkg(fresh, *package.status, name, field_len(&package.name), NULL,
+			group, field_len(&package.group), &versions, hosts, buf);
+		result = btree_load_add_var(loader, &first->stream->key, buf, len);
+	}
+	free(name_copy);
+	free(group_copy);
+
+	advance_input(first);
+	if (first->record != NULL) {
+		heap[*heap_count] = first;
+		heap_up(heap, (*heap_count)++);
+	}
+
+	return result;
+}
+
+/**
+ * @brief Move input to its next key, skipping repeated keys.
+ *
+ * @param[in] input - Merge input.
+ */
+void advance_input(merge_input *input) {
+	int started = (input->record != NULL);
+	md5_t prev;
+	if (started) {
+		md5_cp(&prev, &input->stream->key);
+	}
+
+	do {
+		input->record = btree_stream_next(input->stream);
+	} while (input->record != NULL && started && md5_eq(input->stream->key, prev));
+}
+
+/**
+ * @brief Order inputs by current key, then by position.
+ *
+ * @param[in] a - First input.
+ * @param[in] b - Second input.
+ * @return Boolean result.
+ */
+int input_less(merge_input *a, merge_input *b) {
+	if (md5_eq(a->stream->key, b->stream->key)) {
+		return a->index < b->index;
+	}
+
+	return md5_ls(a->stream->key, b->stream->key);
+}
+
+/**
+ * @brief Move heap entry up to its place.
+ *
+ * @param[in] heap - Heap of inputs.
+ * @param[in] pos - Entry position.
+ */
+void heap_up(merge_input **heap, uint32_t pos) {
+	while (pos > 0) {
+		uint32_t parent = (pos - 1) / 2;
+		if (!input_less(heap[pos], heap[parent])) {
+			break;
+		}
+
+		merge_input *swap = heap[pos];
+		heap[pos] = heap[parent];
+		heap[parent] = swap;
+		pos = parent;
+	}
+}
+
+/**
+ * @brief Move heap entry down to its place.
+ *
+ * @param[in] heap - Heap of inputs.
+ * @param[in] count - Number of entries.
+ * @param[in] pos - Entry position.
+ */
+void heap_down(merge_input **heap, uint32_t count, uint32_t pos) {
+	while (1) {
+		uint32_t smallest = pos;
+		uint32_t left = 2 * pos + 1;
+		uint32_t right = left + 1;
+		if (left < count && input_less(heap[left], heap[smallest])) {
+			smallest = left;
+		}
+		if (right < count && input_less(heap[right], heap[smallest])) {
+			smallest = right;
+		}
+
+		if (smallest == pos) {
+			return;
+		}
+
+		merge_input *swap = heap[pos];
+		heap[pos] = heap[smallest];
+		heap[smallest] = swap;
+		pos = smallest;
+	}
+}
+
+/**
+ * @brief Get field bytes of the current input record without caching ext pages.
+ *
+ * @param[in] input - Merge input.
+ * @param[in] field - Decoded field.
+ * @param[out] owned - Copy to free (NULL if none was made).
+ * @return Field data (not null-terminated) or NULL if not set or unreadable.
+ */
+const char *input_field(merge_input *input, pkg_field *field, char **owned) {
+	*owned = NULL;
+	if (field->data != NULL || field_len(field) == 0) {
+		return field->data;
+	}
+
+	*owned = malloc(field_len(field));
+	if (ext_read_direct(input->table, &field->ext, *owned) < 0) {
+		free(*owned);
+		*owned = NULL;
+	}
+
+	return *owned;
+}
+
+/**
+ * @brief Get versions of a single package from the client.
+ *
+ * @param[in] cl - Package client.
+ * @param[in] name - Package name.
+ * @param[out] current - Client versions.
+ */
+void query_pkg(const client *cl, const char *name, client_pkg *current) {
+	current->name = name;
+	cl->versions(name, &current->installed, &current->available);
+}
+
+/**
+ * @brief Compute status from client versions.
+ *
+ * @param[in] table - Table object.
+ * @param[in] current - Client versions (NULL if unknown to the client).
+ * @param[in,out] versions - Version snapshot to update (NULL to skip).
+ * @return Package status.
+ */
+pkg_status check_status(pkg_table *table, const client_pkg *current, pkg_versions *versions) {
+	const char *installed = (current != NULL) ? current->installed : NULL;
+	const char *available = (current != NULL) ? current->available : NULL;
+
+	if (versions != NULL) {
+		store_version(table, &versions->installed, installed);
+		store_version(table, &versions->available, available);
+		versions->taken = 1;
+	}
+
+	return version_status(installed, (installed != NULL) ? strlen(installed) : 0,
+		available, (available != NULL) ? strlen(available) : 0);
+}
+
+/**
+ * @brief Refresh status and version snapshot of a stored package.
+ *
+ * @param[in] table - Table object.
+ * @param[in] current - Client versions (NULL if unknown to the client).
+ * @param[in,out] package - Decoded record, updated in place.
+ * @return Boolean result, 1 if the record changed (its page must be marked,
+ * see btree_touch).
+ */
+int refresh_status(pkg_table *table, const client_pkg *current, pkg_ref *package) {
+	pkg_status status = *package->status;
+	pkg_versions versions;
+	if (package->versions != NULL) {
+		versions = *package->versions;
+	}
+
+	*package->status = check_status(table, current, package->versions);
+	return *package->status != status
+		|| (package->versions != NULL && memcmp(&versions, package->versions, sizeof(pkg_versions)) != 0);
+}
+
+/**
+ * @brief Update stored version, writing ext data only if it changed.
+ *
+ * @param[in] table - Table object.
+ * @param[in,out] locator - Stored version.
+ * @param[in] version - Current version or NULL if none.
+ */
+void store_version(pkg_table *table, ext_t *locator, const char *version) {
+	if (version == NULL) {
+		*locator = (ext_t){ .ptr = INVALID_EXT, .len = 0 };
+		return;
+	}
+
+	uint32_t len = strlen(version);
+	pkg_field stored = ext_field(*locator);
+	const char *view = field_view(table, &stored);
+	if (field_len(&stored) == len && view != NULL && memcmp(view, version, len) == 0) {
+		return;
+	}
+
+	*locator = ext_insert(table, version, len);
+}
+
+/**
+ * @brief Compute status from versions.
+ *
+ * @param[in] installed - Installed version or NULL.
+ * @param[in] installed_len - Installed version length.
+ * @param[in] available - Repository version or NULL.
+ * @param[in] available_len - Repository version length.
+ * @return Package status.
+ */
+pkg_status version_status(const char *installed, uint32_t installed_len,
+		const char *available, uint32_t available_len) {
+	if (installed == NULL) {
+		return PKG_MISSING;
+	}
+
+	return (available != NULL && vercmp(available, available_len, installed, installed_len) > 0)
+		? PKG_OLD : PKG_OK;
+}
+
+/**
+ * @brief Get status from the stored version snapshot, without the client.
+ *
+ * @param[in] table - Table object.
+ * @param[in] package - Package record.
+ * @return Package status (stored status if the record has no snapshot).
+ */
+pkg_status snapshot_status(pkg_table *table, pkg_ref *package) {
+	if (!has_snapshot(package)) {
+		return *package->status;
+	}
+
+	pkg_field installed = ext_field(package->versions->installed);
+	pkg_field available = ext_field(package->versions->available);
+
+	char *installed_copy = NULL;
+	char *available_copy = NULL;
+	pkg_status status = version_status(
+		field_bytes(table, &installed, &installed_copy), field_len(&installed),
+		field_bytes(table, &available, &available_copy), field_len(&available));
+	free(installed_copy);
+	free(available_copy);
+
+	return status;
+}
+
+/**
+ * @brief Store version snapshot as ext data of another table.
+ *
+ * @param[in] src - Source table.
+ * @param[in] dest - Destination table.
+ * @param[in] versions - Snapshot in source table or NULL.
+ * @param[out] copy - Snapshot in destination table.
+ */
+void copy_versions(db_table *src, db_table *dest, pkg_versions *versions, pkg_versions *copy) {
+	copy->installed = (ext_t){ .ptr = INVALID_EXT, .len = 0 };
+	copy->available = (ext_t){ .ptr = INVALID_EXT, .len = 0 };
+	copy->taken = 0;
+	copy->_padding = 0;
+	if (versions == NULL || !versions->taken) {
+		return;
+	}
+
+	pkg_field installed = ext_field(versions->installed);
+	pkg_field available = ext_field(versions->available);
+	copy->installed = copy_field(src, dest, &installed);
+	copy->available = copy_field(src, dest, &available);
+	copy->taken = 1;
+}
+
+/**
+ * @brief Look up package record by name.
+ *
+ * @param[in] table - Table object.
+ * @param[in] name - Package name.
+ * @param[out] ref - Decoded record.
+ * @return Status code (-1 if not in table).
+ */
+int find_pkg(pkg_table *table, const char *name, pkg_ref *ref) {
+	md5_t hash;
+	hash_name(name, &hash);
+
+	uint32_t length;
+	void *record = pkg_btree_find(table, &hash, &length);
+	if (record == NULL) {
+		return -1;
+	}
+
+	decode_pkg(pkg_get_format(table), record, length, ref);
+	return 0;
+}
+
+/**
+ * @brief Get stored data of a package that is added again.
+ *
+ * @param[in] table - Table object.
+ * @param[in] name - Package name.
+ * @param[in] record - Stored record or NULL if not in table.
+ * @param[in] length - Record length.
+ * @param[out] versions - Stored version snapshot (empty if none).
+ * @return Ext locator of the stored name (INVALID_EXT if stored inline or not in table).
+ */
+ext_t stored_pkg(pkg_table *table, const char *name, void *record, uint32_t length, pkg_versions *versions) {
+	*versions = (pkg_versions){
+		.installed = { .ptr = INVALID_EXT, .len = 0 },
+		.available = { .ptr = INVALID_EXT, .len = 0 },
+		.taken = 0,
+		._padding = 0
+	};
+
+	if (record == NULL) {
+		return (ext_t){ .ptr = INVALID_EXT, .len = 0 };
+	}
+
+	pkg_ref package;
+	decode_pkg(pkg_get_format(table), record, length, &package);
+	if (package.versions != NULL) {
+		memcpy(versions, package.versions, sizeof(pkg_versions));
+	}
+	if (package.name.data != NULL || field_len(&package.name) != strlen(name)) {
+		return (ext_t){ .ptr = INVALID_EXT, .len = 0 };
+	}
+
+	return package.name.ext;
+}
+
+/**
+ * @brief Decode record stored in a leaf.
+ * Slotted records are laid out as status followed by a tagged field each
+ * for name and group: a uint16_t inline length and the bytes, FIELD_EXT and
+ * an ext page locator, or FIELD_NONE. The version snapshot and host count
+ * follow, aligned to VERSIONS_ALIGN.
+ *
+ * @param[in] format - Leaf record format.
+ * @param[in] record - Record in leaf.
+ * @param[in] length - Record length.
+ * @param[out] ref - Decoded record.
+ */
+void decode_pkg(pkg_format format, void *record, uint32_t length, pkg_ref *ref) {
+	if (format == PKG_FIXED) {
+		pkg *package = record;
+		ref->status = &package->status;
+		ref->name = ext_field(package->name);
+		ref->group = ext_field(package->group);
+		ref->versions = has_field(length, pkg, versions) ? &package->versions : NULL;
+		ref->hosts = has_field(length, pkg, hosts) ? &package->hosts : NULL;
+		return;
+	}
+
+	ref->status = record;
+	uint8_t *pos = (uint8_t *)record + sizeof(pkg_status);
+
+	pkg_field *fields[] = { &ref->name, &ref->group };
+	for (uint32_t i = 0; i < 2; i++) {
+		uint16_t tag;
+		memcpy(&tag, pos, sizeof(tag));
+		pos += sizeof(tag);
+
+		fields[i]->data = NULL;
+		fields[i]->ext = (ext_t){ .ptr = INVALID_EXT, .len = 0 };
+		if (tag == FIELD_EXT) {
+			memcpy(&fields[i]->ext, pos, sizeof(ext_t));
+			pos += sizeof(ext_t);
+		} else if (tag != FIELD_NONE) {
+			fields[i]->data = (const char *)pos;
+			fields[i]->ext.len = tag;
+			pos += tag;
+		}
+	}
+
+	uint32_t offset = align_versions(pos - (uint8_t *)record);
+	ref->versions = (offset + sizeof(pkg_versions) <= length)
+		? (pkg_versions *)((uint8_t *)record + offset) : NULL;
+	ref->hosts = (offset + PKG_TRAILER_LEN <= length)
+		? (uint32_t *)((uint8_t *)record + offset + sizeof(pkg_versions)) : NULL;
+}
+
+/**
+ * @brief Advance table scan and decode the record.
+ * On entering a leaf, ext data of all its records is read ahead.
+ *
+ * @param[in] table - Table object.
+ * @param[in] iter - Table iterator.
+ * @param[in] format - Leaf record format.
+ * @param[out] ref - Decoded record.
+ * @return Raw record in leaf.
+ */
+void *next_pkg(pkg_table *table, btree_cursor *iter, pkg_format format, pkg_ref *ref) {
+	if (iter->cell_num == 0) {
+		void *record;
+		uint32_t length;
+		for (uint32_t i = 0; (record = btree_peek(iter, i, &length)) != NULL; i++) {
+			pkg_ref ahead;
+			decode_pkg(format, record, length, &ahead);
+			prefetch_field(table, &ahead.name);
+			prefetch_field(table, &ahead.group);
+			if (has_snapshot(&ahead)) {
+				prefetch_field(table, &ext_field(ahead.versions->installed));
+				prefetch_field(table, &ext_field(ahead.versions->available));
+			}
+		}
+		table_prefetch_submit(table);
+	}
+
+	void *record = btree_next(iter);
+	decode_pkg(format, record, iter->length, ref);
+	return record;
+}
+
+/**
+ * @brief Start reading ext data of a field in the background.
+ *
+ * @param[in] table - Table object.
+ * @param[in] field - Decoded field.
+ */
+void prefetch_field(pkg_table *table, pkg_field *field) {
+	if (field->data == NULL && field_len(field) > 0) {
+		ext_prefetch(table, &field->ext);
+	}
+}
+
+/**
+ * @brief Encode slotted leaf record.
+ *
+ * @param[in] table - Table object (for oversized fields).
+ * @param[in] status - Package status.
+ * @param[in] name - Package name.
+ * @param[in] name_len - Package name length.
+ * @param[in] name_ext - Ext data already holding the name (NULL or INVALID_EXT if none).
+ * @param[in] group - Package group or NULL.
+ * @param[in] group_len - Package group length.
+ * @param[in] versions - Version snapshot.
+ * @param[in] hosts - Host count.
+ * @param[out] buf - Record buffer (PKG_RECORD_MAX bytes).
+ * @return Record length.
+ */
+uint32_t encode_pkg(pkg_table *table, pkg_status status, const char *name, uint32_t name_len,
+		const ext_t *name_ext, const char *group, uint32_t group_len, pkg_versions *versions, uint32_t hosts,
+		uint8_t *buf) {
+	memcpy(buf, &status, sizeof(status));
+
+	uint8_t *pos = buf + sizeof(status);
+	pos = encode_field(table, name, name_len, name_ext, pos);
+	pos = encode_field(table, group, group_len, NULL, pos);
+
+	uint32_t offset = align_versions(pos - buf);
+	memset(pos, 0, offset - (pos - buf));
+	memcpy(buf + offset, versions, sizeof(pkg_versions));
+	memcpy(buf + offset + sizeof(pkg_versions), &hosts, sizeof(hosts));
+
+	return offset + PKG_TRAILER_LEN;
+}
+
+/**
+ * @brief Encode a single field, moving it to ext pages if oversized.
+ *
+ * @param[in] table - Table object.
+ * @param[in] value - Field value or NULL.
+ * @param[in] len - Field length.
+ * @param[in] stored - Ext data already holding the value (NULL or INVALID_EXT if none).
+ * @param[out] buf - Write position.
+ * @return Next write position.
+ */
+uint8_t *encode_field(pkg_table *table, const char *value, uint32_t len, const ext_t *stored, uint8_t *buf) {
+	uint16_t tag = FIELD_NONE;
+	if (value == NULL) {
+		memcpy(buf, &tag, sizeof(tag));
+		return buf + sizeof(tag);
+	}
+
+	// Small pages must still fit a few records
+	uint32_t limit = (slotted_max_record(table_page_size(table)) - sizeof(pkg_status)
+		- (VERSIONS_ALIGN - 1) - PKG_TRAILER_LEN) / 2 - sizeof(uint16_t);
+	if (limit > FIELD_INLINE_MAX) {
+		limit = FIELD_INLINE_MAX;
+	}
+
+	if (len > limit) {
+		tag = FIELD_EXT;
+		ext_t locator = (stored != NULL && stored->ptr != INVALID_EXT && stored->len == len)
+			? *stored : ext_insert(table, value, len);
+		memcpy(buf, &tag, sizeof(tag));
+		memcpy(buf + sizeof(tag), &locator, sizeof(locator));
+		return buf + sizeof(tag) + sizeof(locator);
+	}
+
+	tag = len;
+	memcpy(buf, &tag, sizeof(tag));
+	memcpy(buf + sizeof(tag), value, len);
+	return buf + sizeof(tag) + len;
+}
+
+/**
+ * @brief Get length of a field.
+ *
+ * @param[in] field - Decoded field.
+ * @return Length in bytes (0 if field is not set).
+ */
+uint32_t field_len(pkg_field *field) {
+	if (field->data == NULL && field->ext.ptr == INVALID_EXT) {
+		return 0;
+	}
+
+	return field->ext.len;
+}
+
+/**
+ * @brief Get field bytes in place (inline or in cached ext page).
+ *
+ * @param[in] table - Table object.
+ * @param[in] field - Decoded field.
+ * @return Field data (not null-terminated) or NULL if field is not set or
+ * spans ext overflow pages.
+ */
+const char *field_view(db_table *table, pkg_field *field) {
+	if (field->data != NULL) {
+		return field->data;
+	}
+
+	return (field_len(field) > 0) ? ext_view(table, &field->ext) : NULL;
+}
+
+/**
+ * @brief Get field bytes contiguously, copying only if they span overflow pages.
+ *
+ * @param[in] table - Table object.
+ * @param[in] field - Decoded field.
+ * @param[out] owned - Copy to free (NULL if none was made).
+ * @return Field data (not null-terminated) or NULL if field is not set.
+ */
+const char *field_bytes(db_table *table, pkg_field *field, char **owned) {
+	*owned = NULL;
+
+	const char *view = field_view(table, field);
+	if (view == NULL && field_len(field) > 0) {
+		*owned = malloc(field_len(field) + 1);
+		field_read(table, field, *owned);
+		view = *owned;
+	}
+
+	return view;
+}
+
+/**
+ * @brief Copy field into a null-terminated string.
+ *
+ * @param[in] table - Table object.
+ * @param[in] field - Decoded field.
+ * @param[out] buf - Buffer of at least field_len() + 1 bytes.
+ */
+void field_read(db_table *table, pkg_field *field, char *buf) {
+	uint32_t len = field_len(field);
+	if (field->data != NULL) {
+		memcpy(buf, field->data, len);
+	} else if (len > 0) {
+		ext_access(table, &field->ext, buf);
+	}
+
+	buf[len] = '\0';
+}
+
+/**
+ * @brief Copy field into a null-terminated string at the end of a buffer.
+ *
+ * @param[in] table - Table object.
+ * @param[in] field - Decoded field.
+ * @param[in,out] buf - Byte buffer (vector of char).
+ * @return Offset of the string in the buffer.
+ */
+uint32_t field_push(db_table *table, pkg_field *field, vector *buf) {
+	uint32_t start = buf->count;
+	field_read(table, field, vec_extend(buf, field_len(field) + 1));
+	return start;
+}
+
+/**
+ * @brief Store field as ext data of another table.
+ *
+ * @param[in] src - Source table.
+ * @param[in] dest - Destination table.
+ * @param[in] field - Decoded field in source table.
+ * @return Locator in destination table.
+ */
+ext_t copy_field(db_table *src, db_table *dest, pkg_field *field) {
+	uint32_t len = field_len(field);
+	if (len == 0) {
+		return (ext_t){ .ptr = INVALID_EXT, .len = 0 };
+	}
+
+	char *copy = NULL;
+	ext_t locator = ext_insert(dest, field_bytes(src, field, &copy), len);
+	free(copy);
+	return locator;
+}
+
+/**
+ * @brief Write field data to output.
+ *
+ * @param[in] table - Table object.
+ * @param[in] field - Decoded field.
+ * @param[in] json - Write as quoted JSON string.
+ */
+void print_field(db_table *table, pkg_field *field, int json) {
+	uint32_t len = field_len(field);
+	const char *data = field_view(table, field);
+
+	if (data == NULL) {
+		field_read(table, field, out_reserve(len + 1));
+	} else if (json) {
+		memcpy(out_reserve(len), data, len);
+	} else {
+		out_write(data, len);
+		return;
+	}
+
+	if (json) {
+		out_commit_json(len);
+	} else {
+		out_commit(len);
+	}
+}
+
+/**
+ * @brief Write stored version to output.
+ *
+ * @param[in] table - Table object.
+ * @param[in] locator - Stored version or NULL if the record has no snapshot.
+ * @param[in] json - Write as JSON (string or null).
+ */
+void print_version(db_table *table, ext_t *locator, int json) {
+	pkg_field version = { .data = NULL, .ext = { .ptr = INVALID_EXT, .len = 0 } };
+	if (locator != NULL) {
+		version.ext = *locator;
+	}
+
+	if (field_len(&version) > 0) {
+		print_field(table, &version, json);
+	} else {
+		out_str(json ? "null" : "none");
+	}
+}
+
+/**
+ * @brief Print package as colored human-readable line.
+ *
+ * @param[in] table - Table object.
+ * @param[in] package - Package record.
+ * @param[in] status - Package status.
+ */
+void print_text(db_table *table, pkg_ref *package, pkg_status status) {
+	out_color(status_colors[status]);
+	print_field(table, &package->name, 0);
+
+	if (field_len(&package->group) > 0) {
+		out_str(" (");
+		print_field(table, &package->group, 0);
+		out_char(')');
+	}
+
+	out_char('\n');
+}
+
+/**
+ * @brief Print package as tab-separated line: name, group, status.
+ *
+ * @param[in] table - Table object.
+ * @param[in] package - Package record.
+ * @param[in] status - Package status.
+ */
+void print_tsv(db_table *table, pkg_ref *package, pkg_status status) {
+	print_field(table, &package->name, 0);
+	out_char('\t');
+
+	if (field_len(&package->group) > 0) {
+		print_field(table, &package->group, 0);
+	}
+	out_char('\t');
+
+	out_str(status_names[status]);
+	out_char('\n');
+}
+
+/**
+ * @brief Print package as JSON object.
+ *
+ * @param[in] table - Table object.
+ * @param[in] package - Package record.
+ * @param[in] status - Package status.
+ */
+void print_json(db_table *table, pkg_ref *package, pkg_status status) {
+	out_str("{\"name\":");
+	print_field(table, &package->name, 1);
+
+	out_str(",\"group\":");
+	if (field_len(&package->group) > 0) {
+		print_field(table, &package->group, 1);
+	} else {
+		out_str("null");
+	}
+
+	out_str(",\"version\":");
+	print_version(table, has_snapshot(package) ? &package->versions->installed : NULL, 1);
+	out_str(",\"latest\":");
+	print_version(table, has_snapshot(package) ? &package->versions->available : NULL, 1);
+
+	out_str(",\"hosts\":");
+	out_uint(pkg_hosts(package));
+
+	out_str(",\"status\":\"");
+	out_str(status_names[status]);
+	out_str("\"}");
+}
+
+/**
+ * @brief Get page size for newly created tables (PMM_PAGE_SIZE).
+ *
+ * @return Page size, 0 for default.
+ */
+uint32_t new_page_size(void) {
+	const char *value = getenv(PAGE_SIZE_ENV);
+	if (value == NULL || *value == '\0') {
+		return 0;
+	}
+
+	uint32_t page_size = strtoul(value, NULL, 10);
+	if (!valid_page_size(page_size)) {
+		fprintf(stderr, "warning: ignoring %s, page size must be a power of two between %d and %d\n",
+			PAGE_SIZE_ENV, PAGE_SIZE_MIN, PAGE_SIZE_MAX);
+		return 0;
+	}
+
+	return page_size;
 }
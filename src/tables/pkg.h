@@ -1,7 +1,11 @@
 #pragma once
 
+#include <stdint.h>
+
 #include "../db/table.h"
 #include "../db/defines.h"
+#include "../util/output.h"
+#include "../util/graph.h"
 
 // Package status
 typedef enum {
@@ -10,24 +14,75 @@ typedef enum {
 	PKG_OK
 } pkg_status;
 
+// Versions seen at the last status check (ext data, unset if none)
+typedef struct {
+	ext_t installed;
+	ext_t available;
+	// Set once a check filled in the versions
+	uint32_t taken;
+	uint32_t _padding;
+} pkg_versions;
+
 // Package layout
+// Older records end after status or versions.
 typedef struct {
 	ext_t name;
 	ext_t group;
 	pkg_status status;
+	pkg_versions versions;
+	// Number of hosts wanting the package (merged tables)
+	uint32_t hosts;
 } pkg;
 
+// Field of a decoded record: inline bytes or ext page locator
+typedef struct {
+	const char *data;
+	ext_t ext;
+} pkg_field;
+
+// Decoded package record (either leaf format)
+typedef struct {
+	pkg_status *status;
+	pkg_field name;
+	pkg_field group;
+	// NULL if the record has no version snapshot
+	pkg_versions *versions;
+	// NULL if the record has no host count (one host)
+	uint32_t *hosts;
+} pkg_ref;
+
+// Leaf record format
+typedef enum {
+	PKG_FIXED,
+	PKG_SLOTTED
+} pkg_format;
+
 // Alias
 typedef db_table pkg_table;
 
+// Most tables merged in one pass
+#define MERGE_FAN_IN 256
+// Page size of newly created tables (default DEFAULT_PAGE_SIZE)
+#define PAGE_SIZE_ENV "PMM_PAGE_SIZE"
+
 /**
  * @brief Open table containing packages.
+ * A new file gets the page size set by PMM_PAGE_SIZE.
  *
  * @param[in] file - File name.
  * @return Table object.
  */
 pkg_table *pkg_open(const char *file);
 
+/**
+ * @brief Open table containing packages for writing.
+ * Waits for other writers, see table_open_locked.
+ *
+ * @param[in] file - File name.
+ * @return Table object.
+ */
+pkg_table *pkg_open_locked(const char *file);
+
 /**
  * @brief Save package database table.
  *
@@ -36,6 +91,42 @@ pkg_table *pkg_open(const char *file);
  */
 int pkg_save(pkg_table *table);
 
+/**
+ * @brief Get leaf record format of the table.
+ *
+ * @param[in] table - Table object.
+ * @return Record format.
+ */
+pkg_format pkg_get_format(pkg_table *table);
+
+/**
+ * @brief Rewrite table into a compact file and atomically swap it in.
+ * Leaves are packed to the fill factor and ext data is stored in key order.
+ * The table object is not modified and should be closed afterwards.
+ *
+ * @param[in] table - Table object.
+ * @param[in] file - File name the table was opened from.
+ * @param[in] fill - Leaf/inner node fill factor in percent (1-100).
+ * @param[in] format - Leaf record format of the new file.
+ * @param[in] page_size - Page size of the new file (0 to keep current).
+ * @param[in] compress - Compress ext pages of the new file (-1 to keep current).
+ * @return Status code.
+ */
+int pkg_vacuum(pkg_table *table, const char *file, uint32_t fill, pkg_format format, uint32_t page_size, int compress);
+
+/**
+ * @brief Merge tables into a new one with a streaming k-way merge.
+ * Packages in several tables are stored once with the sum of their host
+ * counts. Inputs are read a leaf at a time, in passes of at most
+ * MERGE_FAN_IN tables.
+ *
+ * @param[in] file - Output table file name.
+ * @param[in] inputs - Input table file names.
+ * @param[in] count - Number of inputs.
+ * @return Status code.
+ */
+int pkg_merge(const char *file, const char **inputs, uint32_t count);
+
 /**
  * @brief Add a new package to the database.
  *
@@ -45,9 +136,36 @@ int pkg_save(pkg_table *table);
  */
 int pkg_add(pkg_table *table, const char *name);
 
+/**
+ * @brief Add packages to the database in one batch.
+ * Nothing is added if any of them does not exist.
+ *
+ * @param[in] table - Table object.
+ * @param[in] names - Names of packages.
+ * @param[in] count - Number of packages.
+ * @return Status code.
+ */
+int pkg_add_many(pkg_table *table, char **names, uint32_t count);
+
 int pkg_remove(char *name);
 
-int pkg_print_info(char *name);
+/**
+ * @brief Print a single package stored in database.
+ *
+ * @param[in] table - Table object.
+ * @param[in] name - Name of package.
+ * @return Status code.
+ */
+int pkg_print_info(pkg_table *table, const char *name);
+
+/**
+ * @brief Recheck status of a single package by key.
+ *
+ * @param[in] table - Table object.
+ * @param[in] name - Name of package.
+ * @return 1 if updated, 0 if package is not in the table, -1 on error.
+ */
+int pkg_update(pkg_table *table, const char *name);
 
 /**
  * @brief Check that packages exist and update state.
@@ -59,11 +177,33 @@ int pkg_check(pkg_table *table);
 
 /**
  * @brief Print all packages stored in database.
+ * Statuses are derived from the stored version snapshots, so no package
+ * backend is used.
+ *
+ * @param[in] table - Table object.
+ * @param[in] format - Output format.
+ * @return Status code.
+ */
+int pkg_print_all(pkg_table *table, out_format format);
+
+/**
+ * @brief Print differences between the table and explicitly installed packages:
+ * entries that are not explicitly installed, explicitly installed packages
+ * missing from the table and entries with a newer repository version.
+ *
+ * @param[in] table - Table object.
+ * @return Status code.
+ */
+int pkg_diff(pkg_table *table);
+
+/**
+ * @brief Print installed packages not reachable from any package in the table.
  *
  * @param[in] table - Table object.
+ * @param[in] deps - Dependency graph of installed packages.
  * @return Status code.
  */
-int pkg_print_all(pkg_table *table);
+int pkg_orphans(pkg_table *table, graph *deps);
 
 /**
  * @brief Sync installed packages to wanted packages.
@@ -0,0 +1,122 @@
+#include "arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "vector.h"
+
+// Mapped slab
+typedef struct {
+	void *base;
+	size_t length;
+} arena_slab;
+
+int map_slab(page_arena *arena);
+
+page_arena *arena_new(uint32_t frame_size) {
+	page_arena *arena = malloc(sizeof(page_arena));
+
+	arena->frame_size = frame_size;
+	arena->free_list = NULL;
+	arena->next_frame = NULL;
+	arena->slab_end = NULL;
+	arena->slabs = vec_new(sizeof(arena_slab));
+
+	return arena;
+}
+
+void *arena_alloc(page_arena *arena) {
+	// Reuse released frames first
+	if (arena->free_list != NULL) {
+		void *frame = arena->free_list;
+		arena->free_list = *(void **)frame;
+		return frame;
+	}
+
+	if (arena->next_frame == arena->slab_end && map_slab(arena) < 0) {
+		return NULL;
+	}
+
+	void *frame = arena->next_frame;
+	arena->next_frame += arena->frame_size;
+	return frame;
+}
+
+void *arena_calloc(page_arena *arena) {
+	// Fresh slab memory is already zero, recycled frames are not
+	int recycled = (arena->free_list != NULL);
+	void *frame = arena_alloc(arena);
+	if (frame != NULL && recycled) {
+		memset(frame, 0, arena->frame_size);
+	}
+
+	return frame;
+}
+
+void arena_release(page_arena *arena, void *frame) {
+	*(void **)frame = arena->free_list;
+	arena->free_list = frame;
+}
+
+void arena_free(page_arena *arena) {
+	if (arena == NULL) {
+		return;
+	}
+
+	for (uint32_t i = 0; i < arena->slabs->count; i++) {
+		arena_slab *slab = vec_at(arena->slabs, i);
+		munmap(slab->base, slab->length);
+	}
+
+	vec_free(arena->slabs);
+	free(arena);
+}
+
+/** Private functions */
+
+/**
+ * @brief Map a new slab and make it current.
+ * Uses MAP_HUGETLB when requested and available, otherwise asks for
+ * transparent huge pages.
+ *
+ * @param[in] arena - Arena object.
+ * @return Success code.
+ */
+int map_slab(page_arena *arena) {
+	size_t length = ARENA_SLAB_SIZE;
+	int huge = (getenv(ARENA_HUGEPAGES_ENV) != NULL);
+	void *base = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+	if (huge) {
+		base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	}
+#endif // MAP_HUGETLB
+
+	if (base == MAP_FAILED) {
+		base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base == MAP_FAILED) {
+			return -1;
+		}
+
+#ifdef MADV_HUGEPAGE
+		if (huge) {
+			madvise(base, length, MADV_HUGEPAGE);
+		}
+#endif // MADV_HUGEPAGE
+	}
+
+	arena_slab slab = {
+		.base = base,
+		.length = length
+	};
+	vec_push(arena->slabs, &slab);
+
+	arena->next_frame = base;
+	arena->slab_end = (uint8_t *)base + length - length % arena->frame_size;
+	return 0;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "vector.h"
+
+#define ARENA_HUGEPAGES_ENV "PMM_HUGEPAGES"
+
+// Slab size, matches a 2M huge page
+#define ARENA_SLAB_SIZE (2 * 1024 * 1024)
+
+// Fixed-size frame allocator backed by mmap'd slabs
+typedef struct {
+	uint32_t frame_size;
+	// Recycled frames, linked through their first word
+	void *free_list;
+	// Unused part of the newest slab
+	uint8_t *next_frame;
+	uint8_t *slab_end;
+	// Mapped slabs (arena_slab)
+	vector *slabs;
+} page_arena;
+
+/**
+ * @brief Create arena handing out frames of one size.
+ * Frames are aligned to the system page size (or the frame size if smaller).
+ * Slabs use huge pages if PMM_HUGEPAGES is set.
+ *
+ * @param[in] frame_size - Frame size in bytes (power of two).
+ * @return Arena object.
+ */
+page_arena *arena_new(uint32_t frame_size);
+
+/**
+ * @brief Get a frame. Contents are undefined.
+ *
+ * @param[in] arena - Arena object.
+ * @return Frame or NULL if out of memory.
+ */
+void *arena_alloc(page_arena *arena);
+
+/**
+ * @brief Get a zeroed frame.
+ *
+ * @param[in] arena - Arena object.
+ * @return Frame or NULL if out of memory.
+ */
+void *arena_calloc(page_arena *arena);
+
+/**
+ * @brief Return a frame for reuse.
+ *
+ * @param[in] arena - Arena object.
+ * @param[in] frame - Frame from this arena.
+ */
+void arena_release(page_arena *arena, void *frame);
+
+/**
+ * @brief Unmap all slabs and delete arena. All frames become invalid.
+ *
+ * @param[in] arena - Arena object.
+ */
+void arena_free(page_arena *arena);
@@ -10,7 +10,7 @@ const char *const ansi_colors[] = {
 	// Green
 	"\e[0;32m",
 	// White
-	"\e[0:37m"
+	"\e[0;37m"
 };
 
 void printf_color(color_t color) {
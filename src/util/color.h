@@ -7,6 +7,9 @@ typedef enum {
 	WHITE
 } color_t;
 
+// ANSI escape sequences, indexed by color_t
+extern const char *const ansi_colors[];
+
 /**
  * @brief Changes printf's output to desired color.
  *
@@ -0,0 +1,316 @@
+#include "graph.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vector.h"
+
+int compare_names(const void *a, const void *b);
+uint32_t find_name(graph_name *names, uint32_t count, const char *name);
+void map_blob(graph *g);
+void free_names(vector *names);
+
+graph_builder *graph_builder_new(void) {
+	graph_builder *builder = malloc(sizeof(graph_builder));
+	builder->nodes = vec_new(sizeof(char *));
+	builder->aliases = vec_new(sizeof(graph_name));
+	builder->edges = vec_new(sizeof(graph_name));
+
+	return builder;
+}
+
+uint32_t graph_add_node(graph_builder *builder, const char *name) {
+	char *copy = strdup(name);
+	vec_push(builder->nodes, &copy);
+
+	return builder->nodes->count - 1;
+}
+
+void graph_add_alias(graph_builder *builder, uint32_t node, const char *alias) {
+	graph_name entry = {
+		.name = strdup(alias),
+		.node = node
+	};
+	vec_push(builder->aliases, &entry);
+}
+
+void graph_add_edge(graph_builder *builder, uint32_t node, const char *target) {
+	graph_name entry = {
+		.name = strdup(target),
+		.node = node
+	};
+	vec_push(builder->edges, &entry);
+}
+
+graph *graph_build(graph_builder *builder) {
+	uint32_t node_count = builder->nodes->count;
+	uint32_t alias_count = builder->aliases->count;
+	uint32_t pending_count = builder->edges->count;
+
+	// Number nodes in name order
+	graph_name *order = malloc((node_count + 1) * sizeof(graph_name));
+	uint64_t names_len = 0;
+	for (uint32_t i = 0; i < node_count; i++) {
+		order[i].name = *(char **)vec_at(builder->nodes, i);
+		order[i].node = i;
+		names_len += strlen(order[i].name) + 1;
+	}
+	qsort(order, node_count, sizeof(graph_name), &compare_names);
+
+	uint32_t *rank = malloc((node_count + 1) * sizeof(uint32_t));
+	for (uint32_t i = 0; i < node_count; i++) {
+		rank[order[i].node] = i;
+	}
+
+	// Aliases point to ranks as well
+	graph_name *aliases = builder->aliases->raw_array;
+	for (uint32_t i = 0; i < alias_count; i++) {
+		aliases[i].node = rank[aliases[i].node];
+	}
+	qsort(aliases, alias_count, sizeof(graph_name), &compare_names);
+
+	// Resolve edges, counting them per source
+	uint32_t *targets = malloc((pending_count + 1) * sizeof(uint32_t));
+	uint32_t *counts = calloc(node_count + 1, sizeof(uint32_t));
+	uint32_t edge_count = 0;
+	for (uint32_t i = 0; i < pending_count; i++) {
+		graph_name *edge = vec_at(builder->edges, i);
+		uint32_t source = rank[edge->node];
+
+		// Node names first, then aliases
+		uint32_t target = find_name(order, node_count, edge->name);
+		if (target == GRAPH_NONE) {
+			target = find_name(aliases, alias_count, edge->name);
+			target = (target == GRAPH_NONE) ? GRAPH_NONE : aliases[target].node;
+		}
+
+		if (target == source) {
+			target = GRAPH_NONE;
+		}
+
+		targets[i] = target;
+		if (target != GRAPH_NONE) {
+			counts[source]++;
+			edge_count++;
+		}
+	}
+
+	// Lay out serialized form
+	graph *g = malloc(sizeof(graph));
+	g->blob_len = sizeof(graph_header)
+		+ (2 * (uint64_t)(node_count + 1) + edge_count) * sizeof(uint32_t) + names_len;
+	g->blob = malloc(g->blob_len);
+
+	graph_header *header = g->blob;
+	header->node_count = node_count;
+	header->edge_count = edge_count;
+	header->names_len = names_len;
+	header->_padding = 0;
+	map_blob(g);
+
+	// Offsets, then place edges using counts as cursors
+	g->offsets[0] = 0;
+	for (uint32_t i = 0; i < node_count; i++) {
+		g->offsets[i + 1] = g->offsets[i] + counts[i];
+		counts[i] = g->offsets[i];
+	}
+	for (uint32_t i = 0; i < pending_count; i++) {
+		if (targets[i] != GRAPH_NONE) {
+			uint32_t source = rank[((graph_name *)vec_at(builder->edges, i))->node];
+			g->edges[counts[source]++] = targets[i];
+		}
+	}
+
+	// Names in node order
+	char *names = (char *)g->names;
+	uint32_t pos = 0;
+	for (uint32_t i = 0; i < node_count; i++) {
+		uint32_t len = strlen(order[i].name) + 1;
+		g->name_offsets[i] = pos;
+		memcpy(names + pos, order[i].name, len);
+		pos += len;
+	}
+	g->name_offsets[node_count] = pos;
+
+	free(order);
+	free(rank);
+	free(targets);
+	free(counts);
+
+	for (uint32_t i = 0; i < node_count; i++) {
+		free(*(char **)vec_at(builder->nodes, i));
+	}
+	vec_free(builder->nodes);
+	free_names(builder->aliases);
+	free_names(builder->edges);
+	free(builder);
+
+	return g;
+}
+
+graph *graph_load(void *blob, uint64_t len) {
+	if (len < sizeof(graph_header)) {
+		free(blob);
+		return NULL;
+	}
+
+	graph_header *header = blob;
+	uint64_t expected = sizeof(graph_header)
+		+ (2 * (uint64_t)header->node_count + 2 + header->edge_count) * sizeof(uint32_t)
+		+ header->names_len;
+	if (expected != len) {
+		free(blob);
+		return NULL;
+	}
+
+	graph *g = malloc(sizeof(graph));
+	g->blob = blob;
+	g->blob_len = len;
+	map_blob(g);
+
+	// Every index must stay in bounds
+	int valid = (g->offsets[0] == 0 && g->offsets[g->node_count] == g->edge_count
+		&& g->name_offsets[g->node_count] == header->names_len);
+	for (uint32_t i = 0; valid && i < g->node_count; i++) {
+		valid = (g->offsets[i] <= g->offsets[i + 1]
+			&& g->name_offsets[i] < g->name_offsets[i + 1]
+			&& g->names[g->name_offsets[i + 1] - 1] == '\0');
+	}
+	for (uint32_t i = 0; valid && i < g->edge_count; i++) {
+		valid = (g->edges[i] < g->node_count);
+	}
+
+	if (!valid) {
+		graph_free(g);
+		return NULL;
+	}
+
+	return g;
+}
+
+uint32_t graph_find(graph *g, const char *name) {
+	return graph_find_len(g, name, strlen(name));
+}
+
+uint32_t graph_find_len(graph *g, const char *name, uint32_t len) {
+	uint32_t low = 0;
+	uint32_t high = g->node_count;
+	while (low < high) {
+		uint32_t mid = low + (high - low) / 2;
+		const char *node = graph_node_name(g, mid);
+		int cmp = strncmp(node, name, len);
+		if (cmp == 0 && node[len] != '\0') {
+			// Name is a prefix of the node's
+			cmp = 1;
+		}
+		if (cmp == 0) {
+			return mid;
+		}
+
+		if (cmp < 0) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	return GRAPH_NONE;
+}
+
+uint8_t *graph_reach(graph *g, const uint32_t *roots, uint32_t count) {
+	uint8_t *reached = calloc(g->node_count + 1, sizeof(uint8_t));
+	uint32_t *queue = malloc((g->node_count + 1) * sizeof(uint32_t));
+	uint32_t head = 0;
+	uint32_t tail = 0;
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (roots[i] < g->node_count && !reached[roots[i]]) {
+			reached[roots[i]] = 1;
+			queue[tail++] = roots[i];
+		}
+	}
+
+	// Each node is queued once, each edge looked at once
+	while (head < tail) {
+		uint32_t node = queue[head++];
+		for (uint32_t i = g->offsets[node]; i < g->offsets[node + 1]; i++) {
+			uint32_t next = g->edges[i];
+			if (!reached[next]) {
+				reached[next] = 1;
+				queue[tail++] = next;
+			}
+		}
+	}
+
+	free(queue);
+	return reached;
+}
+
+void graph_free(graph *g) {
+	if (g == NULL) {
+		return;
+	}
+
+	free(g->blob);
+	free(g);
+}
+
+/** Private functions */
+
+/**
+ * @brief Order graph_name entries by name (qsort).
+ *
+ * @param[in] a - First entry.
+ * @param[in] b - Second entry.
+ * @return Comparison result.
+ */
+int compare_names(const void *a, const void *b) {
+	return strcmp(((const graph_name *)a)->name, ((const graph_name *)b)->name);
+}
+
+/**
+ * @brief Find name in sorted entries.
+ *
+ * @param[in] names - Entries sorted by name.
+ * @param[in] count - Number of entries.
+ * @param[in] name - Name to find.
+ * @return Entry index or GRAPH_NONE.
+ */
+uint32_t find_name(graph_name *names, uint32_t count, const char *name) {
+	graph_name key = { .name = (char *)name };
+	graph_name *found = (count > 0)
+		? bsearch(&key, names, count, sizeof(graph_name), &compare_names)
+		: NULL;
+
+	return (found != NULL) ? (uint32_t)(found - names) : GRAPH_NONE;
+}
+
+/**
+ * @brief Point graph arrays into its serialized form.
+ *
+ * @param[in] g - Graph object with blob set.
+ */
+void map_blob(graph *g) {
+	graph_header *header = g->blob;
+	g->node_count = header->node_count;
+	g->edge_count = header->edge_count;
+
+	g->offsets = (uint32_t *)(header + 1);
+	g->edges = g->offsets + g->node_count + 1;
+	g->name_offsets = g->edges + g->edge_count;
+	g->names = (const char *)(g->name_offsets + g->node_count + 1);
+}
+
+/**
+ * @brief Free names and vector of graph_name entries.
+ *
+ * @param[in] names - Vector of graph_name.
+ */
+void free_names(vector *names) {
+	for (uint32_t i = 0; i < names->count; i++) {
+		free(((graph_name *)vec_at(names, i))->name);
+	}
+
+	vec_free(names);
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "vector.h"
+
+#define GRAPH_NONE UINT32_MAX
+
+// Serialized graph header, followed by offsets, edges, name offsets and names
+typedef struct {
+	uint32_t node_count;
+	uint32_t edge_count;
+	uint32_t names_len;
+	uint32_t _padding;
+} graph_header;
+
+// Directed graph in compressed sparse row form.
+// Nodes are numbered in name order, edges of node i are
+// edges[offsets[i]] to edges[offsets[i + 1] - 1].
+typedef struct {
+	uint32_t node_count;
+	uint32_t edge_count;
+	uint32_t *offsets;
+	uint32_t *edges;
+	uint32_t *name_offsets;
+	const char *names;
+	// Single allocation holding the serialized graph
+	void *blob;
+	uint64_t blob_len;
+} graph;
+
+// Graph under construction, edges point to names
+typedef struct {
+	// Node names (char *)
+	vector *nodes;
+	// Alternative node names (graph_name)
+	vector *aliases;
+	// Unresolved edges (graph_name)
+	vector *edges;
+} graph_builder;
+
+// Name referring to a node
+typedef struct {
+	char *name;
+	uint32_t node;
+} graph_name;
+
+// Get node name
+#define graph_node_name(g, node) ((g)->names + (g)->name_offsets[node])
+
+/**
+ * @brief Start building a graph.
+ *
+ * @return Builder object.
+ */
+graph_builder *graph_builder_new(void);
+
+/**
+ * @brief Add node to graph.
+ *
+ * @param[in] builder - Builder object.
+ * @param[in] name - Node name (copied).
+ * @return Node index within the builder.
+ */
+uint32_t graph_add_node(graph_builder *builder, const char *name);
+
+/**
+ * @brief Add alternative name edges may use to point to a node.
+ * Node names take precedence over aliases.
+ *
+ * @param[in] builder - Builder object.
+ * @param[in] node - Node index from graph_add_node.
+ * @param[in] alias - Alternative name (copied).
+ */
+void graph_add_alias(graph_builder *builder, uint32_t node, const char *alias);
+
+/**
+ * @brief Add edge to a node by name, resolved when the graph is built.
+ *
+ * @param[in] builder - Builder object.
+ * @param[in] node - Source node index from graph_add_node.
+ * @param[in] target - Target node name or alias (copied).
+ */
+void graph_add_edge(graph_builder *builder, uint32_t node, const char *target);
+
+/**
+ * @brief Resolve names and build compressed graph. Edges to unknown names
+ * and self loops are dropped. The builder is deleted.
+ *
+ * @param[in] builder - Builder object.
+ * @return Graph object.
+ */
+graph *graph_build(graph_builder *builder);
+
+/**
+ * @brief Load graph from its serialized form (graph->blob).
+ *
+ * @param[in] blob - Serialized graph (ownership is taken, freed on error).
+ * @param[in] len - Serialized length.
+ * @return Graph object or NULL if the data is malformed.
+ */
+graph *graph_load(void *blob, uint64_t len);
+
+/**
+ * @brief Find node by name.
+ *
+ * @param[in] g - Graph object.
+ * @param[in] name - Node name.
+ * @return Node or GRAPH_NONE.
+ */
+uint32_t graph_find(graph *g, const char *name);
+
+/**
+ * @brief Find node by name that is not null-terminated.
+ *
+ * @param[in] g - Graph object.
+ * @param[in] name - Node name.
+ * @param[in] len - Name length.
+ * @return Node or GRAPH_NONE.
+ */
+uint32_t graph_find_len(graph *g, const char *name, uint32_t len);
+
+/**
+ * @brief Mark all nodes reachable from a set of roots.
+ *
+ * @param[in] g - Graph object.
+ * @param[in] roots - Start nodes.
+ * @param[in] count - Number of start nodes.
+ * @return Flag per node (free after use).
+ */
+uint8_t *graph_reach(graph *g, const uint32_t *roots, uint32_t count);
+
+/**
+ * @brief Delete graph.
+ *
+ * @param[in] g - Graph object.
+ */
+void graph_free(graph *g);
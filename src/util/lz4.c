@@ -0,0 +1,209 @@
+#include "lz4.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define MIN_MATCH 4
+// Block must end with this many literals
+#define LAST_LITERALS 5
+// No match may start closer to the end
+#define MATCH_LIMIT 12
+#define MAX_OFFSET 65535
+#define HASH_BITS 12
+// Length fields extend with bytes when the token nibble is full
+#define NIBBLE_MAX 15
+
+#define hash32(seq) (((seq) * 2654435761u) >> (32 - HASH_BITS))
+
+uint32_t read32(const uint8_t *ptr);
+int emit_sequence(uint8_t *dst, uint32_t cap, uint32_t *out, const uint8_t *literals,
+	uint32_t lit_len, uint32_t offset, uint32_t match_len);
+void write_length(uint8_t *dst, uint32_t *out, uint32_t len);
+int read_length(const uint8_t *src, uint32_t len, uint32_t *in, uint32_t *value);
+
+uint32_t lz4_compress(const void *src, uint32_t len, void *dst, uint32_t cap) {
+	const uint8_t *in = src;
+	// Positions plus one, zero is empty
+	uint32_t seen[1 << HASH_BITS];
+	memset(seen, 0, sizeof(seen));
+
+	uint32_t out = 0;
+	uint32_t anchor = 0;
+	uint32_t pos = 0;
+	while (len >= MATCH_LIMIT && pos <= len - MATCH_LIMIT) {
+		uint32_t seq = read32(in + pos);
+		uint32_t slot = hash32(seq);
+		uint32_t cand = seen[slot];
+		seen[slot] = pos + 1;
+
+		if (cand == 0 || pos - (cand - 1) > MAX_OFFSET || read32(in + cand - 1) != seq) {
+			pos++;
+			continue;
+		}
+		cand--;
+
+		uint32_t end = pos + MIN_MATCH;
+		while (end < len - LAST_LITERALS && in[end] == in[cand + end - pos]) {
+			end++;
+		}
+
+		if (emit_sequence(dst, cap, &out, in + anchor, pos - anchor, pos - cand, end - pos) < 0) {
+			return 0;
+		}
+		pos = end;
+		anchor = end;
+	}
+
+	// Rest is literals
+	if (emit_sequence(dst, cap, &out, in + anchor, len - anchor, 0, 0) < 0) {
+		return 0;
+	}
+
+	return out;
+}
+
+int64_t lz4_decompress(const void *src, uint32_t len, void *dst, uint32_t cap) {
+	const uint8_t *in = src;
+	uint8_t *out = dst;
+	uint32_t i = 0;
+	uint32_t o = 0;
+	while (i < len) {
+		uint8_t token = in[i++];
+
+		uint32_t lit_len = token >> 4;
+		if (lit_len == NIBBLE_MAX && read_length(in, len, &i, &lit_len) < 0) {
+			return -1;
+		}
+		if (lit_len > len - i || lit_len > cap - o) {
+			return -1;
+		}
+		memcpy(out + o, in + i, lit_len);
+		i += lit_len;
+		o += lit_len;
+
+		// Last sequence has no match
+		if (i == len) {
+			break;
+		}
+
+		if (len - i < 2) {
+			return -1;
+		}
+		uint32_t offset = in[i] | (in[i + 1] << 8);
+		i += 2;
+		if (offset == 0 || offset > o) {
+			return -1;
+		}
+
+		uint32_t match_len = token & NIBBLE_MAX;
+		if (match_len == NIBBLE_MAX && read_length(in, len, &i, &match_len) < 0) {
+			return -1;
+		}
+		match_len += MIN_MATCH;
+		if (match_len > cap - o) {
+			return -1;
+		}
+
+		// Match may overlap its own output
+		for (uint32_t k = 0; k < match_len; k++) {
+			out[o + k] = out[o - offset + k];
+		}
+		o += match_len;
+	}
+
+	return o;
+}
+
+/** Private functions */
+
+/**
+ * @brief Load 4 bytes from any alignment.
+ *
+ * @param[in] ptr - Data.
+ * @return Loaded bytes.
+ */
+uint32_t read32(const uint8_t *ptr) {
+	uint32_t value;
+	memcpy(&value, ptr, sizeof(uint32_t));
+	return value;
+}
+
+/**
+ * @brief Write one sequence: literals, then a match (if match_len is not 0).
+ *
+ * @param[out] dst - Output buffer.
+ * @param[in] cap - Output buffer size.
+ * @param[in,out] out - Output position.
+ * @param[in] literals - Literal bytes.
+ * @param[in] lit_len - Number of literals.
+ * @param[in] offset - Match distance.
+ * @param[in] match_len - Match length (0 for the last sequence).
+ * @return Success code (-1 if out of space).
+ */
+int emit_sequence(uint8_t *dst, uint32_t cap, uint32_t *out, const uint8_t *literals,
+		uint32_t lit_len, uint32_t offset, uint32_t match_len) {
+	uint64_t worst = 1 + (uint64_t)lit_len / 255 + 1 + lit_len + 2 + match_len / 255 + 1;
+	if (worst > cap - *out) {
+		return -1;
+	}
+
+	uint32_t match_code = (match_len > 0) ? match_len - MIN_MATCH : 0;
+	uint8_t lit_nibble = (lit_len < NIBBLE_MAX) ? lit_len : NIBBLE_MAX;
+	uint8_t match_nibble = (match_code < NIBBLE_MAX) ? match_code : NIBBLE_MAX;
+	dst[(*out)++] = (lit_nibble << 4) | match_nibble;
+
+	if (lit_len >= NIBBLE_MAX) {
+		write_length(dst, out, lit_len - NIBBLE_MAX);
+	}
+	memcpy(dst + *out, literals, lit_len);
+	*out += lit_len;
+
+	if (match_len == 0) {
+		return 0;
+	}
+
+	dst[(*out)++] = offset & 0xff;
+	dst[(*out)++] = offset >> 8;
+	if (match_code >= NIBBLE_MAX) {
+		write_length(dst, out, match_code - NIBBLE_MAX);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Write length extension bytes.
+ *
+ * @param[out] dst - Output buffer.
+ * @param[in,out] out - Output position.
+ * @param[in] len - Length past the token nibble.
+ */
+void write_length(uint8_t *dst, uint32_t *out, uint32_t len) {
+	while (len >= 255) {
+		dst[(*out)++] = 255;
+		len -= 255;
+	}
+	dst[(*out)++] = len;
+}
+
+/**
+ * @brief Read length extension bytes.
+ *
+ * @param[in] src - Compressed block.
+ * @param[in] len - Compressed length.
+ * @param[in,out] in - Input position.
+ * @param[in,out] value - Length to add to.
+ * @return Success code (-1 if the block ends first).
+ */
+int read_length(const uint8_t *src, uint32_t len, uint32_t *in, uint32_t *value) {
+	uint8_t byte;
+	do {
+		if (*in >= len) {
+			return -1;
+		}
+		byte = src[(*in)++];
+		*value += byte;
+	} while (byte == 255);
+
+	return 0;
+}
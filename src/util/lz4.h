@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+// Largest compressed size of len bytes
+#define lz4_bound(len) ((len) + (len) / 255 + 16)
+
+/**
+ * @brief Compress data into the LZ4 block format (greedy, single pass).
+ *
+ * @param[in] src - Data to compress.
+ * @param[in] len - Data length.
+ * @param[out] dst - Output buffer.
+ * @param[in] cap - Output buffer size.
+ * @return Compressed length or 0 if it does not fit in cap.
+ */
+uint32_t lz4_compress(const void *src, uint32_t len, void *dst, uint32_t cap);
+
+/**
+ * @brief Decompress an LZ4 block.
+ *
+ * @param[in] src - Compressed block.
+ * @param[in] len - Compressed length.
+ * @param[out] dst - Output buffer.
+ * @param[in] cap - Output buffer size.
+ * @return Decompressed length or -1 if the block is malformed or too large.
+ */
+int64_t lz4_decompress(const void *src, uint32_t len, void *dst, uint32_t cap);
@@ -0,0 +1,180 @@
+#include "output.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "color.h"
+
+#define OUT_BUFFER_SIZE (64 * 1024)
+#define NO_COLOR_ENV "NO_COLOR"
+
+static char *buffer = NULL;
+static uint64_t buffer_size = 0;
+static uint64_t used = 0;
+static int use_color = 0;
+
+static const char *const format_names[] = {
+	"text",
+	"tsv",
+	"json",
+	"ndjson"
+};
+
+void ensure_space(uint64_t len);
+
+int out_parse_format(const char *name, out_format *format) {
+	for (uint32_t i = 0; i < sizeof(format_names) / sizeof(char *); i++) {
+		if (strcmp(name, format_names[i]) == 0) {
+			*format = i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+void out_begin(out_format format) {
+	if (buffer == NULL) {
+		buffer_size = OUT_BUFFER_SIZE;
+		buffer = malloc(buffer_size);
+	}
+
+	used = 0;
+	use_color = (format == OUT_TEXT)
+		&& isatty(STDOUT_FILENO)
+		&& getenv(NO_COLOR_ENV) == NULL;
+}
+
+int out_flush(void) {
+	// Keep ordering with anything printed through stdio
+	fflush(stdout);
+
+	uint64_t done = 0;
+	while (done < used) {
+		ssize_t bytes = write(STDOUT_FILENO, buffer + done, used - done);
+		if (bytes < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			used = 0;
+			return -1;
+		}
+
+		done += bytes;
+	}
+
+	used = 0;
+	return 0;
+}
+
+char *out_reserve(uint64_t len) {
+	ensure_space(len);
+	return buffer + used;
+}
+
+void out_commit(uint64_t len) {
+	used += len;
+}
+
+void out_commit_json(uint64_t len) {
+	// Fast path: nothing to escape
+	uint64_t i = 0;
+	while (i < len) {
+		unsigned char c = buffer[used + i];
+		if (c == '"' || c == '\\' || c < 0x20) {
+			break;
+		}
+		i++;
+	}
+
+	if (i == len) {
+		memmove(buffer + used + 1, buffer + used, len);
+		buffer[used] = '"';
+		buffer[used + len + 1] = '"';
+		used += len + 2;
+		return;
+	}
+
+	// Slow path: escaped string may grow up to 6x
+	char *raw = malloc(len);
+	memcpy(raw, buffer + used, len);
+	ensure_space(len * 6 + 2);
+
+	buffer[used++] = '"';
+	for (i = 0; i < len; i++) {
+		unsigned char c = raw[i];
+		if (c == '"' || c == '\\') {
+			buffer[used++] = '\\';
+			buffer[used++] = c;
+		} else if (c < 0x20) {
+			used += sprintf(buffer + used, "\\u%04x", c);
+		} else {
+			buffer[used++] = c;
+		}
+	}
+	buffer[used++] = '"';
+
+	free(raw);
+}
+
+void out_write(const void *data, uint64_t len) {
+	ensure_space(len);
+	memcpy(buffer + used, data, len);
+	used += len;
+}
+
+void out_str(const char *str) {
+	out_write(str, strlen(str));
+}
+
+void out_char(char c) {
+	ensure_space(1);
+	buffer[used++] = c;
+}
+
+void out_uint(uint64_t value) {
+	char digits[20];
+	uint32_t count = 0;
+	do {
+		digits[count++] = '0' + value % 10;
+		value /= 10;
+	} while (value != 0);
+
+	ensure_space(count);
+	while (count > 0) {
+		buffer[used++] = digits[--count];
+	}
+}
+
+void out_color(color_t color) {
+	if (use_color) {
+		out_str(ansi_colors[color]);
+	}
+}
+
+/** Private functions */
+
+/**
+ * @brief Make room for len more bytes (+2 for JSON quotes), flushing if needed.
+ *
+ * @param[in] len - Bytes needed.
+ */
+void ensure_space(uint64_t len) {
+	len += 2;
+	if (used + len <= buffer_size) {
+		return;
+	}
+
+	// Write out committed bytes
+	out_flush();
+
+	if (len > buffer_size) {
+		buffer_size = len;
+		buffer = realloc(buffer, buffer_size);
+	}
+}
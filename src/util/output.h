@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "color.h"
+
+// Output formats
+typedef enum {
+	OUT_TEXT,
+	OUT_TSV,
+	OUT_JSON,
+	OUT_NDJSON
+} out_format;
+
+/**
+ * @brief Parse output format name.
+ *
+ * @param[in] name - Format name (text, tsv, json, ndjson).
+ * @param[out] format - Parsed format.
+ * @return Success code.
+ */
+int out_parse_format(const char *name, out_format *format);
+
+/**
+ * @brief Start buffered output to stdout.
+ * Color is only enabled for text output to a terminal.
+ *
+ * @param[in] format - Output format.
+ */
+void out_begin(out_format format);
+
+/**
+ * @brief Write out buffered data.
+ *
+ * @return Success code.
+ */
+int out_flush(void);
+
+/**
+ * @brief Reserve space at the end of the output buffer.
+ * Bytes become part of the output after out_commit/out_commit_json.
+ *
+ * @param[in] len - Bytes to reserve.
+ * @return Pointer to reserved space.
+ */
+char *out_reserve(uint64_t len);
+
+/**
+ * @brief Commit reserved bytes as-is.
+ *
+ * @param[in] len - Bytes to commit.
+ */
+void out_commit(uint64_t len);
+
+/**
+ * @brief Commit reserved bytes as a quoted JSON string.
+ *
+ * @param[in] len - Bytes to commit.
+ */
+void out_commit_json(uint64_t len);
+
+/**
+ * @brief Append data to output.
+ *
+ * @param[in] data - Data to write.
+ * @param[in] len - Data length.
+ */
+void out_write(const void *data, uint64_t len);
+
+/**
+ * @brief Append null-terminated string to output.
+ *
+ * @param[in] str - String to write.
+ */
+void out_str(const char *str);
+
+/**
+ * @brief Append character to output.
+ *
+ * @param[in] c - Character.
+ */
+void out_char(char c);
+
+/**
+ * @brief Append unsigned integer in decimal to output.
+ *
+ * @param[in] value - Value to write.
+ */
+void out_uint(uint64_t value);
+
+/**
+ * @brief Change output color (no-op if color is disabled).
+ *
+ * @param[in] color - Color to set.
+ */
+void out_color(color_t color);
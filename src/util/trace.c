@@ -0,0 +1,131 @@
+#define _GNU_SOURCE
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+FILE *trace_file = NULL;
+
+static pid_t trace_pid;
+// Events of shared tables come from several threads
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t trace_count = 0;
+
+void trace_close(void);
+int write_header(char phase, const char *name);
+void write_escaped(const char *str);
+
+void trace_init(void) {
+	const char *path = getenv(TRACE_ENV);
+	if (path == NULL || *path == '\0') {
+		return;
+	}
+
+	trace_file = fopen(path, "w");
+	if (trace_file == NULL) {
+		fprintf(stderr, "warning: failed to open trace file %s\n", path);
+		return;
+	}
+
+	trace_pid = getpid();
+	fputc('[', trace_file);
+	atexit(&trace_close);
+}
+
+void trace_event(char phase, const char *name, const char *detail) {
+	pthread_mutex_lock(&trace_lock);
+	if (write_header(phase, name) < 0) {
+		pthread_mutex_unlock(&trace_lock);
+		return;
+	}
+
+	if (detail != NULL) {
+		fputs(",\"args\":{\"detail\":\"", trace_file);
+		write_escaped(detail);
+		fputs("\"}", trace_file);
+	}
+	fputc('}', trace_file);
+	pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_event_num(char phase, const char *name, uint64_t value) {
+	pthread_mutex_lock(&trace_lock);
+	if (write_header(phase, name) < 0) {
+		pthread_mutex_unlock(&trace_lock);
+		return;
+	}
+
+	fprintf(trace_file, ",\"args\":{\"value\":%" PRIu64 "}}", value);
+	pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_flush(void) {
+	pthread_mutex_lock(&trace_lock);
+	if (trace_file != NULL) {
+		fflush(trace_file);
+	}
+	pthread_mutex_unlock(&trace_lock);
+}
+
+/** Private functions */
+
+/**
+ * @brief Finish JSON array and close trace file.
+ */
+void trace_close(void) {
+	pthread_mutex_lock(&trace_lock);
+	if (trace_file != NULL && getpid() == trace_pid) {
+		fputs("\n]\n", trace_file);
+		fclose(trace_file);
+		trace_file = NULL;
+	}
+	pthread_mutex_unlock(&trace_lock);
+}
+
+/**
+ * @brief Write common event fields (object left open). The trace lock
+ * must be held.
+ *
+ * @param[in] phase - Event phase.
+ * @param[in] name - Span name.
+ * @return Success code.
+ */
+int write_header(char phase, const char *name) {
+	// Forked children must not write into the parent's trace
+	if (trace_file == NULL || getpid() != trace_pid) {
+		return -1;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	uint64_t usec = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+
+	// Each thread gets its own track
+	fprintf(trace_file, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%" PRIu64 ",\"pid\":%d,\"tid\":%ld",
+		(trace_count++ == 0) ? "" : ",", name, phase, usec, trace_pid, (long)syscall(SYS_gettid));
+	return 0;
+}
+
+/**
+ * @brief Write string to trace file as JSON string contents.
+ *
+ * @param[in] str - String to write.
+ */
+void write_escaped(const char *str) {
+	for (; *str != '\0'; str++) {
+		if (*str == '"' || *str == '\\') {
+			fputc('\\', trace_file);
+			fputc(*str, trace_file);
+		} else if ((unsigned char)*str < 0x20) {
+			fprintf(trace_file, "\\u%04x", *str);
+		} else {
+			fputc(*str, trace_file);
+		}
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define TRACE_ENV "PMM_TRACE"
+
+// Trace output, NULL when tracing is disabled
+extern FILE *trace_file;
+
+// Begin a span (no-op when disabled)
+#define trace_begin(name, detail) \
+	do { if (trace_file != NULL) trace_event('B', name, detail); } while (0)
+// Begin a span tagged with a number (no-op when disabled)
+#define trace_begin_num(name, value) \
+	do { if (trace_file != NULL) trace_event_num('B', name, value); } while (0)
+// End the innermost span (no-op when disabled)
+#define trace_end(name) \
+	do { if (trace_file != NULL) trace_event('E', name, NULL); } while (0)
+
+/**
+ * @brief Enable tracing if PMM_TRACE is set in the environment.
+ * Output is written as a Chrome trace-event JSON array.
+ */
+void trace_init(void);
+
+/**
+ * @brief Write a single trace event. Use the trace_begin/trace_end macros.
+ *
+ * @param[in] phase - Event phase ('B' or 'E').
+ * @param[in] name - Span name.
+ * @param[in] detail - Optional detail string (may be NULL).
+ */
+void trace_event(char phase, const char *name, const char *detail);
+
+/**
+ * @brief Write a single trace event with a numeric argument.
+ *
+ * @param[in] phase - Event phase ('B' or 'E').
+ * @param[in] name - Span name.
+ * @param[in] value - Numeric argument.
+ */
+void trace_event_num(char phase, const char *name, uint64_t value);
+
+/**
+ * @brief Flush pending trace output (before forking).
+ */
+void trace_flush(void);
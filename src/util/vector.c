@@ -32,6 +32,26 @@ void *vec_push(vector *vec, void *val) {
 	return dest;
 }
 
+void *vec_extend(vector *vec, uint32_t count) {
+	if (vec->count + count > vec->_alloc_count) {
+		uint32_t alloc = (vec->_alloc_count < 2) ? 2 : vec->_alloc_count * 2;
+		vec_reserve(vec, (vec->count + count > alloc) ? vec->count + count : alloc);
+	}
+
+	void *dest = vec_at(vec, vec->count);
+	vec->count += count;
+	return dest;
+}
+
+void vec_reserve(vector *vec, uint32_t count) {
+	if (count <= vec->_alloc_count) {
+		return;
+	}
+
+	vec->_alloc_count = count;
+	vec->raw_array = realloc(vec->raw_array, vec->_type_size * vec->_alloc_count);
+}
+
 void *vec_at(vector *vec, uint32_t index) {
 	return vec->raw_array + vec->_type_size * index;
 }
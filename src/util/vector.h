@@ -27,6 +27,23 @@ vector *vec_new(uint32_t type_size);
  */
 void *vec_push(vector *vec, void *val);
 
+/**
+ * @brief Add uninitialized elements to the end of vector.
+ *
+ * @param[in] vec - Vector object.
+ * @param[in] count - Number of elements to add.
+ * @returns Pointer to the first new element.
+ */
+void *vec_extend(vector *vec, uint32_t count);
+
+/**
+ * @brief Make room for at least count elements without reallocating.
+ *
+ * @param[in] vec - Vector object.
+ * @param[in] count - Element count.
+ */
+void vec_reserve(vector *vec, uint32_t count);
+
 /**
  * @brief Get element at position.
  *
@@ -0,0 +1,189 @@
+#include "vercmp.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+
+// Part of a version string
+typedef struct {
+	const char *str;
+	uint32_t len;
+} ver_part;
+
+#define is_digit(c) isdigit((unsigned char)(c))
+#define is_alpha(c) isalpha((unsigned char)(c))
+#define is_alnum(c) isalnum((unsigned char)(c))
+
+void parse_evr(const char *str, uint32_t len, ver_part *epoch, ver_part *version, ver_part *release);
+int compare_part(ver_part *a, ver_part *b);
+int compare_segment(const char *a, uint32_t a_len, const char *b, uint32_t b_len);
+
+int vercmp(const char *a, uint32_t a_len, const char *b, uint32_t b_len) {
+	if (a_len == b_len && memcmp(a, b, a_len) == 0) {
+		return 0;
+	}
+
+	ver_part epoch_a, version_a, release_a;
+	ver_part epoch_b, version_b, release_b;
+	parse_evr(a, a_len, &epoch_a, &version_a, &release_a);
+	parse_evr(b, b_len, &epoch_b, &version_b, &release_b);
+
+	int result = compare_part(&epoch_a, &epoch_b);
+	if (result == 0) {
+		result = compare_part(&version_a, &version_b);
+	}
+	// Release is only compared if both have one
+	if (result == 0 && release_a.str != NULL && release_b.str != NULL) {
+		result = compare_part(&release_a, &release_b);
+	}
+
+	return result;
+}
+
+/** Private functions */
+
+/**
+ * @brief Split version string into epoch, version and release.
+ *
+ * @param[in] str - Version string.
+ * @param[in] len - Version string length.
+ * @param[out] epoch - Epoch ("0" if none).
+ * @param[out] version - Version.
+ * @param[out] release - Release (NULL string if none).
+ */
+void parse_evr(const char *str, uint32_t len, ver_part *epoch, ver_part *version, ver_part *release) {
+	uint32_t digits = 0;
+	while (digits < len && is_digit(str[digits])) {
+		digits++;
+	}
+
+	*epoch = (ver_part){ .str = "0", .len = 1 };
+	*version = (ver_part){ .str = str, .len = len };
+	if (digits < len && str[digits] == ':') {
+		if (digits > 0) {
+			*epoch = (ver_part){ .str = str, .len = digits };
+		}
+		*version = (ver_part){ .str = str + digits + 1, .len = len - digits - 1 };
+	}
+
+	// Release follows the last dash
+	*release = (ver_part){ .str = NULL, .len = 0 };
+	for (uint32_t i = version->len; i > 0; i--) {
+		if (version->str[i - 1] == '-') {
+			*release = (ver_part){ .str = version->str + i, .len = version->len - i };
+			version->len = i - 1;
+			break;
+		}
+	}
+}
+
+/**
+ * @brief Compare version parts segment by segment (rpmvercmp).
+ * Numeric segments compare by value and beat alphabetic ones, separators
+ * only matter by their length.
+ *
+ * @param[in] a - First part.
+ * @param[in] b - Second part.
+ * @return -1, 0 or 1.
+ */
+int compare_part(ver_part *a, ver_part *b) {
+	if (a->len == b->len && memcmp(a->str, b->str, a->len) == 0) {
+		return 0;
+	}
+
+	uint32_t i = 0;
+	uint32_t j = 0;
+	while (i < a->len && j < b->len) {
+		uint32_t sep_i = i;
+		uint32_t sep_j = j;
+		while (i < a->len && !is_alnum(a->str[i])) {
+			i++;
+		}
+		while (j < b->len && !is_alnum(b->str[j])) {
+			j++;
+		}
+
+		if (i == a->len || j == b->len) {
+			break;
+		}
+
+		if (i - sep_i != j - sep_j) {
+			return (i - sep_i < j - sep_j) ? -1 : 1;
+		}
+
+		// Take a segment of the same kind from both
+		uint32_t end_i = i;
+		uint32_t end_j = j;
+		int numeric = is_digit(a->str[i]);
+		if (numeric) {
+			while (end_i < a->len && is_digit(a->str[end_i])) {
+				end_i++;
+			}
+			while (end_j < b->len && is_digit(b->str[end_j])) {
+				end_j++;
+			}
+		} else {
+			while (end_i < a->len && is_alpha(a->str[end_i])) {
+				end_i++;
+			}
+			while (end_j < b->len && is_alpha(b->str[end_j])) {
+				end_j++;
+			}
+		}
+
+		// Segments of different kinds: numeric is newer
+		if (end_j == j) {
+			return numeric ? 1 : -1;
+		}
+
+		if (numeric) {
+			while (i < end_i && a->str[i] == '0') {
+				i++;
+			}
+			while (j < end_j && b->str[j] == '0') {
+				j++;
+			}
+
+			if (end_i - i != end_j - j) {
+				return (end_i - i > end_j - j) ? 1 : -1;
+			}
+		}
+
+		int result = compare_segment(a->str + i, end_i - i, b->str + j, end_j - j);
+		if (result != 0) {
+			return result;
+		}
+
+		i = end_i;
+		j = end_j;
+	}
+
+	if (i == a->len && j == b->len) {
+		return 0;
+	}
+
+	// A remaining alphabetic segment never beats an empty one
+	if ((i == a->len && !is_alpha(b->str[j])) || (i < a->len && is_alpha(a->str[i]))) {
+		return -1;
+	}
+
+	return 1;
+}
+
+/**
+ * @brief Compare segments like strcmp.
+ *
+ * @param[in] a - First segment.
+ * @param[in] a_len - First segment length.
+ * @param[in] b - Second segment.
+ * @param[in] b_len - Second segment length.
+ * @return -1, 0 or 1.
+ */
+int compare_segment(const char *a, uint32_t a_len, const char *b, uint32_t b_len) {
+	int result = memcmp(a, b, (a_len < b_len) ? a_len : b_len);
+	if (result == 0 && a_len != b_len) {
+		return (a_len < b_len) ? -1 : 1;
+	}
+
+	return (result > 0) - (result < 0);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Compare package versions ([epoch:]version[-release]).
+ * Same ordering as alpm_pkg_vercmp, so no package backend is needed.
+ *
+ * @param[in] a - First version (not null-terminated).
+ * @param[in] a_len - First version length.
+ * @param[in] b - Second version (not null-terminated).
+ * @param[in] b_len - Second version length.
+ * @return -1, 0 or 1 if a is older, equal or newer than b.
+ */
+int vercmp(const char *a, uint32_t a_len, const char *b, uint32_t b_len);